@@ -0,0 +1,1044 @@
+#include "GLHeaders.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "BenchmarkScenes.h"
+#include "BrickMap.h"
+#include "CameraPath.h"
+#include "CpuRaytracer.h"
+#include "DynamicBvh.h"
+#include "FrameTimer.h"
+#include "GpuRaytracer.h"
+#include "HeadlessContext.h"
+#include "JsonWriter.h"
+#include "MeshLoader.h"
+#include "Platform.h"
+#include "ProgramCache.h"
+#include "SceneCache.h"
+#include "SpatialBvhBuilder.h"
+#include "TwoLevelBvh.h"
+
+// Bump when the meaning of a field in the JSON report changes
+#define BENCHMARK_REPORT_VERSION 1
+
+enum BenchmarkBackend
+{
+	BACKEND_GL,
+	// The GL backend walking binary nodes without a stack
+	BACKEND_GL_STACKLESS,
+	BACKEND_CPU
+};
+
+enum BenchmarkBuilder
+{
+	BUILDER_SAH,
+	BUILDER_LBVH,
+	// Spatial splits, static scenes only
+	BUILDER_SBVH
+};
+
+// One backend tracing one scene along one camera path
+struct BenchmarkResult
+{
+	std::string backend;
+	std::string scene;
+	std::string path;
+	size_t primitives = 0;
+	// Instances of the scene's meshes and voxels, on top of the primitives
+	size_t instances = 0;
+	size_t voxels = 0;
+	// Set with a reason when the backend cannot trace the scene
+	bool skipped = false;
+	std::string reason;
+	// Handing the scene to the backend, once per scene, and the part of it
+	// spent building the BVH or grid
+	double setupMs = 0.0;
+	double buildMs = 0.0;
+	// Size of the uploaded BVH nodes, only on the GL backends
+	size_t nodeBytes = 0;
+	// Boxes the BVH leaves reference, more than the primitives with spatial splits
+	int references = 0;
+	int frames = 0;
+	FrameTimeStats frameTime;
+	// BVH rebuilds inside every frame, only with -animate
+	FrameTimeStats buildTime;
+	// Full rebuilds and the worst refitted SAH cost ratio, only with -refit
+	int rebuilds = 0;
+	float maxSahCostRatio = 0.0f;
+	double mraysPerSecond = 0.0;
+};
+
+int width = 800;
+int height = 600;
+int frames = 60;
+int warmupFrames = 5;
+size_t maxBoxes = 0;
+BenchmarkBuilder builder = BUILDER_SAH;
+// Traces the boxes through a BVH or a uniform grid on every backend
+SceneAccelerator accelerator = ACCELERATOR_BVH;
+// Moves the boxes and rebuilds the BVH every frame
+bool animate = false;
+// Children per CPU BVH node, 4 and 8 collapse the binary tree
+int bvhWidth = 2;
+bool quantizeBvh = false;
+// Refits the animated BVH, rebuilding it only when its quality dropped
+bool refit = false;
+std::vector<BenchmarkBackend> backends = { BACKEND_GL, BACKEND_CPU };
+std::vector<std::string> sceneNames;
+std::vector<CameraPath> cameraPaths = { CAMERA_PATH_STATIC, CAMERA_PATH_ORBIT, CAMERA_PATH_FLYTHROUGH };
+std::string jsonFile;
+
+CCpuRaytracer cpuRaytracer;
+CDynamicBvh dynamicBvh(cpuRaytracer.GetScheduler());
+CBvh sceneBvh;
+CSpatialBvhBuilder spatialBuilder;
+CGrid sceneGrid;
+// Scene and BVH of .rtscene files, used instead of building one unless
+// the scene is animated or traced through a grid
+CSceneCache sceneCache;
+// Meshes and instances of the scene, shared by both backends
+CTwoLevelBvh instanceBvh(cpuRaytracer.GetScheduler());
+// Voxels of the scene, static and shared by both backends
+CBrickMap brickMap;
+CGpuRaytracer gpuRaytracer;
+CGpuRaytracer stacklessRaytracer;
+CProgramCache programCache;
+CHeadlessContext context;
+bool hasContext = false;
+std::string glRenderer;
+std::string glVersion;
+
+static const char* GetBackendName(BenchmarkBackend backend)
+{
+	switch (backend)
+	{
+	case BACKEND_GL:
+		return "gl";
+	case BACKEND_GL_STACKLESS:
+		return "gl-stackless";
+	default:
+		return "cpu";
+	}
+}
+
+static bool IsGlBackend(BenchmarkBackend backend)
+{
+	return backend != BACKEND_CPU;
+}
+
+static bool HasBackend(BenchmarkBackend backend)
+{
+	return std::find(backends.begin(), backends.end(), backend) != backends.end();
+}
+
+static CGpuRaytracer& GetGpuRaytracer(BenchmarkBackend backend)
+{
+	return backend == BACKEND_GL_STACKLESS ? stacklessRaytracer : gpuRaytracer;
+}
+
+static const char* GetNodeFormatName(GpuNodeFormat format)
+{
+	return format == GPU_NODES_BINARY ? "binary" : "wide8";
+}
+
+static const char* GetBuilderName(BenchmarkBuilder type)
+{
+	switch (type)
+	{
+	case BUILDER_SAH:
+		return "sah";
+	case BUILDER_LBVH:
+		return "lbvh";
+	default:
+		return "sbvh";
+	}
+}
+
+static const char* GetAcceleratorName(SceneAccelerator type)
+{
+	return type == ACCELERATOR_BVH ? "bvh" : "grid";
+}
+
+static std::vector<std::string> SplitList(const std::string& list)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+		{
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+// Scene names ending in .obj or .ply are mesh files to load
+static bool IsMeshFile(const std::string& name)
+{
+	std::string extension = name.size() > 4 ? name.substr(name.size() - 4) : "";
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".obj" || extension == ".ply";
+}
+
+// Scene names ending in .rtscene are files written by SceneConverter
+static bool IsSceneCacheFile(const std::string& name)
+{
+	return name.size() > 8 && name.substr(name.size() - 8) == ".rtscene";
+}
+
+static bool UseSceneCache()
+{
+	return sceneCache.IsOpen() && accelerator == ACCELERATOR_BVH && !animate;
+}
+
+void printUsage()
+{
+	printf("Usage: Benchmark [-backends gl,gl-stackless,cpu] [-scenes list|all] [-paths list]\n");
+	printf("                 [-frames N] [-warmup N] [-size WxH] [-threads N]\n");
+	printf("                 [-isa scalar|sse4|avx2|avx512] [-maxboxes N]\n");
+	printf("                 [-accel bvh|grid] [-builder sah|lbvh|sbvh] [-morton 30|63]\n");
+	printf("                 [-splitbudget F] [-animate] [-refit] [-rebuildratio R]\n");
+	printf("                 [-bvhwidth 2|4|8] [-quantize]\n");
+	printf("                 [-gpunodes binary|wide8]\n");
+	printf("                 [-shadercache dir|none] [-json file]\n");
+	printf("  -backends list   comma separated backends to measure, gl and cpu by default\n");
+	printf("  -scenes list     comma separated scenes, defaults to all of them:\n");
+	std::vector<std::string> names = GetBenchmarkSceneNames();
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		printf("                   %s\n", names[i].c_str());
+	}
+	printf("                   or .obj and .ply files, placed on the ground, or .rtscene\n");
+	printf("                   files from SceneConverter, traced with their BVH\n");
+	printf("  -paths list      comma separated camera paths: static, orbit, flythrough\n");
+	printf("  -frames N        measured frames per scene and path, defaults to 60\n");
+	printf("  -warmup N        frames rendered before measuring, defaults to 5\n");
+	printf("  -size WxH        frame buffer resolution, defaults to 800x600\n");
+	printf("  -threads N       CPU backend worker threads, 0 for all cores\n");
+	printf("  -isa I           highest instruction set the CPU backend may use\n");
+	printf("  -maxboxes N      skip scenes with more primitives, 0 (default) for no limit\n");
+	printf("  -accel A         trace the boxes through a BVH (default) or a uniform grid\n");
+	printf("  -builder B       BVH builder, binned SAH (default), parallel LBVH or SAH\n");
+	printf("                   with spatial splits for static scenes\n");
+	printf("  -morton N        LBVH Morton code bits, picked by scene size by default\n");
+	printf("  -splitbudget F   boxes spatial splits may duplicate, as a fraction of\n");
+	printf("                   the box count, defaults to 0.3\n");
+	printf("  -animate         move the boxes and rebuild the BVH every frame\n");
+	printf("  -refit           animate, but refit the BVH and only rebuild it when\n");
+	printf("                   its SAH cost grew by more than -rebuildratio (1.3)\n");
+	printf("  -bvhwidth N      CPU backend BVH node width, 2 traces ray packets (default)\n");
+	printf("  -quantize        store wide BVH child boxes as 8 bit offsets\n");
+	printf("  -gpunodes F      GL backend BVH nodes, binary (default) or compressed 8 wide,\n");
+	printf("                   gl-stackless always walks binary nodes\n");
+	printf("  -shadercache dir where program binaries are cached, none to disable\n");
+	printf("  -json file       write the results to file as JSON\n");
+}
+
+bool parseArguments(int argc, char** argv)
+{
+	sceneNames = GetBenchmarkSceneNames();
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-backends" && i + 1 < argc)
+		{
+			backends.clear();
+			std::vector<std::string> names = SplitList(argv[++i]);
+			for (size_t n = 0; n < names.size(); n++)
+			{
+				if (names[n] == "gl")
+				{
+					backends.push_back(BACKEND_GL);
+				}
+				else if (names[n] == "gl-stackless")
+				{
+					backends.push_back(BACKEND_GL_STACKLESS);
+				}
+				else if (names[n] == "cpu")
+				{
+					backends.push_back(BACKEND_CPU);
+				}
+				else
+				{
+					fprintf(stderr, "Unknown backend '%s'\n", names[n].c_str());
+					return false;
+				}
+			}
+		}
+		else if (arg == "-scenes" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			sceneNames = value == "all" ? GetBenchmarkSceneNames() : SplitList(value);
+			std::vector<std::string> known = GetBenchmarkSceneNames();
+			for (size_t n = 0; n < sceneNames.size(); n++)
+			{
+				if (std::find(known.begin(), known.end(), sceneNames[n]) == known.end() && !IsMeshFile(sceneNames[n]) &&
+					!IsSceneCacheFile(sceneNames[n]))
+				{
+					fprintf(stderr, "Unknown scene '%s'\n", sceneNames[n].c_str());
+					return false;
+				}
+			}
+		}
+		else if (arg == "-paths" && i + 1 < argc)
+		{
+			cameraPaths.clear();
+			std::vector<std::string> names = SplitList(argv[++i]);
+			for (size_t n = 0; n < names.size(); n++)
+			{
+				CameraPath path;
+				if (!ParseCameraPath(names[n], path))
+				{
+					fprintf(stderr, "Unknown camera path '%s'\n", names[n].c_str());
+					return false;
+				}
+				cameraPaths.push_back(path);
+			}
+		}
+		else if (arg == "-frames" && i + 1 < argc)
+		{
+			frames = atoi(argv[++i]);
+			if (frames <= 0)
+			{
+				fprintf(stderr, "Invalid frame count '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-warmup" && i + 1 < argc)
+		{
+			warmupFrames = std::max(atoi(argv[++i]), 0);
+		}
+		else if (arg == "-size" && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 1 || height <= 1)
+			{
+				fprintf(stderr, "Invalid frame size '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-threads" && i + 1 < argc)
+		{
+			cpuRaytracer.GetScheduler().SetThreadCount(atoi(argv[++i]));
+		}
+		else if (arg == "-isa" && i + 1 < argc)
+		{
+			SimdIsa isa;
+			if (!ParseSimdIsa(argv[++i], isa))
+			{
+				fprintf(stderr, "Unknown instruction set '%s'\n", argv[i]);
+				return false;
+			}
+			cpuRaytracer.SetSimdIsa(isa);
+		}
+		else if (arg == "-maxboxes" && i + 1 < argc)
+		{
+			maxBoxes = (size_t)atoll(argv[++i]);
+		}
+		else if (arg == "-accel" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "bvh")
+			{
+				accelerator = ACCELERATOR_BVH;
+			}
+			else if (value == "grid")
+			{
+				accelerator = ACCELERATOR_GRID;
+			}
+			else
+			{
+				fprintf(stderr, "Unknown acceleration structure '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-builder" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "sah")
+			{
+				builder = BUILDER_SAH;
+			}
+			else if (value == "lbvh")
+			{
+				builder = BUILDER_LBVH;
+			}
+			else if (value == "sbvh")
+			{
+				builder = BUILDER_SBVH;
+			}
+			else
+			{
+				fprintf(stderr, "Unknown BVH builder '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-morton" && i + 1 < argc)
+		{
+			int bits = atoi(argv[++i]);
+			if (bits != 30 && bits != 63)
+			{
+				fprintf(stderr, "Morton codes have 30 or 63 bits, not '%s'\n", argv[i]);
+				return false;
+			}
+			dynamicBvh.GetLinearBuilder().SetMortonBits(bits);
+		}
+		else if (arg == "-splitbudget" && i + 1 < argc)
+		{
+			float budget = (float)atof(argv[++i]);
+			if (budget < 0.0f)
+			{
+				fprintf(stderr, "Invalid split budget '%s'\n", argv[i]);
+				return false;
+			}
+			spatialBuilder.SetDuplicationBudget(budget);
+		}
+		else if (arg == "-animate")
+		{
+			animate = true;
+		}
+		else if (arg == "-refit")
+		{
+			animate = true;
+			refit = true;
+		}
+		else if (arg == "-rebuildratio" && i + 1 < argc)
+		{
+			float ratio = (float)atof(argv[++i]);
+			if (ratio < 1.0f)
+			{
+				fprintf(stderr, "Invalid SAH cost ratio '%s'\n", argv[i]);
+				return false;
+			}
+			dynamicBvh.SetRebuildThreshold(ratio);
+			instanceBvh.GetTopLevel().SetRebuildThreshold(ratio);
+		}
+		else if (arg == "-bvhwidth" && i + 1 < argc)
+		{
+			bvhWidth = atoi(argv[++i]);
+			if (bvhWidth != 2 && bvhWidth != 4 && bvhWidth != 8)
+			{
+				fprintf(stderr, "BVH nodes are 2, 4 or 8 wide, not '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-quantize")
+		{
+			quantizeBvh = true;
+		}
+		else if (arg == "-gpunodes" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "binary")
+			{
+				gpuRaytracer.SetNodeFormat(GPU_NODES_BINARY);
+			}
+			else if (value == "wide8")
+			{
+				gpuRaytracer.SetNodeFormat(GPU_NODES_WIDE8);
+			}
+			else
+			{
+				fprintf(stderr, "Unknown GPU node format '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-shadercache" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			programCache.SetCacheDirectory(value == "none" ? "" : value);
+		}
+		else if (arg == "-json" && i + 1 < argc)
+		{
+			jsonFile = argv[++i];
+		}
+		else
+		{
+			printUsage();
+			return false;
+		}
+	}
+	if (refit && accelerator == ACCELERATOR_GRID)
+	{
+		fprintf(stderr, "-refit needs -accel bvh, grids are rebuilt every frame\n");
+		return false;
+	}
+	if (animate && builder == BUILDER_SBVH)
+	{
+		fprintf(stderr, "-builder sbvh is for static scenes, use sah or lbvh with -animate\n");
+		return false;
+	}
+	return true;
+}
+
+// The OpenGL backend renders into a texture of a hidden context
+bool InitGL()
+{
+	if (!context.Create())
+	{
+		return false;
+	}
+	glRenderer = (const char*)glGetString(GL_RENDERER);
+	glVersion = (const char*)glGetString(GL_VERSION);
+	gpuRaytracer.SetAccelerator(accelerator);
+	stacklessRaytracer.SetAccelerator(accelerator);
+	if (HasBackend(BACKEND_GL))
+	{
+		gpuRaytracer.CreateFrameBuffer(width, height);
+		gpuRaytracer.CreateProgram(programCache);
+	}
+	if (HasBackend(BACKEND_GL_STACKLESS))
+	{
+		stacklessRaytracer.SetStacklessTraversal(true);
+		stacklessRaytracer.CreateFrameBuffer(width, height);
+		stacklessRaytracer.CreateProgram(programCache);
+	}
+	return true;
+}
+
+// Builds sceneGrid, or sceneBvh with the selected builder. The SAH and
+// LBVH builders run on the CPU backend's threads.
+void BuildAccelerator(const CScene& scene)
+{
+	if (UseSceneCache())
+	{
+		sceneCache.GetBvh(sceneBvh);
+		return;
+	}
+	std::vector<Box> bounds;
+	const std::vector<Box>& primitives = scene.GetPrimitiveBounds(bounds);
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		sceneGrid.Build(primitives);
+	}
+	else if (builder == BUILDER_LBVH)
+	{
+		dynamicBvh.GetLinearBuilder().Build(primitives, sceneBvh);
+	}
+	else if (builder == BUILDER_SBVH)
+	{
+		spatialBuilder.Build(scene, sceneBvh);
+	}
+	else
+	{
+		dynamicBvh.GetParallelBuilder().Build(primitives, sceneBvh);
+	}
+}
+
+// Hands the scene to the backend, returns false with a reason if it cannot trace it
+bool SetScene(BenchmarkBackend backend, const CScene& scene, std::string& reason)
+{
+	if (maxBoxes > 0 && (size_t)scene.GetPrimitiveCount() > maxBoxes)
+	{
+		reason = "more than -maxboxes primitives";
+		return false;
+	}
+	if (IsGlBackend(backend))
+	{
+		if (!hasContext)
+		{
+			reason = "no OpenGL 4.3 context";
+			return false;
+		}
+		// The cached scene is uploaded from its mapping without a copy
+		if (!UseSceneCache())
+		{
+			BuildAccelerator(scene);
+		}
+		instanceBvh.Build(scene);
+		CGpuRaytracer& raytracer = GetGpuRaytracer(backend);
+		bool uploaded = accelerator == ACCELERATOR_GRID ? raytracer.SetScene(scene, sceneGrid) :
+			UseSceneCache() ? raytracer.SetScene(sceneCache) : raytracer.SetScene(scene, sceneBvh);
+		if (!uploaded || !raytracer.SetInstances(instanceBvh) || !raytracer.SetVoxels(brickMap))
+		{
+			reason = raytracer.GetNodeFormat() == GPU_NODES_WIDE8 && accelerator == ACCELERATOR_BVH ?
+				"the scene does not fit in a shader storage buffer or compressed nodes" :
+				"the scene does not fit in a shader storage buffer";
+			return false;
+		}
+		return true;
+	}
+
+	BuildAccelerator(scene);
+	instanceBvh.Build(scene);
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		cpuRaytracer.SetScene(scene, sceneGrid);
+	}
+	else
+	{
+		cpuRaytracer.SetScene(scene, sceneBvh);
+	}
+	cpuRaytracer.SetInstances(&instanceBvh);
+	cpuRaytracer.SetVoxels(&brickMap);
+	return true;
+}
+
+// Milliseconds from starting the frame until its pixels are in the frame buffer
+double RenderFrame(BenchmarkBackend backend, const FrustumRays& rays, std::vector<float>& pixels)
+{
+	uint64_t start = GetTimeNanoseconds();
+	if (IsGlBackend(backend))
+	{
+		GetGpuRaytracer(backend).Trace(rays);
+		glFinish();
+	}
+	else
+	{
+		cpuRaytracer.Render(rays, width, height, pixels.data());
+	}
+	return MillisecondsSince(start);
+}
+
+// Moves the boxes and instances to where they are in this frame, then
+// rebuilds or refits and uploads the BVHs, or rebuilds the grid. Instances
+// only update the top level. Returns the milliseconds spent updating and
+// handing them over.
+double AnimateScene(BenchmarkBackend backend, const CScene& rest, int frame, CScene& scene, double& buildMs)
+{
+	AnimateBenchmarkScene(rest, frame, scene);
+	uint64_t start = GetTimeNanoseconds();
+	const CBvh* bvh = &sceneBvh;
+	std::vector<Box> bounds;
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		sceneGrid.Build(scene.GetPrimitiveBounds(bounds));
+		buildMs = sceneGrid.GetStats().milliseconds;
+	}
+	else if (refit)
+	{
+		buildMs = dynamicBvh.Update(scene.GetPrimitiveBounds(bounds)).milliseconds;
+		bvh = &dynamicBvh.GetBvh();
+	}
+	else
+	{
+		BuildAccelerator(scene);
+		buildMs = sceneBvh.GetStats().milliseconds;
+	}
+	if (!scene.instances.empty())
+	{
+		if (!refit)
+		{
+			instanceBvh.GetTopLevel().Invalidate();
+		}
+		buildMs += instanceBvh.UpdateInstances(scene.instances).milliseconds;
+	}
+	if (IsGlBackend(backend))
+	{
+		CGpuRaytracer& raytracer = GetGpuRaytracer(backend);
+		if (accelerator == ACCELERATOR_GRID)
+		{
+			raytracer.SetScene(scene, sceneGrid);
+		}
+		else
+		{
+			raytracer.SetScene(scene, *bvh);
+		}
+		if (!scene.instances.empty())
+		{
+			raytracer.UpdateInstances(instanceBvh);
+		}
+	}
+	else if (accelerator == ACCELERATOR_GRID)
+	{
+		cpuRaytracer.SetScene(scene, sceneGrid);
+	}
+	else
+	{
+		cpuRaytracer.SetScene(scene, *bvh);
+	}
+	return MillisecondsSince(start);
+}
+
+void RunPath(BenchmarkBackend backend, CameraPath path, const CScene& scene, BenchmarkResult& result)
+{
+	std::vector<float> pixels(backend == BACKEND_CPU ? (size_t)width * height * 4 : 0);
+	CCamera1 camera;
+	float aspect = (float)width / height;
+	CScene animated = animate ? scene : CScene();
+	double buildMs = 0.0;
+	dynamicBvh.Invalidate();
+	instanceBvh.GetTopLevel().Invalidate();
+
+	// Warm up on the first frame of the path so caches and clocks settle
+	for (int frame = 0; frame < warmupFrames; frame++)
+	{
+		if (animate)
+		{
+			AnimateScene(backend, scene, 0, animated, buildMs);
+		}
+		SetCameraOnPath(camera, path, 0, frames, aspect);
+		RenderFrame(backend, camera.GetFrustumRays(), pixels);
+	}
+
+	std::vector<double> samples;
+	std::vector<double> buildSamples;
+	samples.reserve(frames);
+	// The instances' top level counts along with the boxes' BVH
+	CDynamicBvh& topLevel = instanceBvh.GetTopLevel();
+	int rebuilds = dynamicBvh.GetRebuildCount() + topLevel.GetRebuildCount();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		double sceneMs = 0.0;
+		if (animate)
+		{
+			sceneMs = AnimateScene(backend, scene, frame, animated, buildMs);
+			buildSamples.push_back(buildMs);
+			result.maxSahCostRatio = std::max(result.maxSahCostRatio, dynamicBvh.GetLastUpdate().sahCostRatio);
+			if (!scene.instances.empty())
+			{
+				result.maxSahCostRatio = std::max(result.maxSahCostRatio, topLevel.GetLastUpdate().sahCostRatio);
+			}
+		}
+		SetCameraOnPath(camera, path, frame, frames, aspect);
+		samples.push_back(sceneMs + RenderFrame(backend, camera.GetFrustumRays(), pixels));
+	}
+
+	result.frames = frames;
+	result.frameTime = ComputeFrameTimeStats(samples);
+	result.buildTime = ComputeFrameTimeStats(buildSamples);
+	result.rebuilds = dynamicBvh.GetRebuildCount() + topLevel.GetRebuildCount() - rebuilds;
+	// Primary rays only, one per pixel
+	double rays = (double)width * height;
+	result.mraysPerSecond = result.frameTime.averageMs > 0.0 ?
+		rays / (result.frameTime.averageMs * 1000.0) : 0.0;
+}
+
+void PrintResult(const BenchmarkResult& result)
+{
+	if (result.skipped)
+	{
+		printf("%-12s %-10s %-10s skipped: %s\n", result.backend.c_str(), result.scene.c_str(),
+			result.path.c_str(), result.reason.c_str());
+		return;
+	}
+	const FrameTimeStats& stats = result.frameTime;
+	printf("%-12s %-10s %-10s avg %8.3f ms  p50 %8.3f  p95 %8.3f  p99 %8.3f  %9.2f Mrays/s\n",
+		result.backend.c_str(), result.scene.c_str(), result.path.c_str(),
+		stats.averageMs, stats.p50Ms, stats.p95Ms, stats.p99Ms, result.mraysPerSecond);
+	if (result.buildTime.samples > 0)
+	{
+		printf("%-12s %-10s %-10s build %6.3f ms  p50 %8.3f  p95 %8.3f  p99 %8.3f  (%s)\n",
+			"", "", "", result.buildTime.averageMs, result.buildTime.p50Ms,
+			result.buildTime.p95Ms, result.buildTime.p99Ms,
+			accelerator == ACCELERATOR_GRID ? "grid" : GetBuilderName(builder));
+		if (refit)
+		{
+			printf("%-12s %-10s %-10s refit with %d rebuilds, SAH cost ratio up to %.3f\n",
+				"", "", "", result.rebuilds, result.maxSahCostRatio);
+		}
+	}
+}
+
+bool WriteReport(const std::vector<BenchmarkResult>& results)
+{
+	CJsonWriter json;
+	json.BeginObject();
+	json.Key("version");
+	json.Integer(BENCHMARK_REPORT_VERSION);
+
+	json.Key("system");
+	json.BeginObject();
+	json.Key("cpuThreads");
+	json.Integer(cpuRaytracer.GetScheduler().GetThreadCount());
+	json.Key("cpuIsa");
+	json.String(GetSimdIsaName(cpuRaytracer.GetSimdIsa()));
+	json.Key("cpuBvhWidth");
+	json.Integer(cpuRaytracer.GetBvhWidth());
+	json.Key("cpuBvhQuantized");
+	json.Bool(bvhWidth > 2 && quantizeBvh);
+	// Null when the OpenGL backend was not measured
+	json.Key("glRenderer");
+	if (hasContext)
+	{
+		json.String(glRenderer);
+	}
+	else
+	{
+		json.Null();
+	}
+	json.Key("glVersion");
+	if (hasContext)
+	{
+		json.String(glVersion);
+	}
+	else
+	{
+		json.Null();
+	}
+	json.Key("glNodes");
+	json.String(GetNodeFormatName(gpuRaytracer.GetNodeFormat()));
+	json.EndObject();
+
+	json.Key("settings");
+	json.BeginObject();
+	json.Key("width");
+	json.Integer(width);
+	json.Key("height");
+	json.Integer(height);
+	json.Key("frames");
+	json.Integer(frames);
+	json.Key("warmupFrames");
+	json.Integer(warmupFrames);
+	json.Key("accelerator");
+	json.String(GetAcceleratorName(accelerator));
+	json.Key("builder");
+	json.String(GetBuilderName(builder));
+	json.Key("animate");
+	json.Bool(animate);
+	json.Key("refit");
+	json.Bool(refit);
+	json.EndObject();
+
+	json.Key("results");
+	json.BeginArray();
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& result = results[i];
+		json.BeginObject();
+		json.Key("backend");
+		json.String(result.backend);
+		json.Key("scene");
+		json.String(result.scene);
+		json.Key("primitives");
+		json.Integer((long long)result.primitives);
+		json.Key("instances");
+		json.Integer((long long)result.instances);
+		json.Key("voxels");
+		json.Integer((long long)result.voxels);
+		json.Key("path");
+		json.String(result.path);
+		json.Key("status");
+		json.String(result.skipped ? "skipped" : "ok");
+		if (result.skipped)
+		{
+			json.Key("reason");
+			json.String(result.reason);
+		}
+		else
+		{
+			json.Key("setupMs");
+			json.Number(result.setupMs);
+			json.Key("buildMs");
+			json.Number(result.buildMs);
+			if (result.backend != "cpu")
+			{
+				json.Key("nodeBytes");
+				json.Integer((long long)result.nodeBytes);
+			}
+			if (accelerator == ACCELERATOR_BVH)
+			{
+				json.Key("references");
+				json.Integer(result.references);
+			}
+			json.Key("frames");
+			json.Integer(result.frames);
+			json.Key("msPerFrame");
+			json.BeginObject();
+			json.Key("average");
+			json.Number(result.frameTime.averageMs);
+			json.Key("min");
+			json.Number(result.frameTime.minMs);
+			json.Key("p50");
+			json.Number(result.frameTime.p50Ms);
+			json.Key("p95");
+			json.Number(result.frameTime.p95Ms);
+			json.Key("p99");
+			json.Number(result.frameTime.p99Ms);
+			json.Key("max");
+			json.Number(result.frameTime.maxMs);
+			json.EndObject();
+			// Rebuilds measured inside every frame, only with -animate
+			if (result.buildTime.samples > 0)
+			{
+				json.Key("buildMsPerFrame");
+				json.BeginObject();
+				json.Key("average");
+				json.Number(result.buildTime.averageMs);
+				json.Key("min");
+				json.Number(result.buildTime.minMs);
+				json.Key("p50");
+				json.Number(result.buildTime.p50Ms);
+				json.Key("p95");
+				json.Number(result.buildTime.p95Ms);
+				json.Key("p99");
+				json.Number(result.buildTime.p99Ms);
+				json.Key("max");
+				json.Number(result.buildTime.maxMs);
+				json.EndObject();
+				if (refit)
+				{
+					json.Key("rebuilds");
+					json.Integer(result.rebuilds);
+					json.Key("maxSahCostRatio");
+					json.Number(result.maxSahCostRatio);
+				}
+			}
+			json.Key("mraysPerSecond");
+			json.Number(result.mraysPerSecond);
+		}
+		json.EndObject();
+	}
+	json.EndArray();
+	json.EndObject();
+
+	if (!json.Save(jsonFile))
+	{
+		return false;
+	}
+	printf("Wrote %d results to %s\n", (int)results.size(), jsonFile.c_str());
+	return true;
+}
+
+// Percentiles of the few frames a short run records have to keep the
+// worst frame in the tail instead of rounding it away
+bool CheckFrameTimeStats()
+{
+	std::vector<double> sixty;
+	for (int i = 60; i >= 1; i--)
+	{
+		sixty.push_back(i);
+	}
+	FrameTimeStats one = ComputeFrameTimeStats({ 4.0 });
+	FrameTimeStats three = ComputeFrameTimeStats({ 3.0, 1.0, 2.0 });
+	FrameTimeStats stats = ComputeFrameTimeStats(sixty);
+	if (one.p50Ms != 4.0 || one.p99Ms != 4.0 || three.p50Ms != 2.0 || three.p95Ms != 3.0 || three.p99Ms != 3.0 ||
+		stats.p50Ms != 30.0 || stats.p95Ms != 57.0 || stats.p99Ms != 60.0)
+	{
+		fprintf(stderr, "Frame time percentiles are not nearest rank\n");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (!parseArguments(argc, argv) || !CheckFrameTimeStats())
+	{
+		return 1;
+	}
+	dynamicBvh.SetUseLinearBuilder(builder == BUILDER_LBVH);
+	instanceBvh.GetTopLevel().SetUseLinearBuilder(builder == BUILDER_LBVH);
+	cpuRaytracer.SetBvhWidth(bvhWidth, quantizeBvh);
+
+	if (HasBackend(BACKEND_GL) || HasBackend(BACKEND_GL_STACKLESS))
+	{
+		hasContext = InitGL();
+		if (hasContext)
+		{
+			printf("OpenGL: %s, %s, %s BVH nodes\n", glRenderer.c_str(), glVersion.c_str(),
+				GetNodeFormatName(gpuRaytracer.GetNodeFormat()));
+		}
+	}
+	printf("CPU: %d threads, %s kernels, BVH%d%s\n", cpuRaytracer.GetScheduler().GetThreadCount(),
+		GetSimdIsaName(cpuRaytracer.GetSimdIsa()), cpuRaytracer.GetBvhWidth(),
+		bvhWidth > 2 && quantizeBvh ? " quantized" : "");
+	printf("%dx%d, %d frames after %d warmup frames, %s%s\n", width, height, frames, warmupFrames,
+		accelerator == ACCELERATOR_GRID ? "uniform grid" : (std::string(GetBuilderName(builder)) + " BVH").c_str(),
+		!animate ? "" : refit ? " refitted every frame" : " rebuilt every frame");
+
+	std::vector<BenchmarkResult> results;
+	for (size_t s = 0; s < sceneNames.size(); s++)
+	{
+		// Scenes are built one at a time, the largest need hundreds of megabytes
+		CScene scene;
+		sceneCache.Close();
+		if (IsSceneCacheFile(sceneNames[s]))
+		{
+			uint64_t start = GetTimeNanoseconds();
+			if (!sceneCache.Open(sceneNames[s]))
+			{
+				continue;
+			}
+			sceneCache.GetScene(scene);
+			printf("%s: %d primitives, %d BVH nodes mapped in %.1f ms\n", sceneNames[s].c_str(),
+				scene.GetPrimitiveCount(), (int)sceneCache.GetCount(SCENE_CACHE_NODES), MillisecondsSince(start));
+		}
+		else if (IsMeshFile(sceneNames[s]))
+		{
+			CMeshLoader loader(cpuRaytracer.GetScheduler());
+			scene.boxes.push_back(CScene::CreateDefault().boxes[0]);
+			if (!loader.Load(sceneNames[s], scene))
+			{
+				continue;
+			}
+			scene.PlaceOnGround(0, 8.0f);
+			const MeshLoadStats& stats = loader.GetStats();
+			printf("%s: %d vertices, %d triangles, %.1f MB in %d chunks loaded in %.1f ms\n", sceneNames[s].c_str(),
+				stats.vertices, stats.triangles, stats.bytes / 1048576.0, stats.chunks, stats.milliseconds);
+		}
+		else
+		{
+			CreateBenchmarkScene(sceneNames[s], scene);
+		}
+		brickMap.Build(scene.voxels);
+		if (!brickMap.IsEmpty())
+		{
+			const BrickMapStats& stats = brickMap.GetStats();
+			printf("%s: %d voxels in %d bricks, %.2f bytes per voxel, built in %.1f ms\n", sceneNames[s].c_str(),
+				stats.voxels, stats.bricks, (double)stats.bytes / stats.voxels, stats.milliseconds);
+		}
+
+		for (size_t b = 0; b < backends.size(); b++)
+		{
+			BenchmarkResult sceneResult;
+			sceneResult.backend = GetBackendName(backends[b]);
+			sceneResult.scene = sceneNames[s];
+			sceneResult.primitives = scene.GetPrimitiveCount();
+			sceneResult.instances = scene.instances.size();
+			sceneResult.voxels = scene.voxels.cells.size();
+
+			uint64_t start = GetTimeNanoseconds();
+			sceneResult.skipped = !SetScene(backends[b], scene, sceneResult.reason);
+			sceneResult.setupMs = MillisecondsSince(start);
+			if (IsGlBackend(backends[b]) && !sceneResult.skipped)
+			{
+				sceneResult.nodeBytes = GetGpuRaytracer(backends[b]).GetNodeBufferBytes();
+			}
+			if (!sceneResult.skipped && UseSceneCache())
+			{
+				sceneResult.references = (int)sceneCache.GetCount(SCENE_CACHE_PRIM_INDICES);
+			}
+			else if (!sceneResult.skipped && accelerator == ACCELERATOR_BVH)
+			{
+				sceneResult.references = sceneBvh.GetStats().references;
+				sceneResult.buildMs = sceneBvh.GetStats().milliseconds;
+			}
+			else if (!sceneResult.skipped)
+			{
+				sceneResult.buildMs = sceneGrid.GetStats().milliseconds;
+			}
+
+			for (size_t p = 0; p < cameraPaths.size(); p++)
+			{
+				BenchmarkResult result = sceneResult;
+				result.path = GetCameraPathName(cameraPaths[p]);
+				if (!result.skipped)
+				{
+					RunPath(backends[b], cameraPaths[p], scene, result);
+				}
+				PrintResult(result);
+				results.push_back(result);
+			}
+		}
+	}
+
+	if (hasContext)
+	{
+		gpuRaytracer.Destroy();
+		stacklessRaytracer.Destroy();
+		context.Destroy();
+	}
+
+	if (!jsonFile.empty() && !WriteReport(results))
+	{
+		return 1;
+	}
+	return 0;
+}
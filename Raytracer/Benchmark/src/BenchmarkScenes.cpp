@@ -0,0 +1,137 @@
+#include "BenchmarkScenes.h"
+#include <math.h>
+
+enum BenchmarkSceneType
+{
+	SCENE_DEFAULT,
+	SCENE_GRID,
+	SCENE_RANDOM,
+	SCENE_BEAMS,
+	SCENE_INSTANCES,
+	SCENE_SPOKES,
+	SCENE_VOXELS,
+	SCENE_SPARSE_VOXELS,
+	SCENE_SPHERES
+};
+
+struct BenchmarkScene
+{
+	const char* name;
+	BenchmarkSceneType type;
+	// Grid side, number of random boxes or beams, side of the instance grid,
+	// number of spokes, side of the voxel terrain or of the sphere grid
+	int size;
+};
+
+// Never change a scene once results have been published with it, add a new one
+static const BenchmarkScene benchmarkScenes[] =
+{
+	{ "twoboxes", SCENE_DEFAULT, 0 },
+	{ "grid1k", SCENE_GRID, 32 },
+	{ "random64k", SCENE_RANDOM, 64 * 1024 },
+	{ "random1m", SCENE_RANDOM, 1024 * 1024 },
+	{ "random4m", SCENE_RANDOM, 4 * 1024 * 1024 },
+	{ "instances16k", SCENE_INSTANCES, 128 },
+	// Thin beams crossing each other, where spatial splits pay off
+	{ "beams64k", SCENE_BEAMS, 64 * 1024 },
+	// Deep trees, boxes shrinking along every spoke nest 30 or more levels
+	{ "spokes64k", SCENE_SPOKES, 1024 },
+	// A million unit cubes, the dense kind of world grids are made for
+	{ "voxels1m", SCENE_VOXELS, 580 },
+	// The same terrain in a brick map, and a larger one
+	{ "brickmap1m", SCENE_SPARSE_VOXELS, 580 },
+	{ "brickmap12m", SCENE_SPARSE_VOXELS, 2048 },
+	// Triangles and the ground box in one structure, 960 triangles per sphere
+	{ "spheres60k", SCENE_SPHERES, 8 }
+};
+
+// Boxes along every spoke of the spokes scenes
+static const int boxesPerSpoke = 64;
+// Slices around every sphere of the sphere scenes
+static const int sphereSegments = 32;
+
+// Fixed so every build and machine traces exactly the same boxes
+static const unsigned int benchmarkSeed = 20171104;
+
+std::vector<std::string> GetBenchmarkSceneNames()
+{
+	std::vector<std::string> names;
+	for (size_t i = 0; i < sizeof(benchmarkScenes) / sizeof(benchmarkScenes[0]); i++)
+	{
+		names.push_back(benchmarkScenes[i].name);
+	}
+	return names;
+}
+
+bool CreateBenchmarkScene(const std::string& name, CScene& scene)
+{
+	for (size_t i = 0; i < sizeof(benchmarkScenes) / sizeof(benchmarkScenes[0]); i++)
+	{
+		const BenchmarkScene& entry = benchmarkScenes[i];
+		if (name != entry.name)
+		{
+			continue;
+		}
+		switch (entry.type)
+		{
+		case SCENE_DEFAULT:
+			scene = CScene::CreateDefault();
+			break;
+		case SCENE_GRID:
+			scene = CScene::CreateBoxGrid(entry.size, entry.size);
+			break;
+		case SCENE_RANDOM:
+			scene = CScene::CreateRandomBoxes(entry.size, benchmarkSeed);
+			break;
+		case SCENE_BEAMS:
+			scene = CScene::CreateRandomBeams(entry.size, benchmarkSeed);
+			break;
+		case SCENE_INSTANCES:
+			scene = CScene::CreateInstancedGrid(entry.size, entry.size);
+			break;
+		case SCENE_SPOKES:
+			scene = CScene::CreateBoxSpokes(entry.size, boxesPerSpoke);
+			break;
+		case SCENE_VOXELS:
+			scene = CScene::CreateVoxelTerrain(entry.size);
+			break;
+		case SCENE_SPARSE_VOXELS:
+			scene = CScene::CreateSparseVoxelTerrain(entry.size);
+			break;
+		case SCENE_SPHERES:
+			scene = CScene::CreateSphereGrid(entry.size, entry.size, sphereSegments);
+			break;
+		}
+		return true;
+	}
+	return false;
+}
+
+void AnimateBenchmarkScene(const CScene& rest, int frame, CScene& scene)
+{
+	// Each box circles on its own phase, by about its own size
+	float time = frame / 30.0f;
+	for (size_t i = 1; i < rest.boxes.size(); i++)
+	{
+		const Box& box = rest.boxes[i];
+		float radius = box.max.x - box.min.x;
+		float phase = i * 0.618034f;
+		glm::vec3 offset(sinf(time * 2.0f + phase), 0.5f * sinf(time * 3.0f + 2.0f * phase),
+			cosf(time * 2.0f + phase));
+		scene.boxes[i].min = box.min + offset * radius;
+		scene.boxes[i].max = box.max + offset * radius;
+	}
+
+	// Instances spin in place and bob up and down, their meshes stay put
+	for (size_t i = 0; i < rest.instances.size(); i++)
+	{
+		const Transform3x4& transform = rest.instances[i].objectToWorld;
+		float phase = i * 0.618034f;
+		float angle = time * (1.0f + 0.5f * sinf(phase));
+		glm::mat3 spin(glm::vec3(cosf(angle), 0.0f, -sinf(angle)), glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::vec3(sinf(angle), 0.0f, cosf(angle)));
+		glm::vec3 bob(0.0f, 0.05f * (1.0f + sinf(time * 3.0f + phase)), 0.0f);
+		scene.instances[i].objectToWorld = Transform3x4::Create(transform.GetLinear() * spin,
+			transform.GetTranslation() + bob);
+	}
+}
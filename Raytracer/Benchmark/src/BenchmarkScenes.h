@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+// Names of the canonical scenes, from the two boxes compiled into
+// raytracingShader.txt up to millions of boxes
+std::vector<std::string> GetBenchmarkSceneNames();
+// Returns false for unknown names
+bool CreateBenchmarkScene(const std::string& name, CScene& scene);
+// Moves every box but the ground around its place in rest and spins the
+// instances, scene must start as a copy of rest
+void AnimateBenchmarkScene(const CScene& rest, int frame, CScene& scene);
@@ -0,0 +1,48 @@
+#include "CameraPath.h"
+
+static const char* cameraPathNames[CAMERA_PATH_COUNT] = { "static", "orbit", "flythrough" };
+
+const char* GetCameraPathName(CameraPath path)
+{
+	return cameraPathNames[path];
+}
+
+bool ParseCameraPath(const std::string& name, CameraPath& path)
+{
+	for (int i = 0; i < CAMERA_PATH_COUNT; i++)
+	{
+		if (name == cameraPathNames[i])
+		{
+			path = (CameraPath)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SetCameraOnPath(CCamera1& camera, CameraPath path, int frame, int frameCount, float aspect)
+{
+	// Fraction of the path covered, the last frame stops just short of the end
+	float t = frameCount > 0 ? (float)frame / frameCount : 0.0f;
+	glm::vec3 position(3.0f, 1.0f, 80.0f);
+	glm::vec3 lookAt(0.0f, 0.5f, 0.0f);
+
+	switch (path)
+	{
+	case CAMERA_PATH_STATIC:
+		break;
+	case CAMERA_PATH_ORBIT:
+	{
+		float angle = t * 2.0f * glm::pi<float>();
+		position = glm::vec3(12.0f * std::sin(angle), 4.0f, 12.0f * std::cos(angle));
+		break;
+	}
+	case CAMERA_PATH_FLYTHROUGH:
+		position = glm::vec3(3.0f * std::cos(t * glm::pi<float>()), 1.0f + 2.0f * t, 80.0f - 74.0f * t);
+		break;
+	}
+
+	camera = CCamera1();
+	camera.SetFrustumPerspective(60.0f, aspect, 1.0f, 2.0f);
+	camera.SetLookAt(position, lookAt, glm::vec3(0.0f, 1.0f, 0.0f));
+}
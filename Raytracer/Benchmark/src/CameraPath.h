@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include "Camera.h"
+
+// Scripted camera movements, the same on every run
+enum CameraPath
+{
+	// The interactive app's starting view
+	CAMERA_PATH_STATIC,
+	// One circle around the scene
+	CAMERA_PATH_ORBIT,
+	// From far away down into the scene
+	CAMERA_PATH_FLYTHROUGH
+};
+
+#define CAMERA_PATH_COUNT 3
+
+const char* GetCameraPathName(CameraPath path);
+// Returns false for names other than static, orbit and flythrough
+bool ParseCameraPath(const std::string& name, CameraPath& path);
+
+// Places the camera where the path is at frame out of frameCount
+void SetCameraOnPath(CCamera1& camera, CameraPath path, int frame, int frameCount, float aspect);
@@ -0,0 +1,153 @@
+#include "JsonWriter.h"
+#include <cmath>
+#include <stdio.h>
+
+CJsonWriter::CJsonWriter()
+	: afterKey(false)
+{
+}
+
+void CJsonWriter::Indent()
+{
+	text += "\n";
+	text.append(empty.size() * 2, ' ');
+}
+
+// Separates the value from the previous member and puts it on its own line
+void CJsonWriter::BeginValue()
+{
+	if (afterKey)
+	{
+		afterKey = false;
+		return;
+	}
+	if (!empty.empty())
+	{
+		if (!empty.back())
+		{
+			text += ",";
+		}
+		empty.back() = false;
+		Indent();
+	}
+}
+
+void CJsonWriter::BeginObject()
+{
+	BeginValue();
+	text += "{";
+	empty.push_back(true);
+}
+
+void CJsonWriter::EndObject()
+{
+	bool wasEmpty = empty.back();
+	empty.pop_back();
+	if (!wasEmpty)
+	{
+		Indent();
+	}
+	text += "}";
+}
+
+void CJsonWriter::BeginArray()
+{
+	BeginValue();
+	text += "[";
+	empty.push_back(true);
+}
+
+void CJsonWriter::EndArray()
+{
+	EndObject();
+	text.back() = ']';
+}
+
+void CJsonWriter::Key(const std::string& name)
+{
+	BeginValue();
+	WriteString(name);
+	text += ": ";
+	afterKey = true;
+}
+
+void CJsonWriter::String(const std::string& value)
+{
+	BeginValue();
+	WriteString(value);
+}
+
+void CJsonWriter::WriteString(const std::string& value)
+{
+	text += "\"";
+	for (size_t i = 0; i < value.size(); i++)
+	{
+		unsigned char c = value[i];
+		if (c == '"' || c == '\\')
+		{
+			text += '\\';
+			text += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			text += escaped;
+		}
+		else
+		{
+			text += c;
+		}
+	}
+	text += "\"";
+}
+
+void CJsonWriter::Number(double value)
+{
+	BeginValue();
+	// JSON has no representation for infinities and NaN
+	if (!std::isfinite(value))
+	{
+		text += "null";
+		return;
+	}
+	char number[32];
+	snprintf(number, sizeof(number), "%.6g", value);
+	text += number;
+}
+
+void CJsonWriter::Integer(long long value)
+{
+	BeginValue();
+	text += std::to_string(value);
+}
+
+void CJsonWriter::Bool(bool value)
+{
+	BeginValue();
+	text += value ? "true" : "false";
+}
+
+void CJsonWriter::Null()
+{
+	BeginValue();
+	text += "null";
+}
+
+bool CJsonWriter::Save(const std::string& fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "wb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not open '%s' for writing\n", fileName.c_str());
+		return false;
+	}
+	std::string output = text + "\n";
+	bool written = fwrite(output.data(), 1, output.size(), file) == output.size();
+	written = fclose(file) == 0 && written;
+	if (!written)
+	{
+		fprintf(stderr, "Could not write '%s'\n", fileName.c_str());
+	}
+	return written;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Minimal streaming JSON writer for the benchmark report. Values inside
+// an object must be preceded by Key().
+class CJsonWriter
+{
+public:
+	CJsonWriter();
+
+	void BeginObject();
+	void EndObject();
+	void BeginArray();
+	void EndArray();
+	void Key(const std::string& name);
+
+	void String(const std::string& value);
+	void Number(double value);
+	void Integer(long long value);
+	void Bool(bool value);
+	void Null();
+
+	const std::string& GetText() { return text; }
+	bool Save(const std::string& fileName);
+
+private:
+	void BeginValue();
+	void Indent();
+	void WriteString(const std::string& value);
+
+	std::string text;
+	// One entry per open object or array, true until it has a member
+	std::vector<bool> empty;
+	bool afterKey;
+};
@@ -0,0 +1,100 @@
+#include "BrickMap.h"
+#include "Morton.h"
+#include "Platform.h"
+#include <algorithm>
+
+CBrickMap::CBrickMap()
+	: origin(0.0f), voxelSize(1.0f), firstVoxel(0), resolution(0)
+{
+}
+
+Box CBrickMap::GetBounds() const
+{
+	if (IsEmpty())
+	{
+		return CreateEmptyBox();
+	}
+	glm::vec3 min = origin + glm::vec3(firstVoxel) * voxelSize;
+	Box bounds = { min, min + glm::vec3(resolution * BRICK_SIZE) * voxelSize };
+	return bounds;
+}
+
+void CBrickMap::Build(const SceneVoxels& voxels)
+{
+	uint64_t start = GetTimeNanoseconds();
+	stats = BrickMapStats();
+	brickIndices.clear();
+	bricks.clear();
+	resolution = glm::ivec3(0);
+	origin = voxels.origin;
+	voxelSize = voxels.size;
+	const std::vector<glm::ivec3>& cells = voxels.cells;
+	if (cells.empty())
+	{
+		stats.milliseconds = MillisecondsSince(start);
+		return;
+	}
+
+	// Coarse cells start on a multiple of BRICK_SIZE voxels
+	glm::ivec3 lo = cells[0];
+	glm::ivec3 hi = cells[0];
+	for (size_t i = 1; i < cells.size(); i++)
+	{
+		lo = glm::min(lo, cells[i]);
+		hi = glm::max(hi, cells[i]);
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		firstVoxel[axis] = lo[axis] >= 0 ? lo[axis] / BRICK_SIZE * BRICK_SIZE :
+			-((-lo[axis] + BRICK_SIZE - 1) / BRICK_SIZE * BRICK_SIZE);
+	}
+	resolution = (hi - firstVoxel) / BRICK_SIZE + 1;
+
+	// Mark the occupied coarse cells, then number their bricks in Morton order
+	size_t cellCount = (size_t)resolution.x * resolution.y * resolution.z;
+	brickIndices.assign(cellCount, BRICK_EMPTY);
+	std::vector<uint64_t> keys;
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		glm::ivec3 coarse = (cells[i] - firstVoxel) / BRICK_SIZE;
+		size_t index = ((size_t)coarse.z * resolution.y + coarse.y) * resolution.x + coarse.x;
+		if (brickIndices[index] == BRICK_EMPTY)
+		{
+			brickIndices[index] = 0;
+			keys.push_back(ExpandBits21(coarse.x) << 2 | ExpandBits21(coarse.y) << 1 | ExpandBits21(coarse.z));
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	for (size_t i = 0; i < cellCount; i++)
+	{
+		if (brickIndices[i] == BRICK_EMPTY)
+		{
+			continue;
+		}
+		int x = (int)(i % resolution.x);
+		int y = (int)(i / resolution.x % resolution.y);
+		int z = (int)(i / resolution.x / resolution.y);
+		uint64_t key = ExpandBits21(x) << 2 | ExpandBits21(y) << 1 | ExpandBits21(z);
+		brickIndices[i] = (uint32_t)(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+	}
+
+	bricks.assign(keys.size() * BRICK_WORDS, 0);
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		glm::ivec3 local = cells[i] - firstVoxel;
+		glm::ivec3 coarse = local / BRICK_SIZE;
+		local -= coarse * BRICK_SIZE;
+		uint32_t brick = brickIndices[((size_t)coarse.z * resolution.y + coarse.y) * resolution.x + coarse.x];
+		int bit = (local.z * BRICK_SIZE + local.y) * BRICK_SIZE + local.x;
+		uint32_t& word = bricks[brick * BRICK_WORDS + bit / 32];
+		if ((word & (1u << (bit % 32))) == 0)
+		{
+			word |= 1u << (bit % 32);
+			stats.voxels++;
+		}
+	}
+
+	stats.bricks = (int)keys.size();
+	stats.bytes = (brickIndices.size() + bricks.size()) * sizeof(uint32_t);
+	stats.milliseconds = MillisecondsSince(start);
+}
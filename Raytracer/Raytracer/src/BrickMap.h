@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "glm/glm.hpp"
+#include "Scene.h"
+
+// Voxels per brick side, BRICK_SIZE in raytracingShader.txt
+#define BRICK_SIZE 8
+// 32 bit words of one brick's occupancy bits
+#define BRICK_WORDS (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE / 32)
+// Brick index of a coarse cell without voxels
+#define BRICK_EMPTY 0xffffffffu
+
+struct BrickMapStats
+{
+	double milliseconds = 0.0;
+	int voxels = 0;
+	int bricks = 0;
+	// Coarse cells and bricks together, what the GPU stores
+	size_t bytes = 0;
+};
+
+// Two level brick map over SceneVoxels: a coarse grid of BRICK_SIZE^3
+// voxel cells holds a brick index or BRICK_EMPTY, a brick one occupancy
+// bit per voxel. Rays skip empty coarse cells whole and walk voxels only
+// inside bricks. There are no pointers, every brick is BRICK_WORDS words
+// found through its index alone, so bricks can be uploaded, replaced or
+// evicted one at a time. Bricks are numbered along a Morton curve over the
+// coarse grid, so nearby bricks are also near in memory.
+class CBrickMap
+{
+public:
+	CBrickMap();
+
+	void Build(const SceneVoxels& voxels);
+
+	bool IsEmpty() const { return bricks.empty(); }
+	// Voxel x, y, z spans GetOrigin() + (x, y, z) * GetVoxelSize() to one
+	// voxel further, like in SceneVoxels
+	glm::vec3 GetOrigin() const { return origin; }
+	float GetVoxelSize() const { return voxelSize; }
+	// Voxel at the low corner of coarse cell (0, 0, 0)
+	glm::ivec3 GetFirstVoxel() const { return firstVoxel; }
+	// Coarse cells per axis
+	glm::ivec3 GetResolution() const { return resolution; }
+	// Space the coarse cells cover, empty without bricks
+	Box GetBounds() const;
+	const BrickMapStats& GetStats() const { return stats; }
+
+	// Coarse cell x, y, z is number (z * resolution.y + y) * resolution.x + x
+	std::vector<uint32_t> brickIndices;
+	// BRICK_WORDS words per brick, voxel x, y, z of a brick is bit
+	// (z * BRICK_SIZE + y) * BRICK_SIZE + x
+	std::vector<uint32_t> bricks;
+
+private:
+	glm::vec3 origin;
+	float voxelSize;
+	glm::ivec3 firstVoxel;
+	glm::ivec3 resolution;
+	BrickMapStats stats;
+};
@@ -0,0 +1,350 @@
+#include "Bvh.h"
+#include "Platform.h"
+#include "TileScheduler.h"
+#include <algorithm>
+#include <float.h>
+
+// Leaves larger than this are split even when the SAH says it does not pay
+#define BVH_MAX_LEAF_SIZE 8
+
+// Nodes per range of the parallel refit
+#define BVH_REFIT_GRAIN_SIZE 1024
+
+// Relative costs of visiting a node and testing a box
+static const float traversalCost = 1.0f;
+static const float intersectionCost = 1.0f;
+
+float BoxSurfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 extent = max - min;
+	if (extent.x < 0.0f || extent.y < 0.0f || extent.z < 0.0f)
+	{
+		return 0.0f;
+	}
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+CBvh::CBvh()
+{
+}
+
+void CBvh::Build(const std::vector<Box>& boxes)
+{
+	uint64_t start = GetTimeNanoseconds();
+	int count = (int)boxes.size();
+	stats = BvhBuildStats();
+	nodes.clear();
+	levelNodes.clear();
+	levelStarts.clear();
+	primIndices.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		primIndices[i] = i;
+	}
+	if (count == 0)
+	{
+		stats.milliseconds = MillisecondsSince(start);
+		return;
+	}
+
+	std::vector<glm::vec3> centroids(count);
+	for (int i = 0; i < count; i++)
+	{
+		centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+	}
+
+	// A binary tree over n leaves never has more than 2n - 1 nodes, so
+	// references into nodes stay valid while it grows
+	nodes.reserve(2 * (size_t)count - 1);
+	BvhNode root;
+	root.leftOrFirst = 0;
+	root.count = count;
+	nodes.push_back(root);
+	UpdateBounds(0, boxes);
+	Subdivide(0, 1, boxes, centroids);
+
+	stats.nodes = (int)nodes.size();
+	stats.leaves = (stats.nodes + 1) / 2;
+	stats.references = count;
+	stats.sahCost = ComputeSahCost();
+	stats.milliseconds = MillisecondsSince(start);
+}
+
+void CBvh::UpdateBounds(int nodeIndex, const std::vector<Box>& boxes)
+{
+	BvhNode& node = nodes[nodeIndex];
+	node.min = glm::vec3(FLT_MAX);
+	node.max = glm::vec3(-FLT_MAX);
+	for (int i = 0; i < node.count; i++)
+	{
+		const Box& box = boxes[primIndices[node.leftOrFirst + i]];
+		node.min = glm::min(node.min, box.min);
+		node.max = glm::max(node.max, box.max);
+	}
+}
+
+// Bins the centroids on every axis, returns the SAH cost of the best split
+// or FLT_MAX with axis -1 if the centroids cannot be separated
+float CBvh::FindBestSplit(const BvhNode& node, const std::vector<Box>& boxes,
+	const std::vector<glm::vec3>& centroids, int& axis, float& position) const
+{
+	glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (int i = 0; i < node.count; i++)
+	{
+		const glm::vec3& centroid = centroids[primIndices[node.leftOrFirst + i]];
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+
+	BvhBin bins[3][BVH_BINS];
+	for (int a = 0; a < 3; a++)
+	{
+		float extent = centroidMax[a] - centroidMin[a];
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+		float scale = BVH_BINS / extent;
+		for (int i = 0; i < node.count; i++)
+		{
+			int prim = primIndices[node.leftOrFirst + i];
+			int bin = std::min(BVH_BINS - 1, (int)((centroids[prim][a] - centroidMin[a]) * scale));
+			bins[a][bin].min = glm::min(bins[a][bin].min, boxes[prim].min);
+			bins[a][bin].max = glm::max(bins[a][bin].max, boxes[prim].max);
+			bins[a][bin].count++;
+		}
+	}
+	return FindBestBinSplit(bins, centroidMin, centroidMax, BoxSurfaceArea(node.min, node.max), axis, position);
+}
+
+float CBvh::FindBestBinSplit(const BvhBin bins[3][BVH_BINS], const glm::vec3& centroidMin,
+	const glm::vec3& centroidMax, float nodeArea, int& axis, float& position)
+{
+	float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+	float bestCost = FLT_MAX;
+	axis = -1;
+	for (int a = 0; a < 3; a++)
+	{
+		float extent = centroidMax[a] - centroidMin[a];
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+		float scale = BVH_BINS / extent;
+
+		// Areas and counts left of each border, then right of it
+		float leftArea[BVH_BINS - 1];
+		int leftCount[BVH_BINS - 1];
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+		int sum = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++)
+		{
+			sum += bins[a][b].count;
+			min = glm::min(min, bins[a][b].min);
+			max = glm::max(max, bins[a][b].max);
+			leftCount[b] = sum;
+			leftArea[b] = BoxSurfaceArea(min, max);
+		}
+		min = glm::vec3(FLT_MAX);
+		max = glm::vec3(-FLT_MAX);
+		sum = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--)
+		{
+			sum += bins[a][b].count;
+			min = glm::min(min, bins[a][b].min);
+			max = glm::max(max, bins[a][b].max);
+			if (leftCount[b - 1] == 0 || sum == 0)
+			{
+				continue;
+			}
+			float cost = traversalCost + intersectionCost *
+				(leftCount[b - 1] * leftArea[b - 1] + sum * BoxSurfaceArea(min, max)) * invNodeArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				axis = a;
+				position = centroidMin[a] + b / scale;
+			}
+		}
+	}
+	return bestCost;
+}
+
+bool CBvh::ShouldSplit(int count, int axis, float splitCost)
+{
+	return axis >= 0 && (splitCost < count * intersectionCost || count > BVH_MAX_LEAF_SIZE);
+}
+
+void CBvh::Subdivide(int nodeIndex, int depth, const std::vector<Box>& boxes, const std::vector<glm::vec3>& centroids)
+{
+	stats.depth = std::max(stats.depth, depth);
+	BvhNode& node = nodes[nodeIndex];
+	if (node.count <= 1 || depth >= BVH_MAX_DEPTH)
+	{
+		return;
+	}
+
+	int axis;
+	float position;
+	float splitCost = FindBestSplit(node, boxes, centroids, axis, position);
+	if (!ShouldSplit(node.count, axis, splitCost))
+	{
+		return;
+	}
+
+	// Partition the node's primitives in place around the split plane
+	int first = node.leftOrFirst;
+	int i = first;
+	int j = first + node.count - 1;
+	while (i <= j)
+	{
+		if (centroids[primIndices[i]][axis] < position)
+		{
+			i++;
+		}
+		else
+		{
+			std::swap(primIndices[i], primIndices[j--]);
+		}
+	}
+	int leftCount = i - first;
+	if (leftCount == 0 || leftCount == node.count)
+	{
+		return;
+	}
+
+	int left = (int)nodes.size();
+	BvhNode child;
+	child.leftOrFirst = first;
+	child.count = leftCount;
+	nodes.push_back(child);
+	child.leftOrFirst = i;
+	child.count = node.count - leftCount;
+	nodes.push_back(child);
+	node.leftOrFirst = left;
+	node.count = 0;
+
+	UpdateBounds(left, boxes);
+	UpdateBounds(left + 1, boxes);
+	Subdivide(left, depth + 1, boxes, centroids);
+	Subdivide(left + 1, depth + 1, boxes, centroids);
+}
+
+float CBvh::ComputeSahCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+	float rootArea = BoxSurfaceArea(nodes[0].min, nodes[0].max);
+	if (rootArea <= 0.0f)
+	{
+		return nodes[0].IsLeaf() ? nodes[0].count * intersectionCost : traversalCost;
+	}
+	double cost = 0.0;
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		float area = BoxSurfaceArea(nodes[i].min, nodes[i].max);
+		cost += nodes[i].IsLeaf() ? area * nodes[i].count * intersectionCost : area * traversalCost;
+	}
+	return (float)(cost / rootArea);
+}
+
+void CBvh::ComputeParents(std::vector<int>& parents) const
+{
+	parents.assign(nodes.size(), -1);
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (!nodes[i].IsLeaf())
+		{
+			parents[nodes[i].leftOrFirst] = (int)i;
+			parents[nodes[i].leftOrFirst + 1] = (int)i;
+		}
+	}
+}
+
+void CBvh::BuildLevels()
+{
+	levelNodes.clear();
+	levelStarts.clear();
+	levelNodes.reserve(nodes.size());
+	levelNodes.push_back(0);
+	size_t levelStart = 0;
+	while (levelStart < levelNodes.size())
+	{
+		size_t levelEnd = levelNodes.size();
+		levelStarts.push_back((int)levelStart);
+		for (size_t i = levelStart; i < levelEnd; i++)
+		{
+			const BvhNode& node = nodes[levelNodes[i]];
+			if (!node.IsLeaf())
+			{
+				levelNodes.push_back(node.leftOrFirst);
+				levelNodes.push_back(node.leftOrFirst + 1);
+			}
+		}
+		levelStart = levelEnd;
+	}
+	levelStarts.push_back((int)levelNodes.size());
+}
+
+float CBvh::Refit(const std::vector<Box>& boxes, CTileScheduler& scheduler)
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+	if (levelNodes.empty())
+	{
+		BuildLevels();
+	}
+
+	// Deepest level first, every node only reads the level below it
+	for (int level = (int)levelStarts.size() - 2; level >= 0; level--)
+	{
+		int first = levelStarts[level];
+		scheduler.ParallelFor(levelStarts[level + 1] - first, BVH_REFIT_GRAIN_SIZE, [&](int begin, int end, int)
+		{
+			for (int i = first + begin; i < first + end; i++)
+			{
+				BvhNode& node = nodes[levelNodes[i]];
+				if (node.IsLeaf())
+				{
+					UpdateBounds(levelNodes[i], boxes);
+				}
+				else
+				{
+					const BvhNode& left = nodes[node.leftOrFirst];
+					const BvhNode& right = nodes[node.leftOrFirst + 1];
+					node.min = glm::min(left.min, right.min);
+					node.max = glm::max(left.max, right.max);
+				}
+			}
+		});
+	}
+
+	// Same sum as ComputeSahCost, reduced per range
+	int count = (int)nodes.size();
+	std::vector<double> rangeCosts((count + BVH_REFIT_GRAIN_SIZE - 1) / BVH_REFIT_GRAIN_SIZE);
+	scheduler.ParallelFor(count, BVH_REFIT_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		double cost = 0.0;
+		for (int i = begin; i < end; i++)
+		{
+			float area = BoxSurfaceArea(nodes[i].min, nodes[i].max);
+			cost += nodes[i].IsLeaf() ? area * nodes[i].count * intersectionCost : area * traversalCost;
+		}
+		rangeCosts[begin / BVH_REFIT_GRAIN_SIZE] = cost;
+	});
+	float rootArea = BoxSurfaceArea(nodes[0].min, nodes[0].max);
+	if (rootArea <= 0.0f)
+	{
+		return ComputeSahCost();
+	}
+	double cost = 0.0;
+	for (size_t r = 0; r < rangeCosts.size(); r++)
+	{
+		cost += rangeCosts[r];
+	}
+	return (float)(cost / rootArea);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <float.h>
+#include <vector>
+#include "glm/glm.hpp"
+#include "Scene.h"
+
+class CTileScheduler;
+
+// Deepest tree the builders produce, traversal stacks are sized for it
+#define BVH_MAX_DEPTH 64
+// Candidate split planes per axis are the borders between these bins
+#define BVH_BINS 16
+
+// 32 bytes, the std430 layout of 'struct bvhNode' in raytracingShader.txt.
+// The two children of an interior node are stored next to each other.
+struct BvhNode
+{
+	glm::vec3 min;
+	// Interior: index of the left child, the right one follows it.
+	// Leaf: first entry of its primitives in CBvh::primIndices.
+	int leftOrFirst;
+	glm::vec3 max;
+	// Number of primitives in a leaf, 0 for interior nodes
+	int count;
+
+	bool IsLeaf() const { return count > 0; }
+};
+
+// Centroids of one bin of the SAH split search, with the bounds of their boxes
+struct BvhBin
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+	int count = 0;
+};
+
+struct BvhBuildStats
+{
+	double milliseconds = 0.0;
+	int nodes = 0;
+	int leaves = 0;
+	int depth = 0;
+	// Entries in CBvh::primIndices, above the box count when spatial splits
+	// reference a box from several leaves
+	int references = 0;
+	float sahCost = 0.0f;
+};
+
+// Bounding volume hierarchy over boxes, node 0 is the root. An empty
+// scene has no nodes at all.
+class CBvh
+{
+public:
+	CBvh();
+
+	// Top down binned SAH build
+	void Build(const std::vector<Box>& boxes);
+	// Recomputes the bounds of every node bottom up after the boxes moved,
+	// keeping the topology. Returns the SAH cost of the refitted tree.
+	float Refit(const std::vector<Box>& boxes, CTileScheduler& scheduler);
+
+	// Expected cost of a random ray with the traversal and intersection
+	// costs used by the builder, relative to the root's surface area
+	float ComputeSahCost() const;
+	const BvhBuildStats& GetStats() const { return stats; }
+	// Parent of every node, -1 for the root, for traversals without a stack
+	void ComputeParents(std::vector<int>& parents) const;
+
+	std::vector<BvhNode> nodes;
+	// Leaves reference boxes through this array, in leaf order. Every box
+	// is listed once, except after CSpatialBvhBuilder.
+	std::vector<int> primIndices;
+
+private:
+	friend class CLinearBvhBuilder;
+	friend class CSpatialBvhBuilder;
+	friend class CParallelBvhBuilder;
+	friend class CSceneCache;
+
+	void UpdateBounds(int nodeIndex, const std::vector<Box>& boxes);
+	void BuildLevels();
+	void Subdivide(int nodeIndex, int depth, const std::vector<Box>& boxes, const std::vector<glm::vec3>& centroids);
+	float FindBestSplit(const BvhNode& node, const std::vector<Box>& boxes,
+		const std::vector<glm::vec3>& centroids, int& axis, float& position) const;
+	// Sweeps the borders of bins filled over the centroid bounds, axes with
+	// a flat extent are skipped
+	static float FindBestBinSplit(const BvhBin bins[3][BVH_BINS], const glm::vec3& centroidMin,
+		const glm::vec3& centroidMax, float nodeArea, int& axis, float& position);
+	// Whether a node of count primitives is split with the best split found
+	static bool ShouldSplit(int count, int axis, float splitCost);
+
+	BvhBuildStats stats;
+	// Nodes sorted by depth and where each depth starts, for refitting one
+	// level at a time. Empty until the first refit after a build.
+	std::vector<int> levelNodes;
+	std::vector<int> levelStarts;
+};
+
+// Surface area of a box, 0 for empty ones with min above max
+float BoxSurfaceArea(const glm::vec3& min, const glm::vec3& max);
@@ -1,6 +1,8 @@
 #include "Camera.h"
 #include <math.h>
+#include <algorithm>
 #include <cmath>
+#include <float.h>
 
 CCamera::CCamera() {
 }
@@ -473,6 +475,17 @@ glm::vec3 CCamera1::GetEyeRay(float x, float y)
 	return res;
 }
 
+FrustumRays CCamera1::GetFrustumRays()
+{
+	FrustumRays rays;
+	rays.eye = position;
+	rays.ray00 = GetEyeRay(-1, -1);
+	rays.ray01 = GetEyeRay(-1, 1);
+	rays.ray10 = GetEyeRay(1, -1);
+	rays.ray11 = GetEyeRay(1, 1);
+	return rays;
+}
+
 void CCamera1::SetLookAt(glm::vec3 position, glm::vec3 lookAt, glm::vec3 up)
 {
 	SetPosition(position);
@@ -486,4 +499,70 @@ void CCamera1::SetLookAt(glm::vec3 position, glm::vec3 lookAt, glm::vec3 up)
 	right = glm::normalize(right);
 	tmp0 = glm::cross(right, tmp1);
 	SetUp(tmp0);
-}
\ No newline at end of file
+}
+
+float GetMaxHitDistance(const FrustumRays& rays, const Box& bounds)
+{
+	if (IsEmptyBox(bounds))
+	{
+		return 0.0f;
+	}
+	glm::vec3 farthest = glm::max(glm::abs(bounds.min - rays.eye), glm::abs(bounds.max - rays.eye));
+	// Every ray is a bilinear blend of the corners, so it is at least as
+	// long as the shortest corner along their mean direction
+	glm::vec3 corners[4] = { rays.ray00, rays.ray01, rays.ray10, rays.ray11 };
+	glm::vec3 center = glm::normalize(corners[0] + corners[1] + corners[2] + corners[3]);
+	float shortest = FLT_MAX;
+	for (int i = 0; i < 4; i++)
+	{
+		shortest = std::min(shortest, glm::dot(corners[i], center));
+	}
+	if (!(shortest > 0.0f))
+	{
+		// Wider than a half space, no bound along the rays
+		return FLT_MAX;
+	}
+	// Slightly further, rounding must not cut off the farthest hits
+	return glm::length(farthest) / shortest * 1.001f;
+}
+
+bool GetScreenBounds(const FrustumRays& rays, const Box& box, int width, int height,
+	glm::ivec2& pixelMin, glm::ivec2& pixelMax)
+{
+	// The ray of image position (x, y) is ray00 + x * across + y * down
+	// when the corners span a parallelogram, as they do for this camera
+	glm::vec3 across = rays.ray10 - rays.ray00;
+	glm::vec3 down = rays.ray01 - rays.ray00;
+	glm::vec3 skew = rays.ray11 - rays.ray10 - down;
+	if (glm::length(skew) > 1e-4f * (glm::length(across) + glm::length(down)))
+	{
+		return false;
+	}
+	glm::mat3 toImage = glm::inverse(glm::mat3(rays.ray00, across, down));
+
+	glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y,
+			(corner & 4) ? box.max.z : box.min.z);
+		// Ray parameter of the corner's plane, then the position times it
+		glm::vec3 q = toImage * (p - rays.eye);
+		if (!(q.x > 0.0f))
+		{
+			return false;
+		}
+		glm::vec2 position(q.y / q.x, q.z / q.x);
+		lo = glm::min(lo, position);
+		hi = glm::max(hi, position);
+	}
+	// The shader places pixel p at position p / (size - 1). Clamped before
+	// converting, corners close to the eye's plane project far outside.
+	glm::vec2 scale((float)(width - 1), (float)(height - 1));
+	glm::vec2 outside(-2.0f);
+	glm::vec2 beyond((float)width + 1.0f, (float)height + 1.0f);
+	lo = glm::clamp(glm::floor(lo * scale), outside, beyond);
+	hi = glm::clamp(glm::ceil(hi * scale), outside, beyond);
+	pixelMin = glm::max(glm::ivec2(lo) - 1, glm::ivec2(0));
+	pixelMax = glm::min(glm::ivec2(hi) + 1, glm::ivec2(width - 1, height - 1));
+	return true;
+}
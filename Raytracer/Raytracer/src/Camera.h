@@ -3,7 +3,27 @@
 #define GLM_FORCE_RADIANS
 #include "glm/glm.hpp"
 #include "glm/gtx/rotate_vector.hpp"
-#include <GL/glew.h>
+#include "GLHeaders.h"
+#include "Scene.h"
+
+// Eye position and frustum corner rays, as consumed by raytracingShader.txt
+struct FrustumRays
+{
+	glm::vec3 eye;
+	glm::vec3 ray00;
+	glm::vec3 ray01;
+	glm::vec3 ray10;
+	glm::vec3 ray11;
+};
+
+// Largest ray parameter of a hit inside bounds along any ray between the
+// corner rays, which are not normalized. 0 for empty bounds.
+float GetMaxHitDistance(const FrustumRays& rays, const Box& bounds);
+// Pixels of a width x height image whose rays may pass through box, with a
+// pixel to spare on every side. An off screen box gives min above max.
+// False when part of the box is behind the eye, any pixel may see it then.
+bool GetScreenBounds(const FrustumRays& rays, const Box& box, int width, int height,
+	glm::ivec2& pixelMin, glm::ivec2& pixelMax);
 
 class CCamera
 {
@@ -123,5 +143,6 @@ public:
 	glm::mat4 GetInverseProjectionViewMatrix();
 
 	glm::vec3 GetEyeRay(float x, float y);
+	FrustumRays GetFrustumRays();
 };
 
@@ -0,0 +1,130 @@
+#include "CompressedBvh.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Smallest and largest biased exponent the shader turns into a float
+#define MIN_SCALE_EXPONENT 1
+#define MAX_SCALE_EXPONENT 254
+
+static_assert(WIDE_BVH_MAX_LEAF_SIZE <= COMPRESSED_BVH_MAX_LEAF_SIZE,
+	"Wide BVH leaves must fit the 8 bit count of compressed leaf children");
+
+bool CCompressedBvh::Build(const CBvh& bvh)
+{
+	nodes.clear();
+	stackSize = 0;
+	if (bvh.primIndices.size() > COMPRESSED_BVH_MAX_PRIMITIVES)
+	{
+		fprintf(stderr, "Compressed BVH nodes address at most %d primitives, the scene has %d\n",
+			COMPRESSED_BVH_MAX_PRIMITIVES, (int)bvh.primIndices.size());
+		return false;
+	}
+	wide.Build(bvh, 8, false);
+	nodes.resize(wide.GetNodeCount());
+	for (int node = 0; node < wide.GetNodeCount(); node++)
+	{
+		Compress(node);
+	}
+	if (!nodes.empty())
+	{
+		stackSize = ComputeStackSize(0);
+	}
+	if (stackSize > COMPRESSED_BVH_STACK_SIZE)
+	{
+		fprintf(stderr, "Compressed BVH traversal needs a stack of %d entries, the shader has %d\n",
+			stackSize, COMPRESSED_BVH_STACK_SIZE);
+		return false;
+	}
+	return true;
+}
+
+// Picks the smallest power of two scale whose 255 steps reach from lo to hi
+// and rounds every child box outwards onto that grid
+void CCompressedBvh::Compress(int node)
+{
+	const float* wideBounds = wide.GetBounds(node);
+	const int* wideChildren = wide.GetChildren(node);
+	const uint8_t* wideCounts = wide.GetCounts(node);
+	int childCount = wide.GetChildCount(node);
+	CompressedBvhNode& compressed = nodes[node];
+	memset(&compressed, 0, sizeof(compressed));
+
+	uint32_t header = (uint32_t)childCount << 24;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		for (int c = 0; c < childCount; c++)
+		{
+			lo = std::min(lo, wideBounds[axis * 8 + c]);
+			hi = std::max(hi, wideBounds[(axis + 3) * 8 + c]);
+		}
+		int exponent = 0;
+		frexpf((hi - lo) / 255.0f, &exponent);
+		exponent = std::max(MIN_SCALE_EXPONENT, std::min(MAX_SCALE_EXPONENT, exponent + 127));
+		while (exponent > MIN_SCALE_EXPONENT && lo + 255.0f * ldexpf(1.0f, exponent - 1 - 127) >= hi)
+		{
+			exponent--;
+		}
+		while (exponent < MAX_SCALE_EXPONENT && lo + 255.0f * ldexpf(1.0f, exponent - 127) < hi)
+		{
+			exponent++;
+		}
+		float step = ldexpf(1.0f, exponent - 127);
+		compressed.origin[axis] = lo;
+		header |= (uint32_t)exponent << (axis * 8);
+
+		for (int c = 0; c < childCount; c++)
+		{
+			float min = wideBounds[axis * 8 + c];
+			float max = wideBounds[(axis + 3) * 8 + c];
+			int qMin = std::max(0, std::min(255, (int)floorf((min - lo) / step)));
+			int qMax = std::max(0, std::min(255, (int)ceilf((max - lo) / step)));
+			while (qMin > 0 && lo + (float)qMin * step > min)
+			{
+				qMin--;
+			}
+			while (qMax < 255 && lo + (float)qMax * step < max)
+			{
+				qMax++;
+			}
+			compressed.bounds[axis][c] = (uint8_t)qMin;
+			compressed.bounds[axis + 3][c] = (uint8_t)qMax;
+		}
+	}
+	compressed.header = header;
+
+	for (int c = 0; c < childCount; c++)
+	{
+		if (wideCounts[c] > 0)
+		{
+			compressed.children[c] = 0x80000000u | (uint32_t)(wideCounts[c] - 1) << 23 | (uint32_t)wideChildren[c];
+		}
+		else
+		{
+			compressed.children[c] = (uint32_t)wideChildren[c];
+		}
+	}
+}
+
+// The traversal descends into the nearest interior child and pushes the
+// others, so the stack holds at most all but one interior child of every
+// node on the path from the root
+int CCompressedBvh::ComputeStackSize(int node) const
+{
+	const uint32_t* children = nodes[node].children;
+	int childCount = (int)(nodes[node].header >> 24);
+	int interior = 0;
+	int deepest = 0;
+	for (int c = 0; c < childCount; c++)
+	{
+		if ((children[c] & 0x80000000u) == 0)
+		{
+			interior++;
+			deepest = std::max(deepest, ComputeStackSize((int)children[c]));
+		}
+	}
+	return std::max(0, interior - 1) + deepest;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Bvh.h"
+#include "WideBvh.h"
+
+// Traversal stack of the compressed shader path, WIDE_BVH_STACK_SIZE in
+// raytracingShader.txt
+#define COMPRESSED_BVH_STACK_SIZE 64
+// Leaf children address primIndices with 23 bits
+#define COMPRESSED_BVH_MAX_PRIMITIVES (1 << 23)
+// and store their primitive count minus one in 8
+#define COMPRESSED_BVH_MAX_LEAF_SIZE 256
+
+// 96 bytes, the std430 layout of 'struct wideNode' in raytracingShader.txt when
+// COMPRESSED_WIDE_NODES is defined. Eight child boxes in the space of three
+// binary nodes: child c spans origin + q * 2^exponent per axis, with q read
+// from byte c of row minX, minY, minZ, maxX, maxY, maxZ.
+struct CompressedBvhNode
+{
+	float origin[3];
+	// Biased exponent of the x, y and z scale in the low three bytes, the
+	// number of children in the high one
+	uint32_t header;
+	uint8_t bounds[6][8];
+	// Interior children: index of the node. Leaf children: bit 31 set, the
+	// primitive count minus one in bits 23-30, the first primIndices entry below.
+	uint32_t children[8];
+};
+
+// 8 wide BVH packed for the GPU, collapsed from a binary CBvh. Larger binary
+// leaves are split by the collapse, see WIDE_BVH_MAX_LEAF_SIZE. Scales are
+// powers of two so q * scale is exact and the shader decodes the same boxes
+// whether or not it fuses the multiply and add.
+class CCompressedBvh
+{
+public:
+	// False when the tree needs a deeper stack or more primitives than the
+	// shader supports
+	bool Build(const CBvh& bvh);
+
+	// Deepest the traversal stack gets for this tree
+	int GetStackSize() const { return stackSize; }
+
+	std::vector<CompressedBvhNode> nodes;
+
+private:
+	void Compress(int node);
+	int ComputeStackSize(int node) const;
+
+	// Kept between builds so per frame rebuilds do not allocate
+	CWideBvh wide;
+	int stackSize = 0;
+};
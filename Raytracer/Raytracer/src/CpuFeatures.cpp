@@ -0,0 +1,90 @@
+#include "CpuFeatures.h"
+#include <string.h>
+
+#if defined(RT_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+SimdIsa DetectSimdIsa()
+{
+#if defined(RT_X86) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return SIMD_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1"))
+	{
+		return SIMD_SSE4;
+	}
+	return SIMD_SCALAR;
+#elif defined(RT_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// The OS has to save the wider registers on context switches
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymmState = (xcr0 & 0x6) == 0x6;
+	bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+	bool avx2 = false;
+	bool avx512 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+
+	if (avx512 && zmmState)
+	{
+		return SIMD_AVX512;
+	}
+	if (avx && avx2 && ymmState)
+	{
+		return SIMD_AVX2;
+	}
+	if (sse41)
+	{
+		return SIMD_SSE4;
+	}
+	return SIMD_SCALAR;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+const char* GetSimdIsaName(SimdIsa isa)
+{
+	switch (isa)
+	{
+	case SIMD_SSE4: return "sse4";
+	case SIMD_AVX2: return "avx2";
+	case SIMD_AVX512: return "avx512";
+	default: return "scalar";
+	}
+}
+
+bool ParseSimdIsa(const char* name, SimdIsa& isa)
+{
+	const SimdIsa all[] = { SIMD_SCALAR, SIMD_SSE4, SIMD_AVX2, SIMD_AVX512 };
+	for (int i = 0; i < 4; i++)
+	{
+		if (strcmp(name, GetSimdIsaName(all[i])) == 0)
+		{
+			isa = all[i];
+			return true;
+		}
+	}
+	return false;
+}
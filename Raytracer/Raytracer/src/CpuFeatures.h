@@ -0,0 +1,28 @@
+#pragma once
+
+// Instruction sets the CPU backend has hand written kernels for
+enum SimdIsa
+{
+	SIMD_SCALAR,
+	SIMD_SSE4,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RT_X86 1
+#endif
+
+// Lets a single translation unit hold kernels for several instruction sets.
+// MSVC accepts any intrinsic without this, GCC and Clang need it per function.
+#if defined(RT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RT_TARGET(isa)
+#endif
+
+// Best instruction set supported by both the CPU and the operating system
+SimdIsa DetectSimdIsa();
+const char* GetSimdIsaName(SimdIsa isa);
+// Returns false for names other than scalar, sse4, avx2 and avx512
+bool ParseSimdIsa(const char* name, SimdIsa& isa);
@@ -0,0 +1,1014 @@
+#include "CpuRaytracer.h"
+#include "ParallelBvhBuilder.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+CCpuRaytracer::CCpuRaytracer()
+	: accelerator(ACCELERATOR_BVH), primitiveBounds(CreateEmptyBox()), maxDistance(FLT_MAX), instanceBvh(nullptr),
+	brickMap(nullptr), bvhWidth(2), quantizeWideBvh(false)
+{
+	SetScene(CScene::CreateDefault());
+	SetSimdIsa(SIMD_AVX512);
+}
+
+void CCpuRaytracer::SetScene(const CScene& scene)
+{
+	std::vector<Box> bounds;
+	const std::vector<Box>& primitives = scene.GetPrimitiveBounds(bounds);
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		CGrid sceneGrid;
+		sceneGrid.Build(primitives);
+		SetScene(scene, sceneGrid);
+		return;
+	}
+	CBvh sceneBvh;
+	CParallelBvhBuilder builder(scheduler);
+	builder.Build(primitives, sceneBvh);
+	SetScene(scene, sceneBvh);
+}
+
+void CCpuRaytracer::SetScene(const CScene& scene, const CBvh& sceneBvh)
+{
+	boxes = scene.boxes;
+	vertices = scene.vertices;
+	triangles = scene.triangles;
+	bvh = sceneBvh;
+	accelerator = ACCELERATOR_BVH;
+	grid = CGrid();
+	primitiveBounds = CreateEmptyBox();
+	if (!bvh.nodes.empty())
+	{
+		primitiveBounds.min = bvh.nodes[0].min;
+		primitiveBounds.max = bvh.nodes[0].max;
+	}
+
+	// Spatial splits may list a primitive in several leaves
+	std::vector<Box> bounds;
+	const std::vector<Box>& primitives = scene.GetPrimitiveBounds(bounds);
+	std::vector<Box> leafOrder(bvh.primIndices.size());
+	for (size_t i = 0; i < leafOrder.size(); i++)
+	{
+		leafOrder[i] = primitives[bvh.primIndices[i]];
+	}
+	boxesSoA.Set(leafOrder);
+	slotTriangles.clear();
+	if (!triangles.empty())
+	{
+		slotTriangles.resize(bvh.primIndices.size());
+		for (size_t i = 0; i < slotTriangles.size(); i++)
+		{
+			slotTriangles[i] = std::max(bvh.primIndices[i] - (int)boxes.size(), -1);
+		}
+	}
+	if (bvhWidth > 2)
+	{
+		wideBvh.Build(bvh, bvhWidth, quantizeWideBvh);
+	}
+}
+
+void CCpuRaytracer::SetScene(const CScene& scene, const CGrid& sceneGrid)
+{
+	boxes = scene.boxes;
+	vertices = scene.vertices;
+	triangles = scene.triangles;
+	grid = sceneGrid;
+	accelerator = ACCELERATOR_GRID;
+	bvh = CBvh();
+	primitiveBounds = grid.GetBounds();
+	std::vector<Box> bounds;
+	boxesSoA.Set(scene.GetPrimitiveBounds(bounds));
+	slotTriangles.clear();
+	if (!triangles.empty())
+	{
+		slotTriangles.resize(GetPrimitiveCount());
+		for (int i = 0; i < (int)slotTriangles.size(); i++)
+		{
+			slotTriangles[i] = std::max(i - (int)boxes.size(), -1);
+		}
+	}
+}
+
+void CCpuRaytracer::SetInstances(const CTwoLevelBvh* instances)
+{
+	instanceBvh = instances;
+}
+
+void CCpuRaytracer::SetVoxels(const CBrickMap* voxels)
+{
+	brickMap = voxels;
+}
+
+void CCpuRaytracer::SetBvhWidth(int width, bool quantize)
+{
+	bvhWidth = width > 2 ? (width > 4 ? 8 : 4) : 2;
+	quantizeWideBvh = quantize;
+	if (bvhWidth > 2)
+	{
+		wideBvh.Build(bvh, bvhWidth, quantizeWideBvh);
+	}
+}
+
+void CCpuRaytracer::SetSimdIsa(SimdIsa isa)
+{
+	simdIsa = std::min(isa, DetectSimdIsa());
+	intersectBoxesPacket = GetIntersectBoxesPacket(simdIsa);
+	intersectNodePacket = GetIntersectNodePacket(simdIsa);
+	intersectWideNode = GetIntersectWideNode(simdIsa);
+	decodeWideNode = GetDecodeWideNode(simdIsa);
+}
+
+glm::vec2 CCpuRaytracer::IntersectBox(glm::vec3 origin, glm::vec3 dir, const Box& b)
+{
+	glm::vec3 tMin = (b.min - origin) / dir;
+	glm::vec3 tMax = (b.max - origin) / dir;
+	glm::vec3 t1 = glm::min(tMin, tMax);
+	glm::vec3 t2 = glm::max(tMin, tMax);
+	float tNear = glm::max(glm::max(t1.x, t1.y), t1.z);
+	float tFar = glm::min(glm::min(t2.x, t2.y), t2.z);
+	return glm::vec2(tNear, tFar);
+}
+
+glm::vec2 CCpuRaytracer::IntersectNode(glm::vec3 origin, glm::vec3 dir, const BvhNode& node)
+{
+	Box box = { node.min, node.max };
+	return IntersectBox(origin, dir, box);
+}
+
+bool CCpuRaytracer::IntersectTriangle(glm::vec3 origin, glm::vec3 dir, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2,
+	float& t)
+{
+	// Shear the corners into a space where the ray starts at the origin and
+	// runs along +z. The largest component of dir becomes z, x and y are
+	// swapped for negative ones to keep the winding.
+	glm::vec3 absDir = glm::abs(dir);
+	int kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+	int kx = (kz + 1) % 3;
+	int ky = (kx + 1) % 3;
+	if (dir[kz] < 0.0f)
+	{
+		std::swap(kx, ky);
+	}
+	float sx = dir[kx] / dir[kz];
+	float sy = dir[ky] / dir[kz];
+	float sz = 1.0f / dir[kz];
+	glm::vec3 a = v0 - origin;
+	glm::vec3 b = v1 - origin;
+	glm::vec3 c = v2 - origin;
+	float ax = a[kx] - sx * a[kz];
+	float ay = a[ky] - sy * a[kz];
+	float bx = b[kx] - sx * b[kz];
+	float by = b[ky] - sy * b[kz];
+	float cx = c[kx] - sx * c[kz];
+	float cy = c[ky] - sy * c[kz];
+
+	// Edge functions, an edge shared by two triangles gets the same value
+	// in both up to the sign, so no ray slips through between them. Exact
+	// zeros are decided again in double precision.
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+	if (u == 0.0f || v == 0.0f || w == 0.0f)
+	{
+		u = (float)((double)cx * by - (double)cy * bx);
+		v = (float)((double)ax * cy - (double)ay * cx);
+		w = (float)((double)bx * ay - (double)by * ax);
+	}
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+	{
+		return false;
+	}
+	float det = u + v + w;
+	if (det == 0.0f)
+	{
+		return false;
+	}
+	// Distance along z, scaled by det like u, v and w
+	float scaled = u * (sz * a[kz]) + v * (sz * b[kz]) + w * (sz * c[kz]);
+	t = scaled / det;
+	return true;
+}
+
+bool CCpuRaytracer::IntersectPrimitive(glm::vec3 origin, glm::vec3 dir, int primitive, float smallest,
+	glm::vec2& lambda) const
+{
+	if (primitive < (int)boxes.size())
+	{
+		glm::vec2 boxLambda = IntersectBox(origin, dir, boxes[primitive]);
+		if (boxLambda.x > 0.0f && boxLambda.x < boxLambda.y && boxLambda.x < smallest)
+		{
+			lambda = boxLambda;
+			return true;
+		}
+		return false;
+	}
+	const Triangle& triangle = triangles[primitive - boxes.size()];
+	float t;
+	if (IntersectTriangle(origin, dir, vertices[triangle.v0], vertices[triangle.v1], vertices[triangle.v2], t) &&
+		t > 0.0f && t < smallest)
+	{
+		lambda = glm::vec2(t, t);
+		return true;
+	}
+	return false;
+}
+
+bool CCpuRaytracer::IntersectBoxes(glm::vec3 origin, glm::vec3 dir, HitInfo& info)
+{
+	float smallest = maxDistance;
+	bool found = false;
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		float tFar;
+		int box = IntersectGrid(origin, dir, 1.0f / dir, smallest, tFar);
+		if (box >= 0)
+		{
+			info.lambda = glm::vec2(smallest, tFar);
+			info.bi = box;
+			found = true;
+		}
+		if (instanceBvh != nullptr && IntersectInstances(origin, dir, smallest, info))
+		{
+			found = true;
+		}
+		if (brickMap != nullptr && IntersectVoxels(origin, dir, smallest, info))
+		{
+			found = true;
+		}
+		return found;
+	}
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+	int current = 0;
+	while (!bvh.nodes.empty())
+	{
+		const BvhNode& node = bvh.nodes[current];
+		if (node.IsLeaf())
+		{
+			for (int k = 0; k < node.count; k++)
+			{
+				int i = bvh.primIndices[node.leftOrFirst + k];
+				glm::vec2 lambda;
+				if (IntersectPrimitive(origin, dir, i, smallest, lambda))
+				{
+					info.lambda = lambda;
+					info.bi = i;
+					smallest = lambda.x;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			// Visit the nearer child first and come back for the other one
+			int left = node.leftOrFirst;
+			glm::vec2 leftLambda = IntersectNode(origin, dir, bvh.nodes[left]);
+			glm::vec2 rightLambda = IntersectNode(origin, dir, bvh.nodes[left + 1]);
+			bool hitLeft = leftLambda.x <= leftLambda.y && leftLambda.y > 0.0f && leftLambda.x < smallest;
+			bool hitRight = rightLambda.x <= rightLambda.y && rightLambda.y > 0.0f && rightLambda.x < smallest;
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = leftLambda.x <= rightLambda.x;
+				stack[stackSize++] = leftFirst ? left + 1 : left;
+				current = leftFirst ? left : left + 1;
+				continue;
+			}
+			if (hitLeft || hitRight)
+			{
+				current = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (stackSize == 0)
+		{
+			break;
+		}
+		current = stack[--stackSize];
+	}
+	if (instanceBvh != nullptr && IntersectInstances(origin, dir, smallest, info))
+	{
+		found = true;
+	}
+	if (brickMap != nullptr && IntersectVoxels(origin, dir, smallest, info))
+	{
+		found = true;
+	}
+	return found;
+}
+
+// Same traversal over the top level, each instance leaf moves the ray into
+// object space and traverses its mesh
+bool CCpuRaytracer::IntersectInstances(glm::vec3 origin, glm::vec3 dir, float& smallest, HitInfo& info)
+{
+	const std::vector<BvhNode>& nodes = instanceBvh->GetTopLevelNodes();
+	bool found = false;
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+	int current = 0;
+	while (!nodes.empty())
+	{
+		const BvhNode& node = nodes[current];
+		if (node.IsLeaf())
+		{
+			for (int k = 0; k < node.count; k++)
+			{
+				const BvhInstance& instance = instanceBvh->instances[node.leftOrFirst + k];
+				if (instance.root < 0)
+				{
+					continue;
+				}
+				const Transform3x4& worldToObject = instance.worldToObject;
+				glm::vec2 lambda;
+				if (IntersectMesh(worldToObject.TransformPoint(origin), worldToObject.TransformDirection(dir),
+					instance.root, smallest, lambda))
+				{
+					info.lambda = lambda;
+					info.bi = GetPrimitiveCount() + instance.index;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			int left = node.leftOrFirst;
+			glm::vec2 leftLambda = IntersectNode(origin, dir, nodes[left]);
+			glm::vec2 rightLambda = IntersectNode(origin, dir, nodes[left + 1]);
+			bool hitLeft = leftLambda.x <= leftLambda.y && leftLambda.y > 0.0f && leftLambda.x < smallest;
+			bool hitRight = rightLambda.x <= rightLambda.y && rightLambda.y > 0.0f && rightLambda.x < smallest;
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = leftLambda.x <= rightLambda.x;
+				stack[stackSize++] = leftFirst ? left + 1 : left;
+				current = leftFirst ? left : left + 1;
+				continue;
+			}
+			if (hitLeft || hitRight)
+			{
+				current = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (stackSize == 0)
+		{
+			break;
+		}
+		current = stack[--stackSize];
+	}
+	return found;
+}
+
+// The direction is not normalized, so object space distances are world space ones
+bool CCpuRaytracer::IntersectMesh(glm::vec3 origin, glm::vec3 dir, int root, float& smallest, glm::vec2& lambda)
+{
+	const std::vector<BvhNode>& nodes = instanceBvh->meshNodes;
+	bool found = false;
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+	int current = root;
+	for (;;)
+	{
+		const BvhNode& node = nodes[current];
+		if (node.IsLeaf())
+		{
+			for (int i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+			{
+				glm::vec2 boxLambda = IntersectBox(origin, dir, instanceBvh->meshBoxes[i]);
+				if (boxLambda.x > 0.0f && boxLambda.x < boxLambda.y && boxLambda.x < smallest)
+				{
+					lambda = boxLambda;
+					smallest = boxLambda.x;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			int left = node.leftOrFirst;
+			glm::vec2 leftLambda = IntersectNode(origin, dir, nodes[left]);
+			glm::vec2 rightLambda = IntersectNode(origin, dir, nodes[left + 1]);
+			bool hitLeft = leftLambda.x <= leftLambda.y && leftLambda.y > 0.0f && leftLambda.x < smallest;
+			bool hitRight = rightLambda.x <= rightLambda.y && rightLambda.y > 0.0f && rightLambda.x < smallest;
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = leftLambda.x <= rightLambda.x;
+				stack[stackSize++] = leftFirst ? left + 1 : left;
+				current = leftFirst ? left : left + 1;
+				continue;
+			}
+			if (hitLeft || hitRight)
+			{
+				current = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (stackSize == 0)
+		{
+			break;
+		}
+		current = stack[--stackSize];
+	}
+	return found;
+}
+
+glm::vec4 CCpuRaytracer::Trace(glm::vec3 origin, glm::vec3 dir)
+{
+	HitInfo i;
+	if (IntersectBoxes(origin, dir, i))
+	{
+		glm::vec4 gray = glm::vec4(i.bi / 10.0f + 0.8f);
+		return glm::vec4(gray.x, gray.y, gray.z, 1.0f);
+	}
+	return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// Body of the compute shader main(), one row segment of a tile per packet
+void CCpuRaytracer::RenderTile(const FrustumRays& rays, const Tile& tile, int width, int height, float* rgba)
+{
+	RayPacket packet;
+	PacketHits hits;
+	glm::vec3 dirs[RAY_PACKET_SIZE];
+	int instanceHits[RAY_PACKET_SIZE];
+	int voxelHits[RAY_PACKET_SIZE];
+	int voxelIdBase = GetVoxelIdBase();
+	glm::vec2 size = glm::vec2((float)(width - 1), (float)(height - 1));
+
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		packet.originX[lane] = rays.eye.x;
+		packet.originY[lane] = rays.eye.y;
+		packet.originZ[lane] = rays.eye.z;
+	}
+
+	for (int y = tile.y; y < tile.y + tile.height; y++)
+	{
+		for (int x0 = tile.x; x0 < tile.x + tile.width; x0 += RAY_PACKET_SIZE)
+		{
+			int count = std::min(RAY_PACKET_SIZE, tile.x + tile.width - x0);
+			for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+			{
+				// Spare lanes repeat the last ray of the row segment
+				int x = x0 + std::min(lane, count - 1);
+				glm::vec2 pos = glm::vec2((float)x, (float)y) / size;
+				// GLSL mix(a, b, t) is defined as a * (1 - t) + b * t
+				glm::vec3 left = rays.ray00 * (1.0f - pos.y) + rays.ray01 * pos.y;
+				glm::vec3 right = rays.ray10 * (1.0f - pos.y) + rays.ray11 * pos.y;
+				glm::vec3 dir = left * (1.0f - pos.x) + right * pos.x;
+				dirs[lane] = dir;
+				packet.invDirX[lane] = 1.0f / dir.x;
+				packet.invDirY[lane] = 1.0f / dir.y;
+				packet.invDirZ[lane] = 1.0f / dir.z;
+			}
+
+			if (accelerator == ACCELERATOR_GRID)
+			{
+				TraceGrid(packet, dirs, hits);
+			}
+			else if (bvhWidth > 2)
+			{
+				TraceWide(packet, dirs, hits);
+			}
+			else
+			{
+				TracePacket(packet, dirs, hits);
+			}
+			TraceInstances(packet, dirs, hits, instanceHits);
+			TraceVoxels(packet, dirs, hits, voxelHits);
+
+			float* pixel = rgba + ((size_t)y * width + x0) * 4;
+			for (int lane = 0; lane < count; lane++, pixel += 4)
+			{
+				// Shade with the primitive's index in the scene, like the shader
+				int box = hits.box[lane];
+				if (box >= 0 && accelerator == ACCELERATOR_BVH)
+				{
+					box = bvh.primIndices[box];
+				}
+				float gray = voxelHits[lane] >= 0 ? (voxelIdBase + voxelHits[lane]) / 10.0f + 0.8f :
+					instanceHits[lane] >= 0 ? (GetPrimitiveCount() + instanceHits[lane]) / 10.0f + 0.8f :
+					box >= 0 ? box / 10.0f + 0.8f : 0.0f;
+				pixel[0] = gray;
+				pixel[1] = gray;
+				pixel[2] = gray;
+				pixel[3] = 1.0f;
+			}
+		}
+	}
+}
+
+// Packet version of IntersectBoxes. A node is entered when any lane hits
+// it, children are visited nearest first by their closest lane.
+void CCpuRaytracer::TracePacket(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits)
+{
+	ResetPacketHits(hits, maxDistance);
+	float tNear;
+	if (bvh.nodes.empty() || !intersectNodePacket(packet, bvh.nodes[0], hits, tNear))
+	{
+		return;
+	}
+
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+	int current = 0;
+	for (;;)
+	{
+		const BvhNode& node = bvh.nodes[current];
+		if (node.IsLeaf())
+		{
+			IntersectLeafPacket(packet, dirs, node.leftOrFirst, node.count, hits);
+		}
+		else
+		{
+			int left = node.leftOrFirst;
+			float leftNear, rightNear;
+			bool hitLeft = intersectNodePacket(packet, bvh.nodes[left], hits, leftNear);
+			bool hitRight = intersectNodePacket(packet, bvh.nodes[left + 1], hits, rightNear);
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = leftNear <= rightNear;
+				stack[stackSize++] = leftFirst ? left + 1 : left;
+				current = leftFirst ? left : left + 1;
+				continue;
+			}
+			if (hitLeft || hitRight)
+			{
+				current = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (stackSize == 0)
+		{
+			break;
+		}
+		current = stack[--stackSize];
+	}
+}
+
+// Single ray traversal of the wide BVH. One slab test covers all children
+// of a node, leaf children are tested right away and the interior ones
+// are visited nearest first, the others are pushed with their distance so
+// they can be skipped once a closer hit was found.
+void CCpuRaytracer::TraceWide(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits)
+{
+	ResetPacketHits(hits, maxDistance);
+	if (wideBvh.GetNodeCount() == 0)
+	{
+		return;
+	}
+
+	int width = wideBvh.GetWidth();
+	alignas(32) float decoded[6 * WIDE_BVH_MAX_WIDTH];
+	alignas(32) float childNear[WIDE_BVH_MAX_WIDTH];
+	int stackNodes[BVH_MAX_DEPTH * (WIDE_BVH_MAX_WIDTH - 1)];
+	float stackNear[BVH_MAX_DEPTH * (WIDE_BVH_MAX_WIDTH - 1)];
+
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		WideRay ray;
+		ray.originX = packet.originX[lane];
+		ray.originY = packet.originY[lane];
+		ray.originZ = packet.originZ[lane];
+		ray.invDirX = packet.invDirX[lane];
+		ray.invDirY = packet.invDirY[lane];
+		ray.invDirZ = packet.invDirZ[lane];
+		float closest = hits.tNear[lane];
+
+		int stackSize = 0;
+		int current = 0;
+		for (;;)
+		{
+			const float* bounds = wideBvh.IsQuantized() ? decoded : wideBvh.GetBounds(current);
+			if (wideBvh.IsQuantized())
+			{
+				decodeWideNode(wideBvh.GetFrame(current), wideBvh.GetQuantizedBounds(current), width, decoded);
+			}
+			int mask = intersectWideNode(ray, bounds, width, closest, childNear) &
+				((1 << wideBvh.GetChildCount(current)) - 1);
+			const int* children = wideBvh.GetChildren(current);
+			const uint8_t* counts = wideBvh.GetCounts(current);
+
+			// Interior children sorted by entry distance, nearest first
+			int order[WIDE_BVH_MAX_WIDTH];
+			int orderCount = 0;
+			for (int c = 0; c < width; c++)
+			{
+				if ((mask & (1 << c)) == 0)
+				{
+					continue;
+				}
+				if (counts[c] > 0)
+				{
+					for (int i = children[c]; i < children[c] + counts[c]; i++)
+					{
+						if (!slotTriangles.empty() && slotTriangles[i] >= 0)
+						{
+							glm::vec3 origin(ray.originX, ray.originY, ray.originZ);
+							glm::vec2 lambda;
+							if (IntersectPrimitive(origin, dirs[lane], bvh.primIndices[i], closest, lambda))
+							{
+								closest = lambda.x;
+								hits.tNear[lane] = lambda.x;
+								hits.tFar[lane] = lambda.y;
+								hits.box[lane] = i;
+							}
+							continue;
+						}
+						float t0x = (boxesSoA.minX[i] - ray.originX) * ray.invDirX;
+						float t1x = (boxesSoA.maxX[i] - ray.originX) * ray.invDirX;
+						float t0y = (boxesSoA.minY[i] - ray.originY) * ray.invDirY;
+						float t1y = (boxesSoA.maxY[i] - ray.originY) * ray.invDirY;
+						float t0z = (boxesSoA.minZ[i] - ray.originZ) * ray.invDirZ;
+						float t1z = (boxesSoA.maxZ[i] - ray.originZ) * ray.invDirZ;
+						float tNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::min(t0z, t1z));
+						float tFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::max(t0z, t1z));
+						if (tNear > 0.0f && tNear < tFar && tNear < closest)
+						{
+							closest = tNear;
+							hits.tNear[lane] = tNear;
+							hits.tFar[lane] = tFar;
+							hits.box[lane] = i;
+						}
+					}
+					continue;
+				}
+				int slot = orderCount++;
+				while (slot > 0 && childNear[order[slot - 1]] > childNear[c])
+				{
+					order[slot] = order[slot - 1];
+					slot--;
+				}
+				order[slot] = c;
+			}
+
+			// Children the leaves above already hid are dropped
+			while (orderCount > 0 && childNear[order[orderCount - 1]] >= closest)
+			{
+				orderCount--;
+			}
+			if (orderCount > 0)
+			{
+				for (int k = orderCount - 1; k > 0; k--)
+				{
+					stackNodes[stackSize] = children[order[k]];
+					stackNear[stackSize] = childNear[order[k]];
+					stackSize++;
+				}
+				current = children[order[0]];
+				continue;
+			}
+
+			while (stackSize > 0 && stackNear[stackSize - 1] >= closest)
+			{
+				stackSize--;
+			}
+			if (stackSize == 0)
+			{
+				break;
+			}
+			current = stackNodes[--stackSize];
+		}
+	}
+}
+
+void CCpuRaytracer::TraceGrid(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits)
+{
+	ResetPacketHits(hits, maxDistance);
+	if (grid.IsEmpty())
+	{
+		return;
+	}
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		glm::vec3 origin(packet.originX[lane], packet.originY[lane], packet.originZ[lane]);
+		glm::vec3 invDir(packet.invDirX[lane], packet.invDirY[lane], packet.invDirZ[lane]);
+		float closest = hits.tNear[lane];
+		float tFar;
+		int box = IntersectGrid(origin, dirs[lane], invDir, closest, tFar);
+		if (box >= 0)
+		{
+			hits.tNear[lane] = closest;
+			hits.tFar[lane] = tFar;
+			hits.box[lane] = box;
+		}
+	}
+}
+
+void CCpuRaytracer::IntersectLeafPacket(const RayPacket& packet, const glm::vec3* dirs, int first, int count,
+	PacketHits& hits)
+{
+	if (slotTriangles.empty())
+	{
+		intersectBoxesPacket(packet, boxesSoA, first, count, hits);
+		return;
+	}
+	int end = first + count;
+	for (int i = first; i < end;)
+	{
+		if (slotTriangles[i] >= 0)
+		{
+			IntersectTrianglePacket(packet, dirs, i++, hits);
+			continue;
+		}
+		int run = i;
+		while (run < end && slotTriangles[run] < 0)
+		{
+			run++;
+		}
+		intersectBoxesPacket(packet, boxesSoA, i, run - i, hits);
+		i = run;
+	}
+}
+
+void CCpuRaytracer::IntersectTrianglePacket(const RayPacket& packet, const glm::vec3* dirs, int slot, PacketHits& hits)
+{
+	const Triangle& triangle = triangles[slotTriangles[slot]];
+	glm::vec3 v0 = vertices[triangle.v0];
+	glm::vec3 v1 = vertices[triangle.v1];
+	glm::vec3 v2 = vertices[triangle.v2];
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		glm::vec3 origin(packet.originX[lane], packet.originY[lane], packet.originZ[lane]);
+		float t;
+		if (IntersectTriangle(origin, dirs[lane], v0, v1, v2, t) && t > 0.0f && t < hits.tNear[lane])
+		{
+			hits.tNear[lane] = t;
+			hits.tFar[lane] = t;
+			hits.box[lane] = slot;
+		}
+	}
+}
+
+int CCpuRaytracer::IntersectGrid(glm::vec3 origin, glm::vec3 dir, glm::vec3 invDir, float& closest, float& tFar) const
+{
+	if (grid.IsEmpty())
+	{
+		return -1;
+	}
+	glm::ivec3 resolution = grid.GetResolution();
+	glm::vec3 gridMin = grid.GetOrigin();
+	glm::vec3 cellSize = grid.GetCellSize();
+	glm::vec3 gridMax = gridMin + glm::vec3(resolution) * cellSize;
+
+	// Where the ray enters and leaves the grid
+	glm::vec3 t0 = (gridMin - origin) * invDir;
+	glm::vec3 t1 = (gridMax - origin) * invDir;
+	glm::vec3 tLow = glm::min(t0, t1);
+	glm::vec3 tHigh = glm::max(t0, t1);
+	float tEnter = std::max(std::max(std::max(tLow.x, tLow.y), tLow.z), 0.0f);
+	float tExit = std::min(std::min(tHigh.x, tHigh.y), tHigh.z);
+	if (!(tEnter <= tExit) || tEnter >= closest)
+	{
+		return -1;
+	}
+
+	// Cell at the entry point, then per axis the distance to the next
+	// cell border and between two borders. Axes the ray runs parallel to
+	// never reach a border.
+	glm::vec3 entry = origin + tEnter / invDir;
+	glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((entry - gridMin) / cellSize)), glm::ivec3(0), resolution - 1);
+	glm::ivec3 step;
+	glm::vec3 tNext, tDelta;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		step[axis] = invDir[axis] >= 0.0f ? 1 : -1;
+		if (isinf(invDir[axis]))
+		{
+			tNext[axis] = FLT_MAX;
+			tDelta[axis] = FLT_MAX;
+			continue;
+		}
+		float border = gridMin[axis] + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * cellSize[axis];
+		tNext[axis] = (border - origin[axis]) * invDir[axis];
+		tDelta[axis] = cellSize[axis] * fabsf(invDir[axis]);
+	}
+
+	int hit = -1;
+	for (;;)
+	{
+		int index = (cell.z * resolution.y + cell.y) * resolution.x + cell.x;
+		for (int k = grid.cellStarts[index]; k < grid.cellStarts[index + 1]; k++)
+		{
+			int i = grid.primIndices[k];
+			if (!slotTriangles.empty() && slotTriangles[i] >= 0)
+			{
+				glm::vec2 lambda;
+				if (IntersectPrimitive(origin, dir, i, closest, lambda))
+				{
+					closest = lambda.x;
+					tFar = lambda.y;
+					hit = i;
+				}
+				continue;
+			}
+			float t0x = (boxesSoA.minX[i] - origin.x) * invDir.x;
+			float t1x = (boxesSoA.maxX[i] - origin.x) * invDir.x;
+			float t0y = (boxesSoA.minY[i] - origin.y) * invDir.y;
+			float t1y = (boxesSoA.maxY[i] - origin.y) * invDir.y;
+			float t0z = (boxesSoA.minZ[i] - origin.z) * invDir.z;
+			float t1z = (boxesSoA.maxZ[i] - origin.z) * invDir.z;
+			float tNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::min(t0z, t1z));
+			float tBoxFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::max(t0z, t1z));
+			if (tNear > 0.0f && tNear < tBoxFar && tNear < closest)
+			{
+				closest = tNear;
+				tFar = tBoxFar;
+				hit = i;
+			}
+		}
+
+		// Primitives span cells, so a hit only ends the walk once the cell it is
+		// in has been searched
+		int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+		if (closest <= tNext[axis] || tNext[axis] > tExit)
+		{
+			break;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= resolution[axis])
+		{
+			break;
+		}
+		tNext[axis] += tDelta[axis];
+	}
+	return hit;
+}
+
+// One lane at a time, instance leaves are too few per packet to pay for
+// transforming all lanes
+void CCpuRaytracer::TraceInstances(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits, int* instanceHits)
+{
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		instanceHits[lane] = -1;
+		if (instanceBvh == nullptr || instanceBvh->IsEmpty())
+		{
+			continue;
+		}
+		glm::vec3 origin(packet.originX[lane], packet.originY[lane], packet.originZ[lane]);
+		float smallest = hits.tNear[lane];
+		HitInfo info;
+		if (IntersectInstances(origin, dirs[lane], smallest, info))
+		{
+			hits.tNear[lane] = info.lambda.x;
+			hits.tFar[lane] = info.lambda.y;
+			instanceHits[lane] = info.bi - GetPrimitiveCount();
+		}
+	}
+}
+
+void CCpuRaytracer::TraceVoxels(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits, int* voxelHits)
+{
+	int voxelIdBase = GetVoxelIdBase();
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		voxelHits[lane] = -1;
+		if (brickMap == nullptr || brickMap->IsEmpty())
+		{
+			continue;
+		}
+		glm::vec3 origin(packet.originX[lane], packet.originY[lane], packet.originZ[lane]);
+		float smallest = hits.tNear[lane];
+		HitInfo info;
+		if (IntersectVoxels(origin, dirs[lane], smallest, info))
+		{
+			hits.tNear[lane] = info.lambda.x;
+			hits.tFar[lane] = info.lambda.y;
+			voxelHits[lane] = info.bi - voxelIdBase;
+		}
+	}
+}
+
+int CCpuRaytracer::GetVoxelIdBase() const
+{
+	return GetPrimitiveCount() + (instanceBvh != nullptr ? (int)instanceBvh->instances.size() : 0);
+}
+
+// Walks the coarse cells with a 3D-DDA in voxel units, and the voxels of
+// every brick it passes through with a second one. Voxels do not overlap,
+// so the first one hit is the closest.
+bool CCpuRaytracer::IntersectVoxels(glm::vec3 origin, glm::vec3 dir, float& smallest, HitInfo& info)
+{
+	if (brickMap->IsEmpty())
+	{
+		return false;
+	}
+	float voxelSize = brickMap->GetVoxelSize();
+	glm::ivec3 firstVoxel = brickMap->GetFirstVoxel();
+	glm::ivec3 resolution = brickMap->GetResolution();
+	// The ray in voxel units with coarse cell (0, 0, 0) at the origin.
+	// Distances along it stay the same.
+	glm::vec3 o = (origin - brickMap->GetOrigin()) / voxelSize - glm::vec3(firstVoxel);
+	glm::vec3 d = dir / voxelSize;
+	glm::vec3 invD;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		invD[axis] = d[axis] != 0.0f ? 1.0f / d[axis] : FLT_MAX;
+	}
+
+	Box bounds = { glm::vec3(0.0f), glm::vec3(resolution * BRICK_SIZE) };
+	glm::vec3 t0 = (bounds.min - o) * invD;
+	glm::vec3 t1 = (bounds.max - o) * invD;
+	float tEnter = std::max(std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::min(t0.z, t1.z)), 0.0f);
+	float tExit = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::max(t0.z, t1.z));
+	if (!(tEnter <= tExit) || tEnter >= smallest)
+	{
+		return false;
+	}
+
+	glm::ivec3 step;
+	glm::vec3 tDelta;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		step[axis] = d[axis] >= 0.0f ? 1 : -1;
+		tDelta[axis] = d[axis] != 0.0f ? fabsf(invD[axis]) : FLT_MAX;
+	}
+	glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((o + d * tEnter) / (float)BRICK_SIZE)), glm::ivec3(0), resolution - 1);
+	glm::vec3 tNext;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float border = (float)((cell[axis] + (step[axis] > 0 ? 1 : 0)) * BRICK_SIZE);
+		tNext[axis] = d[axis] != 0.0f ? (border - o[axis]) * invD[axis] : FLT_MAX;
+	}
+
+	float tCell = tEnter;
+	for (;;)
+	{
+		int coarseAxis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+		uint32_t brick = brickMap->brickIndices[(cell.z * resolution.y + cell.y) * resolution.x + cell.x];
+		if (brick != BRICK_EMPTY)
+		{
+			// Same walk over the voxels of the brick, from where the ray entered it
+			const uint32_t* bits = &brickMap->bricks[brick * BRICK_WORDS];
+			glm::ivec3 brickMin = cell * BRICK_SIZE;
+			glm::ivec3 voxel = glm::clamp(glm::ivec3(glm::floor(o + d * tCell)) - brickMin, glm::ivec3(0),
+				glm::ivec3(BRICK_SIZE - 1));
+			glm::vec3 tVoxel;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float border = (float)(brickMin[axis] + voxel[axis] + (step[axis] > 0 ? 1 : 0));
+				tVoxel[axis] = d[axis] != 0.0f ? (border - o[axis]) * invD[axis] : FLT_MAX;
+			}
+			for (;;)
+			{
+				int bit = (voxel.z * BRICK_SIZE + voxel.y) * BRICK_SIZE + voxel.x;
+				if (bits[bit / 32] & (1u << (bit % 32)))
+				{
+					Box box;
+					box.min = brickMap->GetOrigin() + glm::vec3(firstVoxel + brickMin + voxel) * voxelSize;
+					box.max = box.min + glm::vec3(voxelSize);
+					glm::vec2 lambda = IntersectBox(origin, dir, box);
+					if (lambda.x > 0.0f && lambda.x < lambda.y)
+					{
+						if (lambda.x >= smallest)
+						{
+							return false;
+						}
+						smallest = lambda.x;
+						info.lambda = lambda;
+						info.bi = GetVoxelIdBase() + (int)brick * BRICK_SIZE * BRICK_SIZE * BRICK_SIZE + bit;
+						return true;
+					}
+				}
+				int axis = tVoxel.x < tVoxel.y ? (tVoxel.x < tVoxel.z ? 0 : 2) : (tVoxel.y < tVoxel.z ? 1 : 2);
+				voxel[axis] += step[axis];
+				if (voxel[axis] < 0 || voxel[axis] >= BRICK_SIZE)
+				{
+					break;
+				}
+				tVoxel[axis] += tDelta[axis];
+			}
+		}
+
+		// Empty cells are skipped whole
+		if (smallest <= tNext[coarseAxis] || tNext[coarseAxis] > tExit)
+		{
+			break;
+		}
+		tCell = tNext[coarseAxis];
+		cell[coarseAxis] += step[coarseAxis];
+		if (cell[coarseAxis] < 0 || cell[coarseAxis] >= resolution[coarseAxis])
+		{
+			break;
+		}
+		tNext[coarseAxis] += tDelta[coarseAxis] * BRICK_SIZE;
+	}
+	return false;
+}
+
+void CCpuRaytracer::Render(const FrustumRays& rays, int width, int height, float* rgba)
+{
+	Box bounds = primitiveBounds;
+	if (instanceBvh != nullptr)
+	{
+		bounds = UnionBox(bounds, instanceBvh->GetBounds());
+	}
+	if (brickMap != nullptr)
+	{
+		bounds = UnionBox(bounds, brickMap->GetBounds());
+	}
+	maxDistance = GetMaxHitDistance(rays, bounds);
+	scheduler.Run(width, height, [&](const Tile& tile, int)
+	{
+		RenderTile(rays, tile, width, height, rgba);
+	});
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "BrickMap.h"
+#include "Bvh.h"
+#include "Camera.h"
+#include "CpuFeatures.h"
+#include "Grid.h"
+#include "RayPacket.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+#include "TwoLevelBvh.h"
+#include "WideBvh.h"
+
+// Mirrors 'struct hitinfo' in raytracingShader.txt
+struct HitInfo
+{
+	glm::vec2 lambda;
+	int bi;
+};
+
+// C++ port of raytracingShader.txt, renders tiles on all CPU cores into
+// a float RGBA buffer laid out like the RGBA32F frame buffer texture
+class CCpuRaytracer
+{
+public:
+	CCpuRaytracer();
+
+	// Builds a BVH or a grid over the scene's boxes and triangles, see SetAccelerator()
+	void SetScene(const CScene& scene);
+	// Takes a BVH or grid built elsewhere, for scenes rebuilt every frame,
+	// and traces through it from now on
+	void SetScene(const CScene& scene, const CBvh& sceneBvh);
+	void SetScene(const CScene& scene, const CGrid& sceneGrid);
+	const CBvh& GetBvh() { return bvh; }
+	const CGrid& GetGrid() { return grid; }
+	// Structure SetScene(scene) builds, ACCELERATOR_BVH by default
+	void SetAccelerator(SceneAccelerator value) { accelerator = value; }
+	SceneAccelerator GetAccelerator() { return accelerator; }
+	// Instances traced along with the scene's boxes. The structure is read
+	// while rendering and must outlive its use here, nullptr removes it.
+	void SetInstances(const CTwoLevelBvh* instances);
+	// Voxels traced along with the boxes and instances, the same way
+	void SetVoxels(const CBrickMap* voxels);
+	// Threads, tile size and tile order are configured on the scheduler
+	CTileScheduler& GetScheduler() { return scheduler; }
+	// Clamped to what this CPU supports, defaults to the best available
+	void SetSimdIsa(SimdIsa isa);
+	SimdIsa GetSimdIsa() { return simdIsa; }
+	// 2 traces packets through the binary BVH, 4 and 8 trace single rays
+	// through a collapsed wide BVH, optionally with 8 bit child boxes
+	void SetBvhWidth(int width, bool quantize);
+	int GetBvhWidth() { return bvhWidth; }
+	const CWideBvh& GetWideBvh() { return wideBvh; }
+
+	// Equivalent of one glDispatchCompute over a width x height image,
+	// rgba must hold width * height * 4 floats. Bounds the rays by the
+	// scene like the shader, see GetMaxHitDistance().
+	void Render(const FrustumRays& rays, int width, int height, float* rgba);
+
+	// Single ray versions, same traversal as the shader
+	static glm::vec2 IntersectBox(glm::vec3 origin, glm::vec3 dir, const Box& b);
+	static glm::vec2 IntersectNode(glm::vec3 origin, glm::vec3 dir, const BvhNode& node);
+	// Watertight test after Woop et al., "Watertight Ray/Triangle
+	// Intersection". Both sides count, t is the distance along dir.
+	static bool IntersectTriangle(glm::vec3 origin, glm::vec3 dir, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, float& t);
+	// Box or triangle of the scene hit before smallest, numbered like in CScene
+	bool IntersectPrimitive(glm::vec3 origin, glm::vec3 dir, int primitive, float smallest, glm::vec2& lambda) const;
+	bool IntersectBoxes(glm::vec3 origin, glm::vec3 dir, HitInfo& info);
+	// Closest instance hit before smallest. Like in the shader, info.bi
+	// numbers instances after the scene's boxes and triangles.
+	bool IntersectInstances(glm::vec3 origin, glm::vec3 dir, float& smallest, HitInfo& info);
+	// Closest voxel hit before smallest, numbered after the instances as
+	// brick * BRICK_SIZE^3 + voxel bit
+	bool IntersectVoxels(glm::vec3 origin, glm::vec3 dir, float& smallest, HitInfo& info);
+	glm::vec4 Trace(glm::vec3 origin, glm::vec3 dir);
+
+private:
+	void RenderTile(const FrustumRays& rays, const Tile& tile, int width, int height, float* rgba);
+	// Closest hit of every lane, hits.box indexes boxesSoA
+	void TracePacket(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits);
+	// Same result, one lane at a time through wideBvh
+	void TraceWide(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits);
+	// Same result, one lane at a time through the grid
+	void TraceGrid(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits);
+	// Slots first to first + count - 1 of boxesSoA against the packet, runs
+	// of boxes with the packet kernel and triangles one lane at a time
+	void IntersectLeafPacket(const RayPacket& packet, const glm::vec3* dirs, int first, int count, PacketHits& hits);
+	// Triangle in slot of boxesSoA against every lane
+	void IntersectTrianglePacket(const RayPacket& packet, const glm::vec3* dirs, int slot, PacketHits& hits);
+	// 3D-DDA through the grid cells the ray crosses until one ends behind
+	// closest. Returns the nearest primitive in front of closest and moves
+	// closest to it, -1 if there is none.
+	int IntersectGrid(glm::vec3 origin, glm::vec3 dir, glm::vec3 invDir, float& closest, float& tFar) const;
+	// Lanes where an instance is nearer than hits get its index in instanceHits, -1 elsewhere
+	void TraceInstances(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits, int* instanceHits);
+	// Lanes where a voxel is nearer than hits get its number in voxelHits, -1 elsewhere
+	void TraceVoxels(const RayPacket& packet, const glm::vec3* dirs, PacketHits& hits, int* voxelHits);
+	// Box number of the first voxel hit
+	int GetVoxelIdBase() const;
+	int GetPrimitiveCount() const { return (int)(boxes.size() + triangles.size()); }
+	// Object space ray against one mesh of instanceBvh
+	bool IntersectMesh(glm::vec3 origin, glm::vec3 dir, int root, float& smallest, glm::vec2& lambda);
+
+	std::vector<Box> boxes;
+	std::vector<glm::vec3> vertices;
+	std::vector<Triangle> triangles;
+	CBvh bvh;
+	CGrid grid;
+	SceneAccelerator accelerator;
+	// Bounds of the boxes and triangles, and how far along the rays of the
+	// frame being rendered a hit can lie
+	Box primitiveBounds;
+	float maxDistance;
+	// The primitives' bounds in BVH leaf order, so every leaf is a
+	// contiguous range, or in scene order for the grid
+	BoxesSoA boxesSoA;
+	// Triangle in every slot of boxesSoA, -1 for boxes. Empty when the
+	// scene has no triangles and every slot is a box.
+	std::vector<int> slotTriangles;
+	CWideBvh wideBvh;
+	const CTwoLevelBvh* instanceBvh;
+	const CBrickMap* brickMap;
+	int bvhWidth;
+	bool quantizeWideBvh;
+	SimdIsa simdIsa;
+	IntersectBoxesPacketFunc intersectBoxesPacket;
+	IntersectNodePacketFunc intersectNodePacket;
+	IntersectWideNodeFunc intersectWideNode;
+	DecodeWideNodeFunc decodeWideNode;
+	CTileScheduler scheduler;
+};
@@ -0,0 +1,116 @@
+#include "DispatchPlanner.h"
+#include <algorithm>
+
+CDispatchPlanner::CDispatchPlanner()
+{
+	// local_size of raytracingShader.txt, replaced by the queried value
+	SetWorkGroupSize(16, 8);
+}
+
+void CDispatchPlanner::SetWorkGroupSize(int sizeX, int sizeY)
+{
+	groupSizeX = std::max(sizeX, 1);
+	groupSizeY = std::max(sizeY, 1);
+}
+
+void CDispatchPlanner::AddRect(int x, int y, int rectWidth, int rectHeight, std::vector<DispatchCommand>& commands)
+{
+	if (rectWidth <= 0 || rectHeight <= 0)
+	{
+		return;
+	}
+
+	DispatchCommand command;
+	command.offsetX = x;
+	command.offsetY = y;
+	command.endX = x + rectWidth;
+	command.endY = y + rectHeight;
+	command.groupsX = (unsigned int)((rectWidth + groupSizeX - 1) / groupSizeX);
+	command.groupsY = (unsigned int)((rectHeight + groupSizeY - 1) / groupSizeY);
+	commands.push_back(command);
+}
+
+std::vector<DispatchCommand> CDispatchPlanner::PlanImage(int width, int height)
+{
+	std::vector<DispatchCommand> commands;
+	AddRect(0, 0, width, height, commands);
+	return commands;
+}
+
+std::vector<DispatchCommand> CDispatchPlanner::PlanRect(const PixelRect& rect, int width, int height)
+{
+	int x0 = std::max(rect.x, 0);
+	int y0 = std::max(rect.y, 0);
+	int x1 = std::min(rect.x + rect.width, width);
+	int y1 = std::min(rect.y + rect.height, height);
+
+	std::vector<DispatchCommand> commands;
+	AddRect(x0, y0, x1 - x0, y1 - y0, commands);
+	return commands;
+}
+
+std::vector<DispatchCommand> CDispatchPlanner::PlanTiles(const std::vector<int>& tileXY, int width, int height)
+{
+	int tilesX = (width + groupSizeX - 1) / groupSizeX;
+	int tilesY = (height + groupSizeY - 1) / groupSizeY;
+
+	std::vector<bool> dirty((size_t)tilesX * tilesY, false);
+	for (size_t i = 0; i + 1 < tileXY.size(); i += 2)
+	{
+		int tx = tileXY[i];
+		int ty = tileXY[i + 1];
+		if (tx >= 0 && ty >= 0 && tx < tilesX && ty < tilesY)
+		{
+			dirty[(size_t)ty * tilesX + tx] = true;
+		}
+	}
+
+	// Greedy: take the first dirty tile in scanline order, grow it right as
+	// far as tiles are dirty, then down while the whole span stays dirty
+	std::vector<DispatchCommand> commands;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			if (!dirty[(size_t)ty * tilesX + tx])
+			{
+				continue;
+			}
+
+			int spanEnd = tx;
+			while (spanEnd < tilesX && dirty[(size_t)ty * tilesX + spanEnd])
+			{
+				spanEnd++;
+			}
+			int rowEnd = ty + 1;
+			while (rowEnd < tilesY &&
+				std::all_of(dirty.begin() + (size_t)rowEnd * tilesX + tx,
+					dirty.begin() + (size_t)rowEnd * tilesX + spanEnd, [](bool d) { return d; }))
+			{
+				rowEnd++;
+			}
+			for (int y = ty; y < rowEnd; y++)
+			{
+				std::fill(dirty.begin() + (size_t)y * tilesX + tx, dirty.begin() + (size_t)y * tilesX + spanEnd, false);
+			}
+
+			int x0 = tx * groupSizeX;
+			int y0 = ty * groupSizeY;
+			AddRect(x0, y0, std::min(spanEnd * groupSizeX, width) - x0,
+				std::min(rowEnd * groupSizeY, height) - y0, commands);
+		}
+	}
+	return commands;
+}
+
+double CDispatchPlanner::GetLaneOverhead(const std::vector<DispatchCommand>& commands)
+{
+	double launched = 0.0;
+	double covered = 0.0;
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		launched += (double)commands[i].groupsX * groupSizeX * commands[i].groupsY * groupSizeY;
+		covered += (double)(commands[i].endX - commands[i].offsetX) * (commands[i].endY - commands[i].offsetY);
+	}
+	return covered > 0.0 ? launched / covered : 0.0;
+}
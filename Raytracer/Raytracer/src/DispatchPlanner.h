@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+// Pixel rectangle of the frame buffer
+struct PixelRect
+{
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+// One glDispatchCompute. The shader adds offset to gl_GlobalInvocationID
+// and drops invocations at or past end, so partial groups stay in bounds.
+struct DispatchCommand
+{
+	int offsetX;
+	int offsetY;
+	int endX;
+	int endY;
+	unsigned int groupsX;
+	unsigned int groupsY;
+};
+
+// Turns images, sub-rectangles or dirty tile lists into dispatches with
+// ceil-divided group counts, so no resolution is rounded up to a power of two
+class CDispatchPlanner
+{
+public:
+	CDispatchPlanner();
+
+	void SetWorkGroupSize(int sizeX, int sizeY);
+	int GetWorkGroupSizeX() { return groupSizeX; }
+	int GetWorkGroupSizeY() { return groupSizeY; }
+
+	// Whole width x height image in a single dispatch
+	std::vector<DispatchCommand> PlanImage(int width, int height);
+	// Only rect, clipped to the image
+	std::vector<DispatchCommand> PlanRect(const PixelRect& rect, int width, int height);
+	// Dirty tiles given as (tileX, tileY) workgroup sized tiles, adjacent
+	// tiles are merged into rectangles so they share dispatches
+	std::vector<DispatchCommand> PlanTiles(const std::vector<int>& tileXY, int width, int height);
+
+	// Invocations launched per pixel actually covered by commands, 1.0 is no waste
+	double GetLaneOverhead(const std::vector<DispatchCommand>& commands);
+
+private:
+	void AddRect(int x, int y, int rectWidth, int rectHeight, std::vector<DispatchCommand>& commands);
+
+	int groupSizeX;
+	int groupSizeY;
+};
@@ -0,0 +1,53 @@
+#include "DynamicBvh.h"
+#include "Platform.h"
+
+CDynamicBvh::CDynamicBvh(CTileScheduler& scheduler)
+	: scheduler(scheduler), linearBuilder(scheduler), parallelBuilder(scheduler)
+{
+}
+
+void CDynamicBvh::SetUseLinearBuilder(bool value)
+{
+	useLinearBuilder = value;
+}
+
+void CDynamicBvh::SetRebuildThreshold(float ratio)
+{
+	rebuildThreshold = ratio;
+}
+
+void CDynamicBvh::Invalidate()
+{
+	rebuildDue = true;
+}
+
+const DynamicBvhUpdate& CDynamicBvh::Update(const std::vector<Box>& boxes)
+{
+	uint64_t start = GetTimeNanoseconds();
+	lastUpdate = DynamicBvhUpdate();
+	if (rebuildDue || boxes.size() != builtBoxCount)
+	{
+		if (useLinearBuilder)
+		{
+			linearBuilder.Build(boxes, bvh);
+		}
+		else
+		{
+			parallelBuilder.Build(boxes, bvh);
+		}
+		builtBoxCount = boxes.size();
+		builtSahCost = bvh.GetStats().sahCost;
+		rebuildDue = false;
+		rebuildCount++;
+		lastUpdate.rebuilt = true;
+	}
+	else
+	{
+		float sahCost = bvh.Refit(boxes, scheduler);
+		lastUpdate.sahCostRatio = builtSahCost > 0.0f ? sahCost / builtSahCost : 1.0f;
+		// The refit already paid for this frame, rebuild on the next one
+		rebuildDue = lastUpdate.sahCostRatio > rebuildThreshold;
+	}
+	lastUpdate.milliseconds = MillisecondsSince(start);
+	return lastUpdate;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include "Bvh.h"
+#include "LinearBvhBuilder.h"
+#include "ParallelBvhBuilder.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// What the last Update() did to the tree
+struct DynamicBvhUpdate
+{
+	bool rebuilt = false;
+	double milliseconds = 0.0;
+	// SAH cost of the tree now over its cost right after the last rebuild
+	float sahCostRatio = 1.0f;
+};
+
+// BVH over boxes that move every frame but keep their topology. Each
+// update refits the tree in parallel, and once refitting has let its SAH
+// cost grow past the threshold the next update rebuilds it instead.
+class CDynamicBvh
+{
+public:
+	explicit CDynamicBvh(CTileScheduler& scheduler);
+
+	// Rebuilds with the parallel LBVH builder instead of binned SAH
+	void SetUseLinearBuilder(bool value);
+	// SAH cost ratio that schedules a rebuild, defaults to 1.3
+	void SetRebuildThreshold(float ratio);
+	CLinearBvhBuilder& GetLinearBuilder() { return linearBuilder; }
+	// Builds the binned SAH trees on the scheduler's threads
+	CParallelBvhBuilder& GetParallelBuilder() { return parallelBuilder; }
+
+	// Rebuilds on the first call, when the number of boxes changed or a
+	// rebuild is due, refits otherwise
+	const DynamicBvhUpdate& Update(const std::vector<Box>& boxes);
+	// Forces a rebuild on the next Update()
+	void Invalidate();
+
+	const CBvh& GetBvh() const { return bvh; }
+	const DynamicBvhUpdate& GetLastUpdate() const { return lastUpdate; }
+	int GetRebuildCount() const { return rebuildCount; }
+
+private:
+	CTileScheduler& scheduler;
+	CLinearBvhBuilder linearBuilder;
+	CParallelBvhBuilder parallelBuilder;
+	bool useLinearBuilder = false;
+	float rebuildThreshold = 1.3f;
+
+	CBvh bvh;
+	size_t builtBoxCount = 0;
+	float builtSahCost = 0.0f;
+	bool rebuildDue = true;
+	int rebuildCount = 0;
+	DynamicBvhUpdate lastUpdate;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+struct EmbeddedShader
+{
+	const char* name;
+	const char* source;
+};
+
+// Every file in src/shaders, ending with a null entry. The table is
+// generated at build time by cmake/EmbedShaders.cmake.
+extern const EmbeddedShader embeddedShaders[];
@@ -0,0 +1,106 @@
+#include "FrameTimer.h"
+#include "Platform.h"
+#include <algorithm>
+
+// Smallest sample with at least percent of all samples at or below it,
+// ceil(percent / 100 * n) counted from 1
+static double NearestRank(const std::vector<double>& sortedMs, int percent)
+{
+	size_t rank = (sortedMs.size() * percent + 99) / 100;
+	return sortedMs[std::max(rank, (size_t)1) - 1];
+}
+
+FrameTimeStats ComputeFrameTimeStats(std::vector<double> samplesMs)
+{
+	FrameTimeStats stats;
+	if (samplesMs.empty())
+	{
+		return stats;
+	}
+	std::sort(samplesMs.begin(), samplesMs.end());
+	double total = 0.0;
+	for (size_t i = 0; i < samplesMs.size(); i++)
+	{
+		total += samplesMs[i];
+	}
+	stats.samples = (int)samplesMs.size();
+	stats.averageMs = total / samplesMs.size();
+	stats.minMs = samplesMs.front();
+	stats.p50Ms = NearestRank(samplesMs, 50);
+	stats.p95Ms = NearestRank(samplesMs, 95);
+	stats.p99Ms = NearestRank(samplesMs, 99);
+	stats.maxMs = samplesMs.back();
+	return stats;
+}
+
+CFrameTimer::CFrameTimer(int windowSize)
+	: windowSize(std::max(windowSize, 1)), nextSample(0), frameCount(0), frameOpen(false), frameStart(0),
+	frameInterval(0), nextDeadline(0), deltaSeconds(0.0)
+{
+}
+
+void CFrameTimer::SetTargetFrameRate(double framesPerSecond)
+{
+	frameInterval = framesPerSecond > 0.0 ? (uint64_t)(1e9 / framesPerSecond) : 0;
+	nextDeadline = 0;
+}
+
+void CFrameTimer::BeginFrame()
+{
+	if (frameInterval != 0 && frameCount > 0)
+	{
+		// Deadlines advance by whole intervals so timing errors do not add
+		// up, but a frame that ran long starts a new schedule instead of
+		// being followed by a burst of catch-up frames
+		nextDeadline += frameInterval;
+		uint64_t now = GetTimeNanoseconds();
+		if (now > nextDeadline + frameInterval)
+		{
+			nextDeadline = now;
+		}
+		SleepUntil(nextDeadline);
+	}
+
+	uint64_t now = GetTimeNanoseconds();
+	if (frameCount == 0)
+	{
+		nextDeadline = now;
+	}
+	else if (frameOpen)
+	{
+		double milliseconds = NanosecondsToMilliseconds(now - frameStart);
+		deltaSeconds = milliseconds * 1e-3;
+		AddSample(milliseconds);
+	}
+	frameStart = now;
+	frameOpen = true;
+	frameCount++;
+}
+
+void CFrameTimer::EndFrame()
+{
+	if (!frameOpen)
+	{
+		return;
+	}
+	AddSample(NanosecondsToMilliseconds(GetTimeNanoseconds() - frameStart));
+	frameOpen = false;
+}
+
+void CFrameTimer::AddSample(double milliseconds)
+{
+	if (samples.size() < (size_t)windowSize)
+	{
+		samples.push_back(milliseconds);
+	}
+	else
+	{
+		samples[nextSample] = milliseconds;
+	}
+	nextSample = (nextSample + 1) % windowSize;
+}
+
+FrameTimeStats CFrameTimer::GetStats()
+{
+	return ComputeFrameTimeStats(samples);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct FrameTimeStats
+{
+	int samples = 0;
+	double averageMs = 0.0;
+	double minMs = 0.0;
+	double p50Ms = 0.0;
+	double p95Ms = 0.0;
+	double p99Ms = 0.0;
+	double maxMs = 0.0;
+};
+
+// Average, extremes and nearest rank percentiles of the samples
+FrameTimeStats ComputeFrameTimeStats(std::vector<double> samplesMs);
+
+// Measures the time from one frame to the next on the monotonic clock and
+// optionally paces frames to a fixed rate
+class CFrameTimer
+{
+public:
+	// Statistics cover the last windowSize frames
+	CFrameTimer(int windowSize = 240);
+
+	// Frames per second to pace to, 0 runs as fast as possible
+	void SetTargetFrameRate(double framesPerSecond);
+	// Call at the start of every frame. With a target rate this sleeps
+	// until the frame is due, then records the time since the previous one.
+	void BeginFrame();
+	// Records the time since BeginFrame() for the frame that ran last, the
+	// next BeginFrame() starts a new interval without recording one
+	void EndFrame();
+
+	// Time between the last two frame starts
+	double GetDeltaSeconds() { return deltaSeconds; }
+	long long GetFrameCount() { return frameCount; }
+	FrameTimeStats GetStats();
+
+private:
+	void AddSample(double milliseconds);
+
+	int windowSize;
+	std::vector<double> samples;
+	size_t nextSample;
+	long long frameCount;
+	// BeginFrame() started an interval that is not recorded yet
+	bool frameOpen;
+	uint64_t frameStart;
+	uint64_t frameInterval;
+	uint64_t nextDeadline;
+	double deltaSeconds;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+// Every OpenGL include goes through this header. Builds without GLEW
+// (RT_NO_GLEW, set by CMake when GLEW is not installed) call the core
+// entry points that libGL/libOpenGL export directly, which Mesa and the
+// proprietary Linux drivers all do for OpenGL 4.3.
+#ifdef RT_NO_GLEW
+#define GL_GLEXT_PROTOTYPES 1
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glu.h>
+#else
+#include <GL/glew.h>
+#endif
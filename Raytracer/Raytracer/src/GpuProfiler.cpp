@@ -0,0 +1,200 @@
+#include "GpuProfiler.h"
+#include "FrameTimer.h"
+#include <algorithm>
+#include <stdio.h>
+
+CGpuProfiler::CGpuProfiler()
+{
+}
+
+CGpuProfiler::~CGpuProfiler()
+{
+	Destroy();
+}
+
+void CGpuProfiler::Init(int frameLatency, int windowSize)
+{
+	Destroy();
+	frames.resize(std::max(frameLatency, 1));
+	this->windowSize = std::max(windowSize, 1);
+	currentFrame = 0;
+	droppedFrames = 0;
+}
+
+void CGpuProfiler::Destroy()
+{
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		if (!frames[i].pool.empty())
+		{
+			glDeleteQueries((GLsizei)frames[i].pool.size(), frames[i].pool.data());
+		}
+	}
+	frames.clear();
+	stageSamples.clear();
+}
+
+int CGpuProfiler::FindStage(const char* name)
+{
+	for (size_t i = 0; i < stageSamples.size(); i++)
+	{
+		if (stageSamples[i].name == name)
+		{
+			return (int)i;
+		}
+	}
+	StageSamples stage;
+	stage.name = name;
+	stageSamples.push_back(stage);
+	return (int)stageSamples.size() - 1;
+}
+
+GLuint CGpuProfiler::NextQuery(FrameQueries& frame, size_t& used)
+{
+	if (used == frame.pool.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.pool.push_back(query);
+	}
+	return frame.pool[used++];
+}
+
+void CGpuProfiler::Collect(FrameQueries& frame, bool wait)
+{
+	if (!frame.pending)
+	{
+		return;
+	}
+	frame.pending = false;
+
+	// Timestamps complete in order, so the last one being ready means all are
+	GLint available = wait ? 1 : 0;
+	if (!wait && !frame.stages.empty())
+	{
+		glGetQueryObjectiv(frame.stages.back().end, GL_QUERY_RESULT_AVAILABLE, &available);
+	}
+	if (!available)
+	{
+		droppedFrames++;
+		return;
+	}
+
+	for (size_t i = 0; i < frame.stages.size(); i++)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.stages[i].begin, GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.stages[i].end, GL_QUERY_RESULT, &end);
+
+		StageSamples& stage = stageSamples[frame.stages[i].stage];
+		double milliseconds = (double)(end - begin) * 1.0e-6;
+		if ((int)stage.samples.size() < windowSize)
+		{
+			stage.samples.push_back(milliseconds);
+		}
+		else
+		{
+			stage.samples[stage.next] = milliseconds;
+		}
+		stage.next = (stage.next + 1) % windowSize;
+		stage.lastMs = milliseconds;
+	}
+}
+
+void CGpuProfiler::BeginFrame()
+{
+	if (frames.empty())
+	{
+		return;
+	}
+	FrameQueries& frame = frames[currentFrame];
+	Collect(frame, false);
+	frame.stages.clear();
+	queriesUsed = 0;
+}
+
+void CGpuProfiler::EndFrame()
+{
+	if (frames.empty())
+	{
+		return;
+	}
+	if (openStage >= 0)
+	{
+		EndStage();
+	}
+	frames[currentFrame].pending = !frames[currentFrame].stages.empty();
+	currentFrame = (currentFrame + 1) % (int)frames.size();
+}
+
+void CGpuProfiler::Flush()
+{
+	// Oldest first so the rolling window stays in frame order
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		Collect(frames[(currentFrame + i) % frames.size()], true);
+	}
+}
+
+void CGpuProfiler::BeginStage(const char* name)
+{
+	if (frames.empty())
+	{
+		return;
+	}
+	if (openStage >= 0)
+	{
+		EndStage();
+	}
+	FrameQueries& frame = frames[currentFrame];
+	StageQuery query;
+	query.stage = FindStage(name);
+	query.begin = NextQuery(frame, queriesUsed);
+	query.end = NextQuery(frame, queriesUsed);
+	glQueryCounter(query.begin, GL_TIMESTAMP);
+	frame.stages.push_back(query);
+	openStage = query.stage;
+}
+
+void CGpuProfiler::EndStage()
+{
+	if (frames.empty() || openStage < 0)
+	{
+		return;
+	}
+	glQueryCounter(frames[currentFrame].stages.back().end, GL_TIMESTAMP);
+	openStage = -1;
+}
+
+std::vector<GpuStageStats> CGpuProfiler::GetStats()
+{
+	std::vector<GpuStageStats> result;
+	for (size_t i = 0; i < stageSamples.size(); i++)
+	{
+		GpuStageStats stats;
+		stats.name = stageSamples[i].name;
+		stats.samples = (int)stageSamples[i].samples.size();
+		stats.lastMs = stageSamples[i].lastMs;
+		FrameTimeStats times = ComputeFrameTimeStats(stageSamples[i].samples);
+		stats.averageMs = times.averageMs;
+		stats.p50Ms = times.p50Ms;
+		stats.p95Ms = times.p95Ms;
+		stats.p99Ms = times.p99Ms;
+		result.push_back(stats);
+	}
+	return result;
+}
+
+std::string CGpuProfiler::GetSummary()
+{
+	std::string summary;
+	std::vector<GpuStageStats> stats = GetStats();
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		char text[128];
+		snprintf(text, sizeof(text), "%s%s %.2f ms (p95 %.2f)", i > 0 ? " | " : "",
+			stats[i].name.c_str(), stats[i].averageMs, stats[i].p95Ms);
+		summary += text;
+	}
+	return summary;
+}
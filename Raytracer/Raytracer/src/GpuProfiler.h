@@ -0,0 +1,82 @@
+#pragma once
+
+#include "GLHeaders.h"
+#include <string>
+#include <vector>
+
+// Rolling statistics of one profiled stage, in milliseconds of GPU time
+struct GpuStageStats
+{
+	std::string name;
+	int samples = 0;
+	double lastMs = 0.0;
+	double averageMs = 0.0;
+	double p50Ms = 0.0;
+	double p95Ms = 0.0;
+	double p99Ms = 0.0;
+};
+
+// Measures GPU time of named stages with GL_TIMESTAMP queries written at
+// the start and end of each stage. Queries of a frame are only read back
+// once the ring has come round to it again, by which point they are
+// normally available, so reading results never stalls the pipeline.
+class CGpuProfiler
+{
+public:
+	CGpuProfiler();
+	~CGpuProfiler();
+
+	// frameLatency frames in flight, statistics over the last windowSize samples
+	void Init(int frameLatency = 4, int windowSize = 240);
+	void Destroy();
+
+	// Collects the results of the frame that last used this slot
+	void BeginFrame();
+	void EndFrame();
+	// Stages must not nest
+	void BeginStage(const char* name);
+	void EndStage();
+	// Waits for every frame still in flight, for reports at shutdown
+	void Flush();
+
+	std::vector<GpuStageStats> GetStats();
+	// Single line of averages, e.g. for the window title
+	std::string GetSummary();
+	// Frames whose results were still pending when their slot came round
+	long long GetDroppedFrames() { return droppedFrames; }
+
+private:
+	struct StageQuery
+	{
+		int stage;
+		GLuint begin;
+		GLuint end;
+	};
+
+	struct FrameQueries
+	{
+		std::vector<GLuint> pool;
+		std::vector<StageQuery> stages;
+		bool pending = false;
+	};
+
+	struct StageSamples
+	{
+		std::string name;
+		std::vector<double> samples;
+		int next = 0;
+		double lastMs = 0.0;
+	};
+
+	int FindStage(const char* name);
+	void Collect(FrameQueries& frame, bool wait);
+	GLuint NextQuery(FrameQueries& frame, size_t& used);
+
+	std::vector<FrameQueries> frames;
+	std::vector<StageSamples> stageSamples;
+	int currentFrame = 0;
+	size_t queriesUsed = 0;
+	int openStage = -1;
+	int windowSize = 240;
+	long long droppedFrames = 0;
+};
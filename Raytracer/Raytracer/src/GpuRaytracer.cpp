@@ -0,0 +1,688 @@
+#include "GpuRaytracer.h"
+#include <algorithm>
+#include <stdio.h>
+
+CGpuRaytracer::CGpuRaytracer()
+	: frameBufferTexuture(0), rayTracingProgram(0), programCache(nullptr), programFeatures(0), boxBuffer(0), nodeBuffer(0), primIndexBuffer(0),
+	parentBuffer(0), vertexBuffer(0), triangleBuffer(0), boxCount(0), triangleCount(0), nodeBufferBytes(0), nodeFormat(GPU_NODES_BINARY), stackless(false),
+	accelerator(ACCELERATOR_BVH), gridOrigin(0.0f), gridCellSize(1.0f), gridResolution(0),
+	primitiveBounds(CreateEmptyBox()), instanceBounds(CreateEmptyBox()), voxelBounds(CreateEmptyBox()),
+	instanceBuffer(0), instanceNodeBuffer(0), meshNodeBuffer(0), meshBoxBuffer(0),
+	instanceCount(0), instanceIdBase(0), voxelBuffer(0), voxelOrigin(0.0f), voxelSize(1.0f),
+	voxelFirst(0), voxelResolution(0), width(0), height(0),
+	eyeUniform(-1), ray00Uniform(-1), ray10Uniform(-1), ray01Uniform(-1), ray11Uniform(-1), maxDistanceUniform(-1),
+	regionOffsetUniform(-1), regionEndUniform(-1), boxCountUniform(-1), instanceCountUniform(-1), instanceIdBaseUniform(-1),
+	gridOriginUniform(-1), gridCellSizeUniform(-1), gridResolutionUniform(-1),
+	voxelOriginUniform(-1), voxelSizeUniform(-1), voxelFirstUniform(-1), voxelResolutionUniform(-1),
+	voxelIdBaseUniform(-1)
+{
+}
+
+// Create texture that is the frame buffer
+void CGpuRaytracer::CreateFrameBuffer(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	if (frameBufferTexuture == 0)
+	{
+		glGenTextures(1, &frameBufferTexuture);
+	}
+	glBindTexture(GL_TEXTURE_2D, frameBufferTexuture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	GLvoid* black = NULL;
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
+		GL_FLOAT, black);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Creating the shader program that actually does the ray tracing
+void CGpuRaytracer::CreateProgram(CProgramCache& programCache)
+{
+	this->programCache = &programCache;
+	BuildProgram();
+}
+
+int CGpuRaytracer::GetSceneFeatures()
+{
+	int features = 0;
+	if (triangleCount > 0)
+	{
+		features |= GPU_SCENE_TRIANGLES;
+	}
+	if (instanceCount > 0)
+	{
+		features |= GPU_SCENE_INSTANCES;
+	}
+	if (voxelResolution.x > 0)
+	{
+		features |= GPU_SCENE_VOXELS;
+	}
+	return features;
+}
+
+void CGpuRaytracer::BuildProgram()
+{
+	if (rayTracingProgram != 0)
+	{
+		glDeleteProgram(rayTracingProgram);
+	}
+	programFeatures = GetSceneFeatures();
+	std::vector<ShaderStage> stages;
+	stages.push_back({ GL_COMPUTE_SHADER, "raytracingShader.txt" });
+	std::string defines;
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		defines += "#define GRID_TRAVERSAL\n";
+	}
+	else if (nodeFormat == GPU_NODES_WIDE8)
+	{
+		defines += "#define COMPRESSED_WIDE_NODES\n";
+	}
+	if (IsStackless())
+	{
+		defines += "#define STACKLESS_TRAVERSAL\n";
+	}
+	if (programFeatures & GPU_SCENE_TRIANGLES)
+	{
+		defines += "#define SCENE_TRIANGLES\n";
+	}
+	if (programFeatures & GPU_SCENE_INSTANCES)
+	{
+		defines += "#define SCENE_INSTANCES\n";
+	}
+	if (programFeatures & GPU_SCENE_VOXELS)
+	{
+		defines += "#define SCENE_VOXELS\n";
+	}
+	rayTracingProgram = programCache->CreateProgram(stages, defines);
+	ValidateProgram(rayTracingProgram);
+
+	GLint params[3];
+	glGetProgramiv(rayTracingProgram, GL_COMPUTE_WORK_GROUP_SIZE, params);
+	dispatchPlanner.SetWorkGroupSize(params[0], params[1]);
+	eyeUniform = glGetUniformLocation(rayTracingProgram, "eye");
+	ray00Uniform = glGetUniformLocation(rayTracingProgram, "ray00");
+	ray10Uniform = glGetUniformLocation(rayTracingProgram, "ray10");
+	ray01Uniform = glGetUniformLocation(rayTracingProgram, "ray01");
+	ray11Uniform = glGetUniformLocation(rayTracingProgram, "ray11");
+	maxDistanceUniform = glGetUniformLocation(rayTracingProgram, "maxDistance");
+	regionOffsetUniform = glGetUniformLocation(rayTracingProgram, "regionOffset");
+	regionEndUniform = glGetUniformLocation(rayTracingProgram, "regionEnd");
+	boxCountUniform = glGetUniformLocation(rayTracingProgram, "boxCount");
+	instanceCountUniform = glGetUniformLocation(rayTracingProgram, "instanceCount");
+	instanceIdBaseUniform = glGetUniformLocation(rayTracingProgram, "instanceIdBase");
+	gridOriginUniform = glGetUniformLocation(rayTracingProgram, "gridOrigin");
+	gridCellSizeUniform = glGetUniformLocation(rayTracingProgram, "gridCellSize");
+	gridResolutionUniform = glGetUniformLocation(rayTracingProgram, "gridResolution");
+	voxelOriginUniform = glGetUniformLocation(rayTracingProgram, "voxelOrigin");
+	voxelSizeUniform = glGetUniformLocation(rayTracingProgram, "voxelSize");
+	voxelFirstUniform = glGetUniformLocation(rayTracingProgram, "voxelFirst");
+	voxelResolutionUniform = glGetUniformLocation(rayTracingProgram, "voxelResolution");
+	voxelIdBaseUniform = glGetUniformLocation(rayTracingProgram, "voxelIdBase");
+}
+
+void CGpuRaytracer::Destroy()
+{
+	if (rayTracingProgram != 0)
+	{
+		glDeleteProgram(rayTracingProgram);
+		rayTracingProgram = 0;
+	}
+	if (frameBufferTexuture != 0)
+	{
+		glDeleteTextures(1, &frameBufferTexuture);
+		frameBufferTexuture = 0;
+	}
+	if (boxBuffer != 0)
+	{
+		GLuint buffers[3] = { boxBuffer, nodeBuffer, primIndexBuffer };
+		glDeleteBuffers(3, buffers);
+		boxBuffer = nodeBuffer = primIndexBuffer = 0;
+	}
+	if (parentBuffer != 0)
+	{
+		glDeleteBuffers(1, &parentBuffer);
+		parentBuffer = 0;
+	}
+	if (vertexBuffer != 0)
+	{
+		GLuint buffers[2] = { vertexBuffer, triangleBuffer };
+		glDeleteBuffers(2, buffers);
+		vertexBuffer = triangleBuffer = 0;
+	}
+	triangleCount = 0;
+	if (instanceBuffer != 0)
+	{
+		GLuint buffers[4] = { instanceBuffer, instanceNodeBuffer, meshNodeBuffer, meshBoxBuffer };
+		glDeleteBuffers(4, buffers);
+		instanceBuffer = instanceNodeBuffer = meshNodeBuffer = meshBoxBuffer = 0;
+	}
+	instanceCount = 0;
+	if (voxelBuffer != 0)
+	{
+		glDeleteBuffers(1, &voxelBuffer);
+		voxelBuffer = 0;
+	}
+	voxelResolution = glm::ivec3(0);
+	primitiveBounds = instanceBounds = voxelBounds = CreateEmptyBox();
+}
+
+static void UploadBuffer(GLuint buffer, GLsizeiptr size, const void* data)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+static std::vector<GpuBox> ToGpuBoxes(const std::vector<Box>& boxes)
+{
+	std::vector<GpuBox> gpuBoxes(boxes.size());
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		gpuBoxes[i].min = boxes[i].min;
+		gpuBoxes[i].max = boxes[i].max;
+	}
+	return gpuBoxes;
+}
+
+static bool FitsStorageBlock(size_t bytes)
+{
+	GLint64 maxBlockSize = 0;
+	glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+	if ((GLint64)bytes > maxBlockSize)
+	{
+		fprintf(stderr, "Scene needs a %lld byte storage buffer, the driver allows %lld\n",
+			(long long)bytes, (long long)maxBlockSize);
+		return false;
+	}
+	return true;
+}
+
+bool CGpuRaytracer::FitsStorageBlocks(int features)
+{
+	// Boxes, nodes or cell starts and primitive indices are always declared
+	int blocks = IsStackless() ? 4 : 3;
+	GLuint lastBinding = 3;
+	if (features & GPU_SCENE_INSTANCES)
+	{
+		blocks += 4;
+		lastBinding = 7;
+	}
+	if (features & GPU_SCENE_VOXELS)
+	{
+		blocks += 1;
+		lastBinding = 8;
+	}
+	if (features & GPU_SCENE_TRIANGLES)
+	{
+		blocks += 2;
+		lastBinding = 10;
+	}
+	GLint maxBlocks = 0;
+	glGetIntegerv(GL_MAX_COMPUTE_SHADER_STORAGE_BLOCKS, &maxBlocks);
+	if (blocks > maxBlocks)
+	{
+		fprintf(stderr, "Scene needs %d storage blocks in the compute shader, the driver allows %d\n",
+			blocks, maxBlocks);
+		return false;
+	}
+	GLint maxBindings = 0;
+	glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &maxBindings);
+	if ((GLint)lastBinding >= maxBindings)
+	{
+		fprintf(stderr, "Scene needs storage buffer binding %u, the driver has %d bindings\n",
+			lastBinding, maxBindings);
+		return false;
+	}
+	return true;
+}
+
+bool CGpuRaytracer::UploadTriangles(const CScene& scene)
+{
+	boxCount = (int)scene.boxes.size();
+	std::vector<GpuVertex> vertices(scene.triangles.empty() ? 0 : scene.vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		vertices[i].position = scene.vertices[i];
+	}
+	return UploadTriangles(vertices.data(), vertices.size(), scene.triangles.data(), scene.triangles.size());
+}
+
+bool CGpuRaytracer::UploadTriangles(const GpuVertex* vertices, size_t vertexCount, const Triangle* triangles,
+	size_t count)
+{
+	triangleCount = 0;
+	if (count == 0)
+	{
+		return true;
+	}
+	if (!FitsStorageBlocks(GetSceneFeatures() | GPU_SCENE_TRIANGLES) ||
+		!FitsStorageBlock(std::max(vertexCount * sizeof(GpuVertex), count * sizeof(Triangle))))
+	{
+		return false;
+	}
+
+	if (vertexBuffer == 0)
+	{
+		GLuint buffers[2];
+		glGenBuffers(2, buffers);
+		vertexBuffer = buffers[0];
+		triangleBuffer = buffers[1];
+	}
+	UploadBuffer(vertexBuffer, vertexCount * sizeof(GpuVertex), vertices);
+	UploadBuffer(triangleBuffer, count * sizeof(Triangle), triangles);
+	triangleCount = (int)count;
+	return true;
+}
+
+bool CGpuRaytracer::SetScene(const CScene& scene)
+{
+	std::vector<Box> bounds;
+	const std::vector<Box>& primitives = scene.GetPrimitiveBounds(bounds);
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		CGrid grid;
+		grid.Build(primitives);
+		return SetScene(scene, grid);
+	}
+	CBvh bvh;
+	bvh.Build(primitives);
+	return SetScene(scene, bvh);
+}
+
+bool CGpuRaytracer::SetScene(const CScene& scene, const CBvh& bvh)
+{
+	if (bvh.nodes.empty())
+	{
+		// The shader always starts at a root, give an empty scene one leaf
+		// with a flat box that no ray can hit
+		CScene flatScene;
+		Box flat = { glm::vec3(0.0f), glm::vec3(0.0f) };
+		flatScene.boxes.push_back(flat);
+		CBvh flatBvh;
+		BvhNode leaf = { glm::vec3(0.0f), 0, glm::vec3(0.0f), 1 };
+		flatBvh.nodes.push_back(leaf);
+		flatBvh.primIndices.push_back(0);
+		bool result = SetScene(flatScene, flatBvh);
+		instanceIdBase = 0;
+		primitiveBounds = CreateEmptyBox();
+		return result;
+	}
+
+	std::vector<GpuBox> boxes = ToGpuBoxes(scene.boxes);
+	if (boxes.empty())
+	{
+		// Only triangles, the buffer still needs an entry
+		boxes.push_back(GpuBox());
+	}
+	const std::vector<int>& primIndices = bvh.primIndices;
+	const void* nodes = bvh.nodes.data();
+	size_t nodeBytes = bvh.nodes.size() * sizeof(BvhNode);
+	if (nodeFormat == GPU_NODES_WIDE8)
+	{
+		if (!compressedBvh.Build(bvh))
+		{
+			return false;
+		}
+		nodes = compressedBvh.nodes.data();
+		nodeBytes = compressedBvh.nodes.size() * sizeof(CompressedBvhNode);
+	}
+
+	if (!FitsStorageBlock(std::max(boxes.size() * sizeof(GpuBox), nodeBytes)) || !UploadTriangles(scene))
+	{
+		return false;
+	}
+	if (IsStackless())
+	{
+		bvh.ComputeParents(parents);
+	}
+	UploadBvh(boxes.data(), boxes.size(), nodes, nodeBytes, primIndices.data(), primIndices.size(), parents.data());
+	// Instances are numbered after the boxes and triangles when shading
+	instanceIdBase = scene.GetPrimitiveCount();
+	primitiveBounds.min = bvh.nodes[0].min;
+	primitiveBounds.max = bvh.nodes[0].max;
+	return true;
+}
+
+bool CGpuRaytracer::SetScene(const CSceneCache& cache)
+{
+	if (accelerator == ACCELERATOR_GRID || nodeFormat == GPU_NODES_WIDE8 || cache.GetCount(SCENE_CACHE_NODES) == 0)
+	{
+		// The grid and the compressed nodes are built from the scene and its
+		// BVH on the host, so is the stand-in for an empty scene
+		CScene scene;
+		cache.GetScene(scene);
+		if (accelerator == ACCELERATOR_GRID)
+		{
+			return SetScene(scene);
+		}
+		CBvh bvh;
+		cache.GetBvh(bvh);
+		return SetScene(scene, bvh);
+	}
+
+	// Everything else is uploaded straight from the mapped file
+	static const GpuBox emptyBoxes[1] = {};
+	size_t cachedBoxCount = cache.GetCount(SCENE_CACHE_BOXES);
+	const GpuBox* boxes = cachedBoxCount > 0 ? cache.GetBoxes() : emptyBoxes;
+	size_t boxEntries = std::max(cachedBoxCount, (size_t)1);
+	size_t nodeBytes = cache.GetCount(SCENE_CACHE_NODES) * sizeof(BvhNode);
+	if (!FitsStorageBlock(std::max(boxEntries * sizeof(GpuBox), nodeBytes)) ||
+		!UploadTriangles(cache.GetVertices(), cache.GetCount(SCENE_CACHE_VERTICES), cache.GetTriangles(),
+			cache.GetCount(SCENE_CACHE_TRIANGLES)))
+	{
+		return false;
+	}
+	boxCount = (int)cachedBoxCount;
+	UploadBvh(boxes, boxEntries, cache.GetNodes(), nodeBytes, cache.GetPrimIndices(),
+		cache.GetCount(SCENE_CACHE_PRIM_INDICES), cache.GetParents());
+	instanceIdBase = cache.GetPrimitiveCount();
+	primitiveBounds = cache.GetBounds();
+	return true;
+}
+
+bool CGpuRaytracer::UpdateScene(const CScene& scene, const CBvh& bvh, const std::vector<ElementRange>& primitiveRanges,
+	const std::vector<ElementRange>& nodeRanges)
+{
+	if (accelerator == ACCELERATOR_GRID)
+	{
+		return SetScene(scene);
+	}
+	if (nodeFormat == GPU_NODES_WIDE8 || boxBuffer == 0 || bvh.nodes.empty() ||
+		bvh.nodes.size() * sizeof(BvhNode) != nodeBufferBytes || boxCount != (int)scene.boxes.size() ||
+		triangleCount != (int)scene.triangles.size())
+	{
+		return SetScene(scene, bvh);
+	}
+
+	std::vector<GpuBox> boxes;
+	std::vector<GpuVertex> vertices;
+	for (size_t i = 0; i < primitiveRanges.size(); i++)
+	{
+		const ElementRange& range = primitiveRanges[i];
+		if (range.first < boxCount)
+		{
+			int end = std::min(range.end, boxCount);
+			boxes.resize(end - range.first);
+			for (int box = range.first; box < end; box++)
+			{
+				boxes[box - range.first].min = scene.boxes[box].min;
+				boxes[box - range.first].max = scene.boxes[box].max;
+			}
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, boxBuffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, range.first * sizeof(GpuBox), boxes.size() * sizeof(GpuBox),
+				boxes.data());
+		}
+		if (range.end > boxCount)
+		{
+			// The corners of the changed triangles, and whatever lies between them
+			int firstVertex = (int)scene.vertices.size();
+			int endVertex = 0;
+			for (int triangle = std::max(range.first, boxCount) - boxCount; triangle < range.end - boxCount; triangle++)
+			{
+				const Triangle& corners = scene.triangles[triangle];
+				firstVertex = std::min(firstVertex, std::min(corners.v0, std::min(corners.v1, corners.v2)));
+				endVertex = std::max(endVertex, std::max(corners.v0, std::max(corners.v1, corners.v2)) + 1);
+			}
+			vertices.resize(endVertex - firstVertex);
+			for (int vertex = firstVertex; vertex < endVertex; vertex++)
+			{
+				vertices[vertex - firstVertex].position = scene.vertices[vertex];
+			}
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertexBuffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstVertex * sizeof(GpuVertex),
+				vertices.size() * sizeof(GpuVertex), vertices.data());
+		}
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+	for (size_t i = 0; i < nodeRanges.size(); i++)
+	{
+		const ElementRange& range = nodeRanges[i];
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, range.first * sizeof(BvhNode),
+			(range.end - range.first) * sizeof(BvhNode), &bvh.nodes[range.first]);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	primitiveBounds.min = bvh.nodes[0].min;
+	primitiveBounds.max = bvh.nodes[0].max;
+	return true;
+}
+
+void CGpuRaytracer::UploadBvh(const GpuBox* boxes, size_t count, const void* nodes, size_t nodeBytes,
+	const int* primIndices, size_t primIndexCount, const int* nodeParents)
+{
+	if (boxBuffer == 0)
+	{
+		GLuint buffers[3];
+		glGenBuffers(3, buffers);
+		boxBuffer = buffers[0];
+		nodeBuffer = buffers[1];
+		primIndexBuffer = buffers[2];
+	}
+	UploadBuffer(boxBuffer, count * sizeof(GpuBox), boxes);
+	UploadBuffer(nodeBuffer, nodeBytes, nodes);
+	nodeBufferBytes = nodeBytes;
+	UploadBuffer(primIndexBuffer, primIndexCount * sizeof(int), primIndices);
+	if (IsStackless())
+	{
+		if (parentBuffer == 0)
+		{
+			glGenBuffers(1, &parentBuffer);
+		}
+		UploadBuffer(parentBuffer, nodeBytes / sizeof(BvhNode) * sizeof(int), nodeParents);
+	}
+}
+
+bool CGpuRaytracer::SetScene(const CScene& scene, const CGrid& grid)
+{
+	std::vector<GpuBox> boxes = ToGpuBoxes(scene.boxes);
+	// An empty grid has no cells to walk, but every buffer still needs an entry
+	static const int emptyCells[1] = { 0 };
+	const int* cellStarts = grid.IsEmpty() ? emptyCells : grid.cellStarts.data();
+	size_t cellBytes = grid.IsEmpty() ? sizeof(emptyCells) : grid.cellStarts.size() * sizeof(int);
+	const int* primIndices = grid.primIndices.empty() ? emptyCells : grid.primIndices.data();
+	size_t primIndexBytes = grid.primIndices.empty() ? sizeof(emptyCells) : grid.primIndices.size() * sizeof(int);
+	if (boxes.empty())
+	{
+		boxes.push_back(GpuBox());
+	}
+
+	if (!FitsStorageBlock(std::max(std::max(boxes.size() * sizeof(GpuBox), cellBytes), primIndexBytes)) ||
+		!UploadTriangles(scene))
+	{
+		return false;
+	}
+
+	if (boxBuffer == 0)
+	{
+		GLuint buffers[3];
+		glGenBuffers(3, buffers);
+		boxBuffer = buffers[0];
+		nodeBuffer = buffers[1];
+		primIndexBuffer = buffers[2];
+	}
+	UploadBuffer(boxBuffer, boxes.size() * sizeof(GpuBox), boxes.data());
+	UploadBuffer(nodeBuffer, cellBytes, cellStarts);
+	nodeBufferBytes = cellBytes;
+	UploadBuffer(primIndexBuffer, primIndexBytes, primIndices);
+	gridOrigin = grid.GetOrigin();
+	gridCellSize = grid.GetCellSize();
+	gridResolution = grid.GetResolution();
+	instanceIdBase = scene.GetPrimitiveCount();
+	primitiveBounds = grid.GetBounds();
+	return true;
+}
+
+bool CGpuRaytracer::SetInstances(const CTwoLevelBvh& instances)
+{
+	if (instances.IsEmpty())
+	{
+		instanceCount = 0;
+		instanceBounds = CreateEmptyBox();
+		return true;
+	}
+	std::vector<GpuBox> meshBoxes = ToGpuBoxes(instances.meshBoxes);
+	if (!FitsStorageBlocks(GetSceneFeatures() | GPU_SCENE_INSTANCES) ||
+		!FitsStorageBlock(std::max(meshBoxes.size() * sizeof(GpuBox), instances.meshNodes.size() * sizeof(BvhNode))))
+	{
+		return false;
+	}
+
+	if (instanceBuffer == 0)
+	{
+		GLuint buffers[4];
+		glGenBuffers(4, buffers);
+		instanceBuffer = buffers[0];
+		instanceNodeBuffer = buffers[1];
+		meshNodeBuffer = buffers[2];
+		meshBoxBuffer = buffers[3];
+	}
+	UploadBuffer(meshNodeBuffer, instances.meshNodes.size() * sizeof(BvhNode), instances.meshNodes.data());
+	UploadBuffer(meshBoxBuffer, meshBoxes.size() * sizeof(GpuBox), meshBoxes.data());
+	return UpdateInstances(instances);
+}
+
+bool CGpuRaytracer::UpdateInstances(const CTwoLevelBvh& instances)
+{
+	if (instanceBuffer == 0 || instances.IsEmpty())
+	{
+		return SetInstances(instances);
+	}
+	const std::vector<BvhNode>& nodes = instances.GetTopLevelNodes();
+	if (!FitsStorageBlock(std::max(instances.instances.size() * sizeof(BvhInstance), nodes.size() * sizeof(BvhNode))))
+	{
+		return false;
+	}
+	UploadBuffer(instanceBuffer, instances.instances.size() * sizeof(BvhInstance), instances.instances.data());
+	UploadBuffer(instanceNodeBuffer, nodes.size() * sizeof(BvhNode), nodes.data());
+	instanceCount = (int)instances.instances.size();
+	instanceBounds = instances.GetBounds();
+	return true;
+}
+
+bool CGpuRaytracer::SetVoxels(const CBrickMap& voxels)
+{
+	if (voxels.IsEmpty())
+	{
+		voxelResolution = glm::ivec3(0);
+		voxelBounds = CreateEmptyBox();
+		return true;
+	}
+	if (!FitsStorageBlocks(GetSceneFeatures() | GPU_SCENE_VOXELS))
+	{
+		return false;
+	}
+	size_t bytes = (voxels.brickIndices.size() + voxels.bricks.size()) * sizeof(uint32_t);
+	if (!FitsStorageBlock(bytes))
+	{
+		return false;
+	}
+
+	if (voxelBuffer == 0)
+	{
+		glGenBuffers(1, &voxelBuffer);
+	}
+	// One buffer, the bricks follow the coarse cells
+	size_t indexBytes = voxels.brickIndices.size() * sizeof(uint32_t);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indexBytes, voxels.brickIndices.data());
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, indexBytes, bytes - indexBytes, voxels.bricks.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	voxelOrigin = voxels.GetOrigin();
+	voxelSize = voxels.GetVoxelSize();
+	voxelFirst = voxels.GetFirstVoxel();
+	voxelResolution = voxels.GetResolution();
+	voxelBounds = voxels.GetBounds();
+	return true;
+}
+
+void CGpuRaytracer::Trace(const FrustumRays& rays)
+{
+	Trace(rays, dispatchPlanner.PlanImage(width, height));
+}
+
+// Ray trace the frame into frameBufferTexuture with the compute shader
+void CGpuRaytracer::Trace(const FrustumRays& rays, const std::vector<DispatchCommand>& commands)
+{
+	if (programCache != nullptr && GetSceneFeatures() != programFeatures)
+	{
+		BuildProgram();
+	}
+	glUseProgram(rayTracingProgram);
+
+	// set viewing frustum corner rays in shader
+	glUniform3f(eyeUniform, rays.eye.x, rays.eye.y, rays.eye.z);
+	glUniform3f(ray00Uniform, rays.ray00.x, rays.ray00.y, rays.ray00.z);
+	glUniform3f(ray01Uniform, rays.ray01.x, rays.ray01.y, rays.ray01.z);
+	glUniform3f(ray10Uniform, rays.ray10.x, rays.ray10.y, rays.ray10.z);
+	glUniform3f(ray11Uniform, rays.ray11.x, rays.ray11.y, rays.ray11.z);
+	Box bounds = UnionBox(UnionBox(primitiveBounds, instanceBounds), voxelBounds);
+	glUniform1f(maxDistanceUniform, GetMaxHitDistance(rays, bounds));
+	glUniform1i(boxCountUniform, boxCount);
+	glUniform1i(instanceCountUniform, instanceCount);
+	glUniform1i(instanceIdBaseUniform, instanceIdBase);
+	glUniform3f(gridOriginUniform, gridOrigin.x, gridOrigin.y, gridOrigin.z);
+	glUniform3f(gridCellSizeUniform, gridCellSize.x, gridCellSize.y, gridCellSize.z);
+	glUniform3i(gridResolutionUniform, gridResolution.x, gridResolution.y, gridResolution.z);
+	glUniform3f(voxelOriginUniform, voxelOrigin.x, voxelOrigin.y, voxelOrigin.z);
+	glUniform1f(voxelSizeUniform, voxelSize);
+	glUniform3i(voxelFirstUniform, voxelFirst.x, voxelFirst.y, voxelFirst.z);
+	glUniform3i(voxelResolutionUniform, voxelResolution.x, voxelResolution.y, voxelResolution.z);
+	// Voxels are numbered after the boxes and instances when shading
+	glUniform1i(voxelIdBaseUniform, instanceIdBase + instanceCount);
+
+	// Bind Level 0 of framebuffer texture as writable image in shader
+	glBindImageTexture(0, frameBufferTexuture, 0, false, 0,
+		GL_WRITE_ONLY, GL_RGBA32F);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, boxBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, nodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, primIndexBuffer);
+	if (IsStackless())
+	{
+		// Storage buffer binding 0, the frame buffer is on image unit 0
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, parentBuffer);
+	}
+	if (instanceCount > 0)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, instanceNodeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, meshNodeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, meshBoxBuffer);
+	}
+	if (voxelResolution.x > 0)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, voxelBuffer);
+	}
+	if (triangleCount > 0)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, vertexBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, triangleBuffer);
+	}
+
+	// Invoke Compute dimension, exactly covering the image or the region
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		glUniform2i(regionOffsetUniform, commands[i].offsetX, commands[i].offsetY);
+		glUniform2i(regionEndUniform, commands[i].endX, commands[i].endY);
+		glDispatchCompute(commands[i].groupsX, commands[i].groupsY, 1);
+	}
+
+	// Reset image and buffer bindings
+	glBindImageTexture(0, 0, 0, false, 0, GL_READ_WRITE, GL_RGBA32F);
+	GLuint lastBinding = triangleCount > 0 ? 10 : voxelResolution.x > 0 ? 8 : 7;
+	for (GLuint binding = 0; binding <= lastBinding; binding++)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+	}
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	glUseProgram(0);
+}
+
+void CGpuRaytracer::ReadPixels(float* rgba)
+{
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, frameBufferTexuture);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, rgba);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
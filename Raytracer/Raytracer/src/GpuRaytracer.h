@@ -0,0 +1,173 @@
+#pragma once
+
+#include "GLHeaders.h"
+#include <vector>
+#include "BrickMap.h"
+#include "Bvh.h"
+#include "Camera.h"
+#include "CompressedBvh.h"
+#include "DispatchPlanner.h"
+#include "Grid.h"
+#include "ProgramCache.h"
+#include "Scene.h"
+#include "SceneCache.h"
+#include "SceneFile.h"
+#include "TwoLevelBvh.h"
+
+// Node layout the shader traverses
+enum GpuNodeFormat
+{
+	// 32 byte BvhNode, two children per node
+	GPU_NODES_BINARY,
+	// 96 byte CompressedBvhNode, eight 8 bit quantized children per node
+	GPU_NODES_WIDE8
+};
+
+// Optional storage blocks of the program, compiled in while the scene uses them
+enum GpuSceneFeature
+{
+	GPU_SCENE_TRIANGLES = 1,
+	GPU_SCENE_INSTANCES = 2,
+	GPU_SCENE_VOXELS = 4
+};
+
+// Runs raytracingShader.txt over an RGBA32F frame buffer texture.
+// Every method needs a current OpenGL 4.3 context.
+class CGpuRaytracer
+{
+public:
+	CGpuRaytracer();
+
+	void CreateFrameBuffer(int width, int height);
+	// The node format is compiled into the program, set it first
+	void SetNodeFormat(GpuNodeFormat format) { nodeFormat = format; }
+	GpuNodeFormat GetNodeFormat() { return nodeFormat; }
+	// Walks binary nodes through parent links instead of a per invocation
+	// stack, also compiled into the program. Ignored for GPU_NODES_WIDE8.
+	void SetStacklessTraversal(bool value) { stackless = value; }
+	bool IsStackless() { return stackless && nodeFormat == GPU_NODES_BINARY && accelerator == ACCELERATOR_BVH; }
+	// Traces through a BVH or a grid, compiled into the program as well
+	void SetAccelerator(SceneAccelerator value) { accelerator = value; }
+	SceneAccelerator GetAccelerator() { return accelerator; }
+	// Keeps the cache to switch programs when the scene starts or stops
+	// using triangles, instances or voxels, it has to outlive the raytracer
+	void CreateProgram(CProgramCache& programCache);
+	void Destroy();
+
+	// Builds a BVH or grid over the boxes and triangles and uploads both
+	// into shader storage buffers. False if they exceed what the driver can bind.
+	bool SetScene(const CScene& scene);
+	// Uploads a BVH or grid built elsewhere, for scenes rebuilt every
+	// frame. It has to match the accelerator of the program.
+	bool SetScene(const CScene& scene, const CBvh& bvh);
+	bool SetScene(const CScene& scene, const CGrid& grid);
+	// Uploads the scene and BVH of an open cache from its mapping, the
+	// cache can be closed afterwards. A grid or compressed nodes are still
+	// built on the host.
+	bool SetScene(const CSceneCache& cache);
+	// Uploads only what changed since the last SetScene() with glBufferSubData,
+	// for a scene that kept its primitives and their order: the boxes and
+	// triangle corners in primitiveRanges and the nodes in nodeRanges of a
+	// refit BVH, whose leaves and parents stayed the same. The triangles
+	// still have to index the same vertices. Falls back to SetScene() when
+	// the program does not trace binary BVH nodes.
+	bool UpdateScene(const CScene& scene, const CBvh& bvh, const std::vector<ElementRange>& primitiveRanges,
+		const std::vector<ElementRange>& nodeRanges);
+	// Uploads instances and their meshes, traced along with the scene's
+	// boxes. An empty structure removes them, false if they exceed what the
+	// driver can bind.
+	bool SetInstances(const CTwoLevelBvh& instances);
+	// Uploads only the instances and the top level, after
+	// CTwoLevelBvh::UpdateInstances() kept the meshes of SetInstances()
+	bool UpdateInstances(const CTwoLevelBvh& instances);
+	// Uploads voxels traced along with the boxes and instances. An empty
+	// brick map removes them, false if it exceeds what the driver can bind.
+	bool SetVoxels(const CBrickMap& voxels);
+	// Size of the uploaded nodes or grid cells, the bytes a ray fetches grow with it
+	size_t GetNodeBufferBytes() { return nodeBufferBytes; }
+
+	// One dispatch exactly covering the frame buffer
+	void Trace(const FrustumRays& rays);
+	// Dispatches planned by GetDispatchPlanner()
+	void Trace(const FrustumRays& rays, const std::vector<DispatchCommand>& commands);
+
+	// Blocking copy of the frame buffer, rgba must hold width * height * 4 floats
+	void ReadPixels(float* rgba);
+
+	GLuint GetFrameBufferTexture() { return frameBufferTexuture; }
+	CDispatchPlanner& GetDispatchPlanner() { return dispatchPlanner; }
+	int GetWidth() { return width; }
+	int GetHeight() { return height; }
+
+private:
+	// GpuSceneFeature flags of what is uploaded
+	int GetSceneFeatures();
+	// Compiles or fetches the program for the uploaded scene features
+	void BuildProgram();
+	// False if the storage blocks of the program with these features exceed
+	// what a compute shader may declare
+	bool FitsStorageBlocks(int features);
+	// Vertices and triangles of the scene, false if they exceed what the
+	// driver allows
+	bool UploadTriangles(const CScene& scene);
+	bool UploadTriangles(const GpuVertex* vertices, size_t vertexCount, const Triangle* triangles, size_t count);
+	// Boxes, nodes in the format of the program, leaf primitive indices and,
+	// for the stackless traversal, the parent of every binary node
+	void UploadBvh(const GpuBox* boxes, size_t count, const void* nodes, size_t nodeBytes,
+		const int* primIndices, size_t primIndexCount, const int* nodeParents);
+
+	GLuint frameBufferTexuture;
+	GLuint rayTracingProgram;
+	CProgramCache* programCache;
+	int programFeatures;
+	// Shader storage for the boxes, BVH nodes and leaf primitive indices,
+	// or for the boxes, grid cell starts and cell primitive indices
+	GLuint boxBuffer;
+	GLuint nodeBuffer;
+	GLuint primIndexBuffer;
+	// Parent of every node, only for the stackless traversal
+	GLuint parentBuffer;
+	// Triangle corners and the triangles indexing them
+	GLuint vertexBuffer;
+	GLuint triangleBuffer;
+	// Primitives below boxCount are boxes, the others triangles
+	int boxCount;
+	int triangleCount;
+	size_t nodeBufferBytes;
+	GpuNodeFormat nodeFormat;
+	bool stackless;
+	SceneAccelerator accelerator;
+	glm::vec3 gridOrigin;
+	glm::vec3 gridCellSize;
+	glm::ivec3 gridResolution;
+	std::vector<int> parents;
+	// Bounds of the primitives, instances and voxels, rays end where no hit
+	// in them is possible
+	Box primitiveBounds;
+	Box instanceBounds;
+	Box voxelBounds;
+	// Packs the nodes for GPU_NODES_WIDE8
+	CCompressedBvh compressedBvh;
+	// Instances in top level leaf order, the top level nodes, then the nodes
+	// and boxes of every mesh
+	GLuint instanceBuffer;
+	GLuint instanceNodeBuffer;
+	GLuint meshNodeBuffer;
+	GLuint meshBoxBuffer;
+	int instanceCount;
+	int instanceIdBase;
+	// Coarse cells, then bricks
+	GLuint voxelBuffer;
+	glm::vec3 voxelOrigin;
+	float voxelSize;
+	glm::ivec3 voxelFirst;
+	glm::ivec3 voxelResolution;
+	int width;
+	int height;
+	int eyeUniform, ray00Uniform, ray10Uniform, ray01Uniform, ray11Uniform, maxDistanceUniform;
+	int regionOffsetUniform, regionEndUniform;
+	int boxCountUniform, instanceCountUniform, instanceIdBaseUniform;
+	int gridOriginUniform, gridCellSizeUniform, gridResolutionUniform;
+	int voxelOriginUniform, voxelSizeUniform, voxelFirstUniform, voxelResolutionUniform, voxelIdBaseUniform;
+	CDispatchPlanner dispatchPlanner;
+};
@@ -0,0 +1,121 @@
+#include "Grid.h"
+#include "Platform.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+// Cells per box the resolution aims for
+#define GRID_CELLS_PER_BOX 4.0f
+// Boxes are binned into every cell they come this close to, in cells, so a
+// ray that rounds into a neighbouring cell still finds them
+#define GRID_CELL_EPSILON 1e-3f
+
+CGrid::CGrid()
+	: origin(0.0f), cellSize(1.0f), resolution(0)
+{
+}
+
+Box CGrid::GetBounds() const
+{
+	if (IsEmpty())
+	{
+		return CreateEmptyBox();
+	}
+	Box bounds = { origin, origin + glm::vec3(resolution) * cellSize };
+	return bounds;
+}
+
+void CGrid::GetCellRange(const Box& box, glm::ivec3& first, glm::ivec3& last) const
+{
+	glm::vec3 lo = (box.min - origin) / cellSize - GRID_CELL_EPSILON;
+	glm::vec3 hi = (box.max - origin) / cellSize + GRID_CELL_EPSILON;
+	first = glm::clamp(glm::ivec3(glm::floor(lo)), glm::ivec3(0), resolution - 1);
+	last = glm::clamp(glm::ivec3(glm::floor(hi)), glm::ivec3(0), resolution - 1);
+}
+
+void CGrid::Build(const std::vector<Box>& boxes)
+{
+	uint64_t start = GetTimeNanoseconds();
+	stats = GridBuildStats();
+	cellStarts.clear();
+	primIndices.clear();
+	resolution = glm::ivec3(0);
+	if (boxes.empty())
+	{
+		stats.milliseconds = MillisecondsSince(start);
+		return;
+	}
+
+	glm::vec3 min(FLT_MAX);
+	glm::vec3 max(-FLT_MAX);
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		min = glm::min(min, boxes[i].min);
+		max = glm::max(max, boxes[i].max);
+	}
+
+	// Flat axes get one cell of the size the largest axis would have at
+	// full resolution, so the volume below is never 0
+	glm::vec3 extent = max - min;
+	float largest = std::max(std::max(extent.x, extent.y), std::max(extent.z, FLT_MIN));
+	extent = glm::max(extent, glm::vec3(largest / GRID_MAX_RESOLUTION));
+	float cellsPerUnit = cbrtf(GRID_CELLS_PER_BOX * boxes.size() / (extent.x * extent.y * extent.z));
+	glm::vec3 cells = glm::clamp(glm::ceil(extent * cellsPerUnit), glm::vec3(1.0f), glm::vec3((float)GRID_MAX_RESOLUTION));
+	// Scale down evenly when the axes together would hold too many cells
+	float total = cells.x * cells.y * cells.z;
+	if (total > GRID_MAX_CELLS)
+	{
+		cells = glm::max(glm::floor(cells * cbrtf(GRID_MAX_CELLS / total)), glm::vec3(1.0f));
+	}
+	resolution = glm::ivec3(cells);
+	origin = min;
+	cellSize = extent / cells;
+
+	// Count the boxes of every cell, turn the counts into starts, then fill
+	// the cells in box order
+	int cellCount = resolution.x * resolution.y * resolution.z;
+	cellStarts.assign((size_t)cellCount + 1, 0);
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		glm::ivec3 first, last;
+		GetCellRange(boxes[i], first, last);
+		for (int z = first.z; z <= last.z; z++)
+		{
+			for (int y = first.y; y <= last.y; y++)
+			{
+				int row = (z * resolution.y + y) * resolution.x;
+				for (int x = first.x; x <= last.x; x++)
+				{
+					cellStarts[row + x + 1]++;
+				}
+			}
+		}
+	}
+	for (int c = 0; c < cellCount; c++)
+	{
+		cellStarts[c + 1] += cellStarts[c];
+	}
+
+	primIndices.resize(cellStarts[cellCount]);
+	std::vector<int> cursor(cellStarts.begin(), cellStarts.end() - 1);
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		glm::ivec3 first, last;
+		GetCellRange(boxes[i], first, last);
+		for (int z = first.z; z <= last.z; z++)
+		{
+			for (int y = first.y; y <= last.y; y++)
+			{
+				int row = (z * resolution.y + y) * resolution.x;
+				for (int x = first.x; x <= last.x; x++)
+				{
+					primIndices[cursor[row + x]++] = (int)i;
+				}
+			}
+		}
+	}
+
+	stats.cells = cellCount;
+	stats.references = (int)primIndices.size();
+	stats.milliseconds = MillisecondsSince(start);
+}
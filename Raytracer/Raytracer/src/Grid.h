@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "Scene.h"
+
+// Cells per axis the resolution is clamped to
+#define GRID_MAX_RESOLUTION 512
+// Total cells, so cellStarts stays within a shader storage buffer
+#define GRID_MAX_CELLS (1 << 24)
+
+// Structure the backends trace the scene's boxes through
+enum SceneAccelerator
+{
+	ACCELERATOR_BVH,
+	// Uniform grid walked with a 3D-DDA, for dense worlds of similar boxes
+	ACCELERATOR_GRID
+};
+
+struct GridBuildStats
+{
+	double milliseconds = 0.0;
+	int cells = 0;
+	// Entries in CGrid::primIndices, boxes spanning several cells count once per cell
+	int references = 0;
+};
+
+// Uniform grid over boxes. The resolution follows the box density so the
+// grid has about GRID_CELLS_PER_BOX cells per box, with cubic cells where
+// the bounds allow. An empty scene has no cells at all.
+class CGrid
+{
+public:
+	CGrid();
+
+	void Build(const std::vector<Box>& boxes);
+
+	bool IsEmpty() const { return cellStarts.empty(); }
+	// Corner of cell (0, 0, 0), the grid spans resolution * cellSize from it
+	glm::vec3 GetOrigin() const { return origin; }
+	glm::vec3 GetCellSize() const { return cellSize; }
+	glm::ivec3 GetResolution() const { return resolution; }
+	// Space the cells cover, empty without cells
+	Box GetBounds() const;
+	const GridBuildStats& GetStats() const { return stats; }
+
+	// Cell x, y, z is number (z * resolution.y + y) * resolution.x + x. It
+	// lists primIndices[cellStarts[cell]] up to primIndices[cellStarts[cell + 1]].
+	std::vector<int> cellStarts;
+	// Indices of the scene's boxes, ascending within every cell
+	std::vector<int> primIndices;
+
+private:
+	// First and last cell a box overlaps on every axis
+	void GetCellRange(const Box& box, glm::ivec3& first, glm::ivec3& last) const;
+
+	glm::vec3 origin;
+	glm::vec3 cellSize;
+	glm::ivec3 resolution;
+	GridBuildStats stats;
+};
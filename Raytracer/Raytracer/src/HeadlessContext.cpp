@@ -0,0 +1,176 @@
+#include "HeadlessContext.h"
+#include "GLHeaders.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <GLFW/glfw3.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+CHeadlessContext::CHeadlessContext()
+{
+}
+
+CHeadlessContext::~CHeadlessContext()
+{
+	Destroy();
+}
+
+#ifdef _WIN32
+
+bool CHeadlessContext::Create()
+{
+	if (glfwInit() != GL_TRUE)
+	{
+		fprintf(stderr, "Failed to initialise GLFW\n");
+		return false;
+	}
+
+	glfwDefaultWindowHints();
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
+	// The window is never shown, it only owns the context
+	window = glfwCreateWindow(1, 1, "Raytracer Headless", NULL, NULL);
+	if (window == nullptr)
+	{
+		fprintf(stderr, "Failed to create hidden GLFW window\n");
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+
+#ifndef RT_NO_GLEW
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		fprintf(stderr, "Failed to initialize GLEW\n");
+		return false;
+	}
+#endif
+	return true;
+}
+
+void CHeadlessContext::Destroy()
+{
+	if (window != nullptr)
+	{
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		window = nullptr;
+	}
+}
+
+#else
+
+bool CHeadlessContext::Create()
+{
+	// Prefer Mesa's surfaceless platform, it needs neither X nor a GPU
+	EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL)
+	{
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (eglDisplay == EGL_NO_DISPLAY)
+	{
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+	{
+		fprintf(stderr, "Failed to initialise EGL (0x%x)\n", eglGetError());
+		return false;
+	}
+	display = eglDisplay;
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "EGL does not support desktop OpenGL\n");
+		return false;
+	}
+
+	const EGLint configAttributes[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = NULL;
+	EGLint configCount = 0;
+	eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount);
+
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext eglContext = eglCreateContext(eglDisplay, configCount > 0 ? config : NULL,
+		EGL_NO_CONTEXT, contextAttributes);
+	if (eglContext == EGL_NO_CONTEXT)
+	{
+		fprintf(stderr, "Failed to create OpenGL 4.3 context (0x%x)\n", eglGetError());
+		return false;
+	}
+	context = eglContext;
+
+	// Rendering goes to textures, so a surface is only needed by
+	// implementations without EGL_KHR_surfaceless_context
+	EGLSurface eglSurface = EGL_NO_SURFACE;
+	const char* extensions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
+	bool surfaceless = extensions != NULL && strstr(extensions, "EGL_KHR_surfaceless_context") != NULL;
+	if (!surfaceless && configCount > 0)
+	{
+		const EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		eglSurface = eglCreatePbufferSurface(eglDisplay, config, surfaceAttributes);
+		surface = eglSurface;
+	}
+
+	if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+	{
+		fprintf(stderr, "Failed to make EGL context current (0x%x)\n", eglGetError());
+		return false;
+	}
+
+#ifndef RT_NO_GLEW
+	glewExperimental = GL_TRUE;
+	GLenum glewStatus = glewInit();
+	// GLEW also looks for GLX, which a surfaceless context does not have
+	if (glewStatus != GLEW_OK && glGetString(GL_VERSION) == NULL)
+	{
+		fprintf(stderr, "Failed to initialize GLEW\n");
+		return false;
+	}
+#endif
+	return true;
+}
+
+void CHeadlessContext::Destroy()
+{
+	if (display == nullptr)
+	{
+		return;
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (surface != nullptr)
+	{
+		eglDestroySurface(display, surface);
+	}
+	if (context != nullptr)
+	{
+		eglDestroyContext(display, context);
+	}
+	eglTerminate(display);
+	display = nullptr;
+	context = nullptr;
+	surface = nullptr;
+}
+
+#endif
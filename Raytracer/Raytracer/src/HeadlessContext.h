@@ -0,0 +1,24 @@
+#pragma once
+
+// OpenGL 4.3 core context that never shows a window. On Linux this is an
+// EGL context without a surface (Mesa llvmpipe included), elsewhere a
+// hidden GLFW window.
+class CHeadlessContext
+{
+public:
+	CHeadlessContext();
+	~CHeadlessContext();
+
+	// Creates the context and makes it current, returns false on failure
+	bool Create();
+	void Destroy();
+
+private:
+#ifdef _WIN32
+	struct GLFWwindow* window = nullptr;
+#else
+	void* display = nullptr;
+	void* context = nullptr;
+	void* surface = nullptr;
+#endif
+};
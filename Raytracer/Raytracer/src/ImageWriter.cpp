@@ -0,0 +1,87 @@
+#include "ImageWriter.h"
+#include <stdio.h>
+#include <vector>
+
+static bool HasExtension(const std::string& fileName, const char* extension)
+{
+	std::string suffix = extension;
+	return fileName.size() >= suffix.size() &&
+		fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static unsigned char ToByte(float value)
+{
+	if (value <= 0.0f)
+	{
+		return 0;
+	}
+	if (value >= 1.0f)
+	{
+		return 255;
+	}
+	return (unsigned char)(value * 255.0f + 0.5f);
+}
+
+// PFM stores scanlines bottom to top, the same as OpenGL
+static bool WritePFM(FILE* file, const float* rgba, int width, int height)
+{
+	fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+	std::vector<float> row((size_t)width * 3);
+	for (int y = 0; y < height; y++)
+	{
+		const float* source = rgba + (size_t)y * width * 4;
+		for (int x = 0; x < width; x++)
+		{
+			row[x * 3 + 0] = source[x * 4 + 0];
+			row[x * 3 + 1] = source[x * 4 + 1];
+			row[x * 3 + 2] = source[x * 4 + 2];
+		}
+		if (fwrite(row.data(), sizeof(float), row.size(), file) != row.size())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool WritePPM(FILE* file, const float* rgba, int width, int height)
+{
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	std::vector<unsigned char> row((size_t)width * 3);
+	for (int y = height - 1; y >= 0; y--)
+	{
+		const float* source = rgba + (size_t)y * width * 4;
+		for (int x = 0; x < width; x++)
+		{
+			row[x * 3 + 0] = ToByte(source[x * 4 + 0]);
+			row[x * 3 + 1] = ToByte(source[x * 4 + 1]);
+			row[x * 3 + 2] = ToByte(source[x * 4 + 2]);
+		}
+		if (fwrite(row.data(), 1, row.size(), file) != row.size())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool WriteImage(const std::string& fileName, const float* rgba, int width, int height)
+{
+	FILE* file = fopen(fileName.c_str(), "wb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not open '%s' for writing\n", fileName.c_str());
+		return false;
+	}
+
+	bool written = HasExtension(fileName, ".pfm") ?
+		WritePFM(file, rgba, width, height) :
+		WritePPM(file, rgba, width, height);
+	fclose(file);
+
+	if (!written)
+	{
+		fprintf(stderr, "Failed writing '%s'\n", fileName.c_str());
+	}
+	return written;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+// Writes an RGBA float image laid out like the frame buffer texture (first
+// row at the bottom). The format follows the extension: .pfm keeps the
+// float values, anything else is written as an 8-bit binary .ppm.
+bool WriteImage(const std::string& fileName, const float* rgba, int width, int height);
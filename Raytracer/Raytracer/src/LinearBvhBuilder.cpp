@@ -0,0 +1,359 @@
+#include "LinearBvhBuilder.h"
+#include "Morton.h"
+#include "Platform.h"
+#include <algorithm>
+#include <float.h>
+#include <stdio.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Items per range of the simple per primitive passes
+#define LBVH_GRAIN_SIZE 4096
+// Bits sorted per radix pass
+#define LBVH_RADIX_BITS 8
+#define LBVH_RADIX_SIZE (1 << LBVH_RADIX_BITS)
+
+static int CountLeadingZeros(uint64_t value)
+{
+	if (value == 0)
+	{
+		return 64;
+	}
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return 63 - (int)index;
+#else
+	return __builtin_clzll(value);
+#endif
+}
+
+// Length of the common prefix of the sorted codes i and j, -1 outside the
+// array. Equal codes are told apart by their positions.
+static int CommonPrefix(const uint64_t* codes, int count, int i, int j)
+{
+	if (j < 0 || j >= count)
+	{
+		return -1;
+	}
+	if (codes[i] == codes[j])
+	{
+		return 64 + CountLeadingZeros((uint64_t)(uint32_t)(i ^ j)) - 32;
+	}
+	return CountLeadingZeros(codes[i] ^ codes[j]);
+}
+
+CLinearBvhBuilder::CLinearBvhBuilder(CTileScheduler& scheduler)
+	: scheduler(scheduler)
+{
+}
+
+void CLinearBvhBuilder::SetMortonBits(int bits)
+{
+	mortonBits = bits;
+}
+
+int CLinearBvhBuilder::GetMortonBits(size_t boxCount) const
+{
+	if (mortonBits == 30 || mortonBits == 63)
+	{
+		return mortonBits;
+	}
+	return boxCount > (1 << 20) ? 63 : 30;
+}
+
+void CLinearBvhBuilder::Build(const std::vector<Box>& boxes, CBvh& bvh)
+{
+	uint64_t start = GetTimeNanoseconds();
+	int count = (int)boxes.size();
+	bvh.stats = BvhBuildStats();
+	bvh.nodes.clear();
+	bvh.primIndices.clear();
+	bvh.levelNodes.clear();
+	bvh.levelStarts.clear();
+	if (count == 0)
+	{
+		bvh.stats.milliseconds = MillisecondsSince(start);
+		return;
+	}
+
+	int bits = GetMortonBits(boxes.size());
+	ComputeMortonCodes(boxes, bits);
+	SortMortonCodes(bits);
+	EmitHierarchy(boxes, bvh);
+	ComputeBounds(bvh);
+
+	bvh.stats.nodes = (int)bvh.nodes.size();
+	bvh.stats.leaves = count;
+	bvh.stats.references = count;
+	bvh.stats.depth = count > 1 ? heights[0] : 1;
+	if (bvh.stats.depth > BVH_MAX_DEPTH)
+	{
+		fprintf(stderr, "LBVH is %d levels deep, falling back to the SAH build\n", bvh.stats.depth);
+		bvh.Build(boxes);
+		return;
+	}
+	bvh.stats.milliseconds = MillisecondsSince(start);
+	bvh.stats.sahCost = bvh.ComputeSahCost();
+}
+
+void CLinearBvhBuilder::ComputeMortonCodes(const std::vector<Box>& boxes, int bits)
+{
+	int count = (int)boxes.size();
+	codes.resize(count);
+	indices.resize(count);
+	centroids.resize(count);
+
+	// Centroid bounds, reduced per range
+	int rangeCount = (count + LBVH_GRAIN_SIZE - 1) / LBVH_GRAIN_SIZE;
+	std::vector<glm::vec3> rangeMin(rangeCount), rangeMax(rangeCount);
+	scheduler.ParallelFor(count, LBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+		for (int i = begin; i < end; i++)
+		{
+			centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+			min = glm::min(min, centroids[i]);
+			max = glm::max(max, centroids[i]);
+		}
+		rangeMin[begin / LBVH_GRAIN_SIZE] = min;
+		rangeMax[begin / LBVH_GRAIN_SIZE] = max;
+	});
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+	for (int r = 0; r < rangeCount; r++)
+	{
+		min = glm::min(min, rangeMin[r]);
+		max = glm::max(max, rangeMax[r]);
+	}
+
+	// Flat axes map every centroid to cell 0
+	float cells = bits == 63 ? (float)((1 << 21) - 1) : (float)((1 << 10) - 1);
+	glm::vec3 extent = max - min;
+	glm::vec3 scale;
+	for (int a = 0; a < 3; a++)
+	{
+		scale[a] = extent[a] > 0.0f ? cells / extent[a] : 0.0f;
+	}
+	scheduler.ParallelFor(count, LBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			glm::vec3 cell = glm::clamp((centroids[i] - min) * scale, glm::vec3(0.0f), glm::vec3(cells));
+			uint64_t x = (uint64_t)cell.x;
+			uint64_t y = (uint64_t)cell.y;
+			uint64_t z = (uint64_t)cell.z;
+			codes[i] = bits == 63 ?
+				ExpandBits21(x) << 2 | ExpandBits21(y) << 1 | ExpandBits21(z) :
+				ExpandBits10(x) << 2 | ExpandBits10(y) << 1 | ExpandBits10(z);
+			indices[i] = i;
+		}
+	});
+}
+
+// Least significant digit first radix sort of the codes and their box
+// indices. Every range counts its digits, a prefix sum over all ranges
+// gives each one its output offsets, and the ranges scatter in parallel.
+void CLinearBvhBuilder::SortMortonCodes(int bits)
+{
+	int count = (int)codes.size();
+	codesScratch.resize(count);
+	indicesScratch.resize(count);
+
+	int rangeCount = std::min(4 * scheduler.GetThreadCount(), (count + LBVH_GRAIN_SIZE - 1) / LBVH_GRAIN_SIZE);
+	int rangeSize = (count + rangeCount - 1) / rangeCount;
+	rangeCount = (count + rangeSize - 1) / rangeSize;
+	std::vector<int> offsets((size_t)rangeCount * LBVH_RADIX_SIZE);
+
+	for (int shift = 0; shift < bits; shift += LBVH_RADIX_BITS)
+	{
+		scheduler.ParallelFor(rangeCount, 1, [&](int begin, int end, int)
+		{
+			for (int r = begin; r < end; r++)
+			{
+				int* counts = &offsets[(size_t)r * LBVH_RADIX_SIZE];
+				std::fill(counts, counts + LBVH_RADIX_SIZE, 0);
+				int last = std::min(count, (r + 1) * rangeSize);
+				for (int i = r * rangeSize; i < last; i++)
+				{
+					counts[(codes[i] >> shift) & (LBVH_RADIX_SIZE - 1)]++;
+				}
+			}
+		});
+
+		// Digit major prefix sum, skipping passes where every code has the same digit
+		int offset = 0;
+		bool sorted = false;
+		for (int digit = 0; digit < LBVH_RADIX_SIZE; digit++)
+		{
+			int digitStart = offset;
+			for (int r = 0; r < rangeCount; r++)
+			{
+				int& entry = offsets[(size_t)r * LBVH_RADIX_SIZE + digit];
+				int entryCount = entry;
+				entry = offset;
+				offset += entryCount;
+			}
+			sorted = sorted || offset - digitStart == count;
+		}
+		if (sorted)
+		{
+			continue;
+		}
+
+		scheduler.ParallelFor(rangeCount, 1, [&](int begin, int end, int)
+		{
+			for (int r = begin; r < end; r++)
+			{
+				int* next = &offsets[(size_t)r * LBVH_RADIX_SIZE];
+				int last = std::min(count, (r + 1) * rangeSize);
+				for (int i = r * rangeSize; i < last; i++)
+				{
+					int slot = next[(codes[i] >> shift) & (LBVH_RADIX_SIZE - 1)]++;
+					codesScratch[slot] = codes[i];
+					indicesScratch[slot] = indices[i];
+				}
+			}
+		});
+		codes.swap(codesScratch);
+		indices.swap(indicesScratch);
+	}
+}
+
+// Every internal node finds the range of sorted leaves it covers and where
+// that range splits, independently of all others. The n - 1 internal nodes
+// each own the two node slots after the root at 1 + 2i, which keeps the
+// children of every node next to each other.
+void CLinearBvhBuilder::EmitHierarchy(const std::vector<Box>& boxes, CBvh& bvh)
+{
+	int count = (int)codes.size();
+	bvh.primIndices = indices;
+	bvh.nodes.resize(2 * (size_t)count - 1);
+	leafSlots.resize(count);
+	internalSlots.resize(std::max(count - 1, 1));
+	internalSlots[0] = 0;
+
+	// A single box is a leaf root, the loop below emits nothing
+	BvhNode& root = bvh.nodes[0];
+	root.leftOrFirst = count > 1 ? 1 : 0;
+	root.count = count > 1 ? 0 : 1;
+	root.min = boxes[indices[0]].min;
+	root.max = boxes[indices[0]].max;
+	leafSlots[0] = 0;
+
+	const uint64_t* sortedCodes = codes.data();
+	scheduler.ParallelFor(count - 1, LBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			// Direction of the range from the neighbour sharing the longer prefix
+			int direction = CommonPrefix(sortedCodes, count, i, i + 1) -
+				CommonPrefix(sortedCodes, count, i, i - 1) >= 0 ? 1 : -1;
+			int minPrefix = CommonPrefix(sortedCodes, count, i, i - direction);
+
+			// Exponential then binary search for the other end of the range
+			int maxLength = 2;
+			while (CommonPrefix(sortedCodes, count, i, i + maxLength * direction) > minPrefix)
+			{
+				maxLength *= 2;
+			}
+			int length = 0;
+			for (int step = maxLength / 2; step >= 1; step /= 2)
+			{
+				if (CommonPrefix(sortedCodes, count, i, i + (length + step) * direction) > minPrefix)
+				{
+					length += step;
+				}
+			}
+			int j = i + length * direction;
+
+			// Binary search for the last leaf sharing more than the node's prefix
+			int nodePrefix = CommonPrefix(sortedCodes, count, i, j);
+			int split = 0;
+			int step = length;
+			do
+			{
+				step = (step + 1) / 2;
+				if (CommonPrefix(sortedCodes, count, i, i + (split + step) * direction) > nodePrefix)
+				{
+					split += step;
+				}
+			} while (step > 1);
+			int gamma = i + split * direction + std::min(direction, 0);
+
+			int children[2] = { gamma, gamma + 1 };
+			bool leaves[2] = { std::min(i, j) == gamma, std::max(i, j) == gamma + 1 };
+			for (int c = 0; c < 2; c++)
+			{
+				int slot = 1 + 2 * i + c;
+				BvhNode& node = bvh.nodes[slot];
+				if (leaves[c])
+				{
+					const Box& box = boxes[indices[children[c]]];
+					node.min = box.min;
+					node.max = box.max;
+					node.leftOrFirst = children[c];
+					node.count = 1;
+					leafSlots[children[c]] = slot;
+				}
+				else
+				{
+					node.leftOrFirst = 1 + 2 * children[c];
+					node.count = 0;
+					internalSlots[children[c]] = slot;
+				}
+			}
+		}
+	});
+}
+
+// Walks up from every leaf, the second child to reach a node merges both
+// bounds and carries on, the first one stops there
+void CLinearBvhBuilder::ComputeBounds(CBvh& bvh)
+{
+	int count = (int)codes.size();
+	if (count < 2)
+	{
+		return;
+	}
+	int internalCount = count - 1;
+	if (visitsCapacity < (size_t)internalCount)
+	{
+		visits.reset(new std::atomic<int>[internalCount]);
+		visitsCapacity = internalCount;
+	}
+	heights.resize(internalCount);
+	scheduler.ParallelFor(internalCount, LBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			visits[i].store(0, std::memory_order_relaxed);
+		}
+	});
+
+	std::vector<BvhNode>& nodes = bvh.nodes;
+	scheduler.ParallelFor(count, LBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		for (int leaf = begin; leaf < end; leaf++)
+		{
+			int slot = leafSlots[leaf];
+			while (slot != 0)
+			{
+				int parent = (slot - 1) / 2;
+				if (visits[parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+				{
+					break;
+				}
+				const BvhNode& left = nodes[1 + 2 * parent];
+				const BvhNode& right = nodes[2 + 2 * parent];
+				BvhNode& node = nodes[internalSlots[parent]];
+				node.min = glm::min(left.min, right.min);
+				node.max = glm::max(left.max, right.max);
+				int leftHeight = left.IsLeaf() ? 1 : heights[(left.leftOrFirst - 1) / 2];
+				int rightHeight = right.IsLeaf() ? 1 : heights[(right.leftOrFirst - 1) / 2];
+				heights[parent] = 1 + std::max(leftHeight, rightHeight);
+				slot = internalSlots[parent];
+			}
+		}
+	});
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include "Bvh.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// Linear BVH for scenes that are rebuilt every frame. Primitives are sorted
+// along a Morton curve and the hierarchy is emitted in parallel after Karras,
+// "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees".
+// Builds into the same node layout as CBvh::Build, one box per leaf.
+class CLinearBvhBuilder
+{
+public:
+	// All passes run on the scheduler's threads
+	explicit CLinearBvhBuilder(CTileScheduler& scheduler);
+
+	// 30 bit codes (10 per axis), 63 bit codes (21 per axis) or 0 to pick
+	// 63 bits for scenes of more than a million boxes
+	void SetMortonBits(int bits);
+	int GetMortonBits(size_t boxCount) const;
+
+	// Falls back to the SAH build when the tree would be too deep to traverse
+	void Build(const std::vector<Box>& boxes, CBvh& bvh);
+
+private:
+	void ComputeMortonCodes(const std::vector<Box>& boxes, int bits);
+	void SortMortonCodes(int bits);
+	void EmitHierarchy(const std::vector<Box>& boxes, CBvh& bvh);
+	void ComputeBounds(CBvh& bvh);
+
+	CTileScheduler& scheduler;
+	int mortonBits = 0;
+
+	// Kept between builds so per frame rebuilds do not allocate
+	std::vector<uint64_t> codes;
+	std::vector<uint64_t> codesScratch;
+	std::vector<int> indices;
+	std::vector<int> indicesScratch;
+	std::vector<glm::vec3> centroids;
+	// Node slot of every internal node and leaf, in sorted order
+	std::vector<int> internalSlots;
+	std::vector<int> leafSlots;
+	// Height of the subtree below each internal node
+	std::vector<int> heights;
+	std::unique_ptr<std::atomic<int>[]> visits;
+	size_t visitsCapacity = 0;
+};
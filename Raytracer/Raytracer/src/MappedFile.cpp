@@ -0,0 +1,138 @@
+#include "MappedFile.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+CMappedFile::CMappedFile()
+	: data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{
+}
+
+bool CMappedFile::Open(const std::string& path)
+{
+	Close();
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Cannot open %s (error %lu)\n", path.c_str(), GetLastError());
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		fprintf(stderr, "Cannot get the size of %s (error %lu)\n", path.c_str(), GetLastError());
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0)
+	{
+		// Empty files cannot be mapped
+		return true;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data = mapping != nullptr ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (data == nullptr)
+	{
+		fprintf(stderr, "Cannot map %s (error %lu)\n", path.c_str(), GetLastError());
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CMappedFile::Close()
+{
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+		data = nullptr;
+	}
+	if (mapping != nullptr)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
+
+#else
+
+CMappedFile::CMappedFile()
+	: data(nullptr), size(0), file(-1)
+{
+}
+
+bool CMappedFile::Open(const std::string& path)
+{
+	Close();
+	file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	struct stat status;
+	if (fstat(file, &status) != 0)
+	{
+		perror(path.c_str());
+		Close();
+		return false;
+	}
+	size = (size_t)status.st_size;
+	if (size == 0)
+	{
+		// Empty files cannot be mapped
+		return true;
+	}
+	void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (view == MAP_FAILED)
+	{
+		perror(path.c_str());
+		Close();
+		return false;
+	}
+	data = (const char*)view;
+	// Every page is parsed once, front to back within each thread
+	madvise(view, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+void CMappedFile::Close()
+{
+	if (data != nullptr)
+	{
+		munmap((void*)data, size);
+		data = nullptr;
+	}
+	if (file >= 0)
+	{
+		close(file);
+		file = -1;
+	}
+	size = 0;
+}
+
+#endif
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+// Read only view of a whole file mapped into the address space. Pages are
+// read by the OS as they are touched, nothing is copied into a buffer, so
+// threads can parse different parts of a large file at the same time.
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+	CMappedFile(const CMappedFile&) = delete;
+	CMappedFile& operator=(const CMappedFile&) = delete;
+
+	// Closes the previous file. Prints why and returns false on failure.
+	bool Open(const std::string& path);
+	void Close();
+
+	// nullptr for an empty file
+	const char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+
+private:
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+};
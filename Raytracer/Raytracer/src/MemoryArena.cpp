@@ -0,0 +1,48 @@
+#include "MemoryArena.h"
+#include <algorithm>
+#include <stdint.h>
+
+CMemoryArena::CMemoryArena(size_t blockSize)
+	: blockSize(blockSize)
+{
+}
+
+void* CMemoryArena::Allocate(size_t bytes, size_t alignment)
+{
+	// Move on to the next block large enough, adding one where none is
+	while (current < blocks.size())
+	{
+		Block& block = blocks[current];
+		uintptr_t address = (uintptr_t)block.data.get() + offset;
+		size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+		if (offset + padding + bytes <= block.size)
+		{
+			offset += padding + bytes;
+			return block.data.get() + offset - bytes;
+		}
+		current++;
+		offset = 0;
+	}
+
+	Block block;
+	block.size = std::max(blockSize, bytes + alignment);
+	block.data.reset(new char[block.size]);
+	blocks.push_back(std::move(block));
+	return Allocate(bytes, alignment);
+}
+
+void CMemoryArena::Reset()
+{
+	current = 0;
+	offset = 0;
+}
+
+size_t CMemoryArena::GetCapacity() const
+{
+	size_t capacity = 0;
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		capacity += blocks[i].size;
+	}
+	return capacity;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+// Bump allocator over large blocks for short lived build data. Allocations
+// are never freed one by one, Reset() releases all of them at once and
+// keeps the blocks for the next use. Not thread safe, every thread that
+// allocates needs an arena of its own.
+class CMemoryArena
+{
+public:
+	explicit CMemoryArena(size_t blockSize = 1 << 20);
+
+	// Uninitialised memory, alignment must be a power of two
+	void* Allocate(size_t bytes, size_t alignment = 16);
+	void Reset();
+	// Bytes of all blocks, used or not
+	size_t GetCapacity() const;
+
+private:
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t blockSize;
+	// Block allocations come from and the first free byte in it
+	size_t current = 0;
+	size_t offset = 0;
+};
@@ -0,0 +1,1036 @@
+#include "MeshLoader.h"
+#include "Platform.h"
+#include <algorithm>
+#include <atomic>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static bool IsBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool IsDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static const char* FindLineEnd(const char* p, const char* end)
+{
+	const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+	return lineEnd != nullptr ? lineEnd : end;
+}
+
+static const char* SkipBlanks(const char* p, const char* end)
+{
+	while (p < end && IsBlank(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+static const char* SkipToken(const char* p, const char* end)
+{
+	while (p < end && !IsBlank(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+static int CountTokens(const char* p, const char* end)
+{
+	int count = 0;
+	for (p = SkipBlanks(p, end); p < end; p = SkipBlanks(SkipToken(p, end), end))
+	{
+		count++;
+	}
+	return count;
+}
+
+static bool StartsWithWord(const char* p, const char* end, const char* word)
+{
+	size_t length = strlen(word);
+	return (size_t)(end - p) >= length && memcmp(p, word, length) == 0 && (p + length == end || IsBlank(p[length]));
+}
+
+// Decimal number like 1, -2.5 or 3e-4, followed by a blank or the end.
+// Unlike strtod it ignores the locale. At most 19 significant digits are
+// kept and scaled by a power of ten in double precision, which rounds to
+// the same float as strtod except in rare ties. Numbers that overflow a
+// float fail like nan and inf, which are not parsed at all.
+static bool ParseFloat(const char*& p, const char* end, float& value)
+{
+	static const double powersOf10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+'))
+	{
+		negative = *s == '-';
+		s++;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool anyDigit = false;
+	for (; s < end && IsDigit(*s); s++)
+	{
+		anyDigit = true;
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*s - '0');
+			digits += mantissa != 0;
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+	if (s < end && *s == '.')
+	{
+		for (s++; s < end && IsDigit(*s); s++)
+		{
+			anyDigit = true;
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*s - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!anyDigit)
+	{
+		return false;
+	}
+	if (s < end && (*s == 'e' || *s == 'E'))
+	{
+		s++;
+		bool negativeExponent = false;
+		if (s < end && (*s == '-' || *s == '+'))
+		{
+			negativeExponent = *s == '-';
+			s++;
+		}
+		if (s == end || !IsDigit(*s))
+		{
+			return false;
+		}
+		int written = 0;
+		for (; s < end && IsDigit(*s); s++)
+		{
+			// Anything this large is 0 or infinite as a float anyway
+			written = std::min(written * 10 + (*s - '0'), 100000);
+		}
+		exponent += negativeExponent ? -written : written;
+	}
+	if (s < end && !IsBlank(*s))
+	{
+		return false;
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0)
+	{
+		result = -exponent <= 22 ? result / powersOf10[-exponent] : result * pow(10.0, exponent);
+	}
+	else if (exponent > 0)
+	{
+		result = exponent <= 22 ? result * powersOf10[exponent] : result * pow(10.0, exponent);
+	}
+	value = (float)(negative ? -result : result);
+	if (!isfinite(value))
+	{
+		return false;
+	}
+	p = s;
+	return true;
+}
+
+// Decimal integer, followed by whatever is not a digit
+static bool ParseInteger(const char*& p, const char* end, long long& value)
+{
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+'))
+	{
+		negative = *s == '-';
+		s++;
+	}
+	if (s == end || !IsDigit(*s))
+	{
+		return false;
+	}
+	long long result = 0;
+	for (; s < end && IsDigit(*s); s++)
+	{
+		if (result > (LLONG_MAX - 9) / 10)
+		{
+			return false;
+		}
+		result = result * 10 + (*s - '0');
+	}
+	value = negative ? -result : result;
+	p = s;
+	return true;
+}
+
+CMeshLoader::CMeshLoader(CTileScheduler& scheduler)
+	: scheduler(scheduler)
+{
+}
+
+bool CMeshLoader::Load(const std::string& path, CScene& scene)
+{
+	uint64_t start = GetTimeNanoseconds();
+	stats = MeshLoadStats();
+	if (!file.Open(path))
+	{
+		return false;
+	}
+	const char* begin = file.GetData();
+	const char* end = begin + file.GetSize();
+	size_t vertexCount = scene.vertices.size();
+	size_t triangleCount = scene.triangles.size();
+	chunks.clear();
+
+	bool loaded;
+	size_t dot = path.find_last_of('.');
+	std::string extension = dot != std::string::npos ? path.substr(dot) : "";
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == ".obj")
+	{
+		loaded = LoadObj(path, begin, end, scene);
+	}
+	else if (extension == ".ply")
+	{
+		PlyHeader header;
+		const char* body = begin;
+		loaded = ParsePlyHeader(path, body, end, header) && (header.ascii ?
+			LoadPlyAscii(path, header, body, end, scene) : LoadPlyBinary(path, header, body, end, scene));
+	}
+	else
+	{
+		fprintf(stderr, "%s: only .obj and .ply meshes can be loaded\n", path.c_str());
+		loaded = false;
+	}
+	file.Close();
+
+	if (!loaded)
+	{
+		scene.vertices.resize(vertexCount);
+		scene.triangles.resize(triangleCount);
+		return false;
+	}
+	stats.bytes = (size_t)(end - begin);
+	stats.chunks = (int)chunks.size();
+	stats.vertices = (int)(scene.vertices.size() - vertexCount);
+	stats.triangles = (int)(scene.triangles.size() - triangleCount);
+	stats.milliseconds = MillisecondsSince(start);
+	return true;
+}
+
+// Only reads a few bytes around every cut, the threads do the rest
+void CMeshLoader::SplitLines(const char* begin, const char* end)
+{
+	chunks.clear();
+	for (const char* p = begin; p < end;)
+	{
+		const char* cut = (size_t)(end - p) > MESH_CHUNK_BYTES ? FindLineEnd(p + MESH_CHUNK_BYTES, end) : end;
+		if (cut < end)
+		{
+			cut++;
+		}
+		Chunk chunk = {};
+		chunk.begin = p;
+		chunk.end = cut;
+		chunks.push_back(chunk);
+		p = cut;
+	}
+}
+
+void CMeshLoader::PrefixSums(size_t& lines, size_t& vertices, size_t& triangles)
+{
+	lines = vertices = triangles = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		chunks[i].firstLine = lines;
+		chunks[i].firstVertex = vertices;
+		chunks[i].firstTriangle = triangles;
+		lines += chunks[i].lines;
+		vertices += chunks[i].vertices;
+		triangles += chunks[i].triangles;
+	}
+}
+
+bool CMeshLoader::CheckChunks(const std::string& path, size_t firstLine)
+{
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (chunks[i].error != nullptr)
+		{
+			fprintf(stderr, "%s:%zu: %s\n", path.c_str(), firstLine + chunks[i].errorLine + 1, chunks[i].error);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Scene indices are ints, so are the indices on the GPU
+static bool FitsSceneIndices(const std::string& path, size_t vertices, size_t triangles)
+{
+	if (vertices > INT_MAX || triangles > INT_MAX)
+	{
+		fprintf(stderr, "%s: more than %d vertices or triangles\n", path.c_str(), INT_MAX);
+		return false;
+	}
+	return true;
+}
+
+bool CMeshLoader::LoadObj(const std::string& path, const char* begin, const char* end, CScene& scene)
+{
+	SplitLines(begin, end);
+
+	// Count the vertices, and the triangles the faces are split into
+	scheduler.ParallelFor((int)chunks.size(), 1, [&](int first, int last, int)
+	{
+		for (int c = first; c < last; c++)
+		{
+			Chunk& chunk = chunks[c];
+			for (const char* p = chunk.begin; p < chunk.end; chunk.lines++)
+			{
+				const char* lineEnd = FindLineEnd(p, chunk.end);
+				p = SkipBlanks(p, lineEnd);
+				if (StartsWithWord(p, lineEnd, "v"))
+				{
+					chunk.vertices++;
+				}
+				else if (StartsWithWord(p, lineEnd, "f"))
+				{
+					chunk.triangles += std::max(CountTokens(p + 1, lineEnd) - 2, 0);
+				}
+				p = lineEnd + 1;
+			}
+		}
+	});
+
+	size_t lines, vertices, triangles;
+	PrefixSums(lines, vertices, triangles);
+	size_t baseVertex = scene.vertices.size();
+	size_t baseTriangle = scene.triangles.size();
+	if (!FitsSceneIndices(path, baseVertex + vertices, baseTriangle + triangles))
+	{
+		return false;
+	}
+	scene.vertices.resize(baseVertex + vertices);
+	scene.triangles.resize(baseTriangle + triangles);
+
+	// Every chunk parses into its own range of both arrays
+	scheduler.ParallelFor((int)chunks.size(), 1, [&](int first, int last, int)
+	{
+		for (int c = first; c < last; c++)
+		{
+			Chunk& chunk = chunks[c];
+			size_t line = chunk.firstLine;
+			size_t vertex = chunk.firstVertex;
+			size_t triangle = chunk.firstTriangle;
+			for (const char* p = chunk.begin; p < chunk.end && chunk.error == nullptr; line++)
+			{
+				const char* lineEnd = FindLineEnd(p, chunk.end);
+				p = SkipBlanks(p, lineEnd);
+				if (StartsWithWord(p, lineEnd, "v"))
+				{
+					glm::vec3 position;
+					p = SkipBlanks(p + 1, lineEnd);
+					for (int axis = 0; axis < 3 && chunk.error == nullptr; axis++)
+					{
+						if (!ParseFloat(p, lineEnd, position[axis]))
+						{
+							chunk.error = "expected three coordinates";
+						}
+						p = SkipBlanks(p, lineEnd);
+					}
+					scene.vertices[baseVertex + vertex++] = position;
+				}
+				else if (StartsWithWord(p, lineEnd, "f"))
+				{
+					// Corners are v, v/vt, v//vn or v/vt/vn, 1 based or
+					// negative from the last vertex so far
+					int corners = 0;
+					int firstCorner = 0;
+					int lastCorner = 0;
+					for (p = SkipBlanks(p + 1, lineEnd); p < lineEnd && chunk.error == nullptr;
+						p = SkipBlanks(SkipToken(p, lineEnd), lineEnd))
+					{
+						long long index;
+						if (!ParseInteger(p, lineEnd, index) || index == 0)
+						{
+							chunk.error = "invalid vertex index";
+							break;
+						}
+						index = index > 0 ? index - 1 : (long long)vertex + index;
+						if (index < 0 || index >= (long long)vertices)
+						{
+							chunk.error = "vertex index out of range";
+							break;
+						}
+						int corner = (int)(baseVertex + index);
+						if (corners == 0)
+						{
+							firstCorner = corner;
+						}
+						else if (corners >= 2)
+						{
+							Triangle fan = { firstCorner, lastCorner, corner };
+							scene.triangles[baseTriangle + triangle++] = fan;
+						}
+						lastCorner = corner;
+						corners++;
+					}
+					if (chunk.error == nullptr && corners < 3)
+					{
+						chunk.error = "face with fewer than three corners";
+					}
+				}
+				if (chunk.error != nullptr)
+				{
+					chunk.errorLine = line;
+				}
+				p = lineEnd + 1;
+			}
+		}
+	});
+	return CheckChunks(path);
+}
+
+static bool ParsePlyType(const std::string& name, int& type)
+{
+	static const char* names[][2] =
+	{
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+		{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+	};
+	for (int i = 0; i < 8; i++)
+	{
+		if (name == names[i][0] || name == names[i][1])
+		{
+			// PlyType values start after PLY_NONE
+			type = i + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t GetPlyTypeSize(int type)
+{
+	static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+	return sizes[type];
+}
+
+// Binary value of any PLY type at p, swapped from the other byte order if needed
+static double ReadPlyValue(const char* p, int type, bool swap)
+{
+	unsigned char bytes[8];
+	size_t size = GetPlyTypeSize(type);
+	memcpy(bytes, p, size);
+	if (swap)
+	{
+		std::reverse(bytes, bytes + size);
+	}
+	switch (type)
+	{
+	case 1: { int8_t v; memcpy(&v, bytes, 1); return v; }
+	case 2: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+	case 3: { int16_t v; memcpy(&v, bytes, 2); return v; }
+	case 4: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+	case 5: { int32_t v; memcpy(&v, bytes, 4); return v; }
+	case 6: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+	case 7: { float v; memcpy(&v, bytes, 4); return v; }
+	default: { double v; memcpy(&v, bytes, 8); return v; }
+	}
+}
+
+bool CMeshLoader::ParsePlyHeader(const std::string& path, const char*& p, const char* end, PlyHeader& header)
+{
+	header.ascii = false;
+	header.bigEndian = false;
+	header.vertexElement = -1;
+	header.faceElement = -1;
+	header.position[0] = header.position[1] = header.position[2] = -1;
+	header.cornerList = -1;
+	header.lines = 0;
+
+	bool hasFormat = false;
+	for (int line = 0; ; line++)
+	{
+		if (p >= end)
+		{
+			fprintf(stderr, "%s: the header has no end_header line\n", path.c_str());
+			return false;
+		}
+		const char* lineEnd = FindLineEnd(p, end);
+		std::vector<std::string> words;
+		for (const char* w = SkipBlanks(p, lineEnd); w < lineEnd; w = SkipBlanks(w, lineEnd))
+		{
+			const char* wordEnd = SkipToken(w, lineEnd);
+			words.push_back(std::string(w, wordEnd));
+			w = wordEnd;
+		}
+		p = lineEnd < end ? lineEnd + 1 : end;
+
+		if (line == 0)
+		{
+			if (words.size() != 1 || words[0] != "ply")
+			{
+				fprintf(stderr, "%s: not a PLY file\n", path.c_str());
+				return false;
+			}
+			continue;
+		}
+		if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+		{
+			continue;
+		}
+		if (words[0] == "end_header")
+		{
+			header.lines = (size_t)line + 1;
+			break;
+		}
+		if (words[0] == "format" && words.size() >= 2)
+		{
+			hasFormat = true;
+			header.ascii = words[1] == "ascii";
+			header.bigEndian = words[1] == "binary_big_endian";
+			if (!header.ascii && !header.bigEndian && words[1] != "binary_little_endian")
+			{
+				fprintf(stderr, "%s:%d: unknown format %s\n", path.c_str(), line + 1, words[1].c_str());
+				return false;
+			}
+		}
+		else if (words[0] == "element" && words.size() == 3)
+		{
+			PlyElement element;
+			element.name = words[1];
+			element.count = (size_t)strtoull(words[2].c_str(), nullptr, 10);
+			if (element.name == "vertex")
+			{
+				header.vertexElement = (int)header.elements.size();
+			}
+			else if (element.name == "face")
+			{
+				header.faceElement = (int)header.elements.size();
+			}
+			header.elements.push_back(element);
+		}
+		else if (words[0] == "property" && !header.elements.empty())
+		{
+			PlyProperty property;
+			int type = PLY_NONE;
+			int countType = PLY_NONE;
+			bool valid;
+			if (words.size() == 5 && words[1] == "list")
+			{
+				valid = ParsePlyType(words[2], countType) && ParsePlyType(words[3], type) && countType <= PLY_UINT32 &&
+					type <= PLY_UINT32;
+				property.name = words[4];
+			}
+			else
+			{
+				valid = words.size() == 3 && ParsePlyType(words[1], type);
+				property.name = words.size() == 3 ? words[2] : "";
+			}
+			if (!valid)
+			{
+				fprintf(stderr, "%s:%d: unsupported property\n", path.c_str(), line + 1);
+				return false;
+			}
+			property.type = (PlyType)type;
+			property.countType = (PlyType)countType;
+			PlyElement& element = header.elements.back();
+			int index = (int)element.properties.size();
+			if (header.elements.size() - 1 == (size_t)header.vertexElement && countType == PLY_NONE)
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if (property.name == std::string(1, (char)('x' + axis)))
+					{
+						header.position[axis] = index;
+					}
+				}
+			}
+			if (header.elements.size() - 1 == (size_t)header.faceElement && countType != PLY_NONE &&
+				(property.name == "vertex_indices" || property.name == "vertex_index"))
+			{
+				header.cornerList = index;
+			}
+			element.properties.push_back(property);
+		}
+		else
+		{
+			fprintf(stderr, "%s:%d: unexpected header line\n", path.c_str(), line + 1);
+			return false;
+		}
+	}
+
+	if (!hasFormat || header.vertexElement < 0 || header.position[0] < 0 || header.position[1] < 0 ||
+		header.position[2] < 0)
+	{
+		fprintf(stderr, "%s: the header needs a format and a vertex element with x, y and z\n", path.c_str());
+		return false;
+	}
+	if (header.faceElement >= 0 && header.cornerList < 0)
+	{
+		fprintf(stderr, "%s: the face element has no vertex_indices list\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CMeshLoader::LoadPlyAscii(const std::string& path, const PlyHeader& header, const char* begin, const char* end,
+	CScene& scene)
+{
+	// Every element record is one line, find out which lines are vertices and faces
+	size_t elementStart[2] = { 0, 0 };
+	size_t elementEnd[2] = { 0, 0 };
+	size_t recordLines = 0;
+	for (size_t e = 0; e < header.elements.size(); e++)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			if ((int)e == (k == 0 ? header.vertexElement : header.faceElement))
+			{
+				elementStart[k] = recordLines;
+				elementEnd[k] = recordLines + header.elements[e].count;
+			}
+		}
+		recordLines += header.elements[e].count;
+	}
+	const PlyElement& vertexElement = header.elements[header.vertexElement];
+	const PlyElement* faceElement = header.faceElement >= 0 ? &header.elements[header.faceElement] : nullptr;
+
+	// Lines first, to know the element of every line. Then the triangles
+	// of the face lines.
+	SplitLines(begin, end);
+	scheduler.ParallelFor((int)chunks.size(), 1, [&](int first, int last, int)
+	{
+		for (int c = first; c < last; c++)
+		{
+			Chunk& chunk = chunks[c];
+			for (const char* p = chunk.begin; p < chunk.end; p = FindLineEnd(p, chunk.end) + 1)
+			{
+				chunk.lines++;
+			}
+		}
+	});
+	size_t lines, vertices, triangles;
+	PrefixSums(lines, vertices, triangles);
+	if (lines < recordLines)
+	{
+		fprintf(stderr, "%s: ends after %zu of %zu element lines\n", path.c_str(), lines, recordLines);
+		return false;
+	}
+
+	scheduler.ParallelFor((int)chunks.size(), 1, [&](int first, int last, int)
+	{
+		for (int c = first; c < last; c++)
+		{
+			Chunk& chunk = chunks[c];
+			size_t line = chunk.firstLine;
+			for (const char* p = chunk.begin; p < chunk.end && faceElement != nullptr; line++)
+			{
+				const char* lineEnd = FindLineEnd(p, chunk.end);
+				if (line >= elementStart[1] && line < elementEnd[1])
+				{
+					// Corner count of the list, scalars before it are skipped
+					p = SkipBlanks(p, lineEnd);
+					for (int k = 0; k < header.cornerList; k++)
+					{
+						p = SkipBlanks(SkipToken(p, lineEnd), lineEnd);
+					}
+					long long corners;
+					if (ParseInteger(p, lineEnd, corners) && corners >= 3)
+					{
+						chunk.triangles += (size_t)corners - 2;
+					}
+				}
+				p = lineEnd + 1;
+			}
+		}
+	});
+	PrefixSums(lines, vertices, triangles);
+	size_t vertexCount = vertexElement.count;
+	size_t baseVertex = scene.vertices.size();
+	size_t baseTriangle = scene.triangles.size();
+	if (!FitsSceneIndices(path, baseVertex + vertexCount, baseTriangle + triangles))
+	{
+		return false;
+	}
+	scene.vertices.resize(baseVertex + vertexCount);
+	scene.triangles.resize(baseTriangle + triangles);
+
+	scheduler.ParallelFor((int)chunks.size(), 1, [&](int first, int last, int)
+	{
+		for (int c = first; c < last; c++)
+		{
+			Chunk& chunk = chunks[c];
+			size_t line = chunk.firstLine;
+			size_t triangle = chunk.firstTriangle;
+			for (const char* p = chunk.begin; p < chunk.end && chunk.error == nullptr; line++)
+			{
+				const char* lineEnd = FindLineEnd(p, chunk.end);
+				p = SkipBlanks(p, lineEnd);
+				if (line >= elementStart[0] && line < elementEnd[0])
+				{
+					glm::vec3& position = scene.vertices[baseVertex + line - elementStart[0]];
+					for (int k = 0; k < (int)vertexElement.properties.size() && chunk.error == nullptr; k++)
+					{
+						int axis = k == header.position[0] ? 0 : k == header.position[1] ? 1 : k == header.position[2] ? 2 : -1;
+						if (axis >= 0 && !ParseFloat(p, lineEnd, position[axis]))
+						{
+							chunk.error = "invalid vertex coordinate";
+						}
+						p = SkipBlanks(SkipToken(p, lineEnd), lineEnd);
+					}
+				}
+				else if (line >= elementStart[1] && line < elementEnd[1])
+				{
+					for (int k = 0; k < header.cornerList; k++)
+					{
+						p = SkipBlanks(SkipToken(p, lineEnd), lineEnd);
+					}
+					long long corners = 0;
+					if (!ParseInteger(p, lineEnd, corners) || corners < 3)
+					{
+						chunk.error = "face with fewer than three corners";
+					}
+					int firstCorner = 0;
+					int lastCorner = 0;
+					for (long long k = 0; k < corners && chunk.error == nullptr; k++)
+					{
+						p = SkipBlanks(p, lineEnd);
+						long long index;
+						if (!ParseInteger(p, lineEnd, index) || index < 0 || index >= (long long)vertexCount)
+						{
+							chunk.error = "vertex index out of range";
+							break;
+						}
+						int corner = (int)(baseVertex + index);
+						if (k == 0)
+						{
+							firstCorner = corner;
+						}
+						else if (k >= 2)
+						{
+							Triangle fan = { firstCorner, lastCorner, corner };
+							scene.triangles[baseTriangle + triangle++] = fan;
+						}
+						lastCorner = corner;
+					}
+				}
+				if (chunk.error != nullptr)
+				{
+					chunk.errorLine = line;
+				}
+				p = lineEnd + 1;
+			}
+		}
+	});
+	return CheckChunks(path, header.lines);
+}
+
+// Bytes of one record of element at p, -1 if it does not fit before end
+static long long GetPlyRecordSize(const std::vector<std::pair<int, int>>& properties, const char* p, const char* end,
+	bool swap)
+{
+	long long size = 0;
+	for (size_t k = 0; k < properties.size(); k++)
+	{
+		int countType = properties[k].first;
+		int type = properties[k].second;
+		if (countType == 0)
+		{
+			size += GetPlyTypeSize(type);
+			continue;
+		}
+		if (end - p < size + (long long)GetPlyTypeSize(countType))
+		{
+			return -1;
+		}
+		double count = ReadPlyValue(p + size, countType, swap);
+		size += GetPlyTypeSize(countType) + (long long)count * GetPlyTypeSize(type);
+	}
+	return end - p >= size ? size : -1;
+}
+
+bool CMeshLoader::LoadPlyBinary(const std::string& path, const PlyHeader& header, const char* begin, const char* end,
+	CScene& scene)
+{
+	const uint16_t one = 1;
+	bool littleEndianHost = *(const unsigned char*)&one == 1;
+	bool swap = header.bigEndian == littleEndianHost;
+
+	// Skip to the vertices, records of other elements are sized one by one
+	// if they hold lists
+	const char* p = begin;
+	const char* vertexStart = nullptr;
+	const char* faceStart = nullptr;
+	for (size_t e = 0; e < header.elements.size(); e++)
+	{
+		const PlyElement& element = header.elements[e];
+		std::vector<std::pair<int, int>> properties;
+		bool fixedSize = true;
+		size_t recordSize = 0;
+		for (size_t k = 0; k < element.properties.size(); k++)
+		{
+			properties.push_back(std::make_pair((int)element.properties[k].countType, (int)element.properties[k].type));
+			fixedSize = fixedSize && element.properties[k].countType == PLY_NONE;
+			recordSize += GetPlyTypeSize(element.properties[k].type);
+		}
+		if ((int)e == header.vertexElement)
+		{
+			vertexStart = p;
+		}
+		if ((int)e == header.faceElement)
+		{
+			faceStart = p;
+			// The face records are sized while parsing them, unless the
+			// vertices come after them
+			if (vertexStart != nullptr)
+			{
+				break;
+			}
+		}
+		if (fixedSize)
+		{
+			if ((size_t)(end - p) / std::max(recordSize, (size_t)1) < element.count)
+			{
+				fprintf(stderr, "%s: ends within the %s element\n", path.c_str(), element.name.c_str());
+				return false;
+			}
+			p += recordSize * element.count;
+			continue;
+		}
+		for (size_t i = 0; i < element.count; i++)
+		{
+			long long size = GetPlyRecordSize(properties, p, end, swap);
+			if (size < 0)
+			{
+				fprintf(stderr, "%s: ends within the %s element\n", path.c_str(), element.name.c_str());
+				return false;
+			}
+			p += size;
+		}
+	}
+
+	const PlyElement& vertexElement = header.elements[header.vertexElement];
+	size_t vertexStride = 0;
+	size_t offsets[3] = { 0, 0, 0 };
+	int types[3] = { 0, 0, 0 };
+	for (size_t k = 0; k < vertexElement.properties.size(); k++)
+	{
+		const PlyProperty& property = vertexElement.properties[k];
+		if (property.countType != PLY_NONE)
+		{
+			fprintf(stderr, "%s: vertices with list properties are not supported\n", path.c_str());
+			return false;
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if ((int)k == header.position[axis])
+			{
+				offsets[axis] = vertexStride;
+				types[axis] = property.type;
+			}
+		}
+		vertexStride += GetPlyTypeSize(property.type);
+	}
+
+	size_t vertexCount = vertexElement.count;
+	size_t baseVertex = scene.vertices.size();
+	if (!FitsSceneIndices(path, baseVertex + vertexCount, scene.triangles.size()))
+	{
+		return false;
+	}
+	scene.vertices.resize(baseVertex + vertexCount);
+	// Lowest vertex with an infinite or nan coordinate
+	std::atomic<size_t> invalidVertex(vertexCount);
+	scheduler.ParallelFor((int)((vertexCount + MESH_RECORD_GRAIN_SIZE - 1) / MESH_RECORD_GRAIN_SIZE), 1,
+		[&](int first, int last, int)
+	{
+		size_t stop = std::min((size_t)last * MESH_RECORD_GRAIN_SIZE, vertexCount);
+		for (size_t i = (size_t)first * MESH_RECORD_GRAIN_SIZE; i < stop; i++)
+		{
+			const char* record = vertexStart + i * vertexStride;
+			glm::vec3& position = scene.vertices[baseVertex + i];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				position[axis] = (float)ReadPlyValue(record + offsets[axis], types[axis], swap);
+			}
+			if (!isfinite(position.x) || !isfinite(position.y) || !isfinite(position.z))
+			{
+				size_t lowest = invalidVertex.load();
+				while (i < lowest && !invalidVertex.compare_exchange_weak(lowest, i))
+				{
+				}
+				break;
+			}
+		}
+	});
+	if (invalidVertex < vertexCount)
+	{
+		fprintf(stderr, "%s: vertex %zu has a coordinate that is not finite\n", path.c_str(), (size_t)invalidVertex);
+		return false;
+	}
+	if (faceStart == nullptr)
+	{
+		return true;
+	}
+
+	// Faces are nearly always triangles, which makes their records the same
+	// size. Try that first and fall back to reading them one after another.
+	const PlyElement& faceElement = header.elements[header.faceElement];
+	size_t faceCount = faceElement.count;
+	size_t countOffset = 0;
+	size_t afterList = 0;
+	bool fixedTriangles = true;
+	const PlyProperty& corners = faceElement.properties[header.cornerList];
+	for (size_t k = 0; k < faceElement.properties.size(); k++)
+	{
+		const PlyProperty& property = faceElement.properties[k];
+		fixedTriangles = fixedTriangles && ((int)k == header.cornerList || property.countType == PLY_NONE);
+		size_t size = GetPlyTypeSize(property.type);
+		if ((int)k < header.cornerList)
+		{
+			countOffset += size;
+		}
+		else if ((int)k > header.cornerList)
+		{
+			afterList += size;
+		}
+	}
+	size_t indexSize = GetPlyTypeSize(corners.type);
+	size_t faceStride = countOffset + GetPlyTypeSize(corners.countType) + 3 * indexSize + afterList;
+	fixedTriangles = fixedTriangles && (size_t)(end - faceStart) / faceStride >= faceCount;
+	if (!fixedTriangles)
+	{
+		return LoadPlyFacesSequential(path, header, swap, faceStart, end, baseVertex, vertexCount, scene);
+	}
+
+	size_t baseTriangle = scene.triangles.size();
+	if (!FitsSceneIndices(path, scene.vertices.size(), baseTriangle + faceCount))
+	{
+		return false;
+	}
+	scene.triangles.resize(baseTriangle + faceCount);
+	std::atomic<bool> notTriangles{ false };
+	std::atomic<bool> outOfRange{ false };
+	scheduler.ParallelFor((int)((faceCount + MESH_RECORD_GRAIN_SIZE - 1) / MESH_RECORD_GRAIN_SIZE), 1,
+		[&](int first, int last, int)
+	{
+		size_t stop = std::min((size_t)last * MESH_RECORD_GRAIN_SIZE, faceCount);
+		for (size_t i = (size_t)first * MESH_RECORD_GRAIN_SIZE; i < stop && !notTriangles; i++)
+		{
+			const char* record = faceStart + i * faceStride;
+			if (ReadPlyValue(record + countOffset, corners.countType, swap) != 3.0)
+			{
+				notTriangles = true;
+				break;
+			}
+			const char* indices = record + countOffset + GetPlyTypeSize(corners.countType);
+			int v[3];
+			for (int k = 0; k < 3; k++)
+			{
+				double index = ReadPlyValue(indices + k * indexSize, corners.type, swap);
+				if (index < 0.0 || index >= (double)vertexCount)
+				{
+					outOfRange = true;
+					index = 0.0;
+				}
+				v[k] = (int)(baseVertex + (size_t)index);
+			}
+			Triangle triangle = { v[0], v[1], v[2] };
+			scene.triangles[baseTriangle + i] = triangle;
+		}
+	});
+	if (notTriangles)
+	{
+		scene.triangles.resize(baseTriangle);
+		return LoadPlyFacesSequential(path, header, swap, faceStart, end, baseVertex, vertexCount, scene);
+	}
+	if (outOfRange)
+	{
+		fprintf(stderr, "%s: vertex index out of range\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CMeshLoader::LoadPlyFacesSequential(const std::string& path, const PlyHeader& header, bool swap,
+	const char* begin, const char* end, size_t baseVertex, size_t vertexCount, CScene& scene)
+{
+	const PlyElement& faceElement = header.elements[header.faceElement];
+	std::vector<std::pair<int, int>> properties;
+	for (size_t k = 0; k < faceElement.properties.size(); k++)
+	{
+		properties.push_back(std::make_pair((int)faceElement.properties[k].countType,
+			(int)faceElement.properties[k].type));
+	}
+	// Properties before the corner list, lists among them vary in size as well
+	std::vector<std::pair<int, int>> before(properties.begin(), properties.begin() + header.cornerList);
+	const PlyProperty& corners = faceElement.properties[header.cornerList];
+	size_t indexSize = GetPlyTypeSize(corners.type);
+
+	const char* p = begin;
+	for (size_t i = 0; i < faceElement.count; i++)
+	{
+		long long size = GetPlyRecordSize(properties, p, end, swap);
+		if (size < 0)
+		{
+			fprintf(stderr, "%s: ends within the face element\n", path.c_str());
+			return false;
+		}
+		size_t countOffset = (size_t)GetPlyRecordSize(before, p, end, swap);
+		const char* indices = p + countOffset + GetPlyTypeSize(corners.countType);
+		long long count = (long long)ReadPlyValue(p + countOffset, corners.countType, swap);
+		if (count < 3)
+		{
+			fprintf(stderr, "%s: face %zu has fewer than three corners\n", path.c_str(), i);
+			return false;
+		}
+		int firstCorner = 0;
+		int lastCorner = 0;
+		for (long long k = 0; k < count; k++)
+		{
+			double index = ReadPlyValue(indices + k * indexSize, corners.type, swap);
+			if (index < 0.0 || index >= (double)vertexCount)
+			{
+				fprintf(stderr, "%s: face %zu has a vertex index out of range\n", path.c_str(), i);
+				return false;
+			}
+			int corner = (int)(baseVertex + (size_t)index);
+			if (k == 0)
+			{
+				firstCorner = corner;
+			}
+			else if (k >= 2)
+			{
+				Triangle fan = { firstCorner, lastCorner, corner };
+				scene.triangles.push_back(fan);
+			}
+			lastCorner = corner;
+		}
+		p += size;
+	}
+	return FitsSceneIndices(path, scene.vertices.size(), scene.triangles.size());
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// Bytes of a text file parsed as one task, rounded up to the next line break
+#define MESH_CHUNK_BYTES (1 << 20)
+// Binary PLY vertices and faces converted as one task
+#define MESH_RECORD_GRAIN_SIZE 65536
+
+struct MeshLoadStats
+{
+	double milliseconds = 0.0;
+	size_t bytes = 0;
+	int chunks = 0;
+	int vertices = 0;
+	int triangles = 0;
+};
+
+// Imports triangle meshes from Wavefront .obj and Stanford .ply files,
+// ascii or binary. The file is mapped into memory and text is cut into line
+// aligned chunks that are parsed on the scheduler's threads. A first pass
+// counts the vertices and triangles of every chunk, prefix sums over the
+// counts give each chunk the place of its results in the scene's arrays,
+// and a second pass parses straight into them. Binary PLY records have a
+// fixed size in the usual case and are converted in parallel as well.
+class CMeshLoader
+{
+public:
+	explicit CMeshLoader(CTileScheduler& scheduler);
+
+	// Appends the positions and triangles of an .obj or .ply file to scene,
+	// faces with more corners are split into fans. Normals, texture
+	// coordinates and other properties are skipped. Prints why and leaves
+	// scene as it was on failure.
+	bool Load(const std::string& path, CScene& scene);
+	const MeshLoadStats& GetStats() const { return stats; }
+
+private:
+	// Line aligned part of a text file, counted in the first pass
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		size_t lines;
+		size_t vertices;
+		size_t triangles;
+		// Prefix sums of the counts of the chunks before
+		size_t firstLine;
+		size_t firstVertex;
+		size_t firstTriangle;
+		// First error in the chunk and its line in the file, nullptr if none
+		const char* error;
+		size_t errorLine;
+	};
+
+	enum PlyType
+	{
+		PLY_NONE,
+		PLY_INT8,
+		PLY_UINT8,
+		PLY_INT16,
+		PLY_UINT16,
+		PLY_INT32,
+		PLY_UINT32,
+		PLY_FLOAT32,
+		PLY_FLOAT64
+	};
+
+	struct PlyProperty
+	{
+		std::string name;
+		PlyType type;
+		// Type of the corner count for lists, PLY_NONE for scalars
+		PlyType countType;
+	};
+
+	struct PlyElement
+	{
+		std::string name;
+		size_t count;
+		std::vector<PlyProperty> properties;
+	};
+
+	// Header of a PLY file, the elements in file order
+	struct PlyHeader
+	{
+		bool ascii;
+		bool bigEndian;
+		std::vector<PlyElement> elements;
+		// Indices into elements, -1 if missing
+		int vertexElement;
+		int faceElement;
+		// Properties of x, y, z in the vertex element and of the corner
+		// list in the face element
+		int position[3];
+		int cornerList;
+		// Lines up to and including end_header
+		size_t lines;
+	};
+
+	void SplitLines(const char* begin, const char* end);
+	// Turns the counts of every chunk into the first line, vertex and
+	// triangle of the ones after it, returns the totals
+	void PrefixSums(size_t& lines, size_t& vertices, size_t& triangles);
+	// Prints the first error of any chunk at its line in the file, whose
+	// first firstLine lines were not split into chunks. False if there was one.
+	bool CheckChunks(const std::string& path, size_t firstLine = 0);
+
+	bool LoadObj(const std::string& path, const char* begin, const char* end, CScene& scene);
+	bool ParsePlyHeader(const std::string& path, const char*& p, const char* end, PlyHeader& header);
+	bool LoadPlyAscii(const std::string& path, const PlyHeader& header, const char* begin, const char* end, CScene& scene);
+	bool LoadPlyBinary(const std::string& path, const PlyHeader& header, const char* begin, const char* end, CScene& scene);
+	// Faces of any size one after another, for the files where not every
+	// face is a triangle
+	bool LoadPlyFacesSequential(const std::string& path, const PlyHeader& header, bool swap,
+		const char* begin, const char* end, size_t baseVertex, size_t vertexCount, CScene& scene);
+
+	CTileScheduler& scheduler;
+	CMappedFile file;
+	std::vector<Chunk> chunks;
+	MeshLoadStats stats;
+};
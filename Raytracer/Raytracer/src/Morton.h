@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Spreads the low 10 bits of value so two zero bits follow each one,
+// interleaving three of them gives a 30 bit Morton code
+inline uint64_t ExpandBits10(uint64_t value)
+{
+	value &= 0x3ff;
+	value = (value | value << 16) & 0x30000ff;
+	value = (value | value << 8) & 0x300f00f;
+	value = (value | value << 4) & 0x30c30c3;
+	value = (value | value << 2) & 0x9249249;
+	return value;
+}
+
+// Same for the low 21 bits, for 63 bit codes
+inline uint64_t ExpandBits21(uint64_t value)
+{
+	value &= 0x1fffff;
+	value = (value | value << 32) & 0x1f00000000ffffull;
+	value = (value | value << 16) & 0x1f0000ff0000ffull;
+	value = (value | value << 8) & 0x100f00f00f00f00full;
+	value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+	value = (value | value << 2) & 0x1249249249249249ull;
+	return value;
+}
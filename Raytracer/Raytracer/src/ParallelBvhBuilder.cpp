@@ -0,0 +1,361 @@
+#include "ParallelBvhBuilder.h"
+#include "Platform.h"
+#include <algorithm>
+#include <float.h>
+
+// Primitives per range of the parallel passes over one node
+#define PBVH_GRAIN_SIZE 16384
+// Subtrees smaller than this are never split up further between threads
+#define PBVH_MIN_TASK_SIZE 4096
+// Subtree tasks aimed for per thread, so stealing can even out their sizes
+#define PBVH_TASKS_PER_THREAD 8
+
+static void ComputeNodeBounds(const std::vector<Box>& boxes, const std::vector<int>& primIndices, BvhNode& node)
+{
+	node.min = glm::vec3(FLT_MAX);
+	node.max = glm::vec3(-FLT_MAX);
+	for (int i = 0; i < node.count; i++)
+	{
+		const Box& box = boxes[primIndices[node.leftOrFirst + i]];
+		node.min = glm::min(node.min, box.min);
+		node.max = glm::max(node.max, box.max);
+	}
+}
+
+CParallelBvhBuilder::CParallelBvhBuilder(CTileScheduler& scheduler)
+	: scheduler(scheduler)
+{
+}
+
+void CParallelBvhBuilder::Build(const std::vector<Box>& boxes, CBvh& bvh)
+{
+	uint64_t start = GetTimeNanoseconds();
+	int count = (int)boxes.size();
+	if (count <= PBVH_MIN_TASK_SIZE)
+	{
+		// Small scenes are one task anyway, keep them on the calling thread
+		bvh.Build(boxes);
+		return;
+	}
+	bvh.stats = BvhBuildStats();
+	bvh.nodes.clear();
+	bvh.levelNodes.clear();
+	bvh.levelStarts.clear();
+	bvh.primIndices.resize(count);
+
+	centroids.resize(count);
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			bvh.primIndices[i] = i;
+			centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+		}
+	});
+
+	// Room for the largest possible tree, trimmed to the nodes used at the end
+	bvh.nodes.resize(2 * (size_t)count - 1);
+	bvh.nodes[0].leftOrFirst = 0;
+	bvh.nodes[0].count = count;
+	ComputeBounds(0, count, boxes, bvh, bvh.nodes[0]);
+	nodeCount = 1;
+
+	// Split the large nodes one at a time with every thread, until only
+	// nodes small enough to be tasks are left
+	int threadCount = scheduler.GetThreadCount();
+	int taskSize = std::max(PBVH_MIN_TASK_SIZE, count / (threadCount * PBVH_TASKS_PER_THREAD));
+	std::vector<Subtree> open;
+	std::vector<Subtree> tasks;
+	Subtree root = { 0, 1, 1 };
+	open.push_back(root);
+	while (!open.empty())
+	{
+		Subtree subtree = open.back();
+		open.pop_back();
+		bvh.stats.depth = std::max(bvh.stats.depth, subtree.depth);
+		if (bvh.nodes[subtree.nodeIndex].count <= taskSize || subtree.depth >= BVH_MAX_DEPTH)
+		{
+			tasks.push_back(subtree);
+			continue;
+		}
+		if (SplitInParallel(subtree.nodeIndex, boxes, bvh))
+		{
+			int left = bvh.nodes[subtree.nodeIndex].leftOrFirst;
+			Subtree child = { left + 1, subtree.depth + 1, subtree.depth + 1 };
+			open.push_back(child);
+			child.nodeIndex = left;
+			open.push_back(child);
+		}
+	}
+	topArena.Reset();
+
+	// Largest subtrees first, the small ones at the end even out the threads
+	std::sort(tasks.begin(), tasks.end(), [&](const Subtree& a, const Subtree& b)
+	{
+		return bvh.nodes[a.nodeIndex].count > bvh.nodes[b.nodeIndex].count;
+	});
+	while ((int)threadArenas.size() < threadCount)
+	{
+		threadArenas.push_back(std::unique_ptr<CMemoryArena>(new CMemoryArena()));
+	}
+	scheduler.ParallelFor((int)tasks.size(), 1, [&](int begin, int end, int threadIndex)
+	{
+		for (int t = begin; t < end; t++)
+		{
+			BuildSubtree(tasks[t], boxes, bvh, *threadArenas[threadIndex]);
+		}
+	});
+	for (size_t t = 0; t < tasks.size(); t++)
+	{
+		bvh.stats.depth = std::max(bvh.stats.depth, tasks[t].maxDepth);
+	}
+	for (size_t i = 0; i < threadArenas.size(); i++)
+	{
+		threadArenas[i]->Reset();
+	}
+
+	bvh.nodes.resize(nodeCount);
+	bvh.stats.nodes = (int)bvh.nodes.size();
+	bvh.stats.leaves = (bvh.stats.nodes + 1) / 2;
+	bvh.stats.references = count;
+	bvh.stats.sahCost = bvh.ComputeSahCost();
+	bvh.stats.milliseconds = MillisecondsSince(start);
+}
+
+void CParallelBvhBuilder::ComputeBounds(int first, int count, const std::vector<Box>& boxes, const CBvh& bvh, BvhNode& node)
+{
+	int ranges = (count + PBVH_GRAIN_SIZE - 1) / PBVH_GRAIN_SIZE;
+	Box* rangeBounds = (Box*)topArena.Allocate(sizeof(Box) * ranges);
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		Box bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+		for (int i = begin; i < end; i++)
+		{
+			const Box& box = boxes[bvh.primIndices[first + i]];
+			bounds.min = glm::min(bounds.min, box.min);
+			bounds.max = glm::max(bounds.max, box.max);
+		}
+		rangeBounds[begin / PBVH_GRAIN_SIZE] = bounds;
+	});
+	node.min = glm::vec3(FLT_MAX);
+	node.max = glm::vec3(-FLT_MAX);
+	for (int r = 0; r < ranges; r++)
+	{
+		node.min = glm::min(node.min, rangeBounds[r].min);
+		node.max = glm::max(node.max, rangeBounds[r].max);
+	}
+}
+
+// Same binning as CBvh::FindBestSplit, every range fills bins of its own
+// that are merged before the sweep. The partition is stable, through a
+// scratch copy of the node's primitive indices.
+bool CParallelBvhBuilder::SplitInParallel(int nodeIndex, const std::vector<Box>& boxes, CBvh& bvh)
+{
+	topArena.Reset();
+	BvhNode node = bvh.nodes[nodeIndex];
+	int first = node.leftOrFirst;
+	int count = node.count;
+	int ranges = (count + PBVH_GRAIN_SIZE - 1) / PBVH_GRAIN_SIZE;
+	std::vector<int>& primIndices = bvh.primIndices;
+
+	Box* rangeBounds = (Box*)topArena.Allocate(sizeof(Box) * ranges);
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		Box bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+		for (int i = begin; i < end; i++)
+		{
+			const glm::vec3& centroid = centroids[primIndices[first + i]];
+			bounds.min = glm::min(bounds.min, centroid);
+			bounds.max = glm::max(bounds.max, centroid);
+		}
+		rangeBounds[begin / PBVH_GRAIN_SIZE] = bounds;
+	});
+	glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (int r = 0; r < ranges; r++)
+	{
+		centroidMin = glm::min(centroidMin, rangeBounds[r].min);
+		centroidMax = glm::max(centroidMax, rangeBounds[r].max);
+	}
+
+	typedef BvhBin RangeBins[3][BVH_BINS];
+	RangeBins* rangeBins = (RangeBins*)topArena.Allocate(sizeof(RangeBins) * ranges);
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		RangeBins& bins = rangeBins[begin / PBVH_GRAIN_SIZE];
+		for (int a = 0; a < 3; a++)
+		{
+			for (int b = 0; b < BVH_BINS; b++)
+			{
+				bins[a][b] = BvhBin();
+			}
+			float extent = centroidMax[a] - centroidMin[a];
+			if (extent <= 0.0f)
+			{
+				continue;
+			}
+			float scale = BVH_BINS / extent;
+			for (int i = begin; i < end; i++)
+			{
+				int prim = primIndices[first + i];
+				int bin = std::min(BVH_BINS - 1, (int)((centroids[prim][a] - centroidMin[a]) * scale));
+				bins[a][bin].min = glm::min(bins[a][bin].min, boxes[prim].min);
+				bins[a][bin].max = glm::max(bins[a][bin].max, boxes[prim].max);
+				bins[a][bin].count++;
+			}
+		}
+	});
+	BvhBin bins[3][BVH_BINS];
+	for (int r = 0; r < ranges; r++)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			for (int b = 0; b < BVH_BINS; b++)
+			{
+				bins[a][b].min = glm::min(bins[a][b].min, rangeBins[r][a][b].min);
+				bins[a][b].max = glm::max(bins[a][b].max, rangeBins[r][a][b].max);
+				bins[a][b].count += rangeBins[r][a][b].count;
+			}
+		}
+	}
+
+	int axis;
+	float position;
+	float splitCost = CBvh::FindBestBinSplit(bins, centroidMin, centroidMax, BoxSurfaceArea(node.min, node.max), axis, position);
+	if (!CBvh::ShouldSplit(count, axis, splitCost))
+	{
+		return false;
+	}
+
+	// Left primitives per range, then where each range's left and right
+	// primitives start in the scratch copy
+	int* leftStarts = (int*)topArena.Allocate(sizeof(int) * ranges);
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		int left = 0;
+		for (int i = begin; i < end; i++)
+		{
+			left += centroids[primIndices[first + i]][axis] < position ? 1 : 0;
+		}
+		leftStarts[begin / PBVH_GRAIN_SIZE] = left;
+	});
+	int leftCount = 0;
+	for (int r = 0; r < ranges; r++)
+	{
+		int left = leftStarts[r];
+		leftStarts[r] = leftCount;
+		leftCount += left;
+	}
+	if (leftCount == 0 || leftCount == count)
+	{
+		return false;
+	}
+
+	int* scratch = (int*)topArena.Allocate(sizeof(int) * count);
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		int left = leftStarts[begin / PBVH_GRAIN_SIZE];
+		int right = leftCount + begin - left;
+		for (int i = begin; i < end; i++)
+		{
+			int prim = primIndices[first + i];
+			scratch[centroids[prim][axis] < position ? left++ : right++] = prim;
+		}
+	});
+	scheduler.ParallelFor(count, PBVH_GRAIN_SIZE, [&](int begin, int end, int)
+	{
+		std::copy(scratch + begin, scratch + end, primIndices.begin() + first + begin);
+	});
+
+	int left = nodeCount;
+	nodeCount += 2;
+	BvhNode& leftChild = bvh.nodes[left];
+	BvhNode& rightChild = bvh.nodes[left + 1];
+	leftChild.leftOrFirst = first;
+	leftChild.count = leftCount;
+	rightChild.leftOrFirst = first + leftCount;
+	rightChild.count = count - leftCount;
+	ComputeBounds(leftChild.leftOrFirst, leftChild.count, boxes, bvh, leftChild);
+	ComputeBounds(rightChild.leftOrFirst, rightChild.count, boxes, bvh, rightChild);
+	bvh.nodes[nodeIndex].leftOrFirst = left;
+	bvh.nodes[nodeIndex].count = 0;
+	return true;
+}
+
+// Builds the subtree into the thread's arena, then copies it into a block
+// of bvh.nodes taken at once. Its root stays in the slot it already has.
+void CParallelBvhBuilder::BuildSubtree(Subtree& subtree, const std::vector<Box>& boxes, CBvh& bvh, CMemoryArena& arena)
+{
+	arena.Reset();
+	const BvhNode& root = bvh.nodes[subtree.nodeIndex];
+	BvhNode* nodes = (BvhNode*)arena.Allocate(sizeof(BvhNode) * (2 * (size_t)root.count - 1));
+	nodes[0] = root;
+	int used = 1;
+	subtree.maxDepth = subtree.depth;
+	Subdivide(nodes, 0, used, subtree.depth, subtree.maxDepth, boxes, bvh);
+
+	// Local node i > 0 becomes base + i
+	int base = nodeCount.fetch_add(used - 1) - 1;
+	for (int i = 0; i < used; i++)
+	{
+		BvhNode node = nodes[i];
+		if (!node.IsLeaf())
+		{
+			node.leftOrFirst += base;
+		}
+		bvh.nodes[i == 0 ? subtree.nodeIndex : base + i] = node;
+	}
+}
+
+void CParallelBvhBuilder::Subdivide(BvhNode* nodes, int nodeIndex, int& used, int depth, int& maxDepth,
+	const std::vector<Box>& boxes, CBvh& bvh)
+{
+	maxDepth = std::max(maxDepth, depth);
+	BvhNode& node = nodes[nodeIndex];
+	if (node.count <= 1 || depth >= BVH_MAX_DEPTH)
+	{
+		return;
+	}
+
+	int axis;
+	float position;
+	float splitCost = bvh.FindBestSplit(node, boxes, centroids, axis, position);
+	if (!CBvh::ShouldSplit(node.count, axis, splitCost))
+	{
+		return;
+	}
+
+	// Same in place partition as CBvh::Subdivide, on this subtree's range
+	std::vector<int>& primIndices = bvh.primIndices;
+	int first = node.leftOrFirst;
+	int i = first;
+	int j = first + node.count - 1;
+	while (i <= j)
+	{
+		if (centroids[primIndices[i]][axis] < position)
+		{
+			i++;
+		}
+		else
+		{
+			std::swap(primIndices[i], primIndices[j--]);
+		}
+	}
+	int leftCount = i - first;
+	if (leftCount == 0 || leftCount == node.count)
+	{
+		return;
+	}
+
+	int left = used;
+	used += 2;
+	nodes[left].leftOrFirst = first;
+	nodes[left].count = leftCount;
+	nodes[left + 1].leftOrFirst = i;
+	nodes[left + 1].count = node.count - leftCount;
+	node.leftOrFirst = left;
+	node.count = 0;
+	ComputeNodeBounds(boxes, primIndices, nodes[left]);
+	ComputeNodeBounds(boxes, primIndices, nodes[left + 1]);
+	Subdivide(nodes, left, used, depth + 1, maxDepth, boxes, bvh);
+	Subdivide(nodes, left + 1, used, depth + 1, maxDepth, boxes, bvh);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Bvh.h"
+#include "MemoryArena.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// Top down binned SAH build on the scheduler's threads, producing the same
+// tree as CBvh::Build. Nodes with many primitives are binned and
+// partitioned in parallel one after another. Below a size that leaves
+// several per thread, subtrees become tasks that each build sequentially.
+// Scratch arrays and the nodes of a subtree come from per thread arenas
+// that are reset in one go, nothing is allocated per node.
+class CParallelBvhBuilder
+{
+public:
+	// All passes run on the scheduler's threads
+	explicit CParallelBvhBuilder(CTileScheduler& scheduler);
+
+	void Build(const std::vector<Box>& boxes, CBvh& bvh);
+
+private:
+	// Node whose primitives still have to be split, with its depth
+	struct Subtree
+	{
+		int nodeIndex;
+		int depth;
+		// Depth of the deepest leaf, once built
+		int maxDepth;
+	};
+
+	// Splits a large node with parallel passes, returns false if it stays a leaf
+	bool SplitInParallel(int nodeIndex, const std::vector<Box>& boxes, CBvh& bvh);
+	// Bounds of primIndices[first] up to first + count
+	void ComputeBounds(int first, int count, const std::vector<Box>& boxes, const CBvh& bvh, BvhNode& node);
+	void BuildSubtree(Subtree& subtree, const std::vector<Box>& boxes, CBvh& bvh, CMemoryArena& arena);
+	// Sequential split of nodes[nodeIndex], children go to nodes[used]
+	void Subdivide(BvhNode* nodes, int nodeIndex, int& used, int depth, int& maxDepth,
+		const std::vector<Box>& boxes, CBvh& bvh);
+
+	CTileScheduler& scheduler;
+	std::vector<glm::vec3> centroids;
+	// Scratch of the passes over one large node, reset for every node
+	CMemoryArena topArena;
+	// One per scheduler thread for the subtree tasks
+	std::vector<std::unique_ptr<CMemoryArena>> threadArenas;
+	// Nodes handed out so far, subtree tasks take theirs in one block
+	std::atomic<int> nodeCount{ 0 };
+};
@@ -0,0 +1,152 @@
+#include "PboReadback.h"
+#include "Platform.h"
+#include <algorithm>
+
+CPboReadback::CPboReadback()
+{
+}
+
+CPboReadback::~CPboReadback()
+{
+	Destroy();
+}
+
+bool CPboReadback::Init(int width, int height, int ringSize)
+{
+	Destroy();
+	this->width = width;
+	this->height = height;
+
+	GLsizeiptr size = (GLsizeiptr)width * height * 4 * sizeof(float);
+	slots.resize(std::max(ringSize, 1));
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		glGenBuffers(1, &slots[i].buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	stats = ReadbackStats();
+	totalLatencyMs = 0.0;
+	return glGetError() == GL_NO_ERROR;
+}
+
+void CPboReadback::Destroy()
+{
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].fence != 0)
+		{
+			glDeleteSync(slots[i].fence);
+		}
+		glDeleteBuffers(1, &slots[i].buffer);
+	}
+	slots.clear();
+	head = 0;
+	inFlight = 0;
+}
+
+void CPboReadback::Capture(GLuint texture)
+{
+	if (slots.empty())
+	{
+		return;
+	}
+
+	// Ring is full, the oldest frame has to come out first
+	if (inFlight == (int)slots.size())
+	{
+		uint64_t start = GetTimeNanoseconds();
+		DeliverOldest(GL_TIMEOUT_IGNORED);
+		stats.totalStallMs += MillisecondsSince(start);
+		stats.stalls++;
+	}
+
+	Slot& slot = slots[head];
+	// Image stores from the compute shader must land before the copy
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.frameIndex = nextFrameIndex++;
+	slot.captureTime = GetTimeNanoseconds();
+	// Make sure the fence actually reaches the GPU before anyone waits on it
+	glFlush();
+
+	head = (head + 1) % (int)slots.size();
+	inFlight++;
+	stats.framesCaptured++;
+}
+
+void CPboReadback::Poll()
+{
+	while (inFlight > 0 && DeliverOldest(0))
+	{
+	}
+}
+
+void CPboReadback::Flush()
+{
+	while (inFlight > 0)
+	{
+		DeliverOldest(GL_TIMEOUT_IGNORED);
+	}
+}
+
+bool CPboReadback::DeliverOldest(GLuint64 timeoutNs)
+{
+	int index = (head - inFlight + (int)slots.size()) % (int)slots.size();
+	Slot& slot = slots[index];
+
+	GLenum status = glClientWaitSync(slot.fence, 0, timeoutNs);
+	if (status == GL_TIMEOUT_EXPIRED)
+	{
+		return false;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+	// Waiting again would fail again, the frame is given up so the ring
+	// still drains
+	if (status == GL_WAIT_FAILED)
+	{
+		stats.framesDropped++;
+		inFlight--;
+		return true;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	GLsizeiptr size = (GLsizeiptr)width * height * 4 * sizeof(float);
+	const float* pixels = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (pixels == NULL)
+	{
+		stats.framesDropped++;
+	}
+	else
+	{
+		double latency = MillisecondsSince(slot.captureTime);
+		totalLatencyMs += latency;
+		stats.maxLatencyMs = std::max(stats.maxLatencyMs, latency);
+		stats.framesDelivered++;
+		stats.averageLatencyMs = totalLatencyMs / stats.framesDelivered;
+
+		if (callback)
+		{
+			ReadbackFrame frame;
+			frame.rgba = pixels;
+			frame.width = width;
+			frame.height = height;
+			frame.frameIndex = slot.frameIndex;
+			callback(frame);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	inFlight--;
+	return true;
+}
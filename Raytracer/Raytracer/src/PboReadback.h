@@ -0,0 +1,82 @@
+#pragma once
+
+#include "GLHeaders.h"
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// A finished readback. rgba points straight into the mapped pixel buffer
+// and is only valid until the callback returns.
+struct ReadbackFrame
+{
+	const float* rgba;
+	int width;
+	int height;
+	long long frameIndex;
+};
+
+struct ReadbackStats
+{
+	long long framesCaptured = 0;
+	long long framesDelivered = 0;
+	// Captured frames whose fence wait or buffer mapping failed, they never
+	// reach the callback
+	long long framesDropped = 0;
+	// Capture() to callback, measured on the CPU
+	double averageLatencyMs = 0.0;
+	double maxLatencyMs = 0.0;
+	// Time spent blocked because the oldest buffer was still in flight
+	double totalStallMs = 0.0;
+	long long stalls = 0;
+};
+
+// Ring of pixel pack buffers that copies the RGBA32F frame buffer texture
+// to host memory asynchronously. Each copy is guarded by a fence, so frame
+// N is read back while frame N + 1 is being dispatched.
+class CPboReadback
+{
+public:
+	typedef std::function<void(const ReadbackFrame& frame)> Callback;
+
+	CPboReadback();
+	~CPboReadback();
+
+	bool Init(int width, int height, int ringSize = 3);
+	void Destroy();
+	void SetCallback(const Callback& callback) { this->callback = callback; }
+
+	// Queues a copy of texture level 0, call after the compute dispatch.
+	// Blocks only if every buffer in the ring is still in flight.
+	void Capture(GLuint texture);
+	// Delivers every frame whose copy has finished, never blocks
+	void Poll();
+	// Blocks until every captured frame has been delivered
+	void Flush();
+
+	const ReadbackStats& GetStats() { return stats; }
+
+private:
+	struct Slot
+	{
+		GLuint buffer = 0;
+		GLsync fence = 0;
+		long long frameIndex = 0;
+		uint64_t captureTime;
+	};
+
+	// Waits at most timeoutNs for the oldest slot, delivers it if ready.
+	// A slot whose wait or mapping fails is retired without delivering it,
+	// counted in ReadbackStats::framesDropped. False when
+	// the oldest slot is still in flight.
+	bool DeliverOldest(GLuint64 timeoutNs);
+
+	std::vector<Slot> slots;
+	int head = 0;		// next slot to capture into
+	int inFlight = 0;	// captured but not delivered, oldest at head - inFlight
+	int width = 0;
+	int height = 0;
+	long long nextFrameIndex = 0;
+	double totalLatencyMs = 0.0;
+	Callback callback;
+	ReadbackStats stats;
+};
@@ -0,0 +1,82 @@
+#include "Platform.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+#ifdef _WIN32
+
+uint64_t GetTimeNanoseconds()
+{
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	// Split to avoid overflowing 64 bits for large counter values
+	uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+	uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000000ull + remainder * 1000000000ull / frequency.QuadPart;
+}
+
+void SleepUntil(uint64_t deadline)
+{
+	// Sleep() only wakes on scheduler ticks, so sleep most of the way and
+	// spin for the last two milliseconds
+	const uint64_t spinTime = 2000000;
+	for (;;)
+	{
+		uint64_t now = GetTimeNanoseconds();
+		if (now >= deadline)
+		{
+			return;
+		}
+		if (deadline - now > spinTime)
+		{
+			Sleep((DWORD)((deadline - now - spinTime) / 1000000));
+		}
+		else
+		{
+			YieldProcessor();
+		}
+	}
+}
+
+#else
+
+uint64_t GetTimeNanoseconds()
+{
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+void SleepUntil(uint64_t deadline)
+{
+#ifdef __linux__
+	timespec time;
+	time.tv_sec = (time_t)(deadline / 1000000000ull);
+	time.tv_nsec = (long)(deadline % 1000000000ull);
+	// Absolute deadlines do not drift when a signal interrupts the sleep
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL) == EINTR)
+	{
+	}
+#else
+	for (uint64_t now = GetTimeNanoseconds(); now < deadline; now = GetTimeNanoseconds())
+	{
+		timespec time;
+		time.tv_sec = (time_t)((deadline - now) / 1000000000ull);
+		time.tv_nsec = (long)((deadline - now) % 1000000000ull);
+		nanosleep(&time, NULL);
+	}
+#endif
+}
+
+#endif
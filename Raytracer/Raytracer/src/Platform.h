@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// Monotonic clock in nanoseconds since an arbitrary point, never goes back
+// and is not affected by changes to the wall clock. CLOCK_MONOTONIC on
+// Linux, QueryPerformanceCounter on Windows.
+uint64_t GetTimeNanoseconds();
+
+// Blocks the calling thread until GetTimeNanoseconds() reaches deadline
+void SleepUntil(uint64_t deadline);
+
+inline double NanosecondsToMilliseconds(uint64_t nanoseconds)
+{
+	return nanoseconds * 1e-6;
+}
+
+inline double MillisecondsSince(uint64_t start)
+{
+	return NanosecondsToMilliseconds(GetTimeNanoseconds() - start);
+}
+
+inline double SecondsSince(uint64_t start)
+{
+	return (GetTimeNanoseconds() - start) * 1e-9;
+}
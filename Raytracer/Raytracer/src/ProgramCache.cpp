@@ -0,0 +1,314 @@
+#include "ProgramCache.h"
+#include "EmbeddedShaders.h"
+#include "Platform.h"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define MakeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define MakeDirectory(path) mkdir(path, 0755)
+#endif
+
+// Bump when the file layout changes
+static const unsigned int binaryFileVersion = 1;
+static const char binaryFileMagic[4] = { 'R', 'T', 'P', 'B' };
+
+static unsigned long long HashString(const std::string& text)
+{
+	// 64-bit FNV-1a
+	unsigned long long hash = 14695981039346656037ull;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static std::string GetDriverString()
+{
+	std::string driver;
+	const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	for (int i = 0; i < 4; i++)
+	{
+		const GLubyte* value = glGetString(names[i]);
+		driver += value != NULL ? (const char*)value : "";
+		driver += "\n";
+	}
+	return driver;
+}
+
+// Defines have to come after #version, which must be the first statement
+static std::string InsertDefines(const std::string& source, const std::string& defines)
+{
+	if (defines.empty())
+	{
+		return source;
+	}
+	size_t version = source.find("#version");
+	size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+	if (lineEnd == std::string::npos)
+	{
+		return defines + "\n" + source;
+	}
+	return source.substr(0, lineEnd + 1) + defines + "\n" + source.substr(lineEnd + 1);
+}
+
+CProgramCache::CProgramCache()
+{
+	SetCacheDirectory("shadercache");
+}
+
+void CProgramCache::SetCacheDirectory(const std::string& directory)
+{
+	cacheDirectory = directory;
+}
+
+void CProgramCache::SetShaderDirectory(const std::string& directory)
+{
+	shaderDirectory = directory;
+}
+
+std::string CProgramCache::LoadSource(const char* name)
+{
+	if (shaderDirectory.empty())
+	{
+		for (const EmbeddedShader* shader = embeddedShaders; shader->name != NULL; shader++)
+		{
+			if (strcmp(shader->name, name) == 0)
+			{
+				return shader->source;
+			}
+		}
+		fprintf(stderr, "No embedded shader called %s\n", name);
+		exit(1);
+	}
+
+	std::string fileName = shaderDirectory + "/" + name;
+	std::ifstream file(fileName.c_str());
+	if (file.fail())
+	{
+		fprintf(stderr, "error loading shader called %s\n", fileName.c_str());
+		exit(1);
+	}
+	std::stringstream stream;
+	stream << file.rdbuf();
+	return stream.str();
+}
+
+GLuint CProgramCache::CreateProgram(const std::vector<ShaderStage>& stages, const std::string& defines)
+{
+	uint64_t start = GetTimeNanoseconds();
+
+	std::vector<std::string> sources;
+	std::string key;
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		sources.push_back(InsertDefines(LoadSource(stages[i].name), defines));
+		char type[32];
+		snprintf(type, sizeof(type), "%x\n", stages[i].type);
+		key += type + sources.back();
+	}
+	key += GetDriverString();
+
+	GLuint program = 0;
+	std::string path;
+	if (!cacheDirectory.empty())
+	{
+		char fileName[32];
+		snprintf(fileName, sizeof(fileName), "/%016llx.bin", HashString(key));
+		path = cacheDirectory + fileName;
+		program = LoadBinary(path, key);
+	}
+
+	if (program != 0)
+	{
+		stats.hits++;
+	}
+	else
+	{
+		program = LinkFromSource(stages, sources);
+		if (!path.empty())
+		{
+			SaveBinary(program, path, key);
+		}
+		stats.misses++;
+	}
+
+	stats.milliseconds += MillisecondsSince(start);
+	return program;
+}
+
+GLuint CProgramCache::LinkFromSource(const std::vector<ShaderStage>& stages, const std::vector<std::string>& sources)
+{
+	//Start the process of setting up our shaders by creating a program ID
+	GLuint shaderProgramID = glCreateProgram();
+	if (shaderProgramID == 0) {
+		fprintf(stderr, "Error creating shader program\n");
+		exit(1);
+	}
+
+	std::vector<GLuint> shaders;
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		// create a shader object
+		GLuint ShaderObj = glCreateShader(stages[i].type);
+		if (ShaderObj == 0) {
+			fprintf(stderr, "Error creating shader type %d\n", stages[i].type);
+			exit(1);
+		}
+
+		// Bind the source code to the shader, this happens before compilation
+		const char* pShaderSource = sources[i].c_str();
+		glShaderSource(ShaderObj, 1, (const GLchar**)&pShaderSource, NULL);
+		// compile the shader and check for errors
+		glCompileShader(ShaderObj);
+		GLint success;
+		glGetShaderiv(ShaderObj, GL_COMPILE_STATUS, &success);
+		if (!success) {
+			GLchar InfoLog[1024];
+			glGetShaderInfoLog(ShaderObj, 1024, NULL, InfoLog);
+			fprintf(stderr, "Error compiling shader %s: '%s'\n", stages[i].name, InfoLog);
+			exit(1);
+		}
+		// Attach the compiled shader object to the program object
+		glAttachShader(shaderProgramID, ShaderObj);
+		shaders.push_back(ShaderObj);
+	}
+
+	GLint Success = 0;
+	GLchar ErrorLog[1024] = { 0 };
+
+	// Ask the driver to keep a binary we can store in the cache
+	glProgramParameteri(shaderProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	// After compiling all shader objects and attaching them to the program, we can finally link it
+	glLinkProgram(shaderProgramID);
+	// check for program related errors using glGetProgramiv
+	glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &Success);
+	if (Success == 0) {
+		glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
+		fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
+		exit(1);
+	}
+
+	// The program keeps the compiled code, the shader objects can go
+	for (size_t i = 0; i < shaders.size(); i++)
+	{
+		glDetachShader(shaderProgramID, shaders[i]);
+		glDeleteShader(shaders[i]);
+	}
+	return shaderProgramID;
+}
+
+GLuint CProgramCache::LoadBinary(const std::string& path, const std::string& key)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	// Header: magic, version, key hash, driver string, binary format, size
+	char magic[4];
+	unsigned int version = 0;
+	unsigned long long hash = 0;
+	unsigned int keySize = 0;
+	bool valid = fread(magic, 1, 4, file) == 4 && memcmp(magic, binaryFileMagic, 4) == 0 &&
+		fread(&version, sizeof(version), 1, file) == 1 && version == binaryFileVersion &&
+		fread(&hash, sizeof(hash), 1, file) == 1 && hash == HashString(key) &&
+		fread(&keySize, sizeof(keySize), 1, file) == 1 && keySize == key.size();
+
+	// The whole key is stored so a hash collision can never load the wrong program
+	std::string storedKey(keySize, '\0');
+	valid = valid && fread(&storedKey[0], 1, keySize, file) == keySize && storedKey == key;
+
+	GLenum format = 0;
+	unsigned int size = 0;
+	valid = valid && fread(&format, sizeof(format), 1, file) == 1 &&
+		fread(&size, sizeof(size), 1, file) == 1 && size > 0;
+
+	std::vector<char> binary(valid ? size : 0);
+	valid = valid && fread(binary.data(), 1, size, file) == size;
+	fclose(file);
+	if (!valid)
+	{
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, binary.data(), (GLsizei)size);
+	GLint success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		// Typically a driver update, the caller rebuilds from source
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void CProgramCache::SaveBinary(GLuint program, const std::string& path, const std::string& key)
+{
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (formats == 0 || size <= 0)
+	{
+		return;
+	}
+
+	std::vector<char> binary(size);
+	GLenum format = 0;
+	glGetProgramBinary(program, size, NULL, &format, binary.data());
+
+	MakeDirectory(cacheDirectory.c_str());
+	// Written under a temporary name so a crash never leaves half a file
+	std::string temporaryPath = path + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if (file == NULL)
+	{
+		return;
+	}
+	unsigned long long hash = HashString(key);
+	unsigned int keySize = (unsigned int)key.size();
+	unsigned int binarySize = (unsigned int)size;
+	bool written = fwrite(binaryFileMagic, 1, 4, file) == 4 &&
+		fwrite(&binaryFileVersion, sizeof(binaryFileVersion), 1, file) == 1 &&
+		fwrite(&hash, sizeof(hash), 1, file) == 1 &&
+		fwrite(&keySize, sizeof(keySize), 1, file) == 1 &&
+		fwrite(key.data(), 1, keySize, file) == keySize &&
+		fwrite(&format, sizeof(format), 1, file) == 1 &&
+		fwrite(&binarySize, sizeof(binarySize), 1, file) == 1 &&
+		fwrite(binary.data(), 1, binarySize, file) == binarySize;
+	fclose(file);
+
+	remove(path.c_str());
+	if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+	{
+		remove(temporaryPath.c_str());
+	}
+}
+
+void ValidateProgram(GLuint program)
+{
+	GLint Success = 0;
+	GLchar ErrorLog[1024] = { 0 };
+
+	// program has been successfully linked but needs to be validated to check whether the program can execute given the current pipeline state
+	glValidateProgram(program);
+	// check for program related errors using glGetProgramiv
+	glGetProgramiv(program, GL_VALIDATE_STATUS, &Success);
+	if (!Success) {
+		glGetProgramInfoLog(program, sizeof(ErrorLog), NULL, ErrorLog);
+		fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
+		exit(1);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "GLHeaders.h"
+#include <string>
+#include <vector>
+
+// One shader of a program, name is a file in src/shaders
+struct ShaderStage
+{
+	GLenum type;
+	const char* name;
+};
+
+struct ProgramCacheStats
+{
+	int hits = 0;
+	int misses = 0;
+	// Time spent in CreateProgram, loading or compiling
+	double milliseconds = 0.0;
+};
+
+// Builds shader programs from the sources embedded in the executable and
+// keeps their glGetProgramBinary output on disk. Binaries are keyed on a
+// hash of the sources, the defines and the driver, and anything that does
+// not match or fails to load is rebuilt from source.
+class CProgramCache
+{
+public:
+	CProgramCache();
+
+	// Where binaries are stored, an empty string disables the cache
+	void SetCacheDirectory(const std::string& directory);
+	// Reads shaders from this directory instead of the embedded copies,
+	// for iterating on them without rebuilding
+	void SetShaderDirectory(const std::string& directory);
+
+	// Links stages with defines inserted after each #version line.
+	// Compile and link errors are fatal, like everywhere else in the renderer.
+	GLuint CreateProgram(const std::vector<ShaderStage>& stages, const std::string& defines = "");
+
+	std::string LoadSource(const char* name);
+	const ProgramCacheStats& GetStats() { return stats; }
+
+private:
+	GLuint LinkFromSource(const std::vector<ShaderStage>& stages, const std::vector<std::string>& sources);
+	GLuint LoadBinary(const std::string& path, const std::string& key);
+	void SaveBinary(GLuint program, const std::string& path, const std::string& key);
+
+	std::string cacheDirectory;
+	std::string shaderDirectory;
+	ProgramCacheStats stats;
+};
+
+// Checks that a linked program can execute in the current pipeline state,
+// exits on failure
+void ValidateProgram(GLuint program);
@@ -0,0 +1,341 @@
+#include "RayPacket.h"
+#include <algorithm>
+#include <float.h>
+
+#ifdef RT_X86
+#include <immintrin.h>
+#endif
+
+void BoxesSoA::Set(const std::vector<Box>& boxes)
+{
+	size_t count = boxes.size();
+	minX.resize(count); minY.resize(count); minZ.resize(count);
+	maxX.resize(count); maxY.resize(count); maxZ.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		minX[i] = boxes[i].min.x; minY[i] = boxes[i].min.y; minZ[i] = boxes[i].min.z;
+		maxX[i] = boxes[i].max.x; maxY[i] = boxes[i].max.y; maxZ[i] = boxes[i].max.z;
+	}
+}
+
+void ResetPacketHits(PacketHits& hits, float maxDistance)
+{
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		hits.tNear[lane] = maxDistance;
+		hits.tFar[lane] = maxDistance;
+		hits.box[lane] = -1;
+	}
+}
+
+// Reference kernel, the hit test is written with selects rather than
+// branches so the compiler is free to vectorise the lane loop
+static void IntersectBoxesPacketScalar(const RayPacket& packet, const BoxesSoA& boxes,
+	int first, int count, PacketHits& hits)
+{
+	for (int i = first; i < first + count; i++)
+	{
+		for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+		{
+			float t0x = (boxes.minX[i] - packet.originX[lane]) * packet.invDirX[lane];
+			float t1x = (boxes.maxX[i] - packet.originX[lane]) * packet.invDirX[lane];
+			float t0y = (boxes.minY[i] - packet.originY[lane]) * packet.invDirY[lane];
+			float t1y = (boxes.maxY[i] - packet.originY[lane]) * packet.invDirY[lane];
+			float t0z = (boxes.minZ[i] - packet.originZ[lane]) * packet.invDirZ[lane];
+			float t1z = (boxes.maxZ[i] - packet.originZ[lane]) * packet.invDirZ[lane];
+			float tNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::min(t0z, t1z));
+			float tFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::max(t0z, t1z));
+
+			bool hit = tNear > 0.0f && tNear < tFar && tNear < hits.tNear[lane];
+			hits.tNear[lane] = hit ? tNear : hits.tNear[lane];
+			hits.tFar[lane] = hit ? tFar : hits.tFar[lane];
+			hits.box[lane] = hit ? i : hits.box[lane];
+		}
+	}
+}
+
+static bool IntersectNodePacketScalar(const RayPacket& packet, const BvhNode& node,
+	const PacketHits& hits, float& tNear)
+{
+	bool any = false;
+	tNear = FLT_MAX;
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		float t0x = (node.min.x - packet.originX[lane]) * packet.invDirX[lane];
+		float t1x = (node.max.x - packet.originX[lane]) * packet.invDirX[lane];
+		float t0y = (node.min.y - packet.originY[lane]) * packet.invDirY[lane];
+		float t1y = (node.max.y - packet.originY[lane]) * packet.invDirY[lane];
+		float t0z = (node.min.z - packet.originZ[lane]) * packet.invDirZ[lane];
+		float t1z = (node.max.z - packet.originZ[lane]) * packet.invDirZ[lane];
+		float laneNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::min(t0z, t1z));
+		float laneFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::max(t0z, t1z));
+
+		bool hit = laneNear <= laneFar && laneFar > 0.0f && laneNear < hits.tNear[lane];
+		any = any || hit;
+		tNear = hit ? std::min(tNear, laneNear) : tNear;
+	}
+	return any;
+}
+
+#ifdef RT_X86
+
+RT_TARGET("sse4.1")
+static void IntersectBoxesPacketSSE4(const RayPacket& packet, const BoxesSoA& boxes,
+	int first, int count, PacketHits& hits)
+{
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane += 4)
+	{
+		__m128 ox = _mm_load_ps(packet.originX + lane);
+		__m128 oy = _mm_load_ps(packet.originY + lane);
+		__m128 oz = _mm_load_ps(packet.originZ + lane);
+		__m128 ix = _mm_load_ps(packet.invDirX + lane);
+		__m128 iy = _mm_load_ps(packet.invDirY + lane);
+		__m128 iz = _mm_load_ps(packet.invDirZ + lane);
+		__m128 zero = _mm_setzero_ps();
+		__m128 bestNear = _mm_load_ps(hits.tNear + lane);
+		__m128 bestFar = _mm_load_ps(hits.tFar + lane);
+		__m128 bestBox = _mm_castsi128_ps(_mm_load_si128((const __m128i*)(hits.box + lane)));
+
+		for (int i = first; i < first + count; i++)
+		{
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxes.minX[i]), ox), ix);
+			__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxes.maxX[i]), ox), ix);
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxes.minY[i]), oy), iy);
+			__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxes.maxY[i]), oy), iy);
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxes.minZ[i]), oz), iz);
+			__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxes.maxZ[i]), oz), iz);
+			__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+			__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+			__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(tNear, zero), _mm_cmplt_ps(tNear, tFar)),
+				_mm_cmplt_ps(tNear, bestNear));
+			bestNear = _mm_blendv_ps(bestNear, tNear, hit);
+			bestFar = _mm_blendv_ps(bestFar, tFar, hit);
+			bestBox = _mm_blendv_ps(bestBox, _mm_castsi128_ps(_mm_set1_epi32(i)), hit);
+		}
+
+		_mm_store_ps(hits.tNear + lane, bestNear);
+		_mm_store_ps(hits.tFar + lane, bestFar);
+		_mm_store_si128((__m128i*)(hits.box + lane), _mm_castps_si128(bestBox));
+	}
+}
+
+RT_TARGET("sse4.1")
+static bool IntersectNodePacketSSE4(const RayPacket& packet, const BvhNode& node,
+	const PacketHits& hits, float& tNear)
+{
+	__m128 minX = _mm_set1_ps(node.min.x), maxX = _mm_set1_ps(node.max.x);
+	__m128 minY = _mm_set1_ps(node.min.y), maxY = _mm_set1_ps(node.max.y);
+	__m128 minZ = _mm_set1_ps(node.min.z), maxZ = _mm_set1_ps(node.max.z);
+	__m128 zero = _mm_setzero_ps();
+	__m128 none = _mm_set1_ps(FLT_MAX);
+	__m128 nearest = none;
+	int mask = 0;
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane += 4)
+	{
+		__m128 ox = _mm_load_ps(packet.originX + lane);
+		__m128 oy = _mm_load_ps(packet.originY + lane);
+		__m128 oz = _mm_load_ps(packet.originZ + lane);
+		__m128 ix = _mm_load_ps(packet.invDirX + lane);
+		__m128 iy = _mm_load_ps(packet.invDirY + lane);
+		__m128 iz = _mm_load_ps(packet.invDirZ + lane);
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(minX, ox), ix);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(maxX, ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(minY, oy), iy);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(maxY, oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(minZ, oz), iz);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(maxZ, oz), iz);
+		__m128 laneNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+		__m128 laneFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+		__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(laneNear, laneFar), _mm_cmpgt_ps(laneFar, zero)),
+			_mm_cmplt_ps(laneNear, _mm_load_ps(hits.tNear + lane)));
+		mask |= _mm_movemask_ps(hit);
+		nearest = _mm_min_ps(nearest, _mm_blendv_ps(none, laneNear, hit));
+	}
+	nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+	nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+	tNear = _mm_cvtss_f32(nearest);
+	return mask != 0;
+}
+
+RT_TARGET("avx2")
+static void IntersectBoxesPacketAVX2(const RayPacket& packet, const BoxesSoA& boxes,
+	int first, int count, PacketHits& hits)
+{
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane += 8)
+	{
+		__m256 ox = _mm256_load_ps(packet.originX + lane);
+		__m256 oy = _mm256_load_ps(packet.originY + lane);
+		__m256 oz = _mm256_load_ps(packet.originZ + lane);
+		__m256 ix = _mm256_load_ps(packet.invDirX + lane);
+		__m256 iy = _mm256_load_ps(packet.invDirY + lane);
+		__m256 iz = _mm256_load_ps(packet.invDirZ + lane);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 bestNear = _mm256_load_ps(hits.tNear + lane);
+		__m256 bestFar = _mm256_load_ps(hits.tFar + lane);
+		__m256i bestBox = _mm256_load_si256((const __m256i*)(hits.box + lane));
+
+		for (int i = first; i < first + count; i++)
+		{
+			__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxes.minX[i]), ox), ix);
+			__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxes.maxX[i]), ox), ix);
+			__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxes.minY[i]), oy), iy);
+			__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxes.maxY[i]), oy), iy);
+			__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxes.minZ[i]), oz), iz);
+			__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxes.maxZ[i]), oz), iz);
+			__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_min_ps(t0z, t1z));
+			__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_max_ps(t0z, t1z));
+
+			__m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(tNear, zero, _CMP_GT_OQ),
+				_mm256_cmp_ps(tNear, tFar, _CMP_LT_OQ)), _mm256_cmp_ps(tNear, bestNear, _CMP_LT_OQ));
+			bestNear = _mm256_blendv_ps(bestNear, tNear, hit);
+			bestFar = _mm256_blendv_ps(bestFar, tFar, hit);
+			bestBox = _mm256_blendv_epi8(bestBox, _mm256_set1_epi32(i), _mm256_castps_si256(hit));
+		}
+
+		_mm256_store_ps(hits.tNear + lane, bestNear);
+		_mm256_store_ps(hits.tFar + lane, bestFar);
+		_mm256_store_si256((__m256i*)(hits.box + lane), bestBox);
+	}
+}
+
+RT_TARGET("avx2")
+static bool IntersectNodePacketAVX2(const RayPacket& packet, const BvhNode& node,
+	const PacketHits& hits, float& tNear)
+{
+	__m256 minX = _mm256_set1_ps(node.min.x), maxX = _mm256_set1_ps(node.max.x);
+	__m256 minY = _mm256_set1_ps(node.min.y), maxY = _mm256_set1_ps(node.max.y);
+	__m256 minZ = _mm256_set1_ps(node.min.z), maxZ = _mm256_set1_ps(node.max.z);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 none = _mm256_set1_ps(FLT_MAX);
+	__m256 nearest = none;
+	int mask = 0;
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane += 8)
+	{
+		__m256 ox = _mm256_load_ps(packet.originX + lane);
+		__m256 oy = _mm256_load_ps(packet.originY + lane);
+		__m256 oz = _mm256_load_ps(packet.originZ + lane);
+		__m256 ix = _mm256_load_ps(packet.invDirX + lane);
+		__m256 iy = _mm256_load_ps(packet.invDirY + lane);
+		__m256 iz = _mm256_load_ps(packet.invDirZ + lane);
+		__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(minX, ox), ix);
+		__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(maxX, ox), ix);
+		__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(minY, oy), iy);
+		__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(maxY, oy), iy);
+		__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(minZ, oz), iz);
+		__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(maxZ, oz), iz);
+		__m256 laneNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_min_ps(t0z, t1z));
+		__m256 laneFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_max_ps(t0z, t1z));
+
+		__m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(laneNear, laneFar, _CMP_LE_OQ),
+			_mm256_cmp_ps(laneFar, zero, _CMP_GT_OQ)),
+			_mm256_cmp_ps(laneNear, _mm256_load_ps(hits.tNear + lane), _CMP_LT_OQ));
+		mask |= _mm256_movemask_ps(hit);
+		nearest = _mm256_min_ps(nearest, _mm256_blendv_ps(none, laneNear, hit));
+	}
+	__m128 half = _mm_min_ps(_mm256_castps256_ps128(nearest), _mm256_extractf128_ps(nearest, 1));
+	half = _mm_min_ps(half, _mm_shuffle_ps(half, half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_min_ps(half, _mm_shuffle_ps(half, half, _MM_SHUFFLE(2, 3, 0, 1)));
+	tNear = _mm_cvtss_f32(half);
+	return mask != 0;
+}
+
+RT_TARGET("avx512f")
+static void IntersectBoxesPacketAVX512(const RayPacket& packet, const BoxesSoA& boxes,
+	int first, int count, PacketHits& hits)
+{
+	__m512 ox = _mm512_load_ps(packet.originX);
+	__m512 oy = _mm512_load_ps(packet.originY);
+	__m512 oz = _mm512_load_ps(packet.originZ);
+	__m512 ix = _mm512_load_ps(packet.invDirX);
+	__m512 iy = _mm512_load_ps(packet.invDirY);
+	__m512 iz = _mm512_load_ps(packet.invDirZ);
+	__m512 zero = _mm512_setzero_ps();
+	__m512 bestNear = _mm512_load_ps(hits.tNear);
+	__m512 bestFar = _mm512_load_ps(hits.tFar);
+	__m512i bestBox = _mm512_load_si512(hits.box);
+
+	for (int i = first; i < first + count; i++)
+	{
+		__m512 t0x = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(boxes.minX[i]), ox), ix);
+		__m512 t1x = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(boxes.maxX[i]), ox), ix);
+		__m512 t0y = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(boxes.minY[i]), oy), iy);
+		__m512 t1y = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(boxes.maxY[i]), oy), iy);
+		__m512 t0z = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(boxes.minZ[i]), oz), iz);
+		__m512 t1z = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(boxes.maxZ[i]), oz), iz);
+		__m512 tNear = _mm512_max_ps(_mm512_max_ps(_mm512_min_ps(t0x, t1x), _mm512_min_ps(t0y, t1y)), _mm512_min_ps(t0z, t1z));
+		__m512 tFar = _mm512_min_ps(_mm512_min_ps(_mm512_max_ps(t0x, t1x), _mm512_max_ps(t0y, t1y)), _mm512_max_ps(t0z, t1z));
+
+		__mmask16 hit = _mm512_cmp_ps_mask(tNear, zero, _CMP_GT_OQ)
+			& _mm512_cmp_ps_mask(tNear, tFar, _CMP_LT_OQ)
+			& _mm512_cmp_ps_mask(tNear, bestNear, _CMP_LT_OQ);
+		bestNear = _mm512_mask_blend_ps(hit, bestNear, tNear);
+		bestFar = _mm512_mask_blend_ps(hit, bestFar, tFar);
+		bestBox = _mm512_mask_blend_epi32(hit, bestBox, _mm512_set1_epi32(i));
+	}
+
+	_mm512_store_ps(hits.tNear, bestNear);
+	_mm512_store_ps(hits.tFar, bestFar);
+	_mm512_store_si512(hits.box, bestBox);
+}
+
+RT_TARGET("avx512f")
+static bool IntersectNodePacketAVX512(const RayPacket& packet, const BvhNode& node,
+	const PacketHits& hits, float& tNear)
+{
+	__m512 ox = _mm512_load_ps(packet.originX);
+	__m512 oy = _mm512_load_ps(packet.originY);
+	__m512 oz = _mm512_load_ps(packet.originZ);
+	__m512 ix = _mm512_load_ps(packet.invDirX);
+	__m512 iy = _mm512_load_ps(packet.invDirY);
+	__m512 iz = _mm512_load_ps(packet.invDirZ);
+	__m512 t0x = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(node.min.x), ox), ix);
+	__m512 t1x = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(node.max.x), ox), ix);
+	__m512 t0y = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(node.min.y), oy), iy);
+	__m512 t1y = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(node.max.y), oy), iy);
+	__m512 t0z = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(node.min.z), oz), iz);
+	__m512 t1z = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(node.max.z), oz), iz);
+	__m512 laneNear = _mm512_max_ps(_mm512_max_ps(_mm512_min_ps(t0x, t1x), _mm512_min_ps(t0y, t1y)), _mm512_min_ps(t0z, t1z));
+	__m512 laneFar = _mm512_min_ps(_mm512_min_ps(_mm512_max_ps(t0x, t1x), _mm512_max_ps(t0y, t1y)), _mm512_max_ps(t0z, t1z));
+
+	__mmask16 hit = _mm512_cmp_ps_mask(laneNear, laneFar, _CMP_LE_OQ)
+		& _mm512_cmp_ps_mask(laneFar, _mm512_setzero_ps(), _CMP_GT_OQ)
+		& _mm512_cmp_ps_mask(laneNear, _mm512_load_ps(hits.tNear), _CMP_LT_OQ);
+	if (hit == 0)
+	{
+		return false;
+	}
+	tNear = _mm512_mask_reduce_min_ps(hit, laneNear);
+	return true;
+}
+
+#endif
+
+IntersectBoxesPacketFunc GetIntersectBoxesPacket(SimdIsa isa)
+{
+#ifdef RT_X86
+	switch (isa)
+	{
+	case SIMD_AVX512: return IntersectBoxesPacketAVX512;
+	case SIMD_AVX2: return IntersectBoxesPacketAVX2;
+	case SIMD_SSE4: return IntersectBoxesPacketSSE4;
+	default: break;
+	}
+#endif
+	return IntersectBoxesPacketScalar;
+}
+
+IntersectNodePacketFunc GetIntersectNodePacket(SimdIsa isa)
+{
+#ifdef RT_X86
+	switch (isa)
+	{
+	case SIMD_AVX512: return IntersectNodePacketAVX512;
+	case SIMD_AVX2: return IntersectNodePacketAVX2;
+	case SIMD_SSE4: return IntersectNodePacketSSE4;
+	default: break;
+	}
+#endif
+	return IntersectNodePacketScalar;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include "Bvh.h"
+#include "CpuFeatures.h"
+#include "Scene.h"
+
+// Rays traced together by the packet kernels, one AVX-512 register wide
+#define RAY_PACKET_SIZE 16
+
+// Boxes as separate component arrays so one box can be broadcast
+// against every ray of a packet
+struct BoxesSoA
+{
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+
+	void Set(const std::vector<Box>& boxes);
+	int Count() const { return (int)minX.size(); }
+};
+
+// Unused lanes must still hold a valid ray, duplicating the last one is fine
+struct RayPacket
+{
+	alignas(64) float originX[RAY_PACKET_SIZE];
+	alignas(64) float originY[RAY_PACKET_SIZE];
+	alignas(64) float originZ[RAY_PACKET_SIZE];
+	// 1 / dir, computed once per ray instead of once per box
+	alignas(64) float invDirX[RAY_PACKET_SIZE];
+	alignas(64) float invDirY[RAY_PACKET_SIZE];
+	alignas(64) float invDirZ[RAY_PACKET_SIZE];
+};
+
+// Closest hit per lane, box is -1 where the ray missed everything
+struct PacketHits
+{
+	alignas(64) float tNear[RAY_PACKET_SIZE];
+	alignas(64) float tFar[RAY_PACKET_SIZE];
+	alignas(64) int box[RAY_PACKET_SIZE];
+};
+
+// No hit yet in any lane, tNear starts at maxDistance
+void ResetPacketHits(PacketHits& hits, float maxDistance);
+
+// Tests boxes first to first + count - 1 against every ray of the packet
+// and keeps the closer hits, box holds the index into boxes
+typedef void (*IntersectBoxesPacketFunc)(const RayPacket& packet, const BoxesSoA& boxes,
+	int first, int count, PacketHits& hits);
+
+// Slab test of one BVH node against the packet. Returns true if any lane
+// reaches the node before its current closest hit, tNear is then the
+// smallest entry distance of those lanes.
+typedef bool (*IntersectNodePacketFunc)(const RayPacket& packet, const BvhNode& node,
+	const PacketHits& hits, float& tNear);
+
+// Kernels for isa, or for the best instruction set below it the build has
+IntersectBoxesPacketFunc GetIntersectBoxesPacket(SimdIsa isa);
+IntersectNodePacketFunc GetIntersectNodePacket(SimdIsa isa);
@@ -0,0 +1,398 @@
+#include "Scene.h"
+#include <algorithm>
+#include <cmath>
+#include <float.h>
+
+// Triangle bounds grow by this fraction of their largest coordinate
+#define TRIANGLE_BOUNDS_PADDING 1e-5f
+
+Transform3x4 Transform3x4::Create(const glm::mat3& linear, glm::vec3 translation)
+{
+	Transform3x4 transform;
+	for (int row = 0; row < 3; row++)
+	{
+		// glm matrices are indexed by column
+		transform.m[row][0] = linear[0][row];
+		transform.m[row][1] = linear[1][row];
+		transform.m[row][2] = linear[2][row];
+		transform.m[row][3] = translation[row];
+	}
+	return transform;
+}
+
+Transform3x4 Transform3x4::Create(glm::vec3 translation, float angleY, float scale)
+{
+	float c = std::cos(angleY) * scale;
+	float s = std::sin(angleY) * scale;
+	glm::mat3 linear(glm::vec3(c, 0.0f, -s), glm::vec3(0.0f, scale, 0.0f), glm::vec3(s, 0.0f, c));
+	return Create(linear, translation);
+}
+
+glm::mat3 Transform3x4::GetLinear() const
+{
+	return glm::mat3(glm::vec3(m[0][0], m[1][0], m[2][0]), glm::vec3(m[0][1], m[1][1], m[2][1]),
+		glm::vec3(m[0][2], m[1][2], m[2][2]));
+}
+
+glm::vec3 Transform3x4::GetTranslation() const
+{
+	return glm::vec3(m[0][3], m[1][3], m[2][3]);
+}
+
+glm::vec3 Transform3x4::TransformPoint(glm::vec3 p) const
+{
+	return TransformDirection(p) + GetTranslation();
+}
+
+glm::vec3 Transform3x4::TransformDirection(glm::vec3 d) const
+{
+	return glm::vec3(m[0][0] * d.x + m[0][1] * d.y + m[0][2] * d.z,
+		m[1][0] * d.x + m[1][1] * d.y + m[1][2] * d.z,
+		m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z);
+}
+
+Transform3x4 Transform3x4::Inverse() const
+{
+	glm::mat3 inverse = glm::inverse(GetLinear());
+	return Create(inverse, -(inverse * GetTranslation()));
+}
+
+// The center moves with the transform, the half extent grows by the
+// absolute value of the linear part
+Box TransformBox(const Transform3x4& transform, const Box& box)
+{
+	glm::vec3 center = transform.TransformPoint((box.min + box.max) * 0.5f);
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; row++)
+	{
+		worldExtent[row] = std::abs(transform.m[row][0]) * extent.x + std::abs(transform.m[row][1]) * extent.y +
+			std::abs(transform.m[row][2]) * extent.z;
+	}
+	Box bounds = { center - worldExtent, center + worldExtent };
+	return bounds;
+}
+
+Box CreateEmptyBox()
+{
+	Box box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+	return box;
+}
+
+bool IsEmptyBox(const Box& box)
+{
+	return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+}
+
+Box PadTriangleBounds(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 magnitude = glm::max(glm::abs(min), glm::abs(max));
+	float pad = std::max(std::max(magnitude.x, magnitude.y), magnitude.z) * TRIANGLE_BOUNDS_PADDING;
+	Box box = { min - glm::vec3(pad), max + glm::vec3(pad) };
+	return box;
+}
+
+Box UnionBox(const Box& a, const Box& b)
+{
+	Box box = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+	return box;
+}
+
+Box SceneVoxels::GetBox(size_t index) const
+{
+	glm::vec3 min = origin + glm::vec3(cells[index]) * size;
+	return { min, min + glm::vec3(size) };
+}
+
+const std::vector<Box>& CScene::GetPrimitiveBounds(std::vector<Box>& bounds) const
+{
+	if (triangles.empty())
+	{
+		return boxes;
+	}
+	bounds.resize(boxes.size() + triangles.size());
+	std::copy(boxes.begin(), boxes.end(), bounds.begin());
+	for (size_t i = 0; i < triangles.size(); i++)
+	{
+		const Triangle& triangle = triangles[i];
+		glm::vec3 v0 = vertices[triangle.v0];
+		glm::vec3 v1 = vertices[triangle.v1];
+		glm::vec3 v2 = vertices[triangle.v2];
+		bounds[boxes.size() + i] = PadTriangleBounds(glm::min(glm::min(v0, v1), v2), glm::max(glm::max(v0, v1), v2));
+	}
+	return bounds;
+}
+
+void CScene::PlaceOnGround(size_t firstVertex, float size)
+{
+	if (firstVertex >= vertices.size())
+	{
+		return;
+	}
+	glm::vec3 min = vertices[firstVertex];
+	glm::vec3 max = min;
+	for (size_t i = firstVertex; i < vertices.size(); i++)
+	{
+		min = glm::min(min, vertices[i]);
+		max = glm::max(max, vertices[i]);
+	}
+	glm::vec3 extent = max - min;
+	float largest = std::max(std::max(extent.x, extent.y), extent.z);
+	float scale = largest > 0.0f ? size / largest : 1.0f;
+	glm::vec3 bottomCenter(0.5f * (min.x + max.x), min.y, 0.5f * (min.z + max.z));
+	for (size_t i = firstVertex; i < vertices.size(); i++)
+	{
+		vertices[i] = (vertices[i] - bottomCenter) * scale;
+	}
+}
+
+CScene CScene::CreateDefault()
+{
+	CScene scene;
+
+	// The ground
+	scene.boxes.push_back({ glm::vec3(-5.0f, -0.1f, -5.0f), glm::vec3(5.0f, 0.0f, 5.0f) });
+	// Box in the middle
+	scene.boxes.push_back({ glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 1.0f, 0.5f) });
+
+	return scene;
+}
+
+CScene CScene::CreateBoxGrid(int countX, int countZ)
+{
+	CScene scene;
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+
+	// Spread the boxes over the ground with a gap of half a box between them
+	float spacing = 10.0f / std::max(countX, countZ);
+	float size = spacing * 0.5f;
+	for (int z = 0; z < countZ; z++)
+	{
+		for (int x = 0; x < countX; x++)
+		{
+			glm::vec3 min(-5.0f + (x + 0.25f) * spacing, 0.0f, -5.0f + (z + 0.25f) * spacing);
+			scene.boxes.push_back({ min, min + glm::vec3(size, size * (1 + (x + z) % 4), size) });
+		}
+	}
+	return scene;
+}
+
+// xorshift32, std::uniform_real_distribution is not the same everywhere
+static float RandomFloat(unsigned int& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+CScene CScene::CreateRandomBoxes(int count, unsigned int seed)
+{
+	CScene scene;
+	scene.boxes.reserve(count + 1);
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+
+	// Boxes shrink as their number grows so the occupied volume stays similar
+	unsigned int state = seed != 0 ? seed : 1;
+	float maxSize = 4.0f / std::cbrt((float)std::max(count, 1));
+	for (int i = 0; i < count; i++)
+	{
+		glm::vec3 min(RandomFloat(state) * 10.0f - 5.0f, RandomFloat(state) * 4.0f,
+			RandomFloat(state) * 10.0f - 5.0f);
+		glm::vec3 size(RandomFloat(state), RandomFloat(state), RandomFloat(state));
+		scene.boxes.push_back({ min, min + (size * 0.9f + 0.1f) * maxSize });
+	}
+	return scene;
+}
+
+CScene CScene::CreateRandomBeams(int count, unsigned int seed)
+{
+	CScene scene;
+	scene.boxes.reserve(count + 1);
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+
+	unsigned int state = seed != 0 ? seed : 1;
+	float thickness = 0.2f / std::sqrt((float)std::max(count, 1) / 1024.0f);
+	for (int i = 0; i < count; i++)
+	{
+		glm::vec3 center(RandomFloat(state) * 10.0f - 5.0f, RandomFloat(state) * 4.0f,
+			RandomFloat(state) * 10.0f - 5.0f);
+		glm::vec3 half(thickness * 0.5f);
+		half[std::min((int)(RandomFloat(state) * 3.0f), 2)] = 0.5f + RandomFloat(state) * 1.5f;
+		scene.boxes.push_back({ center - half, center + half });
+	}
+	return scene;
+}
+
+CScene CScene::CreateBoxSpokes(int spokes, int boxesPerSpoke)
+{
+	CScene scene;
+	scene.boxes.reserve((size_t)spokes * boxesPerSpoke + 1);
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+
+	for (int s = 0; s < spokes; s++)
+	{
+		// Golden angle steps spread the spokes evenly around the center
+		float angle = s * 2.39996f;
+		float height = 0.5f + (s % 7) * 0.4f;
+		for (int i = 0; i < boxesPerSpoke; i++)
+		{
+			float radius = 4.5f * std::pow(0.8f, (float)i);
+			glm::vec3 center(radius * std::cos(angle), height, radius * std::sin(angle));
+			glm::vec3 half(0.2f * radius);
+			scene.boxes.push_back({ center - half, center + half });
+		}
+	}
+	return scene;
+}
+
+// Rolling hills up to a quarter of the terrain's side high, in cubes
+static int VoxelTerrainHeight(int x, int z, int side)
+{
+	float u = (float)x / side * 6.2831853f;
+	float v = (float)z / side * 6.2831853f;
+	float height = 6.0f + 4.0f * std::sin(u * 2.0f) * std::cos(v * 3.0f) + 3.0f * std::sin(u * 5.0f + v * 7.0f) +
+		2.0f * std::cos(u * 11.0f - v * 13.0f);
+	return std::max(1, (int)(height * side / 64.0f));
+}
+
+// Every column runs from its lowest neighbour up to its own height, so the
+// surface is closed and nothing below it is stored. Columns in z, then x
+// order, each from the bottom up.
+static void CreateTerrainVoxels(int side, std::vector<glm::ivec3>& cells)
+{
+	for (int z = 0; z < side; z++)
+	{
+		for (int x = 0; x < side; x++)
+		{
+			int height = VoxelTerrainHeight(x, z, side);
+			int bottom = height - 1;
+			if (x > 0 && z > 0 && x < side - 1 && z < side - 1)
+			{
+				bottom = std::min(bottom, std::min(std::min(VoxelTerrainHeight(x - 1, z, side),
+					VoxelTerrainHeight(x + 1, z, side)), std::min(VoxelTerrainHeight(x, z - 1, side),
+					VoxelTerrainHeight(x, z + 1, side))));
+			}
+			else
+			{
+				bottom = 0;
+			}
+			for (int y = bottom; y < height; y++)
+			{
+				cells.push_back(glm::ivec3(x, y, z));
+			}
+		}
+	}
+}
+
+CScene CScene::CreateVoxelTerrain(int side)
+{
+	CScene scene = CreateSparseVoxelTerrain(side);
+	scene.boxes.reserve(scene.voxels.cells.size() + 1);
+	for (size_t i = 0; i < scene.voxels.cells.size(); i++)
+	{
+		scene.boxes.push_back(scene.voxels.GetBox(i));
+	}
+	scene.voxels = SceneVoxels();
+	return scene;
+}
+
+CScene CScene::CreateSparseVoxelTerrain(int side)
+{
+	CScene scene;
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+	scene.voxels.origin = glm::vec3(-5.0f, 0.0f, -5.0f);
+	scene.voxels.size = 10.0f / side;
+	CreateTerrainVoxels(side, scene.voxels.cells);
+	return scene;
+}
+
+CScene CScene::CreateSphereGrid(int countX, int countZ, int segments)
+{
+	CScene scene;
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+
+	int rings = std::max(segments / 2, 2);
+	segments = std::max(segments, 3);
+	float spacing = 10.0f / std::max(countX, countZ);
+	float radius = spacing * 0.4f;
+	for (int z = 0; z < countZ; z++)
+	{
+		for (int x = 0; x < countX; x++)
+		{
+			glm::vec3 center(-5.0f + (x + 0.5f) * spacing, radius, -5.0f + (z + 0.5f) * spacing);
+			// Both poles, then the rings between them from the top down
+			int first = (int)scene.vertices.size();
+			scene.vertices.push_back(center + glm::vec3(0.0f, radius, 0.0f));
+			scene.vertices.push_back(center - glm::vec3(0.0f, radius, 0.0f));
+			for (int r = 1; r < rings; r++)
+			{
+				float theta = 3.1415927f * r / rings;
+				for (int s = 0; s < segments; s++)
+				{
+					float phi = 6.2831853f * s / segments;
+					scene.vertices.push_back(center + radius * glm::vec3(std::sin(theta) * std::cos(phi),
+						std::cos(theta), std::sin(theta) * std::sin(phi)));
+				}
+			}
+
+			for (int s = 0; s < segments; s++)
+			{
+				int next = (s + 1) % segments;
+				int top = first + 2;
+				int bottom = first + 2 + (rings - 2) * segments;
+				scene.triangles.push_back({ first, top + next, top + s });
+				scene.triangles.push_back({ first + 1, bottom + s, bottom + next });
+				for (int r = 0; r < rings - 2; r++)
+				{
+					int upper = first + 2 + r * segments;
+					int lower = upper + segments;
+					scene.triangles.push_back({ upper + s, upper + next, lower + next });
+					scene.triangles.push_back({ upper + s, lower + next, lower + s });
+				}
+			}
+		}
+	}
+	return scene;
+}
+
+CScene CScene::CreateInstancedGrid(int countX, int countZ)
+{
+	CScene scene;
+	scene.boxes.push_back(CreateDefault().boxes[0]);
+
+	// A tower of shrinking boxes and a block of 4 x 4 columns, both
+	// standing on y = 0 inside [-1, 1] on x and z
+	SceneMesh tower;
+	for (int i = 0; i < 8; i++)
+	{
+		float half = 1.0f - i * 0.1f;
+		tower.boxes.push_back({ glm::vec3(-half, i * 0.5f, -half), glm::vec3(half, i * 0.5f + 0.45f, half) });
+	}
+	SceneMesh columns;
+	for (int z = 0; z < 4; z++)
+	{
+		for (int x = 0; x < 4; x++)
+		{
+			glm::vec3 min(-1.0f + x * 0.5f, 0.0f, -1.0f + z * 0.5f);
+			columns.boxes.push_back({ min, min + glm::vec3(0.3f, 0.5f + 0.25f * ((x * 3 + z) % 5), 0.3f) });
+		}
+	}
+	scene.meshes.push_back(tower);
+	scene.meshes.push_back(columns);
+
+	float spacing = 10.0f / std::max(countX, countZ);
+	for (int z = 0; z < countZ; z++)
+	{
+		for (int x = 0; x < countX; x++)
+		{
+			int cell = z * countX + x;
+			glm::vec3 center(-5.0f + (x + 0.5f) * spacing, 0.0f, -5.0f + (z + 0.5f) * spacing);
+			float angle = cell * 0.618034f * 6.2831853f;
+			float scale = spacing * (0.25f + 0.1f * (cell % 3));
+			SceneInstance instance = { Transform3x4::Create(center, angle, scale), (x + z) % 2 };
+			scene.instances.push_back(instance);
+		}
+	}
+	return scene;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include "glm/glm.hpp"
+
+// Axis aligned box, mirrors 'struct box' in raytracingShader.txt
+struct Box
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Corners of a triangle as indices into CScene::vertices, mirrors
+// 'struct triangle' in raytracingShader.txt
+struct Triangle
+{
+	int v0, v1, v2;
+};
+
+// std430 layout of 'struct box' in raytracingShader.txt, vec3 is 16 byte aligned
+struct GpuBox
+{
+	glm::vec3 min;
+	float pad0;
+	glm::vec3 max;
+	float pad1;
+};
+
+// std430 layout of the vertices in raytracingShader.txt, vec3 is 16 byte aligned
+struct GpuVertex
+{
+	glm::vec3 position;
+	float pad;
+};
+
+// Row major 3x4 affine transform, the last column is the translation
+struct Transform3x4
+{
+	float m[3][4];
+
+	static Transform3x4 Create(const glm::mat3& linear, glm::vec3 translation);
+	// Uniform scale, then a rotation about the y axis, then the translation
+	static Transform3x4 Create(glm::vec3 translation, float angleY, float scale);
+
+	glm::mat3 GetLinear() const;
+	glm::vec3 GetTranslation() const;
+	glm::vec3 TransformPoint(glm::vec3 p) const;
+	// Directions are not normalized, so distances along a ray keep their meaning
+	glm::vec3 TransformDirection(glm::vec3 d) const;
+	Transform3x4 Inverse() const;
+};
+
+// Bounds of a box after transforming it, larger than the box when rotated
+Box TransformBox(const Transform3x4& transform, const Box& box);
+// Bounds of nothing, min above max so that any union replaces them
+Box CreateEmptyBox();
+bool IsEmptyBox(const Box& box);
+Box UnionBox(const Box& a, const Box& b);
+// Bounds of points from min to max on a triangle, widened a little since
+// rounding in the slab tests would otherwise lose rays through edges and
+// corners lying on a node's faces
+Box PadTriangleBounds(const glm::vec3& min, const glm::vec3& max);
+
+// Boxes in object space, shared by every instance that references them
+struct SceneMesh
+{
+	std::vector<Box> boxes;
+};
+
+// One placement of a mesh in the world
+struct SceneInstance
+{
+	Transform3x4 objectToWorld;
+	int mesh;
+};
+
+// Cubes on a lattice, for static worlds too large to store as boxes.
+// Cell x, y, z is the cube from origin + (x, y, z) * size to one size further.
+struct SceneVoxels
+{
+	glm::vec3 origin = glm::vec3(0.0f);
+	float size = 1.0f;
+	std::vector<glm::ivec3> cells;
+
+	Box GetBox(size_t index) const;
+};
+
+class CScene
+{
+public:
+	// World space boxes, traced directly
+	std::vector<Box> boxes;
+	// World space triangles, traced directly as well. Boxes and triangles
+	// share one acceleration structure: primitive i is box i below
+	// boxes.size() and triangle i - boxes.size() from there on.
+	std::vector<glm::vec3> vertices;
+	std::vector<Triangle> triangles;
+	// Geometry reused by instances without copying it into boxes
+	std::vector<SceneMesh> meshes;
+	std::vector<SceneInstance> instances;
+	// Traced through a brick map, see CBrickMap
+	SceneVoxels voxels;
+
+	int GetPrimitiveCount() const { return (int)(boxes.size() + triangles.size()); }
+	// Bounds of every primitive in that order, what acceleration structures
+	// are built over. That is boxes itself without triangles, otherwise
+	// they are gathered in bounds.
+	const std::vector<Box>& GetPrimitiveBounds(std::vector<Box>& bounds) const;
+	// Scales and moves vertices from firstVertex on, keeping their
+	// proportions, so they stand centered on the default ground and fit in
+	// size on every axis. For meshes loaded in units of their own.
+	void PlaceOnGround(size_t firstVertex, float size);
+
+	// The ground and one box, the same as scenes/default.scene
+	static CScene CreateDefault();
+	// The default ground with countX x countZ unit boxes standing on it
+	static CScene CreateBoxGrid(int countX, int countZ);
+	// The default ground with count boxes scattered above it, the same
+	// seed gives the same scene on every platform
+	static CScene CreateRandomBoxes(int count, unsigned int seed);
+	// The default ground with count long thin beams scattered above it,
+	// each along one axis. Beams crossing in every direction make the
+	// children of object partitioning BVH nodes overlap.
+	static CScene CreateRandomBeams(int count, unsigned int seed);
+	// The default ground with spokes lines of boxes converging on its
+	// center, each box a fifth closer and smaller than the one before. The
+	// uneven density makes for deep BVHs.
+	static CScene CreateBoxSpokes(int spokes, int boxesPerSpoke);
+	// Terrain of side x side columns of cubes on the default ground, with
+	// only the cubes that can be seen from outside, like a voxel world
+	static CScene CreateVoxelTerrain(int side);
+	// The same terrain in voxels instead of boxes
+	static CScene CreateSparseVoxelTerrain(int side);
+	// The default ground with countX x countZ spheres of triangles standing
+	// on it, each cut into segments slices around and segments / 2 from
+	// pole to pole
+	static CScene CreateSphereGrid(int countX, int countZ, int segments);
+	// The default ground with countX x countZ instances of two small meshes,
+	// turned and scaled differently in every cell
+	static CScene CreateInstancedGrid(int countX, int countZ);
+};
@@ -0,0 +1,199 @@
+#include "SceneCache.h"
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const char sceneCacheMagic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+// Indexed by SceneCacheSection
+static const uint32_t sceneCacheRecordSizes[SCENE_CACHE_SECTION_COUNT] =
+{
+	sizeof(GpuBox), sizeof(GpuVertex), sizeof(Triangle), sizeof(BvhNode), sizeof(int), sizeof(int)
+};
+
+static uint64_t AlignSectionOffset(uint64_t offset)
+{
+	return (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+}
+
+CSceneCache::CSceneCache()
+	: header(nullptr)
+{
+}
+
+bool CSceneCache::Write(const std::string& path, const CScene& scene, const CBvh& bvh)
+{
+	if (!scene.instances.empty() || !scene.voxels.cells.empty())
+	{
+		fprintf(stderr, "%s: scene caches hold boxes and triangles, not instances or voxels\n", path.c_str());
+		return false;
+	}
+
+	std::vector<GpuBox> boxes(scene.boxes.size(), GpuBox());
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		boxes[i].min = scene.boxes[i].min;
+		boxes[i].max = scene.boxes[i].max;
+	}
+	std::vector<GpuVertex> vertices(scene.vertices.size(), GpuVertex());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		vertices[i].position = scene.vertices[i];
+	}
+	std::vector<int> parents;
+	bvh.ComputeParents(parents);
+	const void* sections[SCENE_CACHE_SECTION_COUNT] =
+	{
+		boxes.data(), vertices.data(), scene.triangles.data(), bvh.nodes.data(), bvh.primIndices.data(), parents.data()
+	};
+	size_t counts[SCENE_CACHE_SECTION_COUNT] =
+	{
+		boxes.size(), vertices.size(), scene.triangles.size(), bvh.nodes.size(), bvh.primIndices.size(), parents.size()
+	};
+
+	SceneCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, sceneCacheMagic, sizeof(header.magic));
+	header.version = SCENE_CACHE_VERSION;
+	header.byteOrder = SCENE_CACHE_BYTE_ORDER;
+	glm::vec3 boundsMin = bvh.nodes.empty() ? glm::vec3(FLT_MAX) : bvh.nodes[0].min;
+	glm::vec3 boundsMax = bvh.nodes.empty() ? glm::vec3(-FLT_MAX) : bvh.nodes[0].max;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		header.boundsMin[axis] = boundsMin[axis];
+		header.boundsMax[axis] = boundsMax[axis];
+	}
+	header.bvhDepth = bvh.GetStats().depth;
+	uint64_t offset = AlignSectionOffset(sizeof(header));
+	for (int i = 0; i < SCENE_CACHE_SECTION_COUNT; i++)
+	{
+		header.sections[i].offset = offset;
+		header.sections[i].count = counts[i];
+		header.sections[i].recordSize = sceneCacheRecordSizes[i];
+		offset = AlignSectionOffset(offset + counts[i] * sceneCacheRecordSizes[i]);
+	}
+	header.fileSize = offset;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	static const char zeros[SCENE_CACHE_ALIGNMENT] = {};
+	uint64_t written = fwrite(&header, 1, sizeof(header), file);
+	for (int i = 0; i < SCENE_CACHE_SECTION_COUNT; i++)
+	{
+		written += fwrite(zeros, 1, (size_t)(header.sections[i].offset - written), file);
+		written += fwrite(sections[i], sceneCacheRecordSizes[i], counts[i], file) * sceneCacheRecordSizes[i];
+	}
+	written += fwrite(zeros, 1, (size_t)(header.fileSize - written), file);
+	bool failed = ferror(file) != 0 || written != header.fileSize;
+	if (fclose(file) != 0 || failed)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CSceneCache::Open(const std::string& path)
+{
+	Close();
+	if (!file.Open(path))
+	{
+		return false;
+	}
+
+	const SceneCacheHeader* candidate = (const SceneCacheHeader*)file.GetData();
+	size_t size = file.GetSize();
+	const char* problem = nullptr;
+	if (size < sizeof(SceneCacheHeader) || memcmp(candidate->magic, sceneCacheMagic, sizeof(sceneCacheMagic)) != 0)
+	{
+		problem = "not a scene cache";
+	}
+	else if (candidate->version != SCENE_CACHE_VERSION)
+	{
+		problem = "written by another version, convert the scene again";
+	}
+	else if (candidate->byteOrder != SCENE_CACHE_BYTE_ORDER)
+	{
+		problem = "written with the other byte order";
+	}
+	else if (candidate->fileSize != size)
+	{
+		problem = "truncated";
+	}
+	for (int i = 0; i < SCENE_CACHE_SECTION_COUNT && problem == nullptr; i++)
+	{
+		const SceneCacheSectionHeader& section = candidate->sections[i];
+		if (section.recordSize != sceneCacheRecordSizes[i])
+		{
+			problem = "records of another size, convert the scene again";
+		}
+		else if (section.offset % SCENE_CACHE_ALIGNMENT != 0 || section.offset > size ||
+			section.count > (size - section.offset) / section.recordSize)
+		{
+			problem = "a section lies outside the file";
+		}
+	}
+	if (problem != nullptr)
+	{
+		fprintf(stderr, "%s: %s\n", path.c_str(), problem);
+		file.Close();
+		return false;
+	}
+	header = candidate;
+	return true;
+}
+
+void CSceneCache::Close()
+{
+	header = nullptr;
+	file.Close();
+}
+
+Box CSceneCache::GetBounds() const
+{
+	Box bounds;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		bounds.min[axis] = header->boundsMin[axis];
+		bounds.max[axis] = header->boundsMax[axis];
+	}
+	return bounds;
+}
+
+void CSceneCache::GetScene(CScene& scene) const
+{
+	scene = CScene();
+	const GpuBox* boxes = GetBoxes();
+	scene.boxes.resize(GetCount(SCENE_CACHE_BOXES));
+	for (size_t i = 0; i < scene.boxes.size(); i++)
+	{
+		scene.boxes[i].min = boxes[i].min;
+		scene.boxes[i].max = boxes[i].max;
+	}
+	const GpuVertex* vertices = GetVertices();
+	scene.vertices.resize(GetCount(SCENE_CACHE_VERTICES));
+	for (size_t i = 0; i < scene.vertices.size(); i++)
+	{
+		scene.vertices[i] = vertices[i].position;
+	}
+	scene.triangles.assign(GetTriangles(), GetTriangles() + GetCount(SCENE_CACHE_TRIANGLES));
+}
+
+void CSceneCache::GetBvh(CBvh& bvh) const
+{
+	bvh.nodes.assign(GetNodes(), GetNodes() + GetCount(SCENE_CACHE_NODES));
+	bvh.primIndices.assign(GetPrimIndices(), GetPrimIndices() + GetCount(SCENE_CACHE_PRIM_INDICES));
+	bvh.levelNodes.clear();
+	bvh.levelStarts.clear();
+	bvh.stats = BvhBuildStats();
+	bvh.stats.nodes = (int)bvh.nodes.size();
+	bvh.stats.leaves = (bvh.stats.nodes + 1) / 2;
+	bvh.stats.depth = header->bvhDepth;
+	bvh.stats.references = (int)bvh.primIndices.size();
+	bvh.stats.sahCost = bvh.ComputeSahCost();
+}
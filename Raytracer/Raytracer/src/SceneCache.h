@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Bvh.h"
+#include "MappedFile.h"
+#include "Scene.h"
+
+// Bump whenever the header or the layout of a record changes, files of
+// other versions are rejected and have to be converted again
+#define SCENE_CACHE_VERSION 1
+// Sections start at multiples of this, records can be used in place
+#define SCENE_CACHE_ALIGNMENT 64
+// Read back in another value when the file was written with the other byte order
+#define SCENE_CACHE_BYTE_ORDER 0x01020304u
+
+// Sections of a scene cache file, in file order
+enum SceneCacheSection
+{
+	// GpuBox, the std430 layout of the shader's boxes
+	SCENE_CACHE_BOXES,
+	// GpuVertex, the std430 layout of the shader's vertices
+	SCENE_CACHE_VERTICES,
+	// Triangle
+	SCENE_CACHE_TRIANGLES,
+	// BvhNode over the boxes, then the triangles, like CBvh::nodes
+	SCENE_CACHE_NODES,
+	// int, like CBvh::primIndices
+	SCENE_CACHE_PRIM_INDICES,
+	// int, the parent of every node for the stackless traversal
+	SCENE_CACHE_PARENTS,
+	SCENE_CACHE_SECTION_COUNT
+};
+
+struct SceneCacheSectionHeader
+{
+	// Bytes from the start of the file
+	uint64_t offset;
+	uint64_t count;
+	// sizeof the record when written, checked against the reader's
+	uint32_t recordSize;
+	uint32_t pad;
+};
+
+// First bytes of a scene cache file
+struct SceneCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	// SCENE_CACHE_BYTE_ORDER in the writer's byte order
+	uint32_t byteOrder;
+	uint64_t fileSize;
+	// Bounds of every primitive, min above max for an empty scene
+	float boundsMin[3];
+	float boundsMax[3];
+	int32_t bvhDepth;
+	int32_t pad;
+	SceneCacheSectionHeader sections[SCENE_CACHE_SECTION_COUNT];
+};
+
+// Scene with its BVH in a binary file, written once by SceneConverter and
+// then mapped into memory on every start. The boxes, vertices, nodes and
+// indices are stored in the std430 layout of the shader's buffers, so the
+// GL backend uploads them from the mapping without parsing or building
+// anything. Only the header is checked when opening, the rest is trusted
+// like any other build output. Instances and voxels are not stored.
+class CSceneCache
+{
+public:
+	CSceneCache();
+
+	// Writes scene and a BVH built over its primitive bounds, prints why on failure
+	static bool Write(const std::string& path, const CScene& scene, const CBvh& bvh);
+
+	// Maps a file written by Write, prints why and stays closed on failure
+	bool Open(const std::string& path);
+	void Close();
+	bool IsOpen() const { return header != nullptr; }
+
+	const GpuBox* GetBoxes() const { return (const GpuBox*)GetSection(SCENE_CACHE_BOXES); }
+	const GpuVertex* GetVertices() const { return (const GpuVertex*)GetSection(SCENE_CACHE_VERTICES); }
+	const Triangle* GetTriangles() const { return (const Triangle*)GetSection(SCENE_CACHE_TRIANGLES); }
+	const BvhNode* GetNodes() const { return (const BvhNode*)GetSection(SCENE_CACHE_NODES); }
+	const int* GetPrimIndices() const { return (const int*)GetSection(SCENE_CACHE_PRIM_INDICES); }
+	const int* GetParents() const { return (const int*)GetSection(SCENE_CACHE_PARENTS); }
+	size_t GetCount(SceneCacheSection section) const { return (size_t)header->sections[section].count; }
+	int GetPrimitiveCount() const
+	{
+		return (int)(GetCount(SCENE_CACHE_BOXES) + GetCount(SCENE_CACHE_TRIANGLES));
+	}
+	Box GetBounds() const;
+
+	// Copies for code that works on a CScene and a CBvh, like the CPU
+	// backend. Still much faster than parsing and building.
+	void GetScene(CScene& scene) const;
+	void GetBvh(CBvh& bvh) const;
+
+private:
+	const char* GetSection(SceneCacheSection section) const { return file.GetData() + header->sections[section].offset; }
+
+	CMappedFile file;
+	const SceneCacheHeader* header;
+};
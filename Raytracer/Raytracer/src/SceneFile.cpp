@@ -0,0 +1,305 @@
+#include "SceneFile.h"
+#include "Platform.h"
+#include <ctype.h>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+int FindChangedRanges(const void* before, const void* after, size_t count, size_t stride,
+	std::vector<ElementRange>& ranges)
+{
+	ranges.clear();
+	const char* a = (const char*)before;
+	const char* b = (const char*)after;
+	int changed = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (memcmp(a + i * stride, b + i * stride, stride) == 0)
+		{
+			continue;
+		}
+		changed++;
+		if (!ranges.empty() && (int)i - ranges.back().end < SCENE_FILE_RANGE_GAP)
+		{
+			ranges.back().end = (int)i + 1;
+		}
+		else
+		{
+			ElementRange range = { (int)i, (int)i + 1 };
+			ranges.push_back(range);
+		}
+	}
+	return changed;
+}
+
+// Next whitespace separated word of a line, empty at its end
+static std::string ReadWord(const char*& cursor)
+{
+	while (isspace((unsigned char)*cursor))
+	{
+		cursor++;
+	}
+	const char* start = cursor;
+	while (*cursor != '\0' && !isspace((unsigned char)*cursor))
+	{
+		cursor++;
+	}
+	return std::string(start, cursor);
+}
+
+static bool ReadCoordinate(const char*& cursor, float& value)
+{
+	std::string word = ReadWord(cursor);
+	char* end = nullptr;
+	value = strtof(word.c_str(), &end);
+	return !word.empty() && *end == '\0' && std::isfinite(value);
+}
+
+static bool ReadId(const char*& cursor, int& value)
+{
+	std::string word = ReadWord(cursor);
+	char* end = nullptr;
+	long id = strtol(word.c_str(), &end, 10);
+	value = (int)id;
+	return !word.empty() && *end == '\0' && id >= 0 && id <= 0x7fffffff;
+}
+
+CSceneFile::CSceneFile()
+{
+}
+
+CSceneFile::FileStamp CSceneFile::GetStamp(const std::string& path)
+{
+	FileStamp fileStamp;
+	struct stat info;
+	if (stat(path.c_str(), &info) == 0)
+	{
+		fileStamp.modified = (int64_t)info.st_mtime * 1000000000;
+#ifdef __linux__
+		fileStamp.modified += info.st_mtim.tv_nsec;
+#endif
+		fileStamp.size = (int64_t)info.st_size;
+	}
+	return fileStamp;
+}
+
+bool CSceneFile::HasChanged() const
+{
+	if (path.empty())
+	{
+		return false;
+	}
+	FileStamp current = GetStamp(path);
+	return current.modified != stamp.modified || current.size != stamp.size;
+}
+
+bool CSceneFile::Parse(const std::string& filePath, CScene& parsed, std::vector<int>& parsedIds) const
+{
+	FILE* file = fopen(filePath.c_str(), "rb");
+	if (file == nullptr)
+	{
+		perror(filePath.c_str());
+		return false;
+	}
+	std::string text;
+	char buffer[65536];
+	size_t bytes;
+	while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		text.append(buffer, bytes);
+	}
+	bool failed = ferror(file) != 0;
+	fclose(file);
+	if (failed)
+	{
+		perror(filePath.c_str());
+		return false;
+	}
+
+	// Boxes and triangles may be mixed in the file, the scene lists every
+	// box first
+	std::vector<int> boxIds, triangleIds;
+	// Line every ID was defined on
+	std::unordered_map<int, int> idLines;
+	size_t start = 0;
+	for (int line = 1; start < text.size(); line++)
+	{
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos)
+		{
+			end = text.size();
+		}
+		std::string content = text.substr(start, end - start);
+		start = end + 1;
+		size_t comment = content.find('#');
+		if (comment != std::string::npos)
+		{
+			content.resize(comment);
+		}
+
+		const char* cursor = content.c_str();
+		std::string keyword = ReadWord(cursor);
+		if (keyword.empty())
+		{
+			continue;
+		}
+		if (keyword != "box" && keyword != "triangle")
+		{
+			fprintf(stderr, "%s:%d: unknown primitive '%s', expected box or triangle\n", filePath.c_str(), line,
+				keyword.c_str());
+			return false;
+		}
+		int id;
+		if (!ReadId(cursor, id))
+		{
+			fprintf(stderr, "%s:%d: %s needs a non-negative integer ID\n", filePath.c_str(), line, keyword.c_str());
+			return false;
+		}
+		bool isBox = keyword == "box";
+		int coordinateCount = isBox ? 6 : 9;
+		float coordinates[9];
+		for (int i = 0; i < coordinateCount; i++)
+		{
+			if (!ReadCoordinate(cursor, coordinates[i]))
+			{
+				fprintf(stderr, "%s:%d: %s needs %d finite coordinates after its ID\n", filePath.c_str(), line,
+					keyword.c_str(), coordinateCount);
+				return false;
+			}
+		}
+		if (!ReadWord(cursor).empty())
+		{
+			fprintf(stderr, "%s:%d: %s has more than %d coordinates\n", filePath.c_str(), line, keyword.c_str(),
+				coordinateCount);
+			return false;
+		}
+		std::unordered_map<int, int>::const_iterator previous = idLines.find(id);
+		if (previous != idLines.end())
+		{
+			fprintf(stderr, "%s:%d: ID %d is already used on line %d\n", filePath.c_str(), line, id,
+				previous->second);
+			return false;
+		}
+		idLines[id] = line;
+
+		if (isBox)
+		{
+			Box box = { glm::vec3(coordinates[0], coordinates[1], coordinates[2]),
+				glm::vec3(coordinates[3], coordinates[4], coordinates[5]) };
+			if (IsEmptyBox(box))
+			{
+				fprintf(stderr, "%s:%d: box min is above its max\n", filePath.c_str(), line);
+				return false;
+			}
+			parsed.boxes.push_back(box);
+			boxIds.push_back(id);
+		}
+		else
+		{
+			int first = (int)parsed.vertices.size();
+			for (int corner = 0; corner < 3; corner++)
+			{
+				parsed.vertices.push_back(glm::vec3(coordinates[corner * 3], coordinates[corner * 3 + 1],
+					coordinates[corner * 3 + 2]));
+			}
+			Triangle triangle = { first, first + 1, first + 2 };
+			parsed.triangles.push_back(triangle);
+			triangleIds.push_back(id);
+		}
+	}
+	parsedIds = boxIds;
+	parsedIds.insert(parsedIds.end(), triangleIds.begin(), triangleIds.end());
+	return true;
+}
+
+bool CSceneFile::Load(const std::string& filePath)
+{
+	path = filePath;
+	// Taken before reading, a write while parsing shows up as another change
+	stamp = GetStamp(path);
+	CScene parsed;
+	std::vector<int> parsedIds;
+	if (!Parse(path, parsed, parsedIds))
+	{
+		return false;
+	}
+	scene = parsed;
+	ids = parsedIds;
+	return true;
+}
+
+bool CSceneFile::Reload(SceneFileChanges& changes)
+{
+	uint64_t start = GetTimeNanoseconds();
+	changes = SceneFileChanges();
+	stamp = GetStamp(path);
+	CScene parsed;
+	std::vector<int> parsedIds;
+	if (!Parse(path, parsed, parsedIds))
+	{
+		return false;
+	}
+
+	// Index before of every primitive now, the same kind of primitive has
+	// to be behind every ID
+	size_t boxCount = scene.boxes.size();
+	bool sameLayout = parsed.boxes.size() == boxCount && parsed.triangles.size() == scene.triangles.size();
+	std::vector<int> order(parsedIds.size());
+	if (sameLayout)
+	{
+		std::unordered_map<int, int> indices;
+		for (size_t i = 0; i < ids.size(); i++)
+		{
+			indices[ids[i]] = (int)i;
+		}
+		for (size_t i = 0; i < parsedIds.size() && sameLayout; i++)
+		{
+			std::unordered_map<int, int>::const_iterator before = indices.find(parsedIds[i]);
+			sameLayout = before != indices.end() && (before->second < (int)boxCount) == (i < boxCount);
+			order[i] = sameLayout ? before->second : -1;
+		}
+	}
+	if (!sameLayout)
+	{
+		scene = parsed;
+		ids = parsedIds;
+		changes.changedPrimitives.push_back({ 0, scene.GetPrimitiveCount() });
+		changes.changedCount = scene.GetPrimitiveCount();
+		changes.milliseconds = MillisecondsSince(start);
+		return true;
+	}
+
+	// Back in the order before, so only the primitives that changed differ.
+	// Triangle t keeps vertices 3t to 3t + 2, the triangles stay as they are.
+	CScene reordered = scene;
+	for (size_t i = 0; i < boxCount; i++)
+	{
+		reordered.boxes[order[i]] = parsed.boxes[i];
+	}
+	for (size_t t = 0; t < parsed.triangles.size(); t++)
+	{
+		size_t to = order[boxCount + t] - boxCount;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			reordered.vertices[to * 3 + corner] = parsed.vertices[t * 3 + corner];
+		}
+	}
+	std::vector<ElementRange> triangleRanges;
+	changes.sameLayout = true;
+	changes.changedCount = FindChangedRanges(scene.boxes.data(), reordered.boxes.data(), boxCount, sizeof(Box),
+		changes.changedPrimitives);
+	changes.changedCount += FindChangedRanges(scene.vertices.data(), reordered.vertices.data(),
+		scene.triangles.size(), 3 * sizeof(glm::vec3), triangleRanges);
+	for (size_t i = 0; i < triangleRanges.size(); i++)
+	{
+		ElementRange range = { triangleRanges[i].first + (int)boxCount, triangleRanges[i].end + (int)boxCount };
+		changes.changedPrimitives.push_back(range);
+	}
+	scene = reordered;
+	changes.milliseconds = MillisecondsSince(start);
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+// Changed elements closer than this are uploaded as one range, a few
+// unchanged elements cost less than another glBufferSubData call
+#define SCENE_FILE_RANGE_GAP 8
+
+// Elements first up to end
+struct ElementRange
+{
+	int first;
+	int end;
+};
+
+// Ranges of the count elements of stride bytes that differ between before
+// and after, in ascending order. Returns how many elements differ.
+int FindChangedRanges(const void* before, const void* after, size_t count, size_t stride,
+	std::vector<ElementRange>& ranges);
+
+// What CSceneFile::Reload() found
+struct SceneFileChanges
+{
+	// Every ID is still there with the same kind of primitive. The scene
+	// kept the order of the load before, so every primitive kept its index,
+	// and only changedPrimitives differ. Otherwise the scene is in file
+	// order and one range covers everything.
+	bool sameLayout = false;
+	std::vector<ElementRange> changedPrimitives;
+	// Primitives that differ, the ranges also span short runs of unchanged ones
+	int changedCount = 0;
+	double milliseconds = 0.0;
+};
+
+// Text scene description, one primitive per line:
+//   box <id> <min x y z> <max x y z>
+//   triangle <id> <x y z> <x y z> <x y z>
+// # starts a comment. IDs are unique non-negative integers that identify a
+// primitive across edits of the file, so a reload can tell which ones
+// moved. Every triangle has three vertices of its own, triangle t uses
+// vertices 3t to 3t + 2.
+class CSceneFile
+{
+public:
+	CSceneFile();
+
+	// Prints file:line and what is wrong on failure, the scene loaded
+	// before stays
+	bool Load(const std::string& path);
+	// Loads the same file again and compares it with the scene before
+	bool Reload(SceneFileChanges& changes);
+	// The file was written since the last Load() or Reload(), also after
+	// one that failed
+	bool HasChanged() const;
+
+	const std::string& GetPath() const { return path; }
+	const CScene& GetScene() const { return scene; }
+	// ID of every primitive, numbered like in CScene
+	const std::vector<int>& GetIds() const { return ids; }
+
+private:
+	struct FileStamp
+	{
+		int64_t modified = 0;
+		int64_t size = -1;
+	};
+
+	static FileStamp GetStamp(const std::string& path);
+	bool Parse(const std::string& filePath, CScene& parsed, std::vector<int>& parsedIds) const;
+
+	std::string path;
+	FileStamp stamp;
+	CScene scene;
+	std::vector<int> ids;
+};
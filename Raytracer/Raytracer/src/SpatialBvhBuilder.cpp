@@ -0,0 +1,571 @@
+#include "SpatialBvhBuilder.h"
+#include "Platform.h"
+#include <algorithm>
+#include <float.h>
+
+// Bins per axis of both split searches, more than CBvh::Build since the
+// build time matters less here
+#define SBVH_BINS 32
+// Like in Bvh.cpp, larger leaves are split even when the SAH says it does not pay
+#define SBVH_MAX_LEAF_SIZE 8
+// Spatial splits are only tried where the children of the best object split
+// overlap by more than this fraction of the root's area
+#define SBVH_OVERLAP_THRESHOLD 1e-5f
+// Corners of a triangle clipped to its reference's bounds and one more plane
+#define SBVH_MAX_CORNERS 10
+
+// Same costs as CBvh::Build
+static const float traversalCost = 1.0f;
+static const float intersectionCost = 1.0f;
+
+static Box EmptyBox()
+{
+	Box box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+	return box;
+}
+
+static void GrowBox(Box& box, const Box& other)
+{
+	box.min = glm::min(box.min, other.min);
+	box.max = glm::max(box.max, other.max);
+}
+
+static void GrowBox(Box& box, const glm::vec3& point)
+{
+	box.min = glm::min(box.min, point);
+	box.max = glm::max(box.max, point);
+}
+
+static float BoxArea(const Box& box)
+{
+	return BoxSurfaceArea(box.min, box.max);
+}
+
+struct SpatialBin
+{
+	Box bounds = EmptyBox();
+	// References starting and ending in this bin
+	int enter = 0;
+	int exit = 0;
+};
+
+CSpatialBvhBuilder::CSpatialBvhBuilder()
+	: duplicationBudget(0.3f)
+{
+}
+
+void CSpatialBvhBuilder::SetDuplicationBudget(float fraction)
+{
+	duplicationBudget = std::max(fraction, 0.0f);
+}
+
+// Sutherland-Hodgman: the part of a convex polygon of count corners at or
+// below position on axis, or at or above it. Returns its corner count,
+// at most one more than count.
+static int ClipPolygon(const glm::vec3* polygon, int count, int axis, float position, bool below, glm::vec3* clipped)
+{
+	int clippedCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const glm::vec3& a = polygon[i];
+		const glm::vec3& b = polygon[(i + 1) % count];
+		bool aInside = below ? a[axis] <= position : a[axis] >= position;
+		bool bInside = below ? b[axis] <= position : b[axis] >= position;
+		if (aInside)
+		{
+			clipped[clippedCount++] = a;
+		}
+		if (aInside != bInside)
+		{
+			glm::vec3 crossing = a + (b - a) * ((position - a[axis]) / (b[axis] - a[axis]));
+			crossing[axis] = position;
+			clipped[clippedCount++] = crossing;
+		}
+	}
+	return clippedCount;
+}
+
+// Bounds of a clipped part of a triangle, padded like the triangle's own
+// bounds against rounding in the crossings but never beyond side. Empty
+// without corners.
+static Box BoundPolygon(const glm::vec3* polygon, int count, const Box& side)
+{
+	if (count == 0)
+	{
+		return EmptyBox();
+	}
+	glm::vec3 min = polygon[0];
+	glm::vec3 max = polygon[0];
+	for (int i = 1; i < count; i++)
+	{
+		min = glm::min(min, polygon[i]);
+		max = glm::max(max, polygon[i]);
+	}
+	Box part = PadTriangleBounds(min, max);
+	part.min = glm::max(part.min, side.min);
+	part.max = glm::min(part.max, side.max);
+	return part;
+}
+
+// Box clipped to either side of a plane
+static void SplitBox(const Box& bounds, int axis, float position, Box& left, Box& right)
+{
+	float clamped = std::min(std::max(position, bounds.min[axis]), bounds.max[axis]);
+	left = bounds;
+	right = bounds;
+	left.max[axis] = clamped;
+	right.min[axis] = clamped;
+}
+
+// Corners of the triangle of a reference clipped to the reference's
+// bounds, 0 for a box. polygon holds SBVH_MAX_CORNERS.
+int CSpatialBvhBuilder::ClipTriangle(const Reference& reference, glm::vec3* polygon) const
+{
+	int triangleIndex = reference.prim - (int)scene->boxes.size();
+	if (triangleIndex < 0)
+	{
+		return 0;
+	}
+	const Triangle& triangle = scene->triangles[triangleIndex];
+	glm::vec3 clipped[SBVH_MAX_CORNERS];
+	polygon[0] = scene->vertices[triangle.v0];
+	polygon[1] = scene->vertices[triangle.v1];
+	polygon[2] = scene->vertices[triangle.v2];
+	int count = 3;
+	for (int a = 0; a < 3 && count > 0; a++)
+	{
+		count = ClipPolygon(polygon, count, a, reference.bounds.min[a], false, clipped);
+		count = ClipPolygon(clipped, count, a, reference.bounds.max[a], true, polygon);
+	}
+	return count;
+}
+
+// Splits a reference at a plane into the bounds of its parts on either
+// side. A box part is the box clipped to that side. A triangle is clipped
+// as a polygon to the reference's bounds and then to each side, which
+// leaves much smaller parts than clipping its bounds when it runs
+// diagonally. Either part of a triangle may come out empty.
+void CSpatialBvhBuilder::SplitReference(const Reference& reference, int axis, float position,
+	Box& left, Box& right) const
+{
+	Box leftBox, rightBox;
+	SplitBox(reference.bounds, axis, position, leftBox, rightBox);
+	left = leftBox;
+	right = rightBox;
+	if (reference.prim < (int)scene->boxes.size())
+	{
+		return;
+	}
+	glm::vec3 polygon[SBVH_MAX_CORNERS];
+	glm::vec3 part[SBVH_MAX_CORNERS];
+	int count = ClipTriangle(reference, polygon);
+	float plane = leftBox.max[axis];
+	left = BoundPolygon(part, ClipPolygon(polygon, count, axis, plane, true, part), leftBox);
+	right = BoundPolygon(part, ClipPolygon(polygon, count, axis, plane, false, part), rightBox);
+}
+
+void CSpatialBvhBuilder::Build(const CScene& scene, CBvh& bvh)
+{
+	uint64_t start = GetTimeNanoseconds();
+	this->scene = &scene;
+	std::vector<Box> primitiveBounds;
+	const std::vector<Box>& boxes = scene.GetPrimitiveBounds(primitiveBounds);
+	int count = (int)boxes.size();
+	bvh.stats = BvhBuildStats();
+	bvh.nodes.clear();
+	bvh.primIndices.clear();
+	bvh.levelNodes.clear();
+	bvh.levelStarts.clear();
+	if (count == 0)
+	{
+		bvh.stats.milliseconds = MillisecondsSince(start);
+		return;
+	}
+
+	std::vector<Reference> references(count);
+	Box rootBounds = EmptyBox();
+	for (int i = 0; i < count; i++)
+	{
+		references[i].bounds = boxes[i];
+		references[i].prim = i;
+		GrowBox(rootBounds, boxes[i]);
+	}
+	referencesLeft = (int)(count * duplicationBudget);
+	rootArea = BoxArea(rootBounds);
+
+	size_t maxReferences = (size_t)count + referencesLeft;
+	bvh.nodes.reserve(2 * maxReferences - 1);
+	bvh.primIndices.reserve(maxReferences);
+	BvhNode root;
+	root.min = rootBounds.min;
+	root.max = rootBounds.max;
+	root.leftOrFirst = 0;
+	root.count = 0;
+	bvh.nodes.push_back(root);
+	Subdivide(0, references, 1, bvh);
+
+	bvh.stats.nodes = (int)bvh.nodes.size();
+	bvh.stats.leaves = (bvh.stats.nodes + 1) / 2;
+	bvh.stats.references = (int)bvh.primIndices.size();
+	bvh.stats.sahCost = bvh.ComputeSahCost();
+	bvh.stats.milliseconds = MillisecondsSince(start);
+}
+
+void CSpatialBvhBuilder::Subdivide(int nodeIndex, std::vector<Reference>& references, int depth, CBvh& bvh)
+{
+	bvh.stats.depth = std::max(bvh.stats.depth, depth);
+	int count = (int)references.size();
+	Box nodeBounds = { bvh.nodes[nodeIndex].min, bvh.nodes[nodeIndex].max };
+	if (count > 1 && depth < BVH_MAX_DEPTH)
+	{
+		Split split;
+		FindObjectSplit(nodeBounds, references, split);
+		if (referencesLeft > 0)
+		{
+			Box overlap = { glm::max(split.left.min, split.right.min), glm::min(split.left.max, split.right.max) };
+			if (split.axis < 0 || BoxArea(overlap) > SBVH_OVERLAP_THRESHOLD * rootArea)
+			{
+				Split spatial;
+				FindSpatialSplit(nodeBounds, references, spatial);
+				if (spatial.cost < split.cost)
+				{
+					split = spatial;
+				}
+			}
+		}
+
+		if (split.axis >= 0 && (split.cost < count * intersectionCost || count > SBVH_MAX_LEAF_SIZE))
+		{
+			std::vector<Reference> left, right;
+			int duplicates = 0;
+			if (split.spatial)
+			{
+				PartitionSpatial(split, references, left, right, duplicates);
+			}
+			else
+			{
+				PartitionObjects(split, references, left, right);
+			}
+
+			if (!left.empty() && !right.empty())
+			{
+				referencesLeft -= duplicates;
+				// Only the children's references are needed further down
+				std::vector<Reference>().swap(references);
+
+				int first = (int)bvh.nodes.size();
+				std::vector<Reference>* sides[2] = { &left, &right };
+				for (int side = 0; side < 2; side++)
+				{
+					Box bounds = EmptyBox();
+					for (size_t i = 0; i < sides[side]->size(); i++)
+					{
+						GrowBox(bounds, (*sides[side])[i].bounds);
+					}
+					BvhNode child;
+					child.min = bounds.min;
+					child.max = bounds.max;
+					child.leftOrFirst = 0;
+					child.count = 0;
+					bvh.nodes.push_back(child);
+				}
+				bvh.nodes[nodeIndex].leftOrFirst = first;
+				bvh.nodes[nodeIndex].count = 0;
+				Subdivide(first, left, depth + 1, bvh);
+				Subdivide(first + 1, right, depth + 1, bvh);
+				return;
+			}
+		}
+	}
+
+	BvhNode& node = bvh.nodes[nodeIndex];
+	node.leftOrFirst = (int)bvh.primIndices.size();
+	node.count = count;
+	for (int i = 0; i < count; i++)
+	{
+		bvh.primIndices.push_back(references[i].prim);
+	}
+}
+
+// Binned SAH over the centroids of the references like CBvh::FindBestSplit,
+// also keeping the bounds of both children of the best split
+void CSpatialBvhBuilder::FindObjectSplit(const Box& nodeBounds, const std::vector<Reference>& references, Split& split) const
+{
+	split.cost = FLT_MAX;
+	split.axis = -1;
+	split.position = 0.0f;
+	split.spatial = false;
+	split.left = EmptyBox();
+	split.right = EmptyBox();
+
+	Box centroidBounds = EmptyBox();
+	for (size_t i = 0; i < references.size(); i++)
+	{
+		glm::vec3 centroid = (references[i].bounds.min + references[i].bounds.max) * 0.5f;
+		centroidBounds.min = glm::min(centroidBounds.min, centroid);
+		centroidBounds.max = glm::max(centroidBounds.max, centroid);
+	}
+
+	float nodeArea = BoxArea(nodeBounds);
+	float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+	for (int a = 0; a < 3; a++)
+	{
+		float extent = centroidBounds.max[a] - centroidBounds.min[a];
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		Box bins[SBVH_BINS];
+		int counts[SBVH_BINS] = {};
+		for (int b = 0; b < SBVH_BINS; b++)
+		{
+			bins[b] = EmptyBox();
+		}
+		float scale = SBVH_BINS / extent;
+		for (size_t i = 0; i < references.size(); i++)
+		{
+			const Box& bounds = references[i].bounds;
+			float centroid = (bounds.min[a] + bounds.max[a]) * 0.5f;
+			int bin = std::min(SBVH_BINS - 1, (int)((centroid - centroidBounds.min[a]) * scale));
+			GrowBox(bins[bin], bounds);
+			counts[bin]++;
+		}
+
+		Box leftBounds[SBVH_BINS - 1];
+		int leftCount[SBVH_BINS - 1];
+		Box bounds = EmptyBox();
+		int sum = 0;
+		for (int b = 0; b < SBVH_BINS - 1; b++)
+		{
+			sum += counts[b];
+			GrowBox(bounds, bins[b]);
+			leftCount[b] = sum;
+			leftBounds[b] = bounds;
+		}
+		bounds = EmptyBox();
+		sum = 0;
+		for (int b = SBVH_BINS - 1; b > 0; b--)
+		{
+			sum += counts[b];
+			GrowBox(bounds, bins[b]);
+			if (leftCount[b - 1] == 0 || sum == 0)
+			{
+				continue;
+			}
+			float cost = traversalCost + intersectionCost *
+				(leftCount[b - 1] * BoxArea(leftBounds[b - 1]) + sum * BoxArea(bounds)) * invNodeArea;
+			if (cost < split.cost)
+			{
+				split.cost = cost;
+				split.axis = a;
+				split.position = centroidBounds.min[a] + b / scale;
+				split.left = leftBounds[b - 1];
+				split.right = bounds;
+			}
+		}
+	}
+}
+
+// Bins the references by the space they cover instead of their centroids.
+// A reference spanning several bins adds its clipped parts to each of them.
+void CSpatialBvhBuilder::FindSpatialSplit(const Box& nodeBounds, const std::vector<Reference>& references, Split& split) const
+{
+	split.cost = FLT_MAX;
+	split.axis = -1;
+	split.position = 0.0f;
+	split.spatial = true;
+	split.left = EmptyBox();
+	split.right = EmptyBox();
+
+	float nodeArea = BoxArea(nodeBounds);
+	float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+	for (int a = 0; a < 3; a++)
+	{
+		float origin = nodeBounds.min[a];
+		float extent = nodeBounds.max[a] - origin;
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		SpatialBin bins[SBVH_BINS];
+		float scale = SBVH_BINS / extent;
+		float binWidth = extent / SBVH_BINS;
+		for (size_t i = 0; i < references.size(); i++)
+		{
+			const Reference& reference = references[i];
+			Box rest = reference.bounds;
+			int first = std::min(std::max((int)((rest.min[a] - origin) * scale), 0), SBVH_BINS - 1);
+			int last = std::min(std::max((int)((rest.max[a] - origin) * scale), first), SBVH_BINS - 1);
+			if (reference.prim >= (int)scene->boxes.size() && first < last)
+			{
+				// The clipped triangle's corners go to their bins, and every
+				// edge adds where it crosses a bin border to both bins
+				glm::vec3 polygon[SBVH_MAX_CORNERS];
+				int cornerBins[SBVH_MAX_CORNERS];
+				int corners = ClipTriangle(reference, polygon);
+				for (int c = 0; c < corners; c++)
+				{
+					cornerBins[c] = std::min(std::max((int)((polygon[c][a] - origin) * scale), first), last);
+					GrowBox(bins[cornerBins[c]].bounds, polygon[c]);
+				}
+				for (int c = 0; c < corners; c++)
+				{
+					const glm::vec3& p = polygon[c];
+					const glm::vec3& q = polygon[(c + 1) % corners];
+					int lo = std::min(cornerBins[c], cornerBins[(c + 1) % corners]);
+					int hi = std::max(cornerBins[c], cornerBins[(c + 1) % corners]);
+					for (int border = lo + 1; border <= hi; border++)
+					{
+						float plane = origin + border * binWidth;
+						glm::vec3 crossing = p + (q - p) * ((plane - p[a]) / (q[a] - p[a]));
+						crossing[a] = plane;
+						GrowBox(bins[border - 1].bounds, crossing);
+						GrowBox(bins[border].bounds, crossing);
+					}
+				}
+			}
+			else
+			{
+				for (int b = first; b < last; b++)
+				{
+					Box part;
+					SplitBox(rest, a, origin + (b + 1) * binWidth, part, rest);
+					GrowBox(bins[b].bounds, part);
+				}
+				GrowBox(bins[last].bounds, rest);
+			}
+			bins[first].enter++;
+			bins[last].exit++;
+		}
+
+		Box leftBounds[SBVH_BINS - 1];
+		int leftCount[SBVH_BINS - 1];
+		Box bounds = EmptyBox();
+		int sum = 0;
+		for (int b = 0; b < SBVH_BINS - 1; b++)
+		{
+			sum += bins[b].enter;
+			GrowBox(bounds, bins[b].bounds);
+			leftCount[b] = sum;
+			leftBounds[b] = bounds;
+		}
+		bounds = EmptyBox();
+		sum = 0;
+		for (int b = SBVH_BINS - 1; b > 0; b--)
+		{
+			sum += bins[b].exit;
+			GrowBox(bounds, bins[b].bounds);
+			if (leftCount[b - 1] == 0 || sum == 0)
+			{
+				continue;
+			}
+			float cost = traversalCost + intersectionCost *
+				(leftCount[b - 1] * BoxArea(leftBounds[b - 1]) + sum * BoxArea(bounds)) * invNodeArea;
+			if (cost < split.cost)
+			{
+				split.cost = cost;
+				split.axis = a;
+				split.position = origin + b * binWidth;
+				split.left = leftBounds[b - 1];
+				split.right = bounds;
+			}
+		}
+	}
+}
+
+void CSpatialBvhBuilder::PartitionObjects(const Split& split, const std::vector<Reference>& references,
+	std::vector<Reference>& left, std::vector<Reference>& right) const
+{
+	for (size_t i = 0; i < references.size(); i++)
+	{
+		const Box& bounds = references[i].bounds;
+		if ((bounds.min[split.axis] + bounds.max[split.axis]) * 0.5f < split.position)
+		{
+			left.push_back(references[i]);
+		}
+		else
+		{
+			right.push_back(references[i]);
+		}
+	}
+}
+
+// References straddling the plane are split in two, unless moving them
+// whole to one side is cheaper or the budget ran out. This unsplitting
+// keeps small boxes that barely cross the plane from being duplicated.
+void CSpatialBvhBuilder::PartitionSpatial(const Split& split, const std::vector<Reference>& references,
+	std::vector<Reference>& left, std::vector<Reference>& right, int& duplicates) const
+{
+	int axis = split.axis;
+	float position = split.position;
+	int leftCount = 0;
+	int rightCount = 0;
+	for (size_t i = 0; i < references.size(); i++)
+	{
+		const Box& bounds = references[i].bounds;
+		leftCount += bounds.min[axis] < position || bounds.max[axis] <= position ? 1 : 0;
+		rightCount += bounds.max[axis] > position ? 1 : 0;
+	}
+
+	Box leftBounds = split.left;
+	Box rightBounds = split.right;
+	for (size_t i = 0; i < references.size(); i++)
+	{
+		const Reference& reference = references[i];
+		if (reference.bounds.max[axis] <= position)
+		{
+			left.push_back(reference);
+			continue;
+		}
+		if (reference.bounds.min[axis] >= position)
+		{
+			right.push_back(reference);
+			continue;
+		}
+
+		Box wholeLeft = leftBounds;
+		Box wholeRight = rightBounds;
+		GrowBox(wholeLeft, reference.bounds);
+		GrowBox(wholeRight, reference.bounds);
+		float splitCost = BoxArea(leftBounds) * leftCount + BoxArea(rightBounds) * rightCount;
+		float leftCost = BoxArea(wholeLeft) * leftCount + BoxArea(rightBounds) * (rightCount - 1);
+		float rightCost = BoxArea(leftBounds) * (leftCount - 1) + BoxArea(wholeRight) * rightCount;
+		if (duplicates < referencesLeft && splitCost < std::min(leftCost, rightCost))
+		{
+			Reference leftPart = reference;
+			Reference rightPart = reference;
+			SplitReference(reference, axis, position, leftPart.bounds, rightPart.bounds);
+			// Only the bounds of a triangle may reach across the plane
+			if (IsEmptyBox(leftPart.bounds))
+			{
+				right.push_back(rightPart);
+				leftCount--;
+			}
+			else if (IsEmptyBox(rightPart.bounds))
+			{
+				left.push_back(leftPart);
+				rightCount--;
+			}
+			else
+			{
+				left.push_back(leftPart);
+				right.push_back(rightPart);
+				duplicates++;
+			}
+		}
+		else if (leftCost <= rightCost)
+		{
+			left.push_back(reference);
+			leftBounds = wholeLeft;
+			rightCount--;
+		}
+		else
+		{
+			right.push_back(reference);
+			rightBounds = wholeRight;
+			leftCount--;
+		}
+	}
+}
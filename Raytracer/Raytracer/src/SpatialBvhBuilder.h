@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include "Bvh.h"
+#include "Scene.h"
+
+// Spatial split BVH after Stich et al., "Spatial Splits in Bounding Volume
+// Hierarchies". Besides partitioning the primitives like CBvh::Build, a
+// node may cut space with a plane and reference the primitives straddling
+// it from both children, each part bounded on its side, so large primitives
+// stop inflating the nodes around them. Builds into the same node layout as
+// CBvh::Build over CScene::GetPrimitiveBounds(), but CBvh::primIndices may
+// list a primitive in several leaves. Builds are several times slower, it
+// is meant for static scenes.
+class CSpatialBvhBuilder
+{
+public:
+	CSpatialBvhBuilder();
+
+	// References spatial splits may add, as a fraction of the box count.
+	// Once they are used up the remaining nodes only get object splits.
+	void SetDuplicationBudget(float fraction);
+	float GetDuplicationBudget() const { return duplicationBudget; }
+
+	void Build(const CScene& scene, CBvh& bvh);
+
+private:
+	// Part of a primitive, its bounds clipped by the spatial splits above it
+	struct Reference
+	{
+		Box bounds;
+		int prim;
+	};
+
+	struct Split
+	{
+		float cost;
+		int axis;
+		float position;
+		bool spatial;
+		// Bounds of both children
+		Box left;
+		Box right;
+	};
+
+	int ClipTriangle(const Reference& reference, glm::vec3* polygon) const;
+	void SplitReference(const Reference& reference, int axis, float position, Box& left, Box& right) const;
+	void Subdivide(int nodeIndex, std::vector<Reference>& references, int depth, CBvh& bvh);
+	void FindObjectSplit(const Box& nodeBounds, const std::vector<Reference>& references, Split& split) const;
+	void FindSpatialSplit(const Box& nodeBounds, const std::vector<Reference>& references, Split& split) const;
+	void PartitionObjects(const Split& split, const std::vector<Reference>& references,
+		std::vector<Reference>& left, std::vector<Reference>& right) const;
+	// Counts the references it split in duplicates
+	void PartitionSpatial(const Split& split, const std::vector<Reference>& references,
+		std::vector<Reference>& left, std::vector<Reference>& right, int& duplicates) const;
+
+	float duplicationBudget;
+	// Scene of the build running, its triangles are clipped exactly
+	const CScene* scene = nullptr;
+	// References the build may still add, and the root's area the overlap
+	// of object splits is measured against
+	int referencesLeft = 0;
+	float rootArea = 0.0f;
+};
@@ -0,0 +1,369 @@
+#include "TileScheduler.h"
+#include "Platform.h"
+#include <algorithm>
+
+void CWorkStealingDeque::Reset(int capacity)
+{
+	int size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+	if (size > mask + 1 || !buffer)
+	{
+		buffer.reset(new std::atomic<int>[size]);
+		mask = size - 1;
+	}
+	top.store(0, std::memory_order_relaxed);
+	bottom.store(0, std::memory_order_relaxed);
+}
+
+// Memory orderings follow Le et al., "Correct and Efficient Work-Stealing
+// for Weak Memory Models" (PPoPP 2013)
+void CWorkStealingDeque::Push(int tile)
+{
+	int b = bottom.load(std::memory_order_relaxed);
+	buffer[b & mask].store(tile, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+bool CWorkStealingDeque::Pop(int& tile)
+{
+	int b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	tile = buffer[b & mask].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// Last element, race the thieves for it
+		bool won = top.compare_exchange_strong(t, t + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+bool CWorkStealingDeque::Steal(int& tile)
+{
+	int t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int b = bottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+	{
+		return false;
+	}
+
+	tile = buffer[t & mask].load(std::memory_order_relaxed);
+	return top.compare_exchange_strong(t, t + 1,
+		std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+// Interleaves the bits of x and y
+static unsigned int MortonKey(unsigned int x, unsigned int y)
+{
+	unsigned int key = 0;
+	for (unsigned int bit = 0; bit < 16; bit++)
+	{
+		key |= ((x >> bit) & 1u) << (2 * bit);
+		key |= ((y >> bit) & 1u) << (2 * bit + 1);
+	}
+	return key;
+}
+
+CTileScheduler::CTileScheduler()
+{
+}
+
+CTileScheduler::~CTileScheduler()
+{
+	StopThreads();
+}
+
+void CTileScheduler::SetThreadCount(int count)
+{
+	requestedThreadCount = count;
+}
+
+int CTileScheduler::GetThreadCount()
+{
+	if (requestedThreadCount > 0)
+	{
+		return requestedThreadCount;
+	}
+	int hardwareThreads = (int)std::thread::hardware_concurrency();
+	return hardwareThreads > 0 ? hardwareThreads : 1;
+}
+
+void CTileScheduler::SetTileSize(int width, int height)
+{
+	tileWidth = std::max(width, 1);
+	tileHeight = std::max(height, 1);
+	tilesWidth = 0;
+}
+
+void CTileScheduler::SetTileOrder(TileOrder order)
+{
+	tileOrder = order;
+	tilesWidth = 0;
+}
+
+void CTileScheduler::ResetStats()
+{
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		stats[i] = TileThreadStats();
+	}
+}
+
+void CTileScheduler::StartThreads()
+{
+	int count = GetThreadCount();
+	deques = std::vector<CWorkStealingDeque>(count);
+	stats.assign(count, TileThreadStats());
+	// Thread 0 is whoever calls Run()
+	for (int i = 1; i < count; i++)
+	{
+		threads.push_back(std::thread(&CTileScheduler::WorkerMain, this, i, generation));
+	}
+}
+
+void CTileScheduler::StopThreads()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	startCondition.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	threads.clear();
+	stopping = false;
+}
+
+void CTileScheduler::BuildTiles(int width, int height)
+{
+	tiles.clear();
+	int countX = (width + tileWidth - 1) / tileWidth;
+	int countY = (height + tileHeight - 1) / tileHeight;
+	std::vector<unsigned int> keys;
+
+	for (int ty = 0; ty < countY; ty++)
+	{
+		for (int tx = 0; tx < countX; tx++)
+		{
+			Tile tile;
+			tile.x = tx * tileWidth;
+			tile.y = ty * tileHeight;
+			tile.width = std::min(tileWidth, width - tile.x);
+			tile.height = std::min(tileHeight, height - tile.y);
+			tiles.push_back(tile);
+
+			if (tileOrder == TILE_ORDER_MORTON)
+			{
+				keys.push_back(MortonKey(tx, ty));
+			}
+			else if (tileOrder == TILE_ORDER_CENTER_OUT)
+			{
+				int dx = 2 * tile.x + tile.width - width;
+				int dy = 2 * tile.y + tile.height - height;
+				keys.push_back((unsigned int)(dx * dx + dy * dy));
+			}
+		}
+	}
+
+	if (tileOrder != TILE_ORDER_SCANLINE)
+	{
+		std::vector<int> order(tiles.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = (int)i;
+		}
+		std::stable_sort(order.begin(), order.end(),
+			[&](int a, int b) { return keys[a] < keys[b]; });
+		std::vector<Tile> sorted(tiles.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			sorted[i] = tiles[order[i]];
+		}
+		tiles.swap(sorted);
+	}
+
+	tilesWidth = width;
+	tilesHeight = height;
+}
+
+void CTileScheduler::Run(int width, int height, const TileKernel& kernel)
+{
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	if (width != tilesWidth || height != tilesHeight)
+	{
+		BuildTiles(width, height);
+	}
+	Execute(kernel);
+}
+
+void CTileScheduler::ParallelFor(int count, int grainSize, const RangeKernel& kernel)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	// Ranges are one pixel high tiles, the image tiles are rebuilt next Run()
+	grainSize = std::max(grainSize, 1);
+	tiles.clear();
+	for (int begin = 0; begin < count; begin += grainSize)
+	{
+		Tile tile;
+		tile.x = begin;
+		tile.y = 0;
+		tile.width = std::min(grainSize, count - begin);
+		tile.height = 1;
+		tiles.push_back(tile);
+	}
+	tilesWidth = 0;
+	tilesHeight = 0;
+
+	Execute([&](const Tile& tile, int threadIndex)
+	{
+		kernel(tile.x, tile.x + tile.width, threadIndex);
+	});
+}
+
+void CTileScheduler::Execute(const TileKernel& kernel)
+{
+	if ((int)deques.size() != GetThreadCount())
+	{
+		StopThreads();
+		StartThreads();
+	}
+
+	// Each thread starts on its own contiguous run of tiles, pushed in
+	// reverse so the owner pops them in order while thieves take from the end
+	int threadCount = (int)deques.size();
+	int tileCount = (int)tiles.size();
+	for (int i = 0; i < threadCount; i++)
+	{
+		int first = (int)((long long)tileCount * i / threadCount);
+		int last = (int)((long long)tileCount * (i + 1) / threadCount);
+		deques[i].Reset(tileCount);
+		for (int tile = last - 1; tile >= first; tile--)
+		{
+			deques[i].Push(tile);
+		}
+	}
+
+	uint64_t start = GetTimeNanoseconds();
+	currentKernel = &kernel;
+	remainingTiles.store(tileCount, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		runningWorkers = (int)threads.size();
+		generation++;
+	}
+	startCondition.notify_all();
+
+	ExecuteTiles(0);
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [&]() { return runningWorkers == 0; });
+	}
+	currentKernel = nullptr;
+
+	double wall = SecondsSince(start);
+	for (int i = 0; i < threadCount; i++)
+	{
+		stats[i].wallSeconds += wall;
+	}
+}
+
+void CTileScheduler::WorkerMain(int threadIndex, unsigned int startGeneration)
+{
+	unsigned int seenGeneration = startGeneration;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			startCondition.wait(lock,
+				[&]() { return stopping || generation != seenGeneration; });
+			if (stopping)
+			{
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		ExecuteTiles(threadIndex);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--runningWorkers == 0)
+		{
+			doneCondition.notify_one();
+		}
+	}
+}
+
+void CTileScheduler::ExecuteTiles(int threadIndex)
+{
+	int threadCount = (int)deques.size();
+	// Counted locally so threads do not share cache lines per tile
+	TileThreadStats threadStats;
+	unsigned int random = 2654435761u * (threadIndex + 1);
+
+	while (remainingTiles.load(std::memory_order_acquire) > 0)
+	{
+		int tile;
+		bool stolen = false;
+		if (!deques[threadIndex].Pop(tile))
+		{
+			// Own deque is dry, try every other thread starting at a random one
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			int victim = (int)(random % (unsigned int)threadCount);
+			for (int attempt = 0; attempt < threadCount && !stolen; attempt++, victim = (victim + 1) % threadCount)
+			{
+				stolen = victim != threadIndex && deques[victim].Steal(tile);
+			}
+			if (!stolen)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+		}
+
+		uint64_t start = GetTimeNanoseconds();
+		(*currentKernel)(tiles[tile], threadIndex);
+		threadStats.busySeconds += SecondsSince(start);
+		threadStats.tilesExecuted++;
+		if (stolen)
+		{
+			threadStats.tilesStolen++;
+		}
+
+		remainingTiles.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	stats[threadIndex].busySeconds += threadStats.busySeconds;
+	stats[threadIndex].tilesExecuted += threadStats.tilesExecuted;
+	stats[threadIndex].tilesStolen += threadStats.tilesStolen;
+}
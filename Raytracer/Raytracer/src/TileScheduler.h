@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rectangle of pixels, the CPU equivalent of one compute shader workgroup
+struct Tile
+{
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+enum TileOrder
+{
+	TILE_ORDER_SCANLINE,	// row by row, like the GPU rasterises workgroups
+	TILE_ORDER_MORTON,		// Z-order curve, keeps neighbouring tiles on one thread
+	TILE_ORDER_CENTER_OUT	// image centre first, for progressive previews
+};
+
+// Work counters of one scheduler thread, accumulated since ResetStats()
+struct TileThreadStats
+{
+	double busySeconds = 0.0;
+	double wallSeconds = 0.0;
+	int tilesExecuted = 0;
+	int tilesStolen = 0;
+
+	// Fraction of the wall time spent executing tiles
+	double GetUtilisation() const { return wallSeconds > 0.0 ? busySeconds / wallSeconds : 0.0; }
+};
+
+// Chase-Lev work stealing deque of tile indices. The owning thread pushes
+// and pops at the bottom, other threads steal from the top.
+class CWorkStealingDeque
+{
+public:
+	// Empties the deque, must not run concurrently with any other call
+	void Reset(int capacity);
+
+	void Push(int tile);
+	bool Pop(int& tile);
+	bool Steal(int& tile);
+
+private:
+	std::unique_ptr<std::atomic<int>[]> buffer;
+	int mask = 0;
+	std::atomic<int> top{ 0 };
+	std::atomic<int> bottom{ 0 };
+	// Keeps neighbouring deques off each other's cache lines
+	char padding[64];
+};
+
+// Splits an image into tiles and executes them on a pool of persistent
+// threads, each owning a deque and stealing from the others when it runs dry
+class CTileScheduler
+{
+public:
+	typedef std::function<void(const Tile& tile, int threadIndex)> TileKernel;
+	typedef std::function<void(int begin, int end, int threadIndex)> RangeKernel;
+
+	CTileScheduler();
+	~CTileScheduler();
+
+	// 0 uses every hardware thread. Configuration must not change during Run().
+	void SetThreadCount(int count);
+	int GetThreadCount();
+	// Defaults to 16x8, the workgroup size of raytracingShader.txt
+	void SetTileSize(int width, int height);
+	void SetTileOrder(TileOrder order);
+
+	// Runs kernel once for every tile of a width x height image and
+	// returns when all of them have finished. The calling thread is thread 0.
+	void Run(int width, int height, const TileKernel& kernel);
+	// Runs kernel over [0, count) in ranges of at most grainSize items, on
+	// the same threads and with the same stealing as image tiles
+	void ParallelFor(int count, int grainSize, const RangeKernel& kernel);
+
+	const std::vector<TileThreadStats>& GetThreadStats() { return stats; }
+	void ResetStats();
+
+private:
+	void StartThreads();
+	void StopThreads();
+	void BuildTiles(int width, int height);
+	void Execute(const TileKernel& kernel);
+	void WorkerMain(int threadIndex, unsigned int startGeneration);
+	void ExecuteTiles(int threadIndex);
+
+	int requestedThreadCount = 0;
+	int tileWidth = 16;
+	int tileHeight = 8;
+	TileOrder tileOrder = TILE_ORDER_SCANLINE;
+
+	std::vector<std::thread> threads;
+	std::vector<CWorkStealingDeque> deques;
+	std::vector<TileThreadStats> stats;
+	std::vector<Tile> tiles;
+	// Image size the tile list was built for, 0 when it needs rebuilding
+	int tilesWidth = 0;
+	int tilesHeight = 0;
+
+	const TileKernel* currentKernel = nullptr;
+	std::atomic<int> remainingTiles{ 0 };
+
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	unsigned int generation = 0;
+	int runningWorkers = 0;
+	bool stopping = false;
+};
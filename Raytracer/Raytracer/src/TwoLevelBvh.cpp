@@ -0,0 +1,90 @@
+#include "TwoLevelBvh.h"
+
+CTwoLevelBvh::CTwoLevelBvh(CTileScheduler& scheduler)
+	: topLevel(scheduler)
+{
+}
+
+void CTwoLevelBvh::Build(const CScene& scene)
+{
+	meshNodes.clear();
+	meshBoxes.clear();
+	meshRoots.assign(scene.meshes.size(), -1);
+	meshBounds.assign(scene.meshes.size(), Box());
+	for (size_t m = 0; m < scene.meshes.size(); m++)
+	{
+		const std::vector<Box>& boxes = scene.meshes[m].boxes;
+		CBvh bvh;
+		bvh.Build(boxes);
+		if (bvh.nodes.empty())
+		{
+			continue;
+		}
+
+		// Append the mesh with its indices moved past the meshes before it
+		int nodeOffset = (int)meshNodes.size();
+		int boxOffset = (int)meshBoxes.size();
+		for (size_t i = 0; i < bvh.nodes.size(); i++)
+		{
+			BvhNode node = bvh.nodes[i];
+			node.leftOrFirst += node.IsLeaf() ? boxOffset : nodeOffset;
+			meshNodes.push_back(node);
+		}
+		for (size_t i = 0; i < bvh.primIndices.size(); i++)
+		{
+			meshBoxes.push_back(boxes[bvh.primIndices[i]]);
+		}
+		meshRoots[m] = nodeOffset;
+		meshBounds[m].min = bvh.nodes[0].min;
+		meshBounds[m].max = bvh.nodes[0].max;
+	}
+
+	topLevel.Invalidate();
+	UpdateInstances(scene.instances);
+}
+
+Box CTwoLevelBvh::GetBounds() const
+{
+	const std::vector<BvhNode>& nodes = GetTopLevelNodes();
+	if (IsEmpty() || nodes.empty())
+	{
+		return CreateEmptyBox();
+	}
+	Box bounds = { nodes[0].min, nodes[0].max };
+	return bounds;
+}
+
+const DynamicBvhUpdate& CTwoLevelBvh::UpdateInstances(const std::vector<SceneInstance>& sceneInstances)
+{
+	instanceBounds.resize(sceneInstances.size());
+	for (size_t i = 0; i < sceneInstances.size(); i++)
+	{
+		const SceneInstance& instance = sceneInstances[i];
+		if (meshRoots[instance.mesh] >= 0)
+		{
+			instanceBounds[i] = TransformBox(instance.objectToWorld, meshBounds[instance.mesh]);
+		}
+		else
+		{
+			// Nothing to hit, a point keeps the top level bounds tight
+			glm::vec3 position = instance.objectToWorld.GetTranslation();
+			instanceBounds[i].min = position;
+			instanceBounds[i].max = position;
+		}
+	}
+	const DynamicBvhUpdate& update = topLevel.Update(instanceBounds);
+
+	// Refits keep the leaf order, but the transforms changed
+	const std::vector<int>& order = topLevel.GetBvh().primIndices;
+	instances.resize(sceneInstances.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const SceneInstance& instance = sceneInstances[order[i]];
+		BvhInstance& packed = instances[i];
+		packed.worldToObject = instance.objectToWorld.Inverse();
+		packed.root = meshRoots[instance.mesh];
+		packed.index = order[i];
+		packed.pad0 = packed.pad1 = 0;
+	}
+	return update;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include "Bvh.h"
+#include "DynamicBvh.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// 64 bytes, the std430 layout of 'struct instance' in raytracingShader.txt
+struct BvhInstance
+{
+	Transform3x4 worldToObject;
+	// Root of the instance's mesh in CTwoLevelBvh::meshNodes, -1 for an empty mesh
+	int root;
+	// Index in CScene::instances
+	int index;
+	int pad0, pad1;
+};
+
+// Acceleration structure for CScene::meshes and CScene::instances: a BVH
+// per mesh in object space and a top level BVH over the world bounds of
+// the instances. Rays are moved into object space at instance leaves, so
+// moving instances only refits or rebuilds the top level.
+class CTwoLevelBvh
+{
+public:
+	// Top level refits run on the scheduler's threads
+	explicit CTwoLevelBvh(CTileScheduler& scheduler);
+
+	// Builds the mesh BVHs, then the top level
+	void Build(const CScene& scene);
+	// The instances moved or switched meshes, the meshes are the ones of the
+	// last Build(). Refits the top level, or rebuilds it once refitting has
+	// degraded it, see CDynamicBvh.
+	const DynamicBvhUpdate& UpdateInstances(const std::vector<SceneInstance>& sceneInstances);
+
+	bool IsEmpty() const { return instances.empty(); }
+	CDynamicBvh& GetTopLevel() { return topLevel; }
+	// Leaves of the top level index instances directly
+	const std::vector<BvhNode>& GetTopLevelNodes() const { return topLevel.GetBvh().nodes; }
+	// World space bounds of every instance, empty without instances
+	Box GetBounds() const;
+
+	// Instances in top level leaf order
+	std::vector<BvhInstance> instances;
+	// The nodes of every mesh BVH, with child indices into this array and
+	// leaves indexing meshBoxes directly
+	std::vector<BvhNode> meshNodes;
+	// Mesh boxes in mesh BVH leaf order
+	std::vector<Box> meshBoxes;
+
+private:
+	CDynamicBvh topLevel;
+	// Root in meshNodes and object space bounds of every mesh
+	std::vector<int> meshRoots;
+	std::vector<Box> meshBounds;
+	std::vector<Box> instanceBounds;
+};
@@ -0,0 +1,403 @@
+#include "WideBvh.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef RT_X86
+#include <immintrin.h>
+#endif
+
+CWideBvh::CWideBvh()
+	: width(WIDE_BVH_MAX_WIDTH), quantized(false)
+{
+}
+
+int CWideBvh::GetNodeBytes() const
+{
+	int boxBytes = quantized ? (int)sizeof(WideBvhFrame) + 6 * width : 6 * width * (int)sizeof(float);
+	return boxBytes + width * ((int)sizeof(int) + 1) + 1;
+}
+
+void CWideBvh::Build(const CBvh& bvh, int nodeWidth, bool quantize)
+{
+	width = nodeWidth >= 8 ? 8 : 4;
+	quantized = quantize;
+	bounds.clear();
+	frames.clear();
+	quantizedBounds.clear();
+	children.clear();
+	counts.clear();
+	childCounts.clear();
+	if (bvh.nodes.empty())
+	{
+		return;
+	}
+
+	// Every wide node holds at least two binary nodes, apart from a leaf root
+	size_t expected = bvh.nodes.size() / 2 + 1;
+	bounds.reserve(expected * 6 * width);
+	children.reserve(expected * width);
+	counts.reserve(expected * width);
+	childCounts.reserve(expected);
+	Collapse(bvh, 0);
+
+	if (quantized)
+	{
+		frames.resize(childCounts.size());
+		quantizedBounds.resize(bounds.size());
+		for (int node = 0; node < GetNodeCount(); node++)
+		{
+			Quantize(node);
+		}
+		// The float boxes are only needed to quantize
+		std::vector<float>().swap(bounds);
+	}
+}
+
+// Gathers up to width descendants of a binary node by repeatedly opening
+// the interior child with the largest surface area, then collapses the
+// interior ones in turn. Returns the wide node's index.
+int CWideBvh::Collapse(const CBvh& bvh, int binaryIndex)
+{
+	int slots[WIDE_BVH_MAX_WIDTH];
+	int slotCount = 0;
+	const BvhNode& binary = bvh.nodes[binaryIndex];
+	if (binary.IsLeaf())
+	{
+		slots[slotCount++] = binaryIndex;
+	}
+	else
+	{
+		slots[slotCount++] = binary.leftOrFirst;
+		slots[slotCount++] = binary.leftOrFirst + 1;
+	}
+	while (slotCount < width)
+	{
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (int s = 0; s < slotCount; s++)
+		{
+			const BvhNode& node = bvh.nodes[slots[s]];
+			float area = BoxSurfaceArea(node.min, node.max);
+			if (!node.IsLeaf() && area > largestArea)
+			{
+				largest = s;
+				largestArea = area;
+			}
+		}
+		if (largest < 0)
+		{
+			break;
+		}
+		int left = bvh.nodes[slots[largest]].leftOrFirst;
+		slots[largest] = left;
+		slots[slotCount++] = left + 1;
+	}
+
+	int index = GetNodeCount();
+	bounds.resize(bounds.size() + 6 * width, 0.0f);
+	children.resize(children.size() + width, 0);
+	counts.resize(counts.size() + width, 0);
+	childCounts.push_back((uint8_t)slotCount);
+	for (int s = 0; s < slotCount; s++)
+	{
+		const BvhNode& node = bvh.nodes[slots[s]];
+		float* nodeBounds = &bounds[(size_t)index * 6 * width];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			nodeBounds[axis * width + s] = node.min[axis];
+			nodeBounds[(axis + 3) * width + s] = node.max[axis];
+		}
+		if (node.IsLeaf() && node.count <= WIDE_BVH_MAX_LEAF_SIZE)
+		{
+			children[(size_t)index * width + s] = node.leftOrFirst;
+			counts[(size_t)index * width + s] = (uint8_t)node.count;
+		}
+	}
+	// Children are collapsed after the parent is stored, the arrays may grow
+	for (int s = 0; s < slotCount; s++)
+	{
+		const BvhNode& node = bvh.nodes[slots[s]];
+		if (!node.IsLeaf())
+		{
+			int child = Collapse(bvh, slots[s]);
+			children[(size_t)index * width + s] = child;
+		}
+		else if (node.count > WIDE_BVH_MAX_LEAF_SIZE)
+		{
+			int child = SplitLeaf(node, node.leftOrFirst, node.count);
+			children[(size_t)index * width + s] = child;
+		}
+	}
+	return index;
+}
+
+// Node whose children share the bounds of leaf and hold count of its
+// primitives from first on, nested as deep as width leaf children of
+// WIDE_BVH_MAX_LEAF_SIZE do not cover them. Returns the wide node's index.
+int CWideBvh::SplitLeaf(const BvhNode& leaf, int first, int count)
+{
+	int perSlot = WIDE_BVH_MAX_LEAF_SIZE;
+	while ((count + perSlot - 1) / perSlot > width)
+	{
+		perSlot *= width;
+	}
+	int slotCount = (count + perSlot - 1) / perSlot;
+
+	int index = GetNodeCount();
+	bounds.resize(bounds.size() + 6 * width, 0.0f);
+	children.resize(children.size() + width, 0);
+	counts.resize(counts.size() + width, 0);
+	childCounts.push_back((uint8_t)slotCount);
+	for (int s = 0; s < slotCount; s++)
+	{
+		float* nodeBounds = &bounds[(size_t)index * 6 * width];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			nodeBounds[axis * width + s] = leaf.min[axis];
+			nodeBounds[(axis + 3) * width + s] = leaf.max[axis];
+		}
+		int slotSize = std::min(perSlot, count - s * perSlot);
+		if (slotSize <= WIDE_BVH_MAX_LEAF_SIZE)
+		{
+			children[(size_t)index * width + s] = first + s * perSlot;
+			counts[(size_t)index * width + s] = (uint8_t)slotSize;
+		}
+	}
+	for (int s = 0; s < slotCount; s++)
+	{
+		int slotSize = std::min(perSlot, count - s * perSlot);
+		if (slotSize > WIDE_BVH_MAX_LEAF_SIZE)
+		{
+			int child = SplitLeaf(leaf, first + s * perSlot, slotSize);
+			children[(size_t)index * width + s] = child;
+		}
+	}
+	return index;
+}
+
+// Rounds every child box outwards onto a 255 step grid spanning the node.
+// Decoding must give back a box at least as large as the original, so the
+// rounding is checked with the same arithmetic the decode kernels use.
+void CWideBvh::Quantize(int node)
+{
+	const float* nodeBounds = &bounds[(size_t)node * 6 * width];
+	uint8_t* nodeQuantized = &quantizedBounds[(size_t)node * 6 * width];
+	int childCount = childCounts[node];
+	float origin[3], scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		for (int c = 0; c < childCount; c++)
+		{
+			lo = std::min(lo, nodeBounds[axis * width + c]);
+			hi = std::max(hi, nodeBounds[(axis + 3) * width + c]);
+		}
+		float step = (hi - lo) / 255.0f;
+		while (lo + 255.0f * step < hi)
+		{
+			step = nextafterf(step, FLT_MAX);
+		}
+		origin[axis] = lo;
+		scale[axis] = step;
+
+		for (int c = 0; c < childCount; c++)
+		{
+			float min = nodeBounds[axis * width + c];
+			float max = nodeBounds[(axis + 3) * width + c];
+			int qMin = 0, qMax = 0;
+			if (step > 0.0f)
+			{
+				qMin = std::max(0, std::min(255, (int)floorf((min - lo) / step)));
+				qMax = std::max(0, std::min(255, (int)ceilf((max - lo) / step)));
+				while (qMin > 0 && lo + (float)qMin * step > min)
+				{
+					qMin--;
+				}
+				while (qMax < 255 && lo + (float)qMax * step < max)
+				{
+					qMax++;
+				}
+			}
+			nodeQuantized[axis * width + c] = (uint8_t)qMin;
+			nodeQuantized[(axis + 3) * width + c] = (uint8_t)qMax;
+		}
+	}
+	WideBvhFrame& frame = frames[node];
+	frame.originX = origin[0];
+	frame.originY = origin[1];
+	frame.originZ = origin[2];
+	frame.scaleX = scale[0];
+	frame.scaleY = scale[1];
+	frame.scaleZ = scale[2];
+}
+
+// Reference kernels, same slab test as IntersectNodePacketScalar
+static int IntersectWideNodeScalar(const WideRay& ray, const float* bounds, int width,
+	float tMax, float* tNear)
+{
+	int mask = 0;
+	for (int c = 0; c < width; c++)
+	{
+		float t0x = (bounds[c] - ray.originX) * ray.invDirX;
+		float t0y = (bounds[width + c] - ray.originY) * ray.invDirY;
+		float t0z = (bounds[2 * width + c] - ray.originZ) * ray.invDirZ;
+		float t1x = (bounds[3 * width + c] - ray.originX) * ray.invDirX;
+		float t1y = (bounds[4 * width + c] - ray.originY) * ray.invDirY;
+		float t1z = (bounds[5 * width + c] - ray.originZ) * ray.invDirZ;
+		float childNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::min(t0z, t1z));
+		float childFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::max(t0z, t1z));
+
+		bool hit = childNear <= childFar && childFar > 0.0f && childNear < tMax;
+		tNear[c] = childNear;
+		mask |= hit ? 1 << c : 0;
+	}
+	return mask;
+}
+
+static void DecodeWideNodeScalar(const WideBvhFrame& frame, const uint8_t* quantized, int width,
+	float* bounds)
+{
+	const float origin[3] = { frame.originX, frame.originY, frame.originZ };
+	const float scale[3] = { frame.scaleX, frame.scaleY, frame.scaleZ };
+	for (int k = 0; k < 6; k++)
+	{
+		for (int c = 0; c < width; c++)
+		{
+			bounds[k * width + c] = origin[k % 3] + (float)quantized[k * width + c] * scale[k % 3];
+		}
+	}
+}
+
+#ifdef RT_X86
+
+RT_TARGET("sse4.1")
+static int IntersectWideNodeSSE4(const WideRay& ray, const float* bounds, int width,
+	float tMax, float* tNear)
+{
+	__m128 ox = _mm_set1_ps(ray.originX);
+	__m128 oy = _mm_set1_ps(ray.originY);
+	__m128 oz = _mm_set1_ps(ray.originZ);
+	__m128 ix = _mm_set1_ps(ray.invDirX);
+	__m128 iy = _mm_set1_ps(ray.invDirY);
+	__m128 iz = _mm_set1_ps(ray.invDirZ);
+	__m128 zero = _mm_setzero_ps();
+	__m128 limit = _mm_set1_ps(tMax);
+	int mask = 0;
+	for (int c = 0; c < width; c += 4)
+	{
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + c), ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + width + c), oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + 2 * width + c), oz), iz);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + 3 * width + c), ox), ix);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + 4 * width + c), oy), iy);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + 5 * width + c), oz), iz);
+		__m128 childNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+		__m128 childFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+		__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(childNear, childFar), _mm_cmpgt_ps(childFar, zero)),
+			_mm_cmplt_ps(childNear, limit));
+		_mm_storeu_ps(tNear + c, childNear);
+		mask |= _mm_movemask_ps(hit) << c;
+	}
+	return mask;
+}
+
+RT_TARGET("sse4.1")
+static void DecodeWideNodeSSE4(const WideBvhFrame& frame, const uint8_t* quantized, int width,
+	float* bounds)
+{
+	const __m128 origin[3] = { _mm_set1_ps(frame.originX), _mm_set1_ps(frame.originY), _mm_set1_ps(frame.originZ) };
+	const __m128 scale[3] = { _mm_set1_ps(frame.scaleX), _mm_set1_ps(frame.scaleY), _mm_set1_ps(frame.scaleZ) };
+	for (int k = 0; k < 6; k++)
+	{
+		for (int c = 0; c < width; c += 4)
+		{
+			int packed;
+			memcpy(&packed, quantized + k * width + c, sizeof(packed));
+			__m128 q = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+			_mm_storeu_ps(bounds + k * width + c, _mm_add_ps(origin[k % 3], _mm_mul_ps(q, scale[k % 3])));
+		}
+	}
+}
+
+RT_TARGET("avx2")
+static int IntersectWideNodeAVX2(const WideRay& ray, const float* bounds, int width,
+	float tMax, float* tNear)
+{
+	if (width != 8)
+	{
+		return IntersectWideNodeSSE4(ray, bounds, width, tMax, tNear);
+	}
+	__m256 ox = _mm256_set1_ps(ray.originX);
+	__m256 oy = _mm256_set1_ps(ray.originY);
+	__m256 oz = _mm256_set1_ps(ray.originZ);
+	__m256 ix = _mm256_set1_ps(ray.invDirX);
+	__m256 iy = _mm256_set1_ps(ray.invDirY);
+	__m256 iz = _mm256_set1_ps(ray.invDirZ);
+	__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds), ox), ix);
+	__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds + 8), oy), iy);
+	__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds + 16), oz), iz);
+	__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds + 24), ox), ix);
+	__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds + 32), oy), iy);
+	__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds + 40), oz), iz);
+	__m256 childNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_min_ps(t0z, t1z));
+	__m256 childFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_max_ps(t0z, t1z));
+
+	__m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(childNear, childFar, _CMP_LE_OQ),
+		_mm256_cmp_ps(childFar, _mm256_setzero_ps(), _CMP_GT_OQ)),
+		_mm256_cmp_ps(childNear, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+	_mm256_storeu_ps(tNear, childNear);
+	return _mm256_movemask_ps(hit);
+}
+
+RT_TARGET("avx2")
+static void DecodeWideNodeAVX2(const WideBvhFrame& frame, const uint8_t* quantized, int width,
+	float* bounds)
+{
+	if (width != 8)
+	{
+		DecodeWideNodeSSE4(frame, quantized, width, bounds);
+		return;
+	}
+	const __m256 origin[3] = { _mm256_set1_ps(frame.originX), _mm256_set1_ps(frame.originY), _mm256_set1_ps(frame.originZ) };
+	const __m256 scale[3] = { _mm256_set1_ps(frame.scaleX), _mm256_set1_ps(frame.scaleY), _mm256_set1_ps(frame.scaleZ) };
+	for (int k = 0; k < 6; k++)
+	{
+		__m128i packed = _mm_loadl_epi64((const __m128i*)(quantized + k * 8));
+		__m256 q = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(packed));
+		_mm256_storeu_ps(bounds + k * 8, _mm256_add_ps(origin[k % 3], _mm256_mul_ps(q, scale[k % 3])));
+	}
+}
+
+#endif
+
+// Nodes are at most 8 wide, AVX-512 uses the AVX2 kernels
+IntersectWideNodeFunc GetIntersectWideNode(SimdIsa isa)
+{
+#ifdef RT_X86
+	switch (isa)
+	{
+	case SIMD_AVX512:
+	case SIMD_AVX2: return IntersectWideNodeAVX2;
+	case SIMD_SSE4: return IntersectWideNodeSSE4;
+	default: break;
+	}
+#endif
+	return IntersectWideNodeScalar;
+}
+
+DecodeWideNodeFunc GetDecodeWideNode(SimdIsa isa)
+{
+#ifdef RT_X86
+	switch (isa)
+	{
+	case SIMD_AVX512:
+	case SIMD_AVX2: return DecodeWideNodeAVX2;
+	case SIMD_SSE4: return DecodeWideNodeSSE4;
+	default: break;
+	}
+#endif
+	return DecodeWideNodeScalar;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Bvh.h"
+#include "CpuFeatures.h"
+
+// Widest node the collapse produces, one AVX register of child boxes
+#define WIDE_BVH_MAX_WIDTH 8
+// Most primitives a leaf child holds, its count is 8 bits
+#define WIDE_BVH_MAX_LEAF_SIZE 255
+
+// One ray of a wide traversal, broadcast against every child of a node
+struct WideRay
+{
+	float originX, originY, originZ;
+	float invDirX, invDirY, invDirZ;
+};
+
+// Quantized child boxes decode to origin + q * scale per axis
+struct WideBvhFrame
+{
+	float originX, originY, originZ;
+	float scaleX, scaleY, scaleZ;
+};
+
+// BVH with 4 or 8 children per node for single ray SIMD traversal on the
+// CPU, collapsed from a binary CBvh. Child boxes are stored per node as six
+// component arrays of width entries (minX, minY, minZ, maxX, maxY, maxZ),
+// as floats or as 8 bit offsets into the node's frame.
+class CWideBvh
+{
+public:
+	CWideBvh();
+
+	// Width is 4 or 8. Leaf children keep the binary leaves' ranges into
+	// bvh.primIndices, binary leaves larger than WIDE_BVH_MAX_LEAF_SIZE are
+	// split over the children of extra nodes with the same bounds.
+	void Build(const CBvh& bvh, int width, bool quantize);
+
+	int GetWidth() const { return width; }
+	bool IsQuantized() const { return quantized; }
+	int GetNodeCount() const { return (int)childCounts.size(); }
+	// Bytes per node, the child boxes being most of it
+	int GetNodeBytes() const;
+
+	const float* GetBounds(int node) const { return &bounds[(size_t)node * 6 * width]; }
+	const WideBvhFrame& GetFrame(int node) const { return frames[node]; }
+	const uint8_t* GetQuantizedBounds(int node) const { return &quantizedBounds[(size_t)node * 6 * width]; }
+	// Interior children: index of the wide node. Leaf children: first primitive.
+	const int* GetChildren(int node) const { return &children[(size_t)node * width]; }
+	// Primitives of each leaf child, 0 for interior children
+	const uint8_t* GetCounts(int node) const { return &counts[(size_t)node * width]; }
+	// Children are packed at the front, the remaining slots are empty
+	int GetChildCount(int node) const { return childCounts[node]; }
+
+private:
+	int Collapse(const CBvh& bvh, int binaryIndex);
+	int SplitLeaf(const BvhNode& leaf, int first, int count);
+	void Quantize(int node);
+
+	int width;
+	bool quantized;
+	std::vector<float> bounds;
+	std::vector<WideBvhFrame> frames;
+	std::vector<uint8_t> quantizedBounds;
+	std::vector<int> children;
+	std::vector<uint8_t> counts;
+	std::vector<uint8_t> childCounts;
+};
+
+// Slab test of one ray against the width child boxes in bounds. Returns the
+// mask of children the ray enters before tMax, their entry distances are in tNear.
+typedef int (*IntersectWideNodeFunc)(const WideRay& ray, const float* bounds, int width,
+	float tMax, float* tNear);
+// Expands a node's quantized child boxes into 6 * width floats
+typedef void (*DecodeWideNodeFunc)(const WideBvhFrame& frame, const uint8_t* quantized, int width,
+	float* bounds);
+
+// Kernels for isa, or for the best instruction set below it the build has
+IntersectWideNodeFunc GetIntersectWideNode(SimdIsa isa);
+DecodeWideNodeFunc GetDecodeWideNode(SimdIsa isa);
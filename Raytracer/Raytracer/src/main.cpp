@@ -1,203 +1,78 @@
 
-//Some Windows Headers (For Time, IO, etc.)
-#include <windows.h>
-#include <mmsystem.h>
-
-#include <GL/glew.h>
+#include "GLHeaders.h"
 
 //#include <GL/freeglut.h>
+#ifndef RT_NO_GLFW
 #include <GLFW/glfw3.h>
+#endif
 #include <iostream>
 
 #include <string> 
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <ctype.h>
+#include <string.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 #include "Camera.h"
-
-// Macro for indexing vertex buffer
-#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+#include "CpuRaytracer.h"
+#include "DynamicBvh.h"
+#include "HeadlessContext.h"
+#include "ImageWriter.h"
+#include "PboReadback.h"
+#include "DispatchPlanner.h"
+#include "ProgramCache.h"
+#include "GpuProfiler.h"
+#include "GpuRaytracer.h"
+#include "MeshLoader.h"
+#include "SceneCache.h"
+#include "SceneFile.h"
+#include "FrameTimer.h"
+#include "Platform.h"
 
 using namespace std;
 GLuint shaderProgramID;
 
-unsigned int teapot_vao = 0;
 int width = 800.0;
 int height = 600.0;
-GLuint loc1;
-GLuint loc2;
 
 // Shader Functions- click on + to expand
 #pragma region SHADER_FUNCTIONS
 glm::mat4 translateX = glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, 0.0f));
 
-std::string readShaderSource(const std::string& fileName)
-{
-	std::ifstream file(fileName.c_str()); 
-	if(file.fail()) {
-		cout << "error loading shader called " << fileName;
-		exit (1); 
-	} 
-	
-	std::stringstream stream;
-	stream << file.rdbuf();
-	file.close();
-
-	return stream.str();
-}
+// Compiled programs come from the binary cache when possible
+CProgramCache programCache;
 
-static void AddShader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType)
+void PrintProgramCacheStats()
 {
-	// create a shader object
-    GLuint ShaderObj = glCreateShader(ShaderType);
-
-    if (ShaderObj == 0) {
-        fprintf(stderr, "Error creating shader type %d\n", ShaderType);
-        exit(0);
-    }
-	std::string outShader = readShaderSource(pShaderText);
-	const char* pShaderSource = outShader.c_str();
-
-	// Bind the source code to the shader, this happens before compilation
-	glShaderSource(ShaderObj, 1, (const GLchar**)&pShaderSource, NULL);
-	// compile the shader and check for errors
-    glCompileShader(ShaderObj);
-    GLint success;
-	// check for shader related errors using glGetShaderiv
-    glGetShaderiv(ShaderObj, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLchar InfoLog[1024];
-        glGetShaderInfoLog(ShaderObj, 1024, NULL, InfoLog);
-        fprintf(stderr, "Error compiling shader type %d: '%s'\n", ShaderType, InfoLog);
-        exit(1);
-    }
-	// Attach the compiled shader object to the program object
-    glAttachShader(ShaderProgram, ShaderObj);
+	const ProgramCacheStats& stats = programCache.GetStats();
+	printf("Shader programs: %d from cache, %d compiled, %.1f ms\n",
+		stats.hits, stats.misses, stats.milliseconds);
 }
 
 GLuint CompileShadersQuad()
 {
-	//Start the process of setting up our shaders by creating a program ID
-	//Note: we will link all the shaders together into this ID
-    GLuint shaderProgramID = glCreateProgram();
-    if (shaderProgramID == 0) {
-        fprintf(stderr, "Error creating shader program\n");
-        exit(1);
-    }
-
-	// Create two shader objects, one for the vertex, and one for the fragment shader
-    AddShader(shaderProgramID, "../Raytracer/src/shaders/quadVertexShader.txt", GL_VERTEX_SHADER);
-    AddShader(shaderProgramID, "../Raytracer/src/shaders/quadFragmentShader.txt", GL_FRAGMENT_SHADER);
-
-    GLint Success = 0;
-    GLchar ErrorLog[1024] = { 0 };
-
-
-	// After compiling all shader objects and attaching them to the program, we can finally link it
-    glLinkProgram(shaderProgramID);
-	// check for program related errors using glGetProgramiv
-    glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &Success);
-	if (Success == 0) {
-		glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
-		fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
-        exit(1);
-	}
-
-	// program has been successfully linked but needs to be validated to check whether the program can execute given the current pipeline state
-    glValidateProgram(shaderProgramID);
-	// check for program related errors using glGetProgramiv
-    glGetProgramiv(shaderProgramID, GL_VALIDATE_STATUS, &Success);
-    if (!Success) {
-        glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
-        fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
-        exit(1);
-    }
-	// Finally, use the linked shader program
-	// Note: this program will stay in effect for all draw calls until you replace it with another or explicitly disable its use
-    glUseProgram(shaderProgramID);
-
-	return shaderProgramID;
-}
-
-GLuint CompileShadersRay()
-{
-	//Start the process of setting up our shaders by creating a program ID
-	//Note: we will link all the shaders together into this ID
-	GLuint shaderProgramID = glCreateProgram();
-	if (shaderProgramID == 0) {
-		fprintf(stderr, "Error creating shader program\n");
-		exit(1);
-	}
-
-	// Create two shader objects, one for the vertex, and one for the fragment shader
-	AddShader(shaderProgramID, "../Raytracer/src/shaders/raytracingShader.txt", GL_COMPUTE_SHADER);
+	// One vertex and one fragment shader, linked into a single program
+	std::vector<ShaderStage> stages;
+	stages.push_back({ GL_VERTEX_SHADER, "quadVertexShader.txt" });
+	stages.push_back({ GL_FRAGMENT_SHADER, "quadFragmentShader.txt" });
+	GLuint shaderProgramID = programCache.CreateProgram(stages);
 
-	GLint Success = 0;
-	GLchar ErrorLog[1024] = { 0 };
-
-
-	// After compiling all shader objects and attaching them to the program, we can finally link it
-	glLinkProgram(shaderProgramID);
-	// check for program related errors using glGetProgramiv
-	glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &Success);
-	if (Success == 0) {
-		glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
-		fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
-		exit(1);
-	}
-
-	// program has been successfully linked but needs to be validated to check whether the program can execute given the current pipeline state
-	glValidateProgram(shaderProgramID);
-	// check for program related errors using glGetProgramiv
-	glGetProgramiv(shaderProgramID, GL_VALIDATE_STATUS, &Success);
-	if (!Success) {
-		glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
-		fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
-		exit(1);
-	}
+	ValidateProgram(shaderProgramID);
 	// Finally, use the linked shader program
 	// Note: this program will stay in effect for all draw calls until you replace it with another or explicitly disable its use
 	glUseProgram(shaderProgramID);
 
 	return shaderProgramID;
 }
-#pragma endregion SHADER_FUNCTIONS
-
-// VBO Functions - click on + to expand
-#pragma region VBO_FUNCTIONS
-
-void generateObjectBufferTeapot () {
-	GLuint vp_vbo = 0;
-
-	loc1 = glGetAttribLocation(shaderProgramID, "vertex_position");
-	loc2 = glGetAttribLocation(shaderProgramID, "vertex_normals");
-	
-	glGenBuffers (1, &vp_vbo);
-	glBindBuffer (GL_ARRAY_BUFFER, vp_vbo);
-	//glBufferData (GL_ARRAY_BUFFER, 3 * teapot_vertex_count * sizeof (float), teapot_vertex_points, GL_STATIC_DRAW);
-	GLuint vn_vbo = 0;
-	glGenBuffers (1, &vn_vbo);
-	glBindBuffer (GL_ARRAY_BUFFER, vn_vbo);
-	//glBufferData (GL_ARRAY_BUFFER, 3 * teapot_vertex_count * sizeof (float), teapot_normals, GL_STATIC_DRAW);
-  
-	glGenVertexArrays (1, &teapot_vao);
-	glBindVertexArray (teapot_vao);
-
-	glEnableVertexAttribArray (loc1);
-	glBindBuffer (GL_ARRAY_BUFFER, vp_vbo);
-	glVertexAttribPointer (loc1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-	glEnableVertexAttribArray (loc2);
-	glBindBuffer (GL_ARRAY_BUFFER, vn_vbo);
-	glVertexAttribPointer (loc2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-}
-
-
-#pragma endregion VBO_FUNCTIONS
 
+#pragma endregion SHADER_FUNCTIONS
 
 void display(){
 
@@ -242,9 +117,9 @@ void display(){
 void updateScene() {	
 
 		// Wait until at least 16ms passed since start of last frame (Effectively caps framerate at ~60fps)
-	/*static double  last_time = 0;
-	double  curr_time = timeGetTime();
-	float  delta = (curr_time - last_time) * 0.001f;
+	/*static uint64_t  last_time = 0;
+	uint64_t  curr_time = GetTimeNanoseconds();
+	float  delta = (curr_time - last_time) * 1e-9f;
 	if (delta > 0.03f)
 		delta = 0.03f;
 	last_time = curr_time;*/
@@ -254,23 +129,10 @@ void updateScene() {
 }
 
 
+#ifndef RT_NO_GLFW
 GLFWwindow* window;
 const GLFWvidmode* videMode;
-GLuint frameBufferTexuture;
-
-// Create texture that is the frame buffer
-void CreateFrameBufferTexture()
-{
-	glGenTextures(1, &frameBufferTexuture);
-	glBindTexture(GL_TEXTURE_2D, frameBufferTexuture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	GLvoid* black = NULL;
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
-		GL_FLOAT, black);
-	glBindTexture(GL_TEXTURE_2D, 0);
-}
-
+#endif
 GLuint vertexArrayObject = 0;
 GLuint vertexBufferObject = 0;
 GLbyte byteBuffer[] = 
@@ -297,31 +159,8 @@ void QuadFullScreenVAO()
 	glBindVertexArray(0);
 }
 
-GLuint rayTracingProgram, quadProgram;
-int eyeUniform, ray00Uniform, ray10Uniform, ray01Uniform, ray11Uniform;
-GLint workGroupSizeX, workGroupSizeY;
-
-// Creating the shader program that actually does the ray tracing
-GLuint CreateRayTracingProgram()
-{
-	return CompileShadersRay();
-}
-
-// Initialise Ray Tracing Program
-void InitRayTracingProgram()
-{
-	glUseProgram(rayTracingProgram);
-	GLint params[3];
-	glGetProgramiv(rayTracingProgram, GL_COMPUTE_WORK_GROUP_SIZE, params);
-	workGroupSizeX = params[0];
-	workGroupSizeY = params[1];
-	eyeUniform = glGetUniformLocation(rayTracingProgram, "eye");
-	ray00Uniform = glGetUniformLocation(rayTracingProgram, "ray00");
-	ray10Uniform = glGetUniformLocation(rayTracingProgram, "ray10");
-	ray01Uniform = glGetUniformLocation(rayTracingProgram, "ray01");
-	ray11Uniform = glGetUniformLocation(rayTracingProgram, "ray11");
-	glUseProgram(0);
-}
+GLuint quadProgram;
+CGpuRaytracer gpuRaytracer;
 
 GLuint CreateQuadProgram()
 {
@@ -338,6 +177,544 @@ void InitQuadProgram()
 
 CCamera1 camera;
 
+enum RenderBackend
+{
+	BACKEND_GL,
+	BACKEND_CPU
+};
+
+RenderBackend backend = BACKEND_GL;
+CCpuRaytracer cpuRaytracer;
+std::vector<float> cpuFrameBuffer;
+bool compareBackends = false;
+// Children per CPU BVH node, 4 and 8 collapse the binary tree
+int bvhWidth = 2;
+bool quantizeBvh = false;
+bool headless = false;
+int headlessFrames = 1;
+std::string outputPattern = "frame%04d.ppm";
+// outputPattern split at its frame number field, -1 digits without one
+std::string outputPrefix = "frame";
+std::string outputSuffix = ".ppm";
+int outputDigits = 4;
+bool readbackFrames = false;
+bool useRegion = false;
+PixelRect region;
+bool profileGpu = false;
+CGpuProfiler gpuProfiler;
+// Frame to frame times on the monotonic clock, and pacing with -fps
+CFrameTimer frameTimer;
+double targetFrameRate = 0.0;
+CPboReadback readback;
+// Traced by both backends, the default scene or a mesh on its ground
+CScene scene = CScene::CreateDefault();
+std::string meshFile;
+// Scene and BVH from SceneConverter, the GL backend uploads them from the mapping
+CSceneCache sceneCache;
+std::string sceneCacheFile;
+// Text scene from -scene, reloaded whenever the file is saved
+CSceneFile sceneFile;
+std::string sceneFileName;
+// BVH over the scene file's primitives, refit when a reload only moved some
+CDynamicBvh sceneFileBvh(cpuRaytracer.GetScheduler());
+// Workgroup tiles a refitting reload changed, as x, y pairs. The next GL
+// frame only traces them if its rays are those of the last whole frame.
+std::vector<int> dirtyTiles;
+bool traceDirtyTiles = false;
+FrustumRays lastFrameRays;
+bool lastFrameWhole = false;
+
+void SetGpuScene()
+{
+	if (sceneCache.IsOpen())
+	{
+		gpuRaytracer.SetScene(sceneCache);
+	}
+	else if (!sceneFileName.empty() && gpuRaytracer.GetAccelerator() == ACCELERATOR_BVH)
+	{
+		gpuRaytracer.SetScene(scene, sceneFileBvh.GetBvh());
+	}
+	else
+	{
+		gpuRaytracer.SetScene(scene);
+	}
+}
+
+// The cached or scene file BVH is only used as it is, a grid is still built
+void SetCpuScene()
+{
+	if (sceneCache.IsOpen() && cpuRaytracer.GetAccelerator() == ACCELERATOR_BVH)
+	{
+		CBvh bvh;
+		sceneCache.GetBvh(bvh);
+		cpuRaytracer.SetScene(scene, bvh);
+	}
+	else if (!sceneFileName.empty() && cpuRaytracer.GetAccelerator() == ACCELERATOR_BVH)
+	{
+		cpuRaytracer.SetScene(scene, sceneFileBvh.GetBvh());
+	}
+	else
+	{
+		cpuRaytracer.SetScene(scene);
+	}
+}
+
+// Replaces the default scene with sceneFileName and builds its BVH
+bool LoadSceneFile()
+{
+	uint64_t start = GetTimeNanoseconds();
+	if (!sceneFile.Load(sceneFileName))
+	{
+		return false;
+	}
+	scene = sceneFile.GetScene();
+	std::vector<Box> bounds;
+	sceneFileBvh.Update(scene.GetPrimitiveBounds(bounds));
+	printf("%s: %d boxes, %d triangles loaded in %.1f ms\n", sceneFileName.c_str(), (int)scene.boxes.size(),
+		(int)scene.triangles.size(), MillisecondsSince(start));
+	return true;
+}
+
+// Tiles whose pixels may see one of the changed primitives where it was or
+// where it is now, every other pixel keeps its color
+void MarkDirtyTiles(const std::vector<Box>& before, const std::vector<Box>& after,
+	const std::vector<ElementRange>& ranges)
+{
+	FrustumRays rays = camera.GetFrustumRays();
+	CDispatchPlanner& planner = gpuRaytracer.GetDispatchPlanner();
+	int tileWidth = planner.GetWorkGroupSizeX();
+	int tileHeight = planner.GetWorkGroupSizeY();
+	int tilesX = (width + tileWidth - 1) / tileWidth;
+	int tilesY = (height + tileHeight - 1) / tileHeight;
+
+	std::vector<bool> dirty((size_t)tilesX * tilesY, false);
+	for (size_t r = 0; r < ranges.size(); r++)
+	{
+		for (int i = ranges[r].first; i < ranges[r].end; i++)
+		{
+			const Box* boxes[2] = { &before[i], &after[i] };
+			for (int b = 0; b < 2; b++)
+			{
+				glm::ivec2 pixelMin, pixelMax;
+				if (!GetScreenBounds(rays, *boxes[b], width, height, pixelMin, pixelMax))
+				{
+					pixelMin = glm::ivec2(0);
+					pixelMax = glm::ivec2(width - 1, height - 1);
+				}
+				for (int ty = pixelMin.y / tileHeight; ty <= pixelMax.y / tileHeight && pixelMin.y <= pixelMax.y; ty++)
+				{
+					for (int tx = pixelMin.x / tileWidth; tx <= pixelMax.x / tileWidth && pixelMin.x <= pixelMax.x; tx++)
+					{
+						dirty[(size_t)ty * tilesX + tx] = true;
+					}
+				}
+			}
+		}
+	}
+
+	dirtyTiles.clear();
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			if (dirty[(size_t)ty * tilesX + tx])
+			{
+				dirtyTiles.push_back(tx);
+				dirtyTiles.push_back(ty);
+			}
+		}
+	}
+	traceDirtyTiles = true;
+}
+
+// Picks up edits to the scene file. When every ID is still there the BVH
+// is refit and only the primitives and nodes that changed are uploaded,
+// anything else uploads the scene again. On the GL backend the next frame
+// then only traces the tiles those primitives cover. A file that does not
+// parse is reported and the last good scene stays.
+void ReloadSceneFile()
+{
+	if (sceneFileName.empty() || !sceneFile.HasChanged())
+	{
+		return;
+	}
+	uint64_t start = GetTimeNanoseconds();
+	SceneFileChanges changes;
+	if (!sceneFile.Reload(changes))
+	{
+		return;
+	}
+	std::vector<Box> boundsBefore;
+	if (changes.sameLayout)
+	{
+		// Copied, the scene's own boxes are replaced below
+		boundsBefore = scene.GetPrimitiveBounds(boundsBefore);
+	}
+	scene = sceneFile.GetScene();
+	std::vector<Box> bounds;
+	const std::vector<Box>& primitives = scene.GetPrimitiveBounds(bounds);
+	std::vector<BvhNode> nodesBefore;
+	if (changes.sameLayout)
+	{
+		nodesBefore = sceneFileBvh.GetBvh().nodes;
+	}
+	else
+	{
+		sceneFileBvh.Invalidate();
+	}
+	bool refit = !sceneFileBvh.Update(primitives).rebuilt;
+	const CBvh& bvh = sceneFileBvh.GetBvh();
+	std::vector<ElementRange> nodeRanges;
+	if (refit)
+	{
+		FindChangedRanges(nodesBefore.data(), bvh.nodes.data(), bvh.nodes.size(), sizeof(BvhNode), nodeRanges);
+	}
+
+	if (backend == BACKEND_GL)
+	{
+		if (refit && gpuRaytracer.UpdateScene(scene, bvh, changes.changedPrimitives, nodeRanges))
+		{
+			MarkDirtyTiles(boundsBefore, primitives, changes.changedPrimitives);
+		}
+		else
+		{
+			SetGpuScene();
+		}
+	}
+	else
+	{
+		SetCpuScene();
+	}
+	if (refit)
+	{
+		printf("%s reloaded: %d of %d primitives changed, %d primitive and %d node ranges updated in %.1f ms\n",
+			sceneFileName.c_str(), changes.changedCount, scene.GetPrimitiveCount(),
+			(int)changes.changedPrimitives.size(), (int)nodeRanges.size(), MillisecondsSince(start));
+	}
+	else
+	{
+		printf("%s reloaded: %d boxes, %d triangles uploaded again in %.1f ms\n", sceneFileName.c_str(),
+			(int)scene.boxes.size(), (int)scene.triangles.size(), MillisecondsSince(start));
+	}
+}
+
+void printUsage()
+{
+	printf("Usage: Raytracer [-backend gl|cpu] [-threads N] [-tile WxH]\n");
+	printf("                 [-tileorder scanline|morton|center]\n");
+	printf("                 [-isa scalar|sse4|avx2|avx512] [-bvhwidth 2|4|8] [-quantize]\n");
+	printf("                 [-gpunodes binary|wide8] [-stackless] [-accel bvh|grid]\n");
+	printf("                 [-mesh file | -scenecache file | -scene file]\n");
+	printf("                 [-compare] [-size WxH]\n");
+	printf("                 [-headless] [-frames N] [-output pattern] [-readback]\n");
+	printf("                 [-region X,Y,W,H] [-shaderdir dir] [-shadercache dir|none]\n");
+	printf("                 [-profile] [-fps N]\n");
+	printf("  -backend gl|cpu  trace with the compute shader (default) or on the CPU\n");
+	printf("  -threads N       CPU backend worker threads, 0 for all cores\n");
+	printf("  -tile WxH        CPU backend tile size, defaults to the 16x8 workgroup\n");
+	printf("  -tileorder O     order in which CPU tiles are handed to threads\n");
+	printf("  -isa I           highest instruction set the CPU backend may use\n");
+	printf("  -bvhwidth N      CPU backend BVH node width, 2 traces ray packets (default)\n");
+	printf("  -quantize        store wide BVH child boxes as 8 bit offsets\n");
+	printf("  -gpunodes F      GL backend BVH nodes, binary (default) or compressed 8 wide\n");
+	printf("  -stackless       GL backend walks binary nodes through parent links\n");
+	printf("  -accel A         trace the boxes through a BVH (default) or a uniform grid\n");
+	printf("  -mesh file       trace an .obj or .ply mesh on the ground instead of the boxes\n");
+	printf("  -scenecache file trace a scene and BVH written by SceneConverter\n");
+	printf("  -scene file      trace the boxes and triangles of a text scene file and\n");
+	printf("                   reload it whenever it is saved\n");
+	printf("  -compare         render one frame with both backends and compare them\n");
+	printf("  -size WxH        frame buffer resolution, defaults to 800x600\n");
+	printf("  -headless        render without a window and write the frames to disk\n");
+	printf("  -frames N        number of frames rendered in headless mode\n");
+	printf("  -output pattern  file name for headless frames, .ppm or .pfm, where one %%d or\n");
+	printf("                   %%0Nd is the frame number and %%%% a percent sign\n");
+	printf("  -readback        copy every frame to host memory and report the cost\n");
+	printf("  -region X,Y,W,H  only dispatch this part of the frame on the GL backend\n");
+	printf("  -shaderdir dir   load shaders from dir instead of the embedded copies\n");
+	printf("  -shadercache dir where program binaries are cached, none to disable\n");
+	printf("  -profile         time every GPU stage with timer queries\n");
+	printf("  -fps N           pace frames to N per second instead of vsync\n");
+}
+
+// Accepts one %d or %0Nd frame number field and %% for a percent sign,
+// the pattern is never handed to printf
+bool ParseOutputPattern(const std::string& pattern)
+{
+	std::string prefix, suffix;
+	int digits = -1;
+	for (size_t i = 0; i < pattern.size(); i++)
+	{
+		std::string& part = digits < 0 ? prefix : suffix;
+		if (pattern[i] != '%')
+		{
+			part += pattern[i];
+			continue;
+		}
+		if (i + 1 < pattern.size() && pattern[i + 1] == '%')
+		{
+			part += '%';
+			i++;
+			continue;
+		}
+		size_t end = i + 1;
+		int width = 0;
+		bool valid = digits < 0;
+		if (end < pattern.size() && pattern[end] == '0')
+		{
+			for (end++; end < pattern.size() && isdigit((unsigned char)pattern[end]); end++)
+			{
+				width = std::min(width * 10 + (pattern[end] - '0'), 100);
+			}
+			valid = valid && width > 0 && width <= 20;
+		}
+		if (!valid || end >= pattern.size() || pattern[end] != 'd')
+		{
+			fprintf(stderr, "Invalid output pattern '%s', it takes one %%d or %%0Nd frame number\n",
+				pattern.c_str());
+			return false;
+		}
+		digits = width;
+		i = end;
+	}
+	outputPrefix = prefix;
+	outputSuffix = suffix;
+	outputDigits = digits;
+	return true;
+}
+
+std::string GetOutputFileName(long long frame)
+{
+	if (outputDigits < 0)
+	{
+		return outputPrefix;
+	}
+	char number[32];
+	snprintf(number, sizeof(number), "%0*lld", outputDigits, frame);
+	return outputPrefix + number + outputSuffix;
+}
+
+bool parseArguments(int argc, char** argv)
+{
+	bool stackless = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-backend" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "gl")
+			{
+				backend = BACKEND_GL;
+			}
+			else if (value == "cpu")
+			{
+				backend = BACKEND_CPU;
+			}
+			else
+			{
+				fprintf(stderr, "Unknown backend '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-threads" && i + 1 < argc)
+		{
+			cpuRaytracer.GetScheduler().SetThreadCount(atoi(argv[++i]));
+		}
+		else if (arg == "-tile" && i + 1 < argc)
+		{
+			int tileWidth = 0, tileHeight = 0;
+			if (sscanf(argv[++i], "%dx%d", &tileWidth, &tileHeight) != 2 || tileWidth <= 0 || tileHeight <= 0)
+			{
+				fprintf(stderr, "Invalid tile size '%s'\n", argv[i]);
+				return false;
+			}
+			cpuRaytracer.GetScheduler().SetTileSize(tileWidth, tileHeight);
+		}
+		else if (arg == "-tileorder" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "scanline")
+			{
+				cpuRaytracer.GetScheduler().SetTileOrder(TILE_ORDER_SCANLINE);
+			}
+			else if (value == "morton")
+			{
+				cpuRaytracer.GetScheduler().SetTileOrder(TILE_ORDER_MORTON);
+			}
+			else if (value == "center")
+			{
+				cpuRaytracer.GetScheduler().SetTileOrder(TILE_ORDER_CENTER_OUT);
+			}
+			else
+			{
+				fprintf(stderr, "Unknown tile order '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-isa" && i + 1 < argc)
+		{
+			SimdIsa isa;
+			if (!ParseSimdIsa(argv[++i], isa))
+			{
+				fprintf(stderr, "Unknown instruction set '%s'\n", argv[i]);
+				return false;
+			}
+			cpuRaytracer.SetSimdIsa(isa);
+		}
+		else if (arg == "-bvhwidth" && i + 1 < argc)
+		{
+			bvhWidth = atoi(argv[++i]);
+			if (bvhWidth != 2 && bvhWidth != 4 && bvhWidth != 8)
+			{
+				fprintf(stderr, "BVH nodes are 2, 4 or 8 wide, not '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-quantize")
+		{
+			quantizeBvh = true;
+		}
+		else if (arg == "-gpunodes" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "binary")
+			{
+				gpuRaytracer.SetNodeFormat(GPU_NODES_BINARY);
+			}
+			else if (value == "wide8")
+			{
+				gpuRaytracer.SetNodeFormat(GPU_NODES_WIDE8);
+			}
+			else
+			{
+				fprintf(stderr, "Unknown GPU node format '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-stackless")
+		{
+			stackless = true;
+			gpuRaytracer.SetStacklessTraversal(true);
+		}
+		else if (arg == "-accel" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value == "bvh" || value == "grid")
+			{
+				SceneAccelerator accelerator = value == "grid" ? ACCELERATOR_GRID : ACCELERATOR_BVH;
+				cpuRaytracer.SetAccelerator(accelerator);
+				gpuRaytracer.SetAccelerator(accelerator);
+			}
+			else
+			{
+				fprintf(stderr, "Unknown acceleration structure '%s'\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "-mesh" && i + 1 < argc)
+		{
+			meshFile = argv[++i];
+		}
+		else if (arg == "-scenecache" && i + 1 < argc)
+		{
+			sceneCacheFile = argv[++i];
+		}
+		else if (arg == "-scene" && i + 1 < argc)
+		{
+			sceneFileName = argv[++i];
+		}
+		else if (arg == "-compare")
+		{
+			compareBackends = true;
+		}
+		else if (arg == "-size" && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 1 || height <= 1)
+			{
+				fprintf(stderr, "Invalid frame size '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-headless")
+		{
+			headless = true;
+		}
+		else if (arg == "-frames" && i + 1 < argc)
+		{
+			headlessFrames = atoi(argv[++i]);
+		}
+		else if (arg == "-output" && i + 1 < argc)
+		{
+			outputPattern = argv[++i];
+			if (!ParseOutputPattern(outputPattern))
+			{
+				return false;
+			}
+		}
+		else if (arg == "-readback")
+		{
+			readbackFrames = true;
+		}
+		else if (arg == "-region" && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%d,%d,%d,%d", &region.x, &region.y, &region.width, &region.height) != 4)
+			{
+				fprintf(stderr, "Invalid region '%s'\n", argv[i]);
+				return false;
+			}
+			useRegion = true;
+		}
+		else if (arg == "-profile")
+		{
+			profileGpu = true;
+		}
+		else if (arg == "-fps" && i + 1 < argc)
+		{
+			targetFrameRate = atof(argv[++i]);
+			if (targetFrameRate <= 0.0)
+			{
+				fprintf(stderr, "Invalid frame rate '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-shaderdir" && i + 1 < argc)
+		{
+			programCache.SetShaderDirectory(argv[++i]);
+		}
+		else if (arg == "-shadercache" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			programCache.SetCacheDirectory(value == "none" ? "" : value);
+		}
+		else
+		{
+			printUsage();
+			return false;
+		}
+	}
+	if ((int)!meshFile.empty() + (int)!sceneCacheFile.empty() + (int)!sceneFileName.empty() > 1)
+	{
+		fprintf(stderr, "-mesh, -scenecache and -scene all replace the scene, pick one\n");
+		return false;
+	}
+	if (stackless && gpuRaytracer.GetNodeFormat() != GPU_NODES_BINARY)
+	{
+		fprintf(stderr, "-stackless only walks binary GPU nodes\n");
+		return false;
+	}
+	return true;
+}
+
+void InitCamera()
+{
+	camera = CCamera1();
+	camera.SetFrustumPerspective(60.0f, (float)width / height, 1.0f, 2.0f);
+	camera.SetLookAt(glm::vec3(3.0f, 1.0f, 80.0f), glm::vec3(0.0f, 0.5f, 0.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+#ifndef RT_NO_GLFW
 void init()
 {
 	if (glfwInit() != GL_TRUE)
@@ -367,115 +744,433 @@ void init()
 		return;
 	}
 
-	glfwSwapInterval(1);
+	// The frame timer paces frames when a rate is given, vsync otherwise
+	glfwSwapInterval(targetFrameRate > 0.0 ? 0 : 1);
 	glfwShowWindow(window);
 
 	// Create frame buffer textures
-	CreateFrameBufferTexture();
+	gpuRaytracer.CreateFrameBuffer(width, height);
 	// Create a Vertex Array Object with full-screen quad Vertex Buffer Object
 	QuadFullScreenVAO();
 
-	// Create Compute Shader Program
-	rayTracingProgram = CreateRayTracingProgram();
-	InitRayTracingProgram();
+	// Create Compute Shader Program, the CPU backend does not need it
+	if (backend == BACKEND_GL || compareBackends)
+	{
+		gpuRaytracer.CreateProgram(programCache);
+		SetGpuScene();
+	}
 
 	// Create Quad shader Program
 	quadProgram = CreateQuadProgram();
 	InitQuadProgram();
 
-	camera = CCamera1();
-	camera.SetFrustumPerspective(60.0f, (float)width / height, 1.0f, 2.0f);
-	camera.SetLookAt(glm::vec3(3.0f, 1.0f, 80.0f), glm::vec3(0.0f, 0.5f, 0.0f),
-		glm::vec3(0.0f, 1.0f, 0.0f));
+	PrintProgramCacheStats();
+
+	if (readbackFrames)
+	{
+		readback.Init(width, height);
+	}
+	if (profileGpu)
+	{
+		gpuProfiler.Init();
+	}
+
+	InitCamera();
+}
+#endif
+
+// Ray trace the frame with the compute shader, exactly covering the image,
+// the region or the tiles a scene file reload changed
+void TraceGL(const FrustumRays& rays)
+{
+	CDispatchPlanner& planner = gpuRaytracer.GetDispatchPlanner();
+	std::vector<DispatchCommand> commands;
+	if (useRegion)
+	{
+		commands = planner.PlanRect(region, width, height);
+	}
+	else if (traceDirtyTiles && lastFrameWhole && memcmp(&rays, &lastFrameRays, sizeof(rays)) == 0)
+	{
+		commands = planner.PlanTiles(dirtyTiles, width, height);
+		int tileCount = ((width + planner.GetWorkGroupSizeX() - 1) / planner.GetWorkGroupSizeX()) *
+			((height + planner.GetWorkGroupSizeY() - 1) / planner.GetWorkGroupSizeY());
+		printf("Traced %d of %d tiles in %d dispatches, %.2f invocations per pixel\n", (int)dirtyTiles.size() / 2,
+			tileCount, (int)commands.size(), planner.GetLaneOverhead(commands));
+	}
+	else
+	{
+		commands = planner.PlanImage(width, height);
+	}
+	traceDirtyTiles = false;
+	gpuRaytracer.Trace(rays, commands);
+	lastFrameRays = rays;
+	lastFrameWhole = !useRegion;
 }
 
-int NextPowerOfTwo(int param)
+// Ray trace the frame on the CPU and upload it into the frame buffer texture
+void TraceCPU(const FrustumRays& rays)
 {
-	int x = param;
-	x--;
-	x |= x >> 1; // handle 2 bit numbers
-	x |= x >> 2; // handle 4 bit numbers
-	x |= x >> 4; // handle 8 bit numbers
-	x |= x >> 8; // handle 16 bit numbers
-	x |= x >> 16; // handle 32 bit numbers
-	x++;
-	return x;
+	cpuFrameBuffer.resize((size_t)width * height * 4);
+	cpuRaytracer.Render(rays, width, height, cpuFrameBuffer.data());
+
+	glBindTexture(GL_TEXTURE_2D, gpuRaytracer.GetFrameBufferTexture());
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT,
+		cpuFrameBuffer.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void trace()
 {
-	glUseProgram(rayTracingProgram);
-	glm::vec3 eyeRay;
-
-	// set viewing frustum corner rays in shader
-	glUniform3f(eyeUniform, camera.GetPosition().x, camera.GetPosition().y,
-		camera.GetPosition().z);
-	eyeRay = camera.GetEyeRay(-1, -1);
-	glUniform3f(ray00Uniform, eyeRay.x, eyeRay.y, eyeRay.z);
-	eyeRay = camera.GetEyeRay(-1, 1);
-	glUniform3f(ray01Uniform, eyeRay.x, eyeRay.y, eyeRay.z);
-	eyeRay = camera.GetEyeRay(1, -1);
-	glUniform3f(ray10Uniform, eyeRay.x, eyeRay.y, eyeRay.z);
-	eyeRay = camera.GetEyeRay(1, 1);
-	glUniform3f(ray11Uniform, eyeRay.x, eyeRay.y, eyeRay.z);
-
-	// Bind Level 0 of framebuffer texture as writable image in shader
-	glBindImageTexture(0, frameBufferTexuture, 0, false, 0, 
-		GL_WRITE_ONLY, GL_RGBA32F);
-
-	// Invocation dimension
-	int worksizeX = NextPowerOfTwo(width);
-	int worksizeY = NextPowerOfTwo(height);
-
-	// Invoke Compute dimension
-	glDispatchCompute(worksizeX / workGroupSizeX,
-		worksizeY / workGroupSizeY, 1);
-
-	// Reset image binding
-	glBindImageTexture(0, 0, 0, false, 0, GL_READ_WRITE, GL_RGBA32F);
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-	glUseProgram(0);
+	FrustumRays rays = camera.GetFrustumRays();
+
+	if (backend == BACKEND_CPU)
+	{
+		gpuProfiler.BeginStage("upload");
+		TraceCPU(rays);
+	}
+	else
+	{
+		gpuProfiler.BeginStage("dispatch");
+		TraceGL(rays);
+	}
+
+	if (readbackFrames)
+	{
+		// Hand out earlier frames first so this capture rarely has to wait
+		gpuProfiler.BeginStage("readback");
+		readback.Poll();
+		readback.Capture(gpuRaytracer.GetFrameBufferTexture());
+	}
 
 	// Draw rendered image
+	gpuProfiler.BeginStage("present");
 	glUseProgram(quadProgram);
 	glBindVertexArray(vertexArrayObject);
-	glBindTexture(GL_TEXTURE_2D, frameBufferTexuture);
+	glBindTexture(GL_TEXTURE_2D, gpuRaytracer.GetFrameBufferTexture());
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindVertexArray(0);
 	glUseProgram(0);
+	gpuProfiler.EndStage();
+}
+
+// Render one frame with both backends and report how far apart they are
+int CompareBackends()
+{
+	FrustumRays rays = camera.GetFrustumRays();
+	size_t floatCount = (size_t)width * height * 4;
 
+	TraceGL(rays);
+	std::vector<float> gpuPixels(floatCount);
+	gpuRaytracer.ReadPixels(gpuPixels.data());
+
+	std::vector<float> cpuPixels(floatCount);
+	cpuRaytracer.Render(rays, width, height, cpuPixels.data());
+
+	const float tolerance = 1.0f / 255.0f;
+	float maxDifference = 0.0f;
+	int mismatchedPixels = 0;
+	for (size_t i = 0; i < floatCount; i += 4)
+	{
+		float difference = 0.0f;
+		for (size_t c = 0; c < 4; c++)
+		{
+			difference = std::max(difference, std::abs(gpuPixels[i + c] - cpuPixels[i + c]));
+		}
+		maxDifference = std::max(maxDifference, difference);
+		if (difference > tolerance)
+		{
+			mismatchedPixels++;
+		}
+	}
+
+	printf("Compared %dx%d pixels: %d differ by more than %f, max difference %f\n",
+		width, height, mismatchedPixels, tolerance, maxDifference);
+	return mismatchedPixels == 0 ? 0 : 1;
 }
 
+void PrintGpuProfile()
+{
+	std::vector<GpuStageStats> stats = gpuProfiler.GetStats();
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		printf("GPU %-9s avg %7.3f ms  p50 %7.3f  p95 %7.3f  p99 %7.3f  (%d samples)\n",
+			stats[i].name.c_str(), stats[i].averageMs, stats[i].p50Ms, stats[i].p95Ms,
+			stats[i].p99Ms, stats[i].samples);
+	}
+}
+
+void PrintFrameTimeStats()
+{
+	FrameTimeStats stats = frameTimer.GetStats();
+	printf("Frame time: avg %.3f ms  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f  (last %d frames)\n",
+		stats.averageMs, stats.p50Ms, stats.p95Ms, stats.p99Ms, stats.maxMs, stats.samples);
+}
+
+#ifndef RT_NO_GLFW
 void loop()
 {
+	frameTimer.SetTargetFrameRate(targetFrameRate);
+	uint64_t lastTitleUpdate = GetTimeNanoseconds();
 	while (glfwWindowShouldClose(window) == GL_FALSE)
 	{
+		frameTimer.BeginFrame();
 		glfwPollEvents();
 		glViewport(0, 0, width, height);
 
+		ReloadSceneFile();
+		gpuProfiler.BeginFrame();
 		trace();
 
+		gpuProfiler.BeginStage("swap");
 		glfwSwapBuffers(window);
+		gpuProfiler.EndFrame();
+
+		// Frame and stage timings go in the title bar, refreshed once a second
+		if (SecondsSince(lastTitleUpdate) >= 1.0)
+		{
+			FrameTimeStats stats = frameTimer.GetStats();
+			char frameTime[64];
+			snprintf(frameTime, sizeof(frameTime), "%.2f ms (p95 %.2f)", stats.averageMs, stats.p95Ms);
+			std::string title = std::string("Raytracer Compute Shader - ") + frameTime;
+			if (profileGpu)
+			{
+				title += " | " + gpuProfiler.GetSummary();
+			}
+			glfwSetWindowTitle(window, title.c_str());
+			lastTitleUpdate = GetTimeNanoseconds();
+		}
 	}
+	frameTimer.EndFrame();
 }
+#endif
 
-int main(int argc, char** argv){
-	
-	init();
+void PrintReadbackStats()
+{
+	const ReadbackStats& stats = readback.GetStats();
+	printf("Readback: %lld frames, latency %.2f ms average %.2f ms max, stalled %lld times for %.2f ms\n",
+		stats.framesDelivered, stats.averageLatencyMs, stats.maxLatencyMs, stats.stalls, stats.totalStallMs);
+	if (stats.framesDropped > 0)
+	{
+		printf("Readback: dropped %lld frames whose fence wait or mapping failed\n", stats.framesDropped);
+	}
+}
 
-	loop();
+// Render frames without a window and write each one to disk, or compare
+// one frame of both backends with -compare. The CPU backend does not touch
+// OpenGL at all otherwise.
+int RunHeadless()
+{
+	CHeadlessContext context;
+	if (backend == BACKEND_GL || compareBackends)
+	{
+		if (!context.Create())
+		{
+			return 1;
+		}
+		printf("Headless OpenGL: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+		gpuRaytracer.CreateFrameBuffer(width, height);
+		gpuRaytracer.CreateProgram(programCache);
+		SetGpuScene();
+		PrintProgramCacheStats();
+	}
+	InitCamera();
+	// Nothing is written, the frame of both backends is only compared
+	if (compareBackends)
+	{
+		return CompareBackends();
+	}
+	frameTimer.SetTargetFrameRate(targetFrameRate);
 
-    return 0;
+	bool written = true;
+	auto writeFrame = [&](const float* rgba, long long frame)
+	{
+		written = WriteImage(GetOutputFileName(frame), rgba, width, height) && written;
+	};
+
+	if (backend == BACKEND_GL)
+	{
+		// Frames are written from the readback ring while later ones render
+		readback.Init(width, height);
+		readback.SetCallback([&](const ReadbackFrame& frame) { writeFrame(frame.rgba, frame.frameIndex); });
+		if (profileGpu)
+		{
+			gpuProfiler.Init();
+		}
+		for (int frame = 0; frame < headlessFrames && written; frame++)
+		{
+			frameTimer.BeginFrame();
+			ReloadSceneFile();
+			gpuProfiler.BeginFrame();
+			gpuProfiler.BeginStage("dispatch");
+			TraceGL(camera.GetFrustumRays());
+			gpuProfiler.BeginStage("readback");
+			readback.Poll();
+			readback.Capture(gpuRaytracer.GetFrameBufferTexture());
+			gpuProfiler.EndFrame();
+		}
+		// The last frame ends once its readback is written
+		readback.Flush();
+		frameTimer.EndFrame();
+		PrintReadbackStats();
+		if (readback.GetStats().framesDropped > 0)
+		{
+			fprintf(stderr, "%lld frames were never read back\n", readback.GetStats().framesDropped);
+			written = false;
+		}
+		readback.Destroy();
+		if (profileGpu)
+		{
+			gpuProfiler.Flush();
+			PrintGpuProfile();
+			gpuProfiler.Destroy();
+		}
+	}
+	else
+	{
+		std::vector<float> pixels((size_t)width * height * 4);
+		for (int frame = 0; frame < headlessFrames && written; frame++)
+		{
+			frameTimer.BeginFrame();
+			ReloadSceneFile();
+			cpuRaytracer.Render(camera.GetFrustumRays(), width, height, pixels.data());
+			writeFrame(pixels.data(), frame);
+		}
+		frameTimer.EndFrame();
+	}
+
+	if (!written)
+	{
+		return 1;
+	}
+	printf("Wrote %d %dx%d frames to %s\n", headlessFrames, width, height, outputPattern.c_str());
+	PrintFrameTimeStats();
+	return 0;
+}
+
+// Per-thread work of the CPU backend's tile scheduler over the whole run
+void PrintSchedulerStats()
+{
+	const std::vector<TileThreadStats>& stats = cpuRaytracer.GetScheduler().GetThreadStats();
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		printf("Thread %2d: %6.1f%% busy, %d tiles, %d stolen\n", (int)i,
+			stats[i].GetUtilisation() * 100.0, stats[i].tilesExecuted, stats[i].tilesStolen);
+	}
+}
+
+// Replaces the boxes of the default scene with meshFile, on the same ground
+bool LoadMesh()
+{
+	CMeshLoader loader(cpuRaytracer.GetScheduler());
+	scene = CScene();
+	scene.boxes.push_back(CScene::CreateDefault().boxes[0]);
+	if (!loader.Load(meshFile, scene))
+	{
+		return false;
+	}
+	scene.PlaceOnGround(0, 2.0f);
+	const MeshLoadStats& stats = loader.GetStats();
+	printf("%s: %d vertices, %d triangles, %.1f MB in %d chunks loaded in %.1f ms\n", meshFile.c_str(),
+		stats.vertices, stats.triangles, stats.bytes / 1048576.0, stats.chunks, stats.milliseconds);
+	return true;
 }
 
+// Maps sceneCacheFile and copies its scene for the CPU backend
+bool OpenSceneCache()
+{
+	uint64_t start = GetTimeNanoseconds();
+	if (!sceneCache.Open(sceneCacheFile))
+	{
+		return false;
+	}
+	sceneCache.GetScene(scene);
+	printf("%s: %d boxes, %d triangles, %d BVH nodes mapped in %.1f ms\n", sceneCacheFile.c_str(),
+		(int)scene.boxes.size(), (int)scene.triangles.size(), (int)sceneCache.GetCount(SCENE_CACHE_NODES),
+		MillisecondsSince(start));
+	return true;
+}
 
+int main(int argc, char** argv){
+	
+	if (!parseArguments(argc, argv))
+	{
+		return 1;
+	}
 
+	if (!meshFile.empty() && !LoadMesh())
+	{
+		return 1;
+	}
+	if (!sceneCacheFile.empty() && !OpenSceneCache())
+	{
+		return 1;
+	}
+	if (!sceneFileName.empty() && !LoadSceneFile())
+	{
+		return 1;
+	}
 
+	if (backend == BACKEND_CPU || compareBackends)
+	{
+		cpuRaytracer.SetBvhWidth(bvhWidth, quantizeBvh);
+		SetCpuScene();
+		if (cpuRaytracer.GetAccelerator() == ACCELERATOR_GRID)
+		{
+			glm::ivec3 resolution = cpuRaytracer.GetGrid().GetResolution();
+			printf("CPU backend: %d threads, %s kernels, %dx%dx%d grid\n",
+				cpuRaytracer.GetScheduler().GetThreadCount(), GetSimdIsaName(cpuRaytracer.GetSimdIsa()),
+				resolution.x, resolution.y, resolution.z);
+		}
+		else
+		{
+			printf("CPU backend: %d threads, %s kernels, BVH%d%s\n",
+				cpuRaytracer.GetScheduler().GetThreadCount(), GetSimdIsaName(cpuRaytracer.GetSimdIsa()),
+				cpuRaytracer.GetBvhWidth(), bvhWidth > 2 && quantizeBvh ? " quantized" : "");
+		}
+	}
 
+	if (headless)
+	{
+		int result = RunHeadless();
+		if (backend == BACKEND_CPU)
+		{
+			PrintSchedulerStats();
+		}
+		return result;
+	}
 
+#ifdef RT_NO_GLFW
+	fprintf(stderr, "Built without GLFW, only -headless is available\n");
+	return 1;
+#else
+	init();
 
+	if (compareBackends)
+	{
+		return CompareBackends();
+	}
 
+	loop();
 
+	PrintFrameTimeStats();
 
+	if (backend == BACKEND_CPU)
+	{
+		PrintSchedulerStats();
+	}
+	if (readbackFrames)
+	{
+		readback.Flush();
+		PrintReadbackStats();
+	}
+	if (profileGpu)
+	{
+		gpuProfiler.Flush();
+		PrintGpuProfile();
+	}
 
+    return 0;
+#endif
+}
\ No newline at end of file
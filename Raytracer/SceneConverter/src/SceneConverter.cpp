@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "Bvh.h"
+#include "MeshLoader.h"
+#include "ParallelBvhBuilder.h"
+#include "Platform.h"
+#include "SceneCache.h"
+#include "SpatialBvhBuilder.h"
+#include "TileScheduler.h"
+
+// Turns mesh files into scene caches that Raytracer -scenecache and
+// Benchmark -scenes map and trace without parsing or building anything
+
+CTileScheduler scheduler;
+std::string inputFile;
+std::string outputFile;
+// 0 keeps the mesh where it is, otherwise it is put on the default ground
+float groundSize = 0.0f;
+bool spatialSplits = false;
+
+void printUsage()
+{
+	printf("Usage: SceneConverter [-ground size] [-builder sah|sbvh] [-threads N] input output\n");
+	printf("  input            .obj or .ply mesh\n");
+	printf("  output           .rtscene file with the mesh and its BVH\n");
+	printf("  -ground size     add the default ground and scale the mesh to stand on it,\n");
+	printf("                   size wide. Raytracer -mesh uses 2.\n");
+	printf("  -builder B       binned SAH (default) or with spatial splits, slower to\n");
+	printf("                   build but faster to trace\n");
+	printf("  -threads N       threads loading the mesh and building, 0 for all cores\n");
+}
+
+bool parseArguments(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-ground" && i + 1 < argc)
+		{
+			groundSize = (float)atof(argv[++i]);
+			if (groundSize <= 0.0f)
+			{
+				fprintf(stderr, "Invalid ground size '%s'\n", argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "-builder" && i + 1 < argc)
+		{
+			std::string value = argv[++i];
+			if (value != "sah" && value != "sbvh")
+			{
+				fprintf(stderr, "Unknown builder '%s'\n", value.c_str());
+				return false;
+			}
+			spatialSplits = value == "sbvh";
+		}
+		else if (arg == "-threads" && i + 1 < argc)
+		{
+			scheduler.SetThreadCount(atoi(argv[++i]));
+		}
+		else if (arg[0] != '-' && inputFile.empty())
+		{
+			inputFile = arg;
+		}
+		else if (arg[0] != '-' && outputFile.empty())
+		{
+			outputFile = arg;
+		}
+		else
+		{
+			printUsage();
+			return false;
+		}
+	}
+	if (outputFile.empty())
+	{
+		printUsage();
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (!parseArguments(argc, argv))
+	{
+		return 1;
+	}
+
+	CScene scene;
+	if (groundSize > 0.0f)
+	{
+		scene.boxes.push_back(CScene::CreateDefault().boxes[0]);
+	}
+	CMeshLoader loader(scheduler);
+	if (!loader.Load(inputFile, scene))
+	{
+		return 1;
+	}
+	if (groundSize > 0.0f)
+	{
+		scene.PlaceOnGround(0, groundSize);
+	}
+	const MeshLoadStats& loadStats = loader.GetStats();
+	printf("%s: %d vertices, %d triangles loaded in %.1f ms\n", inputFile.c_str(), loadStats.vertices,
+		loadStats.triangles, loadStats.milliseconds);
+
+	std::vector<Box> bounds;
+	const std::vector<Box>& primitives = scene.GetPrimitiveBounds(bounds);
+	CBvh bvh;
+	if (spatialSplits)
+	{
+		CSpatialBvhBuilder builder;
+		builder.Build(scene, bvh);
+	}
+	else
+	{
+		CParallelBvhBuilder builder(scheduler);
+		builder.Build(primitives, bvh);
+	}
+	const BvhBuildStats& buildStats = bvh.GetStats();
+	printf("%s BVH: %d nodes, %d references, depth %d, SAH cost %.2f, built in %.1f ms\n",
+		spatialSplits ? "SBVH" : "SAH", buildStats.nodes, buildStats.references, buildStats.depth,
+		buildStats.sahCost, buildStats.milliseconds);
+
+	uint64_t start = GetTimeNanoseconds();
+	if (!CSceneCache::Write(outputFile, scene, bvh))
+	{
+		return 1;
+	}
+	printf("%s written in %.1f ms\n", outputFile.c_str(), MillisecondsSince(start));
+	return 0;
+}
@@ -0,0 +1,40 @@
+# Embeds every shader in SHADER_DIR into OUTPUT as a C++ table so the
+# renderer does not depend on its working directory to find them.
+#
+#   cmake -DSHADER_DIR=<dir> -DOUTPUT=<file.cpp> -P EmbedShaders.cmake
+#
+# OUTPUT is only rewritten when its contents change, to avoid rebuilds.
+
+if(NOT SHADER_DIR OR NOT OUTPUT)
+	message(FATAL_ERROR "EmbedShaders.cmake needs SHADER_DIR and OUTPUT")
+endif()
+
+file(GLOB shaders RELATIVE "${SHADER_DIR}" "${SHADER_DIR}/*.txt")
+list(SORT shaders)
+
+set(arrays "")
+set(table "")
+set(index 0)
+foreach(shader ${shaders})
+	file(READ "${SHADER_DIR}/${shader}" hex HEX)
+	# Bytes rather than a string literal, MSVC caps literals at 16K
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+	string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n\t" bytes "${bytes}")
+	string(APPEND arrays "static const char shader${index}[] = {\n\t${bytes}0x00\n};\n\n")
+	string(APPEND table "\t{ \"${shader}\", shader${index} },\n")
+	math(EXPR index "${index} + 1")
+endforeach()
+
+set(content "// Generated by cmake/EmbedShaders.cmake from src/shaders, do not edit\n\n")
+string(APPEND content "#include \"EmbeddedShaders.h\"\n\n")
+string(APPEND content "${arrays}")
+string(APPEND content "const EmbeddedShader embeddedShaders[] = {\n${table}\t{ 0, 0 }\n};\n")
+
+if(EXISTS "${OUTPUT}")
+	file(READ "${OUTPUT}" existing)
+else()
+	set(existing "")
+endif()
+if(NOT existing STREQUAL content)
+	file(WRITE "${OUTPUT}" "${content}")
+endif()